@@ -24,12 +24,32 @@ epicsEnvSet("EPICS_DB_INCLUDE_PATH", "$(ADCORE)/db")
 # Define NELEMENTS to be enough for a 2048x2048x3 (color) image
 epicsEnvSet("NELEMENTS", "11059200")
 
-# pcoConfig(const char* portName, int maxBuffers, size_t maxMemory)
-pcoConfig("$(PORT)", 0, 0, 8)
+# frameCopierConfig(int numThreads, int thresholdKb)
+# Optional, must come before pcoConfig.  The default is 2 threads above 1024kB.
+# The pool also sums multiple exposures.
+#frameCopierConfig(2, 1024)
+
+# pcoConfig(const char* portName, int maxBuffers, size_t maxMemory, int numCameraDevices, int ringDepth,
+#           const char* threads)
+# A ringDepth of 0 sizes the SDK buffer ring automatically at arm time, at most 15
+# threads optionally places the driver threads, eg "capture=0x4:90,ingest=0x8:80"
+pcoConfig("$(PORT)", 0, 0, 8, 0, "")
 
 # pcoApiConfig(const char* portName)
 pcoApiConfig("$(PORT)")
 
+# pcoCapturePin(const char* portName, int cpu, int priority)
+# Optional, pins the frame capture thread to a core with a raised EPICS priority
+# (0 leaves the priority alone).  Most useful with BUSY_POLL enabled.
+#pcoCapturePin("$(PORT)", 2, 90)
+
+# pcoThreadConfig(const char* portName, const char* role, const char* cpuMask, int priority)
+# Optional, sets the CPU mask and EPICS priority (0 leaves either alone) of a
+# thread role: state, ingest, capture, simulation, gang, timer, copy or process.  An
+# empty port name applies to every port, the copy threads are shared by all ports.
+#pcoThreadConfig("$(PORT)", "state", "0x30", 0)
+#pcoThreadConfig("", "copy", "0xc0", 0)
+
 # Asyn tracing
 asynSetTraceIOMask($(PORT), 0, 2)
 #asynSetTraceMask($(PORT), 0, 0xFF)
@@ -28,6 +28,8 @@ ADDriverEx::ADDriverEx(const char* portName, int numAddresses, int maxBuffers, s
 , paramADSizeY(this, ADSizeY)
 , paramADBinX(this, ADBinX)
 , paramADBinY(this, ADBinY)
+, paramADReverseX(this, ADReverseX)
+, paramADReverseY(this, ADReverseY)
 , paramADMaxSizeX(this, ADMaxSizeX)
 , paramADMaxSizeY(this, ADMaxSizeY)
 , paramADNumExposures(this, ADNumExposures)
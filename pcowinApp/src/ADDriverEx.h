@@ -42,6 +42,8 @@ public:
 	IntegerParam paramADSizeY;
 	IntegerParam paramADBinX;
 	IntegerParam paramADBinY;
+	IntegerParam paramADReverseX;
+	IntegerParam paramADReverseY;
 	IntegerParam paramADMaxSizeX;
 	IntegerParam paramADMaxSizeY;
 	IntegerParam paramADNumExposures;
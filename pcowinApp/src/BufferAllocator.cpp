@@ -0,0 +1,263 @@
+/* BufferAllocator.cpp
+ *
+ * Revamped PCO area detector driver.
+ *
+ * Allocators for the image buffers handed to the SDK.
+ *
+ */
+
+#include "BufferAllocator.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#include <malloc.h>
+#elif defined(__linux__)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <dirent.h>
+#endif
+
+/** Aligned allocation for DLL buffers. */
+#ifdef _WIN32
+#else
+#define _aligned_malloc(siz, align) malloc(siz)
+#define _aligned_free(buff) free(buff)
+#endif
+
+/** Linux memory policy constants, numaif.h is not always installed */
+#if defined(__linux__)
+#define BUFFERALLOCATOR_MPOL_PREFERRED 1
+#define BUFFERALLOCATOR_MPOL_F_NODE 1
+#define BUFFERALLOCATOR_MPOL_F_ADDR 2
+#endif
+
+/** Constants */
+const size_t HeapBufferAllocator::alignment = 0x10000;
+
+/**
+ * Create an allocator.
+ * \param[in] kind The kind of allocator, unknown kinds get the heap allocator
+ */
+BufferAllocator* BufferAllocator::create(int kind)
+{
+	BufferAllocator* result = NULL;
+	switch(kind)
+	{
+	case kindHugePages:
+		result = new HugePageBufferAllocator();
+		break;
+	default:
+		result = new HeapBufferAllocator();
+		break;
+	}
+	return result;
+}
+
+/**
+ * Return the NUMA node a CPU belongs to.
+ * \param[in] cpu The CPU
+ * \return The node, anyNode if it cannot be found
+ */
+int BufferAllocator::nodeOfCpu(int cpu)
+{
+	int result = anyNode;
+#if defined(_WIN32)
+	UCHAR node;
+	if(cpu >= 0 && cpu < 256 && ::GetNumaProcessorNode((UCHAR)cpu, &node))
+	{
+		result = (int)node;
+	}
+#elif defined(__linux__)
+	char path[64];
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+	DIR* dir = ::opendir(path);
+	if(dir != NULL)
+	{
+		struct dirent* entry;
+		while(result == anyNode && (entry = ::readdir(dir)) != NULL)
+		{
+			int node;
+			if(sscanf(entry->d_name, "node%d", &node) == 1)
+			{
+				result = node;
+			}
+		}
+		::closedir(dir);
+	}
+#endif
+	return result;
+}
+
+/**
+ * Allocate a buffer from the heap.
+ * \param[in] size The size in bytes
+ * \param[in] node Ignored
+ * \param[out] placement Where the buffer ended up
+ * \return The buffer, NULL on failure
+ */
+void* HeapBufferAllocator::allocate(size_t size, int node, Placement& placement)
+{
+	placement.pages = pagesStandard;
+	placement.node = anyNode;
+	return _aligned_malloc(size, HeapBufferAllocator::alignment);
+}
+
+/**
+ * Free a buffer.
+ * \param[in] memory The buffer
+ * \param[in] size The size it was allocated with
+ */
+void HeapBufferAllocator::release(void* memory, size_t size)
+{
+	_aligned_free(memory);
+}
+
+/**
+ * Allocate a buffer backed by huge pages on a NUMA node.  Falls back
+ * to transparent huge pages if none are reserved and to ordinary pages
+ * after that.  The node is a preference so that the allocation cannot
+ * fail later when the pages are touched.  The buffer is touched here so
+ * the page faults happen at arm time rather than during the first frames.
+ * On Windows large pages need the lock pages in memory privilege.
+ * \param[in] size The size in bytes
+ * \param[in] node The preferred node, anyNode for none
+ * \param[out] placement Where the buffer ended up
+ * \return The buffer, NULL on failure
+ */
+void* HugePageBufferAllocator::allocate(size_t size, int node, Placement& placement)
+{
+	placement.pages = pagesHuge;
+	placement.node = anyNode;
+	void* memory = NULL;
+#if defined(_WIN32)
+	DWORD preferred = node == anyNode ? NUMA_NO_PREFERRED_NODE : (DWORD)node;
+	size_t largePage = ::GetLargePageMinimum();
+	if(largePage != 0)
+	{
+		memory = ::VirtualAllocExNuma(::GetCurrentProcess(), NULL, roundUp(size, largePage),
+			MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE, preferred);
+	}
+	if(memory == NULL)
+	{
+		placement.pages = pagesStandard;
+		memory = ::VirtualAllocExNuma(::GetCurrentProcess(), NULL, size,
+			MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, preferred);
+	}
+	if(memory != NULL)
+	{
+		::memset(memory, 0, size);
+		// Report the node the memory is actually on
+		PSAPI_WORKING_SET_EX_INFORMATION info;
+		info.VirtualAddress = memory;
+		if(::QueryWorkingSetEx(::GetCurrentProcess(), &info, sizeof(info)) &&
+			info.VirtualAttributes.Valid)
+		{
+			placement.node = (int)info.VirtualAttributes.Node;
+		}
+	}
+#elif defined(__linux__)
+	size_t length = roundUp(size, HugePageBufferAllocator::hugePageSize());
+	memory = ::mmap(NULL, length, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if(memory == MAP_FAILED)
+	{
+		memory = ::mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(memory == MAP_FAILED)
+		{
+			return NULL;
+		}
+		placement.pages = ::madvise(memory, length, MADV_HUGEPAGE) == 0 ?
+			pagesTransparent : pagesStandard;
+	}
+	if(node != anyNode)
+	{
+		HugePageBufferAllocator::bindToNode(memory, length, node);
+	}
+	::memset(memory, 0, length);
+	// Report the node the memory is actually on
+	int actual;
+	if(::syscall(SYS_get_mempolicy, &actual, NULL, 0, memory,
+			BUFFERALLOCATOR_MPOL_F_NODE | BUFFERALLOCATOR_MPOL_F_ADDR) == 0)
+	{
+		placement.node = actual;
+	}
+#else
+	placement.pages = pagesStandard;
+	memory = malloc(size);
+#endif
+	return memory;
+}
+
+/**
+ * Free a buffer.
+ * \param[in] memory The buffer
+ * \param[in] size The size it was allocated with
+ */
+void HugePageBufferAllocator::release(void* memory, size_t size)
+{
+#if defined(_WIN32)
+	::VirtualFree(memory, 0, MEM_RELEASE);
+#elif defined(__linux__)
+	::munmap(memory, roundUp(size, HugePageBufferAllocator::hugePageSize()));
+#else
+	free(memory);
+#endif
+}
+
+/**
+ * Return the size of the default huge page.
+ */
+size_t HugePageBufferAllocator::hugePageSize()
+{
+	static size_t result = 0;
+	if(result == 0)
+	{
+		result = 2 * 1024 * 1024;
+#if defined(__linux__)
+		FILE* meminfo = fopen("/proc/meminfo", "r");
+		if(meminfo != NULL)
+		{
+			char line[128];
+			unsigned long kb;
+			while(fgets(line, sizeof(line), meminfo) != NULL)
+			{
+				if(sscanf(line, "Hugepagesize: %lu kB", &kb) == 1 && kb > 0)
+				{
+					result = (size_t)kb * 1024;
+				}
+			}
+			fclose(meminfo);
+		}
+#endif
+	}
+	return result;
+}
+
+/**
+ * Ask for untouched memory to be placed on a NUMA node.
+ * \param[in] memory The memory
+ * \param[in] size Its size in bytes
+ * \param[in] node The node
+ * \return False if the request failed
+ */
+bool HugePageBufferAllocator::bindToNode(void* memory, size_t size, int node)
+{
+#if defined(__linux__)
+	enum {maskWords=16, bitsPerWord=sizeof(unsigned long)*8};
+	unsigned long nodeMask[maskWords];
+	if(node < 0 || node >= maskWords * bitsPerWord)
+	{
+		return false;
+	}
+	::memset(nodeMask, 0, sizeof(nodeMask));
+	nodeMask[node / bitsPerWord] = 1UL << (node % bitsPerWord);
+	return ::syscall(SYS_mbind, memory, size, BUFFERALLOCATOR_MPOL_PREFERRED,
+		nodeMask, (unsigned long)(maskWords * bitsPerWord + 1), 0) == 0;
+#else
+	return false;
+#endif
+}
@@ -0,0 +1,62 @@
+/* BufferAllocator.h
+ *
+ * Revamped PCO area detector driver.
+ *
+ * Allocators for the image buffers handed to the SDK.  The heap
+ * allocator is the original aligned allocation.  The huge page
+ * allocator backs each buffer with huge pages on a chosen NUMA
+ * node, falling back to transparent huge pages and then to ordinary
+ * pages, and reports where each buffer actually ended up.
+ *
+ */
+#ifndef BUFFERALLOCATOR_H_
+#define BUFFERALLOCATOR_H_
+
+#include <cstddef>
+
+class BufferAllocator
+{
+public:
+	enum Kind {kindHeap=0, kindHugePages=1};
+	enum Pages {pagesStandard=0, pagesTransparent=1, pagesHuge=2};
+	enum {anyNode=-1};
+	/** Where a buffer ended up */
+	struct Placement
+	{
+		int pages;
+		int node;          // anyNode if not bound
+	};
+public:
+	static BufferAllocator* create(int kind);
+	static int nodeOfCpu(int cpu);
+	virtual ~BufferAllocator() {}
+	virtual int kind() const = 0;
+	virtual void* allocate(size_t size, int node, Placement& placement) = 0;
+	virtual void release(void* memory, size_t size) = 0;
+};
+
+/** The original allocator, aligned heap memory */
+class HeapBufferAllocator: public BufferAllocator
+{
+public:
+	virtual int kind() const {return kindHeap;}
+	virtual void* allocate(size_t size, int node, Placement& placement);
+	virtual void release(void* memory, size_t size);
+private:
+	static const size_t alignment;
+};
+
+/** Huge pages bound to a NUMA node */
+class HugePageBufferAllocator: public BufferAllocator
+{
+public:
+	virtual int kind() const {return kindHugePages;}
+	virtual void* allocate(size_t size, int node, Placement& placement);
+	virtual void release(void* memory, size_t size);
+private:
+	static size_t hugePageSize();
+	static bool bindToNode(void* memory, size_t size, int node);
+	static size_t roundUp(size_t size, size_t granule) {return (size + granule - 1) / granule * granule;}
+};
+
+#endif /* BUFFERALLOCATOR_H_ */
@@ -1086,6 +1086,50 @@ void DllApi::setCameraRamSegmentSize(Handle handle, unsigned long seg1,
     }
 }
 
+/**
+ * Get the meta data mode, and the size of the block appended to each image.
+ */
+void DllApi::getMetaDataMode(Handle handle, unsigned short* mode, unsigned short* size,
+	unsigned short* version) throw(PcoException)
+{
+    int result = doGetMetaDataMode(handle, mode, size, version);
+    *this->trace << "DllApi->GetMetaDataMode(" << handle <<
+        ", " << *mode << ", " << *size << ", " << *version << ") = " << result << std::endl;
+    if(result != DllApi::errorNone)
+    {
+        throw PcoException("getMetaDataMode", result);
+    }
+}
+
+/**
+ * Set the meta data mode.
+ */
+void DllApi::setMetaDataMode(Handle handle, unsigned short mode, unsigned short* size,
+	unsigned short* version) throw(PcoException)
+{
+    int result = doSetMetaDataMode(handle, mode, size, version);
+    *this->trace << "DllApi->SetMetaDataMode(" << handle <<
+        ", " << mode << ", " << *size << ", " << *version << ") = " << result << std::endl;
+    if(result != DllApi::errorNone)
+    {
+        throw PcoException("setMetaDataMode", result);
+    }
+}
+
+/**
+ * Get the meta data of the image in a buffer.
+ */
+void DllApi::getMetaData(Handle handle, short bufferNumber, MetaData* metaData) throw(PcoException)
+{
+    int result = doGetMetaData(handle, bufferNumber, metaData);
+    *this->trace << "DllApi->GetMetaData(" << handle <<
+        ", " << bufferNumber << ", " << metaData->imageCounter << ") = " << result << std::endl;
+    if(result != DllApi::errorNone)
+    {
+        throw PcoException("getMetaData", result);
+    }
+}
+
 /**
  * Start the frame capturing loop
  */
@@ -47,7 +47,10 @@ public:
     enum {timebaseNanoseconds=0, timebaseMicroseconds=1, timebaseMilliseconds=2,
         numTimebases=3};
     enum {adcModeSingle=1, adcModeDual=2};
-    enum {generalCapsTimestampAsciiOnly=0x00000010, generalCapsNoTimestamp=0x00000100};
+    enum {generalCapsTimestampAsciiOnly=0x00000010, generalCapsNoTimestamp=0x00000100,
+        generalCapsMetaData=0x00004000};
+    enum {metaDataModeOff=0, metaDataModeOn=1};
+    enum {metaDataNoTemperature=-32768};
     enum {edgeSetupRollingShutter=0x00000001, edgeSetupGlobalShutter=0x00000002, 
         edgeSetupGlobalReset=0x00000004};
     enum {camlinkDataFormatMask=0x0f, camlinkDataFormat1x16=0x01, camlinkDataFormat2x12=0x02,
@@ -65,7 +68,7 @@ public:
     enum {descriptionNumPixelRates=4};
     enum {cameraSetupDataSize=10, cameraSetupRollingShutter=1, cameraSetupGlobalShutter=2};
     static const double timebaseScaleFactor[numTimebases];
-    enum {maxNumBuffers=8};
+    enum {maxNumBuffers=16};    // PCO_BUFCNT, the most buffers the SDK will hold
     enum {bufferUnallocated=-1};
     enum {binSteppingLinearBinary=0, binSteppingLinear=1};
     enum {bitAlignmentMsb=0, bitAlignmentLsb=1};
@@ -130,6 +133,19 @@ public:
 		unsigned long segmentSizePages[storageNumSegments];  // Segment sizes in pages
 		unsigned short activeSegment;   // The active segment number
 	};
+    struct MetaData
+    {
+        unsigned long imageCounter;     // Decoded from BCD
+        unsigned short exposureTimebase;
+        unsigned long exposureTime;     // In the exposure timebase
+        unsigned long frameRateMilliHz; // 0 if unknown
+        short sensorTemperature;        // In degrees C, metaDataNoTemperature if unknown
+        unsigned char binningX;         // 0 if unknown
+        unsigned char binningY;
+        unsigned char triggerMode;
+        unsigned char syncStatus;       // 1 if locked to an external sync
+        unsigned char timeStatus;       // 0 internal clock, 1 IRIG, 2 master
+    };
 
 // API for derived classes to implement
 protected:
@@ -221,6 +237,11 @@ protected:
 	virtual int doSetNoiseFilterMode(Handle handle, unsigned short mode) = 0;
 	virtual int doSetCameraRamSegmentSize(Handle handle, unsigned long seg1,
 		unsigned long seg2, unsigned long seg3, unsigned long seg4) = 0;
+	virtual int doGetMetaDataMode(Handle handle, unsigned short* mode, unsigned short* size,
+		unsigned short* version) = 0;
+	virtual int doSetMetaDataMode(Handle handle, unsigned short mode, unsigned short* size,
+		unsigned short* version) = 0;
+	virtual int doGetMetaData(Handle handle, short bufferNumber, MetaData* metaData) = 0;
 	virtual void doStartFrameCapture(bool useGetImage) = 0;
 	virtual void doStopFrameCapture() = 0;
 
@@ -315,6 +336,11 @@ public:
 	void setNoiseFilterMode(Handle handle, unsigned short mode) throw(PcoException);
 	void setCameraRamSegmentSize(Handle handle, unsigned long seg1, unsigned long seg2,
 		unsigned long seg3, unsigned long seg4) throw(PcoException);
+	void getMetaDataMode(Handle handle, unsigned short* mode, unsigned short* size,
+		unsigned short* version) throw(PcoException);
+	void setMetaDataMode(Handle handle, unsigned short mode, unsigned short* size,
+		unsigned short* version) throw(PcoException);
+	void getMetaData(Handle handle, short bufferNumber, MetaData* metaData) throw(PcoException);
 	void startFrameCapture(bool useGetImage);
 	void stopFrameCapture();
 	bool isStopped();
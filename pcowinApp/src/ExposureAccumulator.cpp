@@ -0,0 +1,550 @@
+/* ExposureAccumulator.cpp
+ *
+ * Revamped PCO area detector driver.
+ *
+ * Sums the exposures that make up one image.
+ *
+ */
+
+#include "ExposureAccumulator.h"
+#include "FrameCopier.h"
+#include "Simd.h"
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <limits>
+#include "epicsTime.h"
+#include "epicsTypes.h"
+#include "epicsStdio.h"
+
+/** Constants */
+const size_t ExposureAccumulator::chunkElements = 64;
+
+/** Divide an accumulated value by the number of exposures, rounding to nearest */
+static inline epicsUInt32 divideRounded(epicsUInt32 value, int divisor)
+{
+	return (value + (epicsUInt32)divisor / 2) / (epicsUInt32)divisor;
+}
+static inline epicsInt32 divideRounded(epicsInt32 value, int divisor)
+{
+	return value >= 0 ? (value + divisor / 2) / divisor : (value - divisor / 2) / divisor;
+}
+static inline double divideRounded(double value, int divisor)
+{
+	return value / divisor;
+}
+
+/** Clamp an accumulated value to the range of the frame's type */
+template<typename T, typename A> static inline T saturateTo(A value)
+{
+	const A highest = (A)std::numeric_limits<T>::max();
+	const A lowest = std::numeric_limits<T>::is_integer ?
+		(A)std::numeric_limits<T>::min() : (A)-std::numeric_limits<T>::max();
+	return value > highest ? (T)highest : (value < lowest ? (T)lowest : (T)value);
+}
+
+/** Widening copy of the first exposure */
+template<typename T, typename A> static void firstScalar(void* dest, const void* src, size_t count, int divisor)
+{
+	A* acc = (A*)dest;
+	const T* in = (const T*)src;
+	for(size_t i=0; i<count; i++)
+	{
+		acc[i] = (A)in[i];
+	}
+}
+
+/** Add an exposure into the accumulator */
+template<typename T, typename A> static void addScalar(void* dest, const void* src, size_t count, int divisor)
+{
+	A* acc = (A*)dest;
+	const T* in = (const T*)src;
+	for(size_t i=0; i<count; i++)
+	{
+		acc[i] += (A)in[i];
+	}
+}
+
+/** The sum output, the accumulator as it is */
+template<typename A> static void sumScalar(void* dest, const void* src, size_t count, int divisor)
+{
+	::memcpy(dest, src, count * sizeof(A));
+}
+
+/** The mean output, in the frame's own type */
+template<typename T, typename A> static void meanScalar(void* dest, const void* src, size_t count, int divisor)
+{
+	T* out = (T*)dest;
+	const A* acc = (const A*)src;
+	for(size_t i=0; i<count; i++)
+	{
+		out[i] = (T)divideRounded(acc[i], divisor);
+	}
+}
+
+/** The saturated sum output, in the frame's own type */
+template<typename T, typename A> static void saturateScalar(void* dest, const void* src, size_t count, int divisor)
+{
+	T* out = (T*)dest;
+	const A* acc = (const A*)src;
+	for(size_t i=0; i<count; i++)
+	{
+		out[i] = saturateTo<T, A>(acc[i]);
+	}
+}
+
+#ifdef SIMD_SSE2
+/** SSE2 kernels for unsigned 8 and 16 bit frames */
+template<bool first> static void accumulateU16Sse2(void* dest, const void* src, size_t count, int divisor)
+{
+	epicsUInt32* acc = (epicsUInt32*)dest;
+	const epicsUInt16* in = (const epicsUInt16*)src;
+	const __m128i zero = _mm_setzero_si128();
+	size_t i = 0;
+	for(; i+8<=count; i+=8)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)(in+i));
+		__m128i low = _mm_unpacklo_epi16(v, zero);
+		__m128i high = _mm_unpackhi_epi16(v, zero);
+		if(!first)
+		{
+			low = _mm_add_epi32(low, _mm_loadu_si128((const __m128i*)(acc+i)));
+			high = _mm_add_epi32(high, _mm_loadu_si128((const __m128i*)(acc+i+4)));
+		}
+		_mm_storeu_si128((__m128i*)(acc+i), low);
+		_mm_storeu_si128((__m128i*)(acc+i+4), high);
+	}
+	if(first)
+	{
+		firstScalar<epicsUInt16, epicsUInt32>(acc+i, in+i, count-i, divisor);
+	}
+	else
+	{
+		addScalar<epicsUInt16, epicsUInt32>(acc+i, in+i, count-i, divisor);
+	}
+}
+template<bool first> static void accumulateU8Sse2(void* dest, const void* src, size_t count, int divisor)
+{
+	epicsUInt32* acc = (epicsUInt32*)dest;
+	const epicsUInt8* in = (const epicsUInt8*)src;
+	const __m128i zero = _mm_setzero_si128();
+	size_t i = 0;
+	for(; i+16<=count; i+=16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)(in+i));
+		__m128i words[2] = {_mm_unpacklo_epi8(v, zero), _mm_unpackhi_epi8(v, zero)};
+		for(int w=0; w<2; w++)
+		{
+			__m128i low = _mm_unpacklo_epi16(words[w], zero);
+			__m128i high = _mm_unpackhi_epi16(words[w], zero);
+			epicsUInt32* a = acc + i + w*8;
+			if(!first)
+			{
+				low = _mm_add_epi32(low, _mm_loadu_si128((const __m128i*)a));
+				high = _mm_add_epi32(high, _mm_loadu_si128((const __m128i*)(a+4)));
+			}
+			_mm_storeu_si128((__m128i*)a, low);
+			_mm_storeu_si128((__m128i*)(a+4), high);
+		}
+	}
+	if(first)
+	{
+		firstScalar<epicsUInt8, epicsUInt32>(acc+i, in+i, count-i, divisor);
+	}
+	else
+	{
+		addScalar<epicsUInt8, epicsUInt32>(acc+i, in+i, count-i, divisor);
+	}
+}
+#endif
+
+#ifdef SIMD_AVX2
+/** AVX2 kernels for unsigned 8 and 16 bit frames */
+template<bool first> SIMD_TARGET_AVX2
+static void accumulateU16Avx2(void* dest, const void* src, size_t count, int divisor)
+{
+	epicsUInt32* acc = (epicsUInt32*)dest;
+	const epicsUInt16* in = (const epicsUInt16*)src;
+	size_t i = 0;
+	for(; i+16<=count; i+=16)
+	{
+		__m256i low = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(in+i)));
+		__m256i high = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(in+i+8)));
+		if(!first)
+		{
+			low = _mm256_add_epi32(low, _mm256_loadu_si256((const __m256i*)(acc+i)));
+			high = _mm256_add_epi32(high, _mm256_loadu_si256((const __m256i*)(acc+i+8)));
+		}
+		_mm256_storeu_si256((__m256i*)(acc+i), low);
+		_mm256_storeu_si256((__m256i*)(acc+i+8), high);
+	}
+	if(first)
+	{
+		firstScalar<epicsUInt16, epicsUInt32>(acc+i, in+i, count-i, divisor);
+	}
+	else
+	{
+		addScalar<epicsUInt16, epicsUInt32>(acc+i, in+i, count-i, divisor);
+	}
+}
+template<bool first> SIMD_TARGET_AVX2
+static void accumulateU8Avx2(void* dest, const void* src, size_t count, int divisor)
+{
+	epicsUInt32* acc = (epicsUInt32*)dest;
+	const epicsUInt8* in = (const epicsUInt8*)src;
+	size_t i = 0;
+	for(; i+16<=count; i+=16)
+	{
+		__m256i low = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(in+i)));
+		__m256i high = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(in+i+8)));
+		if(!first)
+		{
+			low = _mm256_add_epi32(low, _mm256_loadu_si256((const __m256i*)(acc+i)));
+			high = _mm256_add_epi32(high, _mm256_loadu_si256((const __m256i*)(acc+i+8)));
+		}
+		_mm256_storeu_si256((__m256i*)(acc+i), low);
+		_mm256_storeu_si256((__m256i*)(acc+i+8), high);
+	}
+	if(first)
+	{
+		firstScalar<epicsUInt8, epicsUInt32>(acc+i, in+i, count-i, divisor);
+	}
+	else
+	{
+		addScalar<epicsUInt8, epicsUInt32>(acc+i, in+i, count-i, divisor);
+	}
+}
+#endif
+
+/**
+ * Constructor
+ */
+ExposureAccumulator::ExposureAccumulator()
+: dataType(NDUInt16)
+, ndims(0)
+, numElements(0)
+, accumulator(NULL)
+, accumulatorSize(0)
+, numAdded(0)
+{
+	::memset(&this->format, 0, sizeof(this->format));
+	::memset(this->dims, 0, sizeof(this->dims));
+}
+
+/**
+ * Destructor
+ */
+ExposureAccumulator::~ExposureAccumulator()
+{
+	free(this->accumulator);
+}
+
+/**
+ * Run a kernel over a frame, splitting it across the frame copy
+ * engine's pool if it is large.
+ * \param[in] kernel The kernel
+ * \param[in] dest The destination
+ * \param[in] destBytes The size of a destination element
+ * \param[in] src The source
+ * \param[in] srcBytes The size of a source element
+ * \param[in] count The number of elements
+ * \param[in] divisor Passed to the kernel
+ */
+void ExposureAccumulator::parallel(Kernel kernel, void* dest, size_t destBytes,
+	const void* src, size_t srcBytes, size_t count, int divisor)
+{
+	FrameCopier& pool = FrameCopier::instance();
+	Pass pass;
+	pass.kernel = kernel;
+	pass.dest = (char*)dest;
+	pass.destBytes = destBytes;
+	pass.src = (const char*)src;
+	pass.srcBytes = srcBytes;
+	pass.divisor = divisor;
+	size_t bytes = count * (destBytes > srcBytes ? destBytes : srcBytes);
+	if(bytes < pool.splitThreshold() ||
+		!pool.split(ExposureAccumulator::passShare, &pass, count, chunkElements))
+	{
+		// Small, no pool or it is busy with another frame
+		kernel(dest, src, count, divisor);
+	}
+}
+
+/**
+ * Run a kernel over one share of a frame.
+ * \param[in] context The Pass
+ * \param[in] first The first element
+ * \param[in] count The number of elements
+ * \param[in] share Not used
+ */
+void ExposureAccumulator::passShare(void* context, size_t first, size_t count, int share)
+{
+	Pass* pass = (Pass*)context;
+	pass->kernel(pass->dest + first * pass->destBytes, pass->src + first * pass->srcBytes,
+		count, pass->divisor);
+}
+
+/**
+ * Make the format for frames of type T accumulated as type A.
+ * \param[in] sumType The NDArray type of A
+ */
+template<typename T, typename A> ExposureAccumulator::Format ExposureAccumulator::makeFormat(
+	NDDataType_t sumType)
+{
+	Format result;
+	result.sumType = sumType;
+	result.inBytes = sizeof(T);
+	result.accBytes = sizeof(A);
+	result.first = firstScalar<T, A>;
+	result.add = addScalar<T, A>;
+	result.sum = sumScalar<A>;
+	result.mean = meanScalar<T, A>;
+	result.saturate = saturateScalar<T, A>;
+	return result;
+}
+
+/**
+ * Find how a data type is accumulated.
+ * \param[in] dataType The type of the frames
+ * \param[out] format The format
+ * \return False if the type cannot be accumulated
+ */
+bool ExposureAccumulator::findFormat(NDDataType_t dataType, Format& format)
+{
+	bool result = true;
+	switch(dataType)
+	{
+	case NDInt8:
+		format = makeFormat<epicsInt8, epicsInt32>(NDInt32);
+		break;
+	case NDUInt8:
+		format = makeFormat<epicsUInt8, epicsUInt32>(NDUInt32);
+#ifdef SIMD_SSE2
+		format.first = accumulateU8Sse2<true>;
+		format.add = accumulateU8Sse2<false>;
+#endif
+#ifdef SIMD_AVX2
+		if(Simd::avx2())
+		{
+			format.first = accumulateU8Avx2<true>;
+			format.add = accumulateU8Avx2<false>;
+		}
+#endif
+		break;
+	case NDInt16:
+		format = makeFormat<epicsInt16, epicsInt32>(NDInt32);
+		break;
+	case NDUInt16:
+		format = makeFormat<epicsUInt16, epicsUInt32>(NDUInt32);
+#ifdef SIMD_SSE2
+		format.first = accumulateU16Sse2<true>;
+		format.add = accumulateU16Sse2<false>;
+#endif
+#ifdef SIMD_AVX2
+		if(Simd::avx2())
+		{
+			format.first = accumulateU16Avx2<true>;
+			format.add = accumulateU16Avx2<false>;
+		}
+#endif
+		break;
+	case NDInt32:
+		format = makeFormat<epicsInt32, double>(NDFloat64);
+		break;
+	case NDUInt32:
+		format = makeFormat<epicsUInt32, double>(NDFloat64);
+		break;
+	case NDFloat32:
+		format = makeFormat<epicsFloat32, double>(NDFloat64);
+		break;
+	case NDFloat64:
+		format = makeFormat<epicsFloat64, double>(NDFloat64);
+		break;
+	default:
+		result = false;
+		break;
+	}
+	return result;
+}
+
+/**
+ * Return the widening kernels for a data type, for use outside the
+ * accumulator.
+ * \param[in] dataType The type of the frames
+ * \param[out] first Copies a frame into the accumulator type
+ * \param[out] add Adds a frame into the accumulator type
+ * \return False if the type cannot be accumulated
+ */
+bool ExposureAccumulator::kernels(NDDataType_t dataType, Kernel& first, Kernel& add)
+{
+	Format format;
+	bool result = ExposureAccumulator::findFormat(dataType, format);
+	if(result)
+	{
+		first = format.first;
+		add = format.add;
+	}
+	return result;
+}
+
+/**
+ * Add an exposure.  The first exposure, or one whose type or size
+ * differs from the sum so far, starts a new sum sized from the array.
+ * \param[in] image The exposure, still owned by the caller
+ * \return False if the type cannot be accumulated or there is no memory
+ */
+bool ExposureAccumulator::add(NDArray* image)
+{
+	NDArrayInfo_t info;
+	image->getInfo(&info);
+	if(this->numAdded == 0 || image->dataType != this->dataType ||
+		info.nElements != this->numElements)
+	{
+		this->numAdded = 0;
+		if(!ExposureAccumulator::findFormat(image->dataType, this->format))
+		{
+			return false;
+		}
+		size_t size = info.nElements * this->format.accBytes;
+		if(size > this->accumulatorSize)
+		{
+			free(this->accumulator);
+			this->accumulator = malloc(size);
+			this->accumulatorSize = this->accumulator == NULL ? 0 : size;
+			if(this->accumulator == NULL)
+			{
+				return false;
+			}
+		}
+		this->dataType = image->dataType;
+		this->numElements = info.nElements;
+		this->ndims = image->ndims;
+		::memcpy(this->dims, image->dims, sizeof(this->dims));
+		ExposureAccumulator::parallel(this->format.first, this->accumulator, this->format.accBytes,
+			image->pData, this->format.inBytes, this->numElements, 1);
+	}
+	else
+	{
+		ExposureAccumulator::parallel(this->format.add, this->accumulator, this->format.accBytes,
+			image->pData, this->format.inBytes, this->numElements, 1);
+	}
+	this->numAdded++;
+	return true;
+}
+
+/**
+ * Produce the image from the exposures added so far and start again.
+ * \param[in] pool The pool to allocate the image from
+ * \param[in] output What to produce, one of the Output values
+ * \return The image, NULL if nothing has been added or the pool is exhausted
+ */
+NDArray* ExposureAccumulator::finish(NDArrayPool* pool, int output)
+{
+	NDArray* result = NULL;
+	if(this->numAdded > 0)
+	{
+		size_t dimSizes[ND_ARRAY_MAX_DIMS];
+		for(int i=0; i<this->ndims; i++)
+		{
+			dimSizes[i] = this->dims[i].size;
+		}
+		NDDataType_t type = output == outputSum ? this->format.sumType : this->dataType;
+		result = pool->alloc(this->ndims, dimSizes, type, 0, NULL);
+		if(result != NULL)
+		{
+			// Keep the offsets and binning of the exposures
+			for(int i=0; i<this->ndims; i++)
+			{
+				result->dims[i] = this->dims[i];
+			}
+			Kernel kernel = this->format.sum;
+			size_t outBytes = this->format.accBytes;
+			if(output == outputMean)
+			{
+				kernel = this->format.mean;
+				outBytes = this->format.inBytes;
+			}
+			else if(output == outputSaturate)
+			{
+				kernel = this->format.saturate;
+				outBytes = this->format.inBytes;
+			}
+			ExposureAccumulator::parallel(kernel, result->pData, outBytes,
+				this->accumulator, this->format.accBytes, this->numElements, this->numAdded);
+		}
+	}
+	this->numAdded = 0;
+	return result;
+}
+
+/**
+ * Time the accumulation of 16 bit frames against the plain scalar loop
+ * and check that every kernel gives the same sum.
+ * \param[in] pixels The frame size in pixels
+ * \param[in] exposures The number of exposures to sum
+ */
+void ExposureAccumulator::benchmark(size_t pixels, int exposures)
+{
+	epicsUInt16* frame = (epicsUInt16*)malloc(pixels * sizeof(epicsUInt16));
+	epicsUInt32* expected = (epicsUInt32*)malloc(pixels * sizeof(epicsUInt32));
+	epicsUInt32* acc = (epicsUInt32*)malloc(pixels * sizeof(epicsUInt32));
+	if(frame == NULL || expected == NULL || acc == NULL || exposures <= 0)
+	{
+		printf("pcoBenchmark accumulate: cannot allocate %lu pixels\n", (unsigned long)pixels);
+		free(frame);
+		free(expected);
+		free(acc);
+		return;
+	}
+	// Values near full scale so a 16 bit sum would overflow
+	for(size_t i=0; i<pixels; i++)
+	{
+		frame[i] = (epicsUInt16)(0xff00 + (i * 2654435761u >> 24));
+	}
+	Format format;
+	ExposureAccumulator::findFormat(NDUInt16, format);
+	Kernel scalarFirst = firstScalar<epicsUInt16, epicsUInt32>;
+	Kernel scalarAdd = addScalar<epicsUInt16, epicsUInt32>;
+	epicsTimeStamp start;
+	epicsTimeStamp end;
+	epicsTimeGetCurrent(&start);
+	scalarFirst(expected, frame, pixels, 1);
+	for(int i=1; i<exposures; i++)
+	{
+		scalarAdd(expected, frame, pixels, 1);
+	}
+	epicsTimeGetCurrent(&end);
+	double scalarTime = epicsTimeDiffInSeconds(&end, &start);
+	epicsTimeGetCurrent(&start);
+	format.first(acc, frame, pixels, 1);
+	for(int i=1; i<exposures; i++)
+	{
+		format.add(acc, frame, pixels, 1);
+	}
+	epicsTimeGetCurrent(&end);
+	double kernelTime = epicsTimeDiffInSeconds(&end, &start);
+	bool kernelOk = ::memcmp(acc, expected, pixels * sizeof(epicsUInt32)) == 0;
+	epicsTimeGetCurrent(&start);
+	ExposureAccumulator::parallel(format.first, acc, sizeof(epicsUInt32),
+		frame, sizeof(epicsUInt16), pixels, 1);
+	for(int i=1; i<exposures; i++)
+	{
+		ExposureAccumulator::parallel(format.add, acc, sizeof(epicsUInt32),
+			frame, sizeof(epicsUInt16), pixels, 1);
+	}
+	epicsTimeGetCurrent(&end);
+	double poolTime = epicsTimeDiffInSeconds(&end, &start);
+	bool poolOk = ::memcmp(acc, expected, pixels * sizeof(epicsUInt32)) == 0;
+	double gigabytes = (double)pixels * sizeof(epicsUInt16) * exposures / 1e9;
+	printf("pcoBenchmark accumulate: %lu pixels x %d, %s kernels, %d threads, threshold %lu bytes\n",
+		(unsigned long)pixels, exposures, Simd::isaNames[Simd::isa()],
+		FrameCopier::instance().numShares() - 1, (unsigned long)FrameCopier::instance().splitThreshold());
+	printf("    scalar: %.2f GB/s\n", scalarTime > 0.0 ? gigabytes / scalarTime : 0.0);
+	printf("    kernel: %.2f GB/s%s\n", kernelTime > 0.0 ? gigabytes / kernelTime : 0.0,
+		kernelOk ? "" : ", WRONG SUM");
+	printf("    pool:   %.2f GB/s%s\n", poolTime > 0.0 ? gigabytes / poolTime : 0.0,
+		poolOk ? "" : ", WRONG SUM");
+	free(frame);
+	free(expected);
+	free(acc);
+}
@@ -0,0 +1,79 @@
+/* ExposureAccumulator.h
+ *
+ * Revamped PCO area detector driver.
+ *
+ * Sums the exposures that make up one image into an accumulator wider
+ * than the pixels, so that 8 and 16 bit frames cannot overflow.  Unsigned
+ * frames accumulate into 32 bit integers, signed frames into signed 32 bit
+ * integers and anything wider into doubles.  The kernels for the common
+ * unsigned cases use SSE2 or AVX2, whichever the processor supports.
+ * Large frames are split across the frame copy engine's pool of
+ * threads.  The finished image is the sum, the mean or the sum
+ * saturated to the frame's own type.
+ *
+ */
+#ifndef EXPOSUREACCUMULATOR_H_
+#define EXPOSUREACCUMULATOR_H_
+
+#include <cstddef>
+#include "NDArray.h"
+
+class ExposureAccumulator
+{
+public:
+	enum Output {outputSum=0, outputMean=1, outputSaturate=2};
+	/** A kernel works on count elements, the divisor is only used by the mean */
+	typedef void (*Kernel)(void* dest, const void* src, size_t count, int divisor);
+public:
+	static bool kernels(NDDataType_t dataType, Kernel& first, Kernel& add);
+	ExposureAccumulator();
+	virtual ~ExposureAccumulator();
+	bool add(NDArray* image);
+	NDArray* finish(NDArrayPool* pool, int output);
+	void reset() {this->numAdded = 0;}
+	int count() const {return this->numAdded;}
+	static void benchmark(size_t pixels, int exposures);
+private:
+	/** How one NDArray data type is accumulated */
+	struct Format
+	{
+		NDDataType_t sumType;      // Type of the accumulator and the sum output
+		size_t inBytes;
+		size_t accBytes;
+		Kernel first;              // Widening copy of the first exposure
+		Kernel add;
+		Kernel sum;
+		Kernel mean;
+		Kernel saturate;
+	};
+	/** A pass being split across the pool */
+	struct Pass
+	{
+		Kernel kernel;
+		char* dest;
+		size_t destBytes;
+		const char* src;
+		size_t srcBytes;
+		int divisor;
+	};
+private:
+	ExposureAccumulator(const ExposureAccumulator& other);
+	ExposureAccumulator& operator=(const ExposureAccumulator& other);
+	static bool findFormat(NDDataType_t dataType, Format& format);
+	template<typename T, typename A> static Format makeFormat(NDDataType_t sumType);
+	static void passShare(void* context, size_t first, size_t count, int share);
+	static void parallel(Kernel kernel, void* dest, size_t destBytes,
+		const void* src, size_t srcBytes, size_t count, int divisor);
+private:
+	static const size_t chunkElements;
+	Format format;
+	NDDataType_t dataType;
+	int ndims;
+	NDDimension_t dims[ND_ARRAY_MAX_DIMS];
+	size_t numElements;
+	void* accumulator;
+	size_t accumulatorSize;
+	int numAdded;
+};
+
+#endif /* EXPOSUREACCUMULATOR_H_ */
@@ -0,0 +1,361 @@
+/* FrameCapture.cpp
+ *
+ * Revamped PCO area detector driver.
+ *
+ * The frame capture loop.
+ *
+ */
+
+#include "FrameCapture.h"
+#include "TraceStream.h"
+#include "Pco.h"
+#include "ThreadPlacement.h"
+#include "Simd.h"
+#include "epicsAtomic.h"
+#include "epicsTime.h"
+
+/** Constants */
+const double FrameCapture::bufferWaitTimeout = 5.0;
+const double FrameCapture::getImagePeriod = 0.1;
+const double FrameCapture::busyPollIdleTime = 0.5;
+
+/**
+ * Constructor
+ * \param[in] pco The driver that receives the frames
+ * \param[in] trace The trace stream
+ * \param[in] threadName The name of the capture thread
+ */
+FrameCapture::FrameCapture(Pco* pco, TraceStream* trace, const char* threadName)
+: pco(pco)
+, trace(trace)
+, thread(*this, threadName, epicsThreadGetStackSize(epicsThreadStackMedium))
+, startEvent(epicsEventEmpty)
+, wakeEvent(epicsEventEmpty)
+, stopRequested(0)
+, exitRequested(0)
+, useGetImage(false)
+, placementGeneration(ThreadPlacement::unapplied)
+{
+	for(int i=0; i<DllApi::maxNumBuffers; i++)
+	{
+		this->buffers[i].allocated = 0;
+		this->buffers[i].timesAdded = 0;
+		this->buffers[i].timesTaken = 0;
+		this->buffers[i].signalled = 0;
+	}
+}
+
+/**
+ * Destructor
+ */
+FrameCapture::~FrameCapture()
+{
+	this->stopThread();
+}
+
+/**
+ * Stop the capture thread and wait for it to exit.  A class that
+ * overrides the buffer event primitives must call this in its own
+ * destructor, the thread may still be using them.
+ */
+void FrameCapture::stopThread()
+{
+	epicsAtomicSetIntT(&this->exitRequested, 1);
+	this->stop();
+	this->startEvent.signal();
+	this->thread.exitWait();
+}
+
+/**
+ * Start the capture thread.  Called by the owner once it is fully
+ * constructed, so that the thread never sees a partly built object.
+ */
+void FrameCapture::startThread()
+{
+	this->thread.start();
+}
+
+/**
+ * Start capturing frames.
+ * \param[in] useGetImage Poll for frames with getImage instead of waiting for buffers
+ */
+void FrameCapture::start(bool useGetImage)
+{
+	this->useGetImage = useGetImage;
+	epicsAtomicSetIntT(&this->stopRequested, 0);
+	this->startEvent.signal();
+}
+
+/**
+ * Stop capturing frames.
+ */
+void FrameCapture::stop()
+{
+	epicsAtomicSetIntT(&this->stopRequested, 1);
+	this->wake();
+}
+
+/**
+ * A buffer has been allocated and may now be waited for.
+ * \param[in] bufferNumber The buffer
+ */
+void FrameCapture::bufferAllocated(int bufferNumber)
+{
+	epicsAtomicSetIntT(&this->buffers[bufferNumber].allocated, 1);
+}
+
+/**
+ * A buffer has been given to the DLL, wait for it again.
+ * \param[in] bufferNumber The buffer
+ */
+void FrameCapture::bufferAdded(int bufferNumber)
+{
+	epicsAtomicIncrIntT(&this->buffers[bufferNumber].timesAdded);
+	this->wake();
+}
+
+/**
+ * The DLL has given up all the buffers.
+ */
+void FrameCapture::cancelBuffers()
+{
+	for(int i=0; i<DllApi::maxNumBuffers; i++)
+	{
+		this->resetBuffer(i);
+		epicsAtomicSetIntT(&this->buffers[i].timesTaken,
+			epicsAtomicGetIntT(&this->buffers[i].timesAdded));
+	}
+	this->wake();
+}
+
+/**
+ * Set the default event of a buffer, the buffer has been filled.
+ * \param[in] bufferNumber The buffer
+ */
+void FrameCapture::signalBuffer(int bufferNumber)
+{
+	epicsAtomicSetIntT(&this->buffers[bufferNumber].signalled, 1);
+	this->wakeEvent.signal();
+}
+
+/**
+ * Clear the event of a buffer before it is given to the DLL.
+ * \param[in] bufferNumber The buffer
+ */
+void FrameCapture::resetBuffer(int bufferNumber)
+{
+	epicsAtomicSetIntT(&this->buffers[bufferNumber].signalled, 0);
+}
+
+/**
+ * Wake the capture loop so it checks for stop and rebuilds its wait list.
+ */
+void FrameCapture::wake()
+{
+	this->wakeEvent.signal();
+}
+
+/**
+ * Wait for one of a set of buffers using the default events.
+ * \param[in] bufferNumbers The buffers to wait for
+ * \param[in] numBuffers The number of buffers
+ * \param[in] timeout The time to wait in seconds
+ * \return The index into bufferNumbers of a filled buffer, waitWoken or waitTimeout
+ */
+int FrameCapture::waitForBuffers(const int* bufferNumbers, int numBuffers, double timeout)
+{
+	for(int i=0; i<numBuffers; i++)
+	{
+		if(epicsAtomicGetIntT(&this->buffers[bufferNumbers[i]].signalled))
+		{
+			return i;
+		}
+	}
+	if(!this->wakeEvent.wait(timeout))
+	{
+		return FrameCapture::waitTimeout;
+	}
+	for(int i=0; i<numBuffers; i++)
+	{
+		if(epicsAtomicGetIntT(&this->buffers[bufferNumbers[i]].signalled))
+		{
+			return i;
+		}
+	}
+	return FrameCapture::waitWoken;
+}
+
+/**
+ * The thread that handles buffer events
+ */
+void FrameCapture::run()
+{
+	ThreadPlacement::apply(this->pco->portName, ThreadPlacement::roleCapture,
+		this->placementGeneration);
+	while(!epicsAtomicGetIntT(&this->exitRequested))
+	{
+		// Wait for the start event
+		this->startEvent.wait();
+		if(epicsAtomicGetIntT(&this->exitRequested))
+		{
+			break;
+		}
+		*trace << "#### Entering run event loop" << std::endl;
+		ThreadPlacement::apply(this->pco->portName, ThreadPlacement::roleCapture,
+			this->placementGeneration);
+		bool running = true;
+		bool idle = false;
+		epicsUInt64 lastFrameTime = epicsMonotonicGet();
+		while(running)
+		{
+			if(this->useGetImage)
+			{
+				// Check for stopped, otherwise try to get a frame.  Waiting
+				// for no buffers just waits for a wake up.
+				this->waitForBuffers(NULL, 0, FrameCapture::getImagePeriod);
+				if(epicsAtomicGetIntT(&this->stopRequested))
+				{
+					running = false;
+				}
+				else
+				{
+					this->pco->getFrames();
+				}
+			}
+			else if(this->pco->busyPollActive() && !idle)
+			{
+				running = this->busyPoll(idle, lastFrameTime);
+			}
+			else
+			{
+				// Wait for an image or the stop request.  A wake up rebuilds
+				// the list when a buffer is given back.
+				int runBuffers[DllApi::maxNumBuffers];
+				int runAdded[DllApi::maxNumBuffers];
+				int numRunBuffers = this->runList(runBuffers, runAdded);
+				int result = this->waitForBuffers(runBuffers, numRunBuffers,
+					FrameCapture::bufferWaitTimeout);
+				running = this->handleWait(result, runBuffers, runAdded, numRunBuffers);
+				if(result >= 0)
+				{
+					// Frames are flowing again, go back to busy polling
+					idle = false;
+					lastFrameTime = epicsMonotonicGet();
+				}
+			}
+		}
+		*trace << "#### Exiting run event loop" << std::endl;
+	}
+}
+
+/**
+ * Make the list of buffers to wait for.  Only buffers that are with the
+ * DLL are waited for, the ones handed to the Pco ingest thread still
+ * have their event set.
+ * \param[out] runBuffers The buffers to wait for
+ * \param[out] runAdded Their add counts
+ * \return The number of buffers in the list
+ */
+int FrameCapture::runList(int* runBuffers, int* runAdded)
+{
+	int numRunBuffers = 0;
+	for(int i=0; i<DllApi::maxNumBuffers; i++)
+	{
+		int timesAdded = epicsAtomicGetIntT(&this->buffers[i].timesAdded);
+		if(epicsAtomicGetIntT(&this->buffers[i].allocated) &&
+			timesAdded != epicsAtomicGetIntT(&this->buffers[i].timesTaken))
+		{
+			runBuffers[numRunBuffers] = i;
+			runAdded[numRunBuffers++] = timesAdded;
+		}
+	}
+	return numRunBuffers;
+}
+
+/**
+ * Act on the result of a blocking wait.
+ * \param[in] result The result of waitForBuffers
+ * \param[in] runBuffers The buffers waited for
+ * \param[in] runAdded Their add counts when the wait began
+ * \param[in] numRunBuffers The number of buffers waited for
+ * \return False if capture has been stopped
+ */
+bool FrameCapture::handleWait(int result, const int* runBuffers, const int* runAdded,
+	int numRunBuffers)
+{
+	bool running = true;
+	if(result == FrameCapture::waitTimeout)
+	{
+		// Do a poll
+		this->pco->pollForFrames();
+	}
+	else if(epicsAtomicGetIntT(&this->stopRequested))
+	{
+		running = false;
+	}
+	else if(result == FrameCapture::waitWoken)
+	{
+		// A buffer has been given back, rebuild the wait list
+	}
+	else if(result >= 0 && result < numRunBuffers)
+	{
+		// Handle a buffer ready, it stays ours until added again
+		int bufferNumber = runBuffers[result];
+		epicsAtomicSetIntT(&this->buffers[bufferNumber].timesTaken, runAdded[result]);
+		this->pco->frameReceived(bufferNumber);
+	}
+	else
+	{
+		// Faulty exit reason
+		*trace << "#### Unhandled wait result " << result << std::endl;
+		this->pco->frameWaitFault();
+	}
+	return running;
+}
+
+/**
+ * One pass of the busy poll.  Checks the buffer events without waiting
+ * and without taking the API lock.  If no frame arrives for a while
+ * the loop goes idle and falls back to blocking waits until the next
+ * buffer event.
+ * \param[in,out] idle Set when the loop should block
+ * \param[in,out] lastFrameTime When the last frame was seen
+ * \return False if capture has been stopped
+ */
+bool FrameCapture::busyPoll(bool& idle, epicsUInt64& lastFrameTime)
+{
+	bool running = true;
+	int runBuffers[DllApi::maxNumBuffers];
+	int runAdded[DllApi::maxNumBuffers];
+	int numRunBuffers = this->runList(runBuffers, runAdded);
+	int result = this->waitForBuffers(runBuffers, numRunBuffers, 0.0);
+	epicsUInt64 now = epicsMonotonicGet();
+	if(epicsAtomicGetIntT(&this->stopRequested))
+	{
+		running = false;
+	}
+	else if(result >= 0)
+	{
+		running = this->handleWait(result, runBuffers, runAdded, numRunBuffers);
+		lastFrameTime = now;
+	}
+	else if((double)(now - lastFrameTime) * 1.0e-9 > FrameCapture::busyPollIdleTime)
+	{
+		idle = true;
+	}
+	else if(this->pco->busyPollPause())
+	{
+		FrameCapture::cpuPause();
+	}
+	return running;
+}
+
+/**
+ * Tell the processor we are spinning, where it supports it.
+ */
+void FrameCapture::cpuPause()
+{
+#ifdef SIMD_SSE2
+	_mm_pause();
+#endif
+}
@@ -0,0 +1,89 @@
+/* FrameCapture.h
+ *
+ * Revamped PCO area detector driver.
+ *
+ * The frame capture loop.  Waits for the buffers that are with the
+ * DLL to be filled and hands them to the driver, polling when no
+ * buffer event arrives in time.  The loop itself only uses EPICS
+ * primitives, the default buffer events are too so the simulation
+ * runs the same loop, timeouts and poll fallback as the hardware.
+ * An API whose library provides its own buffer events overrides
+ * the wait, wake and reset functions.  For the lowest latency the
+ * loop can instead spin on the buffer events, without blocking, while
+ * the camera is acquiring.
+ *
+ */
+#ifndef FRAMECAPTURE_H_
+#define FRAMECAPTURE_H_
+
+#include "epicsThread.h"
+#include "epicsEvent.h"
+#include "epicsTypes.h"
+#include "DllApi.h"
+class Pco;
+class TraceStream;
+
+class FrameCapture: public epicsThreadRunable
+{
+// Construction
+public:
+	FrameCapture(Pco* pco, TraceStream* trace, const char* threadName);
+	virtual ~FrameCapture();
+	void startThread();
+	void stopThread();
+
+// API for the DllApi implementations
+public:
+	void start(bool useGetImage);
+	void stop();
+	void bufferAllocated(int bufferNumber);
+	void bufferAdded(int bufferNumber);
+	void cancelBuffers();
+	virtual void signalBuffer(int bufferNumber);
+	virtual void resetBuffer(int bufferNumber);
+
+// Overrides of epicsThreadRunable
+public:
+	virtual void run();
+
+// Busy polling
+public:
+	static void cpuPause();
+protected:
+	bool busyPoll(bool& idle, epicsUInt64& lastFrameTime);
+	int runList(int* runBuffers, int* runAdded);
+	bool handleWait(int result, const int* runBuffers, const int* runAdded, int numRunBuffers);
+
+// Buffer event primitives
+protected:
+	virtual int waitForBuffers(const int* bufferNumbers, int numBuffers, double timeout);
+	virtual void wake();
+
+// Constants
+public:
+	enum {waitWoken=-1, waitTimeout=-2, waitFault=-3};
+	static const double bufferWaitTimeout;
+	static const double getImagePeriod;
+	static const double busyPollIdleTime;
+
+// Members
+protected:
+	Pco* pco;
+	TraceStream* trace;
+	epicsThread thread;
+	epicsEvent startEvent;
+	epicsEvent wakeEvent;
+	int stopRequested;
+	int exitRequested;
+	bool useGetImage;
+	int placementGeneration;
+	struct
+	{
+		int allocated;
+		int timesAdded;      // The buffer is with the DLL while these two differ
+		int timesTaken;
+		int signalled;       // The default buffer event
+	} buffers[DllApi::maxNumBuffers];
+};
+
+#endif /* FRAMECAPTURE_H_ */
@@ -0,0 +1,367 @@
+/* FrameCopier.cpp
+ *
+ * The engine used for all bulk frame copies.
+ *
+ */
+
+#include "FrameCopier.h"
+#include "ThreadPlacement.h"
+#include "Simd.h"
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include "epicsAtomic.h"
+#include "epicsTime.h"
+#include "epicsExport.h"
+#include "iocsh.h"
+#include "epicsStdio.h"
+
+/** The shared engine and its configuration */
+FrameCopier* FrameCopier::theCopier = NULL;
+int FrameCopier::configNumThreads = 2;
+size_t FrameCopier::configThreshold = 1024*1024;
+const size_t FrameCopier::chunkAlignment = 64;
+
+/**
+ * Return the shared engine, creating it on first use.  The first
+ * call is made while the IOC is being configured, by the Pco constructor.
+ */
+FrameCopier& FrameCopier::instance()
+{
+	if(theCopier == NULL)
+	{
+		theCopier = new FrameCopier(configNumThreads, configThreshold);
+	}
+	return *theCopier;
+}
+
+/**
+ * Set the configuration of the shared engine.  Must be called before
+ * the engine is first used.
+ * \param[in] numThreads The number of pool threads helping the calling thread
+ * \param[in] threshold Copies smaller than this use a plain memcpy
+ * \return False if the engine already exists
+ */
+bool FrameCopier::configure(int numThreads, size_t threshold)
+{
+	bool result = theCopier == NULL;
+	if(result)
+	{
+		configNumThreads = numThreads < 0 ? 0 : numThreads;
+		configThreshold = threshold;
+	}
+	return result;
+}
+
+/**
+ * Pool thread constructor
+ */
+FrameCopier::CopyThread::CopyThread(FrameCopier* owner, int index, const char* threadName)
+: thread(*this, threadName,
+        epicsThreadGetStackSize(epicsThreadStackSmall),
+        epicsThreadPriorityHigh)
+, owner(owner)
+, index(index)
+{
+	this->thread.start();
+}
+
+/**
+ * Constructor
+ * \param[in] numThreads The number of pool threads
+ * \param[in] threshold Copies smaller than this use a plain memcpy
+ */
+FrameCopier::FrameCopier(int numThreads, size_t threshold)
+: jobs(numThreads)
+, partials(numThreads)
+, done(epicsEventEmpty)
+, remaining(0)
+, threshold(threshold)
+{
+	char threadName[32];
+	for(int i=0; i<numThreads; i++)
+	{
+		this->jobs[i].work = NULL;
+		this->jobs[i].context = NULL;
+		this->jobs[i].first = 0;
+		this->jobs[i].count = 0;
+		this->jobs[i].start = new epicsEvent(epicsEventEmpty);
+		this->jobs[i].placementGeneration = ThreadPlacement::unapplied;
+	}
+	for(int i=0; i<numThreads; i++)
+	{
+		epicsSnprintf(threadName, sizeof(threadName), "FrameCopy%d", i);
+		this->threads.push_back(new CopyThread(this, i, threadName));
+	}
+}
+
+/**
+ * Destructor.  The engine lives for the life of the IOC.
+ */
+FrameCopier::~FrameCopier()
+{
+}
+
+/**
+ * A pool thread.  Waits for its share of a pass, does it and
+ * signals the caller when it is the last to finish.
+ * \param[in] index The thread's job index
+ */
+void FrameCopier::run(int index)
+{
+	Job& job = this->jobs[index];
+	while(true)
+	{
+		// The pool is shared by all the ports
+		ThreadPlacement::apply("", ThreadPlacement::roleCopy, job.placementGeneration);
+		job.start->wait();
+		job.work(job.context, job.first, job.count, index);
+		if(epicsAtomicDecrIntT(&this->remaining) == 0)
+		{
+			this->done.signal();
+		}
+	}
+}
+
+/**
+ * Copy a frame.
+ * \param[in] dest The destination
+ * \param[in] src The source
+ * \param[in] size The number of bytes
+ * \param[in,out] stats If not NULL, the frame's statistics are added to these
+ */
+void FrameCopier::copy(void* dest, const void* src, size_t size, FrameStats* stats)
+{
+	CopyPass pass;
+	pass.dest = (char*)dest;
+	pass.src = (const char*)src;
+	pass.stats = stats;
+	pass.partials = NULL;
+	pass.numPartials = 0;
+	if(stats != NULL && !this->partials.empty())
+	{
+		// Each share prepares its own, once the pool is ours
+		pass.partials = &this->partials.front();
+		pass.numPartials = (int)this->partials.size();
+	}
+	if(size < this->threshold)
+	{
+		if(stats != NULL)
+		{
+			FrameStats::copy(dest, src, size, *stats);
+		}
+		else
+		{
+			::memcpy(dest, src, size);
+		}
+	}
+	else if(!this->split(FrameCopier::copyShare, &pass, size, chunkAlignment,
+		FrameCopier::copyFinish))
+	{
+		// No pool or it is busy with another port's frame
+		FrameCopier::copyShare(&pass, 0, size, this->numShares() - 1);
+	}
+}
+
+/**
+ * Copy one share of a frame.  The calling thread's share, the last,
+ * gathers into the caller's statistics, the others into their own.
+ * \param[in] context The CopyPass
+ * \param[in] first The first byte
+ * \param[in] count The number of bytes
+ * \param[in] share The share
+ */
+void FrameCopier::copyShare(void* context, size_t first, size_t count, int share)
+{
+	CopyPass* pass = (CopyPass*)context;
+	FrameStats* stats = pass->stats;
+	if(stats != NULL && share < pass->numPartials)
+	{
+		stats = &pass->partials[share];
+		stats->settings = pass->stats->settings;
+		stats->reset();
+	}
+	if(stats != NULL)
+	{
+		FrameStats::copy(pass->dest + first, pass->src + first, count, *stats);
+	}
+	else
+	{
+		FrameCopier::streamCopy(pass->dest + first, pass->src + first, count);
+	}
+}
+
+/**
+ * Merge the statistics of the other shares into the caller's.  The
+ * partials are shared by all the ports, so this is done before the
+ * pool is released.
+ * \param[in] context The CopyPass
+ */
+void FrameCopier::copyFinish(void* context)
+{
+	CopyPass* pass = (CopyPass*)context;
+	if(pass->stats != NULL)
+	{
+		for(int i=0; i<pass->numPartials; i++)
+		{
+			pass->stats->merge(pass->partials[i]);
+		}
+	}
+}
+
+/**
+ * Split a pass over count elements across the pool.  The calling thread
+ * does the last share and returns once every share is done.  Shares are
+ * whole granules except the last.
+ * \param[in] work Does one share
+ * \param[in] context Passed to work
+ * \param[in] count The number of elements
+ * \param[in] granule Shares are a multiple of this many elements
+ * \param[in] finish If not NULL, called once every share is done
+ * \return False, having done nothing, if there is no pool or it is busy
+ */
+bool FrameCopier::split(Work work, void* context, size_t count, size_t granule, Finish finish)
+{
+	if(this->jobs.empty() || !this->busy.tryLock())
+	{
+		return false;
+	}
+	int numParts = this->numShares();
+	size_t chunk = (count / numParts + granule - 1) / granule * granule;
+	size_t first = 0;
+	epicsAtomicSetIntT(&this->remaining, (int)this->jobs.size());
+	for(size_t i=0; i<this->jobs.size(); i++)
+	{
+		size_t n = chunk < count - first ? chunk : count - first;
+		this->jobs[i].work = work;
+		this->jobs[i].context = context;
+		this->jobs[i].first = first;
+		this->jobs[i].count = n;
+		first += n;
+	}
+	for(size_t i=0; i<this->jobs.size(); i++)
+	{
+		this->jobs[i].start->signal();
+	}
+	work(context, first, count - first, numParts - 1);
+	this->done.wait();
+	if(finish != NULL)
+	{
+		finish(context);
+	}
+	this->busy.unlock();
+	return true;
+}
+
+/**
+ * Copy using non-temporal stores where the processor supports them.
+ * The destination is brought up to 16 byte alignment with an ordinary
+ * copy, as is the tail that does not fill a whole cache line.
+ * \param[in] dest The destination
+ * \param[in] src The source
+ * \param[in] size The number of bytes
+ */
+void FrameCopier::streamCopy(void* dest, const void* src, size_t size)
+{
+#ifdef SIMD_SSE2
+	char* d = (char*)dest;
+	const char* s = (const char*)src;
+	size_t head = (16 - ((size_t)d & 15)) & 15;
+	if(head > size)
+	{
+		head = size;
+	}
+	::memcpy(d, s, head);
+	d += head;
+	s += head;
+	size -= head;
+	for(size_t n=size/chunkAlignment; n>0; n--)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i*)s);
+		__m128i b = _mm_loadu_si128((const __m128i*)(s+16));
+		__m128i c = _mm_loadu_si128((const __m128i*)(s+32));
+		__m128i e = _mm_loadu_si128((const __m128i*)(s+48));
+		_mm_stream_si128((__m128i*)d, a);
+		_mm_stream_si128((__m128i*)(d+16), b);
+		_mm_stream_si128((__m128i*)(d+32), c);
+		_mm_stream_si128((__m128i*)(d+48), e);
+		d += chunkAlignment;
+		s += chunkAlignment;
+	}
+	_mm_sfence();
+	::memcpy(d, s, size % chunkAlignment);
+#else
+	::memcpy(dest, src, size);
+#endif
+}
+
+/**
+ * Compare the throughput of the engine against a plain memcpy.
+ * \param[in] size The frame size in bytes
+ * \param[in] repeats The number of copies to time
+ */
+void FrameCopier::benchmark(size_t size, int repeats)
+{
+	char* src = (char*)malloc(size);
+	char* dest = (char*)malloc(size);
+	if(src == NULL || dest == NULL || repeats <= 0)
+	{
+		printf("pcoBenchmark copy: cannot allocate %lu bytes\n", (unsigned long)size);
+		free(src);
+		free(dest);
+		return;
+	}
+	::memset(src, 0x5a, size);
+	::memset(dest, 0, size);
+	epicsTimeStamp start;
+	epicsTimeStamp end;
+	epicsTimeGetCurrent(&start);
+	for(int i=0; i<repeats; i++)
+	{
+		::memcpy(dest, src, size);
+	}
+	epicsTimeGetCurrent(&end);
+	double memcpyTime = epicsTimeDiffInSeconds(&end, &start);
+	epicsTimeGetCurrent(&start);
+	for(int i=0; i<repeats; i++)
+	{
+		this->copy(dest, src, size);
+	}
+	epicsTimeGetCurrent(&end);
+	double engineTime = epicsTimeDiffInSeconds(&end, &start);
+	double gigabytes = (double)size * repeats / 1e9;
+	printf("pcoBenchmark copy: %lu bytes x %d, %d threads, threshold %lu bytes\n",
+		(unsigned long)size, repeats, (int)this->jobs.size(), (unsigned long)this->threshold);
+	printf("    memcpy: %.2f GB/s\n", memcpyTime > 0.0 ? gigabytes / memcpyTime : 0.0);
+	printf("    engine: %.2f GB/s\n", engineTime > 0.0 ? gigabytes / engineTime : 0.0);
+	free(src);
+	free(dest);
+}
+
+// IOC shell configuration command
+extern "C" int frameCopierConfig(int numThreads, int thresholdKb)
+{
+	if(!FrameCopier::configure(numThreads, (size_t)thresholdKb * 1024))
+	{
+		printf("frameCopierConfig: must be called before pcoConfig\n");
+	}
+	return 0;
+}
+static const iocshArg frameCopierConfigArg0 = {"numThreads", iocshArgInt};
+static const iocshArg frameCopierConfigArg1 = {"thresholdKb", iocshArgInt};
+static const iocshArg* const frameCopierConfigArgs[] =
+	{&frameCopierConfigArg0, &frameCopierConfigArg1};
+static const iocshFuncDef configFrameCopier =
+	{"frameCopierConfig", 2, frameCopierConfigArgs};
+static void configFrameCopierCallFunc(const iocshArgBuf *args)
+{
+	frameCopierConfig(args[0].ival, args[1].ival);
+}
+
+/** Register the functions */
+static void frameCopierRegister(void)
+{
+	iocshRegister(&configFrameCopier, configFrameCopierCallFunc);
+}
+
+extern "C" { epicsExportRegistrar(frameCopierRegister); }
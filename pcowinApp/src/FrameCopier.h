@@ -0,0 +1,94 @@
+/* FrameCopier.h
+ *
+ * The engine used for all bulk frame copies.  Large frames are
+ * split across a small pool of persistent threads and written with
+ * streaming (non-temporal) stores so the copy does not evict
+ * the data the consumers are working on from the cache.  Small
+ * frames are copied with a plain memcpy.  Frame statistics can be
+ * gathered during the copy, each thread gathering those of its share.
+ * Other bulk frame work, like summing exposures, is split across the
+ * same pool.  One engine is shared by all the PCO ports in the IOC.
+ *
+ */
+#ifndef FRAMECOPIER_H_
+#define FRAMECOPIER_H_
+
+#include <vector>
+#include <cstddef>
+#include "epicsThread.h"
+#include "epicsEvent.h"
+#include "epicsMutex.h"
+#include "FrameStats.h"
+
+class FrameCopier
+{
+public:
+	/** Work on count elements from first, share numbers the part from 0 */
+	typedef void (*Work)(void* context, size_t first, size_t count, int share);
+	/** Called once every share is done, before the pool is free again */
+	typedef void (*Finish)(void* context);
+public:
+	static FrameCopier& instance();
+	static bool configure(int numThreads, size_t threshold);
+	void copy(void* dest, const void* src, size_t size, FrameStats* stats=NULL);
+	bool split(Work work, void* context, size_t count, size_t granule, Finish finish=NULL);
+	int numShares() const {return (int)this->jobs.size() + 1;}
+	size_t splitThreshold() const {return this->threshold;}
+	static void streamCopy(void* dest, const void* src, size_t size);
+	void benchmark(size_t size, int repeats);
+	// Function called by nested class
+	void run(int index);
+private:
+	/** A thread in the copy pool */
+	class CopyThread: public epicsThreadRunable
+	{
+	private:
+		epicsThread thread;
+		FrameCopier* owner;
+		int index;
+	public:
+		CopyThread(FrameCopier* owner, int index, const char* threadName);
+		virtual ~CopyThread() {}
+		virtual void run() {this->owner->run(this->index);}
+	};
+	/** One thread's share of a pass */
+	struct Job
+	{
+		Work work;
+		void* context;
+		size_t first;
+		size_t count;
+		epicsEvent* start;
+		int placementGeneration;
+	};
+	/** A copy being split */
+	struct CopyPass
+	{
+		char* dest;
+		const char* src;
+		FrameStats* stats;       // The caller's share, or NULL
+		FrameStats* partials;    // The other shares, only while the pool is ours
+		int numPartials;
+	};
+private:
+	FrameCopier(int numThreads, size_t threshold);
+	FrameCopier(const FrameCopier& other);
+	FrameCopier& operator=(const FrameCopier& other);
+	virtual ~FrameCopier();
+	static void copyShare(void* context, size_t first, size_t count, int share);
+	static void copyFinish(void* context);
+private:
+	static FrameCopier* theCopier;
+	static int configNumThreads;
+	static size_t configThreshold;
+	static const size_t chunkAlignment;
+	std::vector<CopyThread*> threads;
+	std::vector<Job> jobs;
+	std::vector<FrameStats> partials;   // Statistics of each job's share
+	epicsEvent done;
+	epicsMutex busy;         // Only one split pass at a time
+	int remaining;
+	size_t threshold;
+};
+
+#endif /* FRAMECOPIER_H_ */
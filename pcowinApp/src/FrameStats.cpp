@@ -0,0 +1,513 @@
+/* FrameStats.cpp
+ *
+ * Statistics of a 16 bit frame gathered while it is copied.
+ *
+ */
+
+#include "FrameStats.h"
+#include "FrameCopier.h"
+#include "Simd.h"
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include "epicsTime.h"
+
+namespace
+{
+	/** Bytes and pixels in a cache line, the unit of the histogram sample */
+	const size_t lineBytes = 64;
+	const size_t linePixels = lineBytes / sizeof(epicsUInt16);
+	/** Cache lines between folds of the narrow accumulators into the totals,
+	 * the 16 bit saturation counters would overflow after 65535 vectors */
+	const size_t foldLines = 4096;
+	/** The pixels are biased into the signed range for the SSE2 compares */
+	const int pixelBias = 0x8000;
+}
+
+/**
+ * Constructor, gathers everything into a 16 bit histogram
+ */
+FrameStats::FrameStats()
+{
+	this->configure(pixelBits, 1 << pixelBits, defaultSample);
+	this->reset();
+}
+
+/**
+ * Set how the statistics are gathered.
+ * \param[in] bitDepth The significant bits of the pixels, the histogram spans these
+ * \param[in] saturationLevel Pixels at or above this are counted as saturated
+ * \param[in] sample Histogram one cache line in this many, 1 for every pixel
+ */
+void FrameStats::configure(int bitDepth, int saturationLevel, int sample)
+{
+	if(bitDepth < binBits || bitDepth > pixelBits)
+	{
+		bitDepth = pixelBits;
+	}
+	this->settings.binShift = bitDepth - binBits;
+	this->settings.saturationLevel = saturationLevel < 1 ? 1 : saturationLevel;
+	this->settings.sample = sample < 1 ? 1 : sample;
+}
+
+/**
+ * Forget the statistics, keeping the settings.
+ */
+void FrameStats::reset()
+{
+	this->count = 0;
+	this->min = 0xffff;
+	this->max = 0;
+	this->sum = 0;
+	this->sumSquares = 0;
+	this->saturated = 0;
+	this->sampled = 0;
+	for(int i=0; i<numBins; i++)
+	{
+		this->histogram[i] = 0;
+	}
+}
+
+/**
+ * Add the statistics of another part of the frame, or of another exposure.
+ * \param[in] other The statistics to add
+ */
+void FrameStats::merge(const FrameStats& other)
+{
+	this->count += other.count;
+	this->min = other.min < this->min ? other.min : this->min;
+	this->max = other.max > this->max ? other.max : this->max;
+	this->sum += other.sum;
+	this->sumSquares += other.sumSquares;
+	this->saturated += other.saturated;
+	this->sampled += other.sampled;
+	for(int i=0; i<numBins; i++)
+	{
+		this->histogram[i] += other.histogram[i];
+	}
+}
+
+/**
+ * Return the mean pixel value
+ */
+double FrameStats::mean() const
+{
+	return this->count == 0 ? 0.0 : (double)this->sum / (double)this->count;
+}
+
+/**
+ * Return the standard deviation of the pixel values
+ */
+double FrameStats::sigma() const
+{
+	double result = 0.0;
+	if(this->count > 0)
+	{
+		double m = this->mean();
+		double variance = (double)this->sumSquares / (double)this->count - m * m;
+		result = variance > 0.0 ? ::sqrt(variance) : 0.0;
+	}
+	return result;
+}
+
+/**
+ * Add pixels one at a time, for the ends of the frame and where there is no SSE2.
+ * \param[in] pixels The pixels
+ * \param[in] count How many
+ * \param[in] histogram Add them to the histogram too
+ */
+void FrameStats::addPixels(const epicsUInt16* pixels, size_t count, bool histogram)
+{
+	epicsUInt16 lowest = this->min;
+	epicsUInt16 highest = this->max;
+	for(size_t i=0; i<count; i++)
+	{
+		epicsUInt16 p = pixels[i];
+		lowest = p < lowest ? p : lowest;
+		highest = p > highest ? p : highest;
+		this->sum += p;
+		this->sumSquares += (epicsUInt64)((epicsUInt32)p * p);
+		this->saturated += p >= this->settings.saturationLevel ? 1 : 0;
+		if(histogram)
+		{
+			int bin = p >> this->settings.binShift;
+			this->histogram[bin < numBins ? bin : numBins - 1]++;
+		}
+	}
+	this->min = lowest;
+	this->max = highest;
+	this->count += count;
+	if(histogram)
+	{
+		this->sampled += count;
+	}
+}
+
+namespace
+{
+	/** Add one cache line to the histogram
+	 * \param[in] pixels The line
+	 * \param[in,out] stats Gets the counts
+	 */
+	inline void histogramLine(const epicsUInt16* pixels, FrameStats& stats)
+	{
+		for(size_t i=0; i<linePixels; i++)
+		{
+			int bin = pixels[i] >> stats.settings.binShift;
+			stats.histogram[bin < FrameStats::numBins ? bin : FrameStats::numBins - 1]++;
+		}
+		stats.sampled += linePixels;
+	}
+
+	/** Add the totals of the vector kernels, which work on biased pixels.
+	 * Unsigned arithmetic wraps a negative biased sum back into range.
+	 * \param[in,out] stats Gets the totals
+	 * \param[in] pixels The number of pixels
+	 * \param[in] biasedSum The sum of the biased pixels
+	 * \param[in] biasedSquares The sum of their squares
+	 * \param[in] saturated The saturated pixels
+	 * \param[in] lowest The minimum, unbiased
+	 * \param[in] highest The maximum, unbiased
+	 */
+	void addBiased(FrameStats& stats, size_t pixels, epicsInt64 biasedSum,
+		epicsUInt64 biasedSquares, epicsUInt64 saturated, epicsUInt16 lowest, epicsUInt16 highest)
+	{
+		if(pixels > 0)
+		{
+			stats.count += pixels;
+			stats.min = lowest < stats.min ? lowest : stats.min;
+			stats.max = highest > stats.max ? highest : stats.max;
+			stats.sum += (epicsUInt64)biasedSum + (epicsUInt64)pixels * pixelBias;
+			stats.sumSquares += biasedSquares + (epicsUInt64)biasedSum * 65536 +
+				((epicsUInt64)pixels << 30);
+			stats.saturated += saturated;
+		}
+	}
+
+#ifdef SIMD_SSE2
+	/** Copy whole cache lines with SSE2, the destination must be 64 byte aligned.
+	 * \param[in] d The destination
+	 * \param[in] s The source
+	 * \param[in] lines The number of cache lines
+	 * \param[in,out] stats Gets the statistics
+	 * \param[in,out] untilSample Lines until the next histogram sample
+	 */
+	void copyLinesSse2(char* d, const char* s, size_t lines, FrameStats& stats, size_t& untilSample)
+	{
+		const __m128i bias = _mm_set1_epi16((short)pixelBias);
+		const __m128i ones = _mm_set1_epi16(1);
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i threshold = _mm_set1_epi16(stats.settings.saturationLevel > 0xffff ?
+			(short)0x7fff : (short)((stats.settings.saturationLevel - 1) ^ pixelBias));
+		__m128i lowest = _mm_set1_epi16((short)0x7fff);
+		__m128i highest = _mm_set1_epi16((short)0x8000);
+		epicsInt64 biasedSum = 0;
+		epicsUInt64 biasedSquares = 0;
+		epicsUInt64 saturated = 0;
+		size_t pixels = lines * linePixels;
+		while(lines > 0)
+		{
+			size_t n = lines < foldLines ? lines : foldLines;
+			lines -= n;
+			__m128i sum32 = zero;
+			__m128i squares64 = zero;
+			__m128i saturated16 = zero;
+			for(size_t i=0; i<n; i++)
+			{
+				__m128i v0 = _mm_loadu_si128((const __m128i*)s);
+				__m128i v1 = _mm_loadu_si128((const __m128i*)(s+16));
+				__m128i v2 = _mm_loadu_si128((const __m128i*)(s+32));
+				__m128i v3 = _mm_loadu_si128((const __m128i*)(s+48));
+				_mm_stream_si128((__m128i*)d, v0);
+				_mm_stream_si128((__m128i*)(d+16), v1);
+				_mm_stream_si128((__m128i*)(d+32), v2);
+				_mm_stream_si128((__m128i*)(d+48), v3);
+				v0 = _mm_xor_si128(v0, bias);
+				v1 = _mm_xor_si128(v1, bias);
+				v2 = _mm_xor_si128(v2, bias);
+				v3 = _mm_xor_si128(v3, bias);
+				lowest = _mm_min_epi16(lowest, _mm_min_epi16(_mm_min_epi16(v0, v1), _mm_min_epi16(v2, v3)));
+				__m128i high = _mm_max_epi16(_mm_max_epi16(v0, v1), _mm_max_epi16(v2, v3));
+				highest = _mm_max_epi16(highest, high);
+				if(_mm_movemask_epi8(_mm_cmpgt_epi16(high, threshold)) != 0)
+				{
+					// Only count when the line has saturated pixels
+					saturated16 = _mm_sub_epi16(saturated16, _mm_cmpgt_epi16(v0, threshold));
+					saturated16 = _mm_sub_epi16(saturated16, _mm_cmpgt_epi16(v1, threshold));
+					saturated16 = _mm_sub_epi16(saturated16, _mm_cmpgt_epi16(v2, threshold));
+					saturated16 = _mm_sub_epi16(saturated16, _mm_cmpgt_epi16(v3, threshold));
+				}
+				sum32 = _mm_add_epi32(sum32, _mm_add_epi32(
+					_mm_add_epi32(_mm_madd_epi16(v0, ones), _mm_madd_epi16(v1, ones)),
+					_mm_add_epi32(_mm_madd_epi16(v2, ones), _mm_madd_epi16(v3, ones))));
+				// A pair of squares only fits 32 bits unsigned
+				__m128i sq0 = _mm_madd_epi16(v0, v0);
+				__m128i sq1 = _mm_madd_epi16(v1, v1);
+				__m128i sq2 = _mm_madd_epi16(v2, v2);
+				__m128i sq3 = _mm_madd_epi16(v3, v3);
+				squares64 = _mm_add_epi64(squares64, _mm_add_epi64(
+					_mm_add_epi64(_mm_unpacklo_epi32(sq0, zero), _mm_unpackhi_epi32(sq0, zero)),
+					_mm_add_epi64(_mm_unpacklo_epi32(sq1, zero), _mm_unpackhi_epi32(sq1, zero))));
+				squares64 = _mm_add_epi64(squares64, _mm_add_epi64(
+					_mm_add_epi64(_mm_unpacklo_epi32(sq2, zero), _mm_unpackhi_epi32(sq2, zero)),
+					_mm_add_epi64(_mm_unpacklo_epi32(sq3, zero), _mm_unpackhi_epi32(sq3, zero))));
+				if(--untilSample == 0)
+				{
+					untilSample = stats.settings.sample;
+					histogramLine((const epicsUInt16*)s, stats);
+				}
+				d += lineBytes;
+				s += lineBytes;
+			}
+			// Fold the narrow lanes into the totals
+			epicsInt32 sums[4];
+			epicsUInt64 squares[2];
+			epicsUInt16 counts[8];
+			_mm_storeu_si128((__m128i*)sums, sum32);
+			_mm_storeu_si128((__m128i*)squares, squares64);
+			_mm_storeu_si128((__m128i*)counts, saturated16);
+			biasedSum += (epicsInt64)sums[0] + sums[1] + sums[2] + sums[3];
+			biasedSquares += squares[0] + squares[1];
+			for(int j=0; j<8; j++)
+			{
+				saturated += counts[j];
+			}
+		}
+		epicsInt16 lows[8];
+		epicsInt16 highs[8];
+		_mm_storeu_si128((__m128i*)lows, lowest);
+		_mm_storeu_si128((__m128i*)highs, highest);
+		epicsUInt16 low = 0xffff;
+		epicsUInt16 high = 0;
+		for(int j=0; j<8; j++)
+		{
+			epicsUInt16 l = (epicsUInt16)(lows[j] ^ pixelBias);
+			epicsUInt16 h = (epicsUInt16)(highs[j] ^ pixelBias);
+			low = l < low ? l : low;
+			high = h > high ? h : high;
+		}
+		addBiased(stats, pixels, biasedSum, biasedSquares, saturated, low, high);
+	}
+#endif
+
+#ifdef SIMD_AVX2
+	/** Copy whole cache lines with AVX2, the destination must be 64 byte aligned.
+	 * AVX2 has unsigned compares so only the sums use the biased pixels.
+	 * \param[in] d The destination
+	 * \param[in] s The source
+	 * \param[in] lines The number of cache lines
+	 * \param[in,out] stats Gets the statistics
+	 * \param[in,out] untilSample Lines until the next histogram sample
+	 */
+	SIMD_TARGET_AVX2
+	void copyLinesAvx2(char* d, const char* s, size_t lines, FrameStats& stats, size_t& untilSample)
+	{
+		const __m256i bias = _mm256_set1_epi16((short)pixelBias);
+		const __m256i ones = _mm256_set1_epi16(1);
+		const __m256i zero = _mm256_setzero_si256();
+		bool saturation = stats.settings.saturationLevel <= 0xffff;
+		const __m256i level = _mm256_set1_epi16((short)(saturation ? stats.settings.saturationLevel : 0));
+		__m256i lowest = _mm256_set1_epi16((short)0xffff);
+		__m256i highest = zero;
+		epicsInt64 biasedSum = 0;
+		epicsUInt64 biasedSquares = 0;
+		epicsUInt64 saturated = 0;
+		size_t pixels = lines * linePixels;
+		while(lines > 0)
+		{
+			size_t n = lines < foldLines ? lines : foldLines;
+			lines -= n;
+			__m256i sum32 = zero;
+			__m256i squares64 = zero;
+			__m256i saturated16 = zero;
+			for(size_t i=0; i<n; i++)
+			{
+				__m256i v0 = _mm256_loadu_si256((const __m256i*)s);
+				__m256i v1 = _mm256_loadu_si256((const __m256i*)(s+32));
+				_mm256_stream_si256((__m256i*)d, v0);
+				_mm256_stream_si256((__m256i*)(d+32), v1);
+				lowest = _mm256_min_epu16(lowest, _mm256_min_epu16(v0, v1));
+				__m256i high = _mm256_max_epu16(v0, v1);
+				highest = _mm256_max_epu16(highest, high);
+				if(saturation && _mm256_movemask_epi8(
+					_mm256_cmpeq_epi16(_mm256_max_epu16(high, level), high)) != 0)
+				{
+					// Only count when the line has saturated pixels
+					saturated16 = _mm256_sub_epi16(saturated16,
+						_mm256_cmpeq_epi16(_mm256_max_epu16(v0, level), v0));
+					saturated16 = _mm256_sub_epi16(saturated16,
+						_mm256_cmpeq_epi16(_mm256_max_epu16(v1, level), v1));
+				}
+				v0 = _mm256_xor_si256(v0, bias);
+				v1 = _mm256_xor_si256(v1, bias);
+				sum32 = _mm256_add_epi32(sum32,
+					_mm256_add_epi32(_mm256_madd_epi16(v0, ones), _mm256_madd_epi16(v1, ones)));
+				__m256i sq0 = _mm256_madd_epi16(v0, v0);
+				__m256i sq1 = _mm256_madd_epi16(v1, v1);
+				squares64 = _mm256_add_epi64(squares64, _mm256_add_epi64(
+					_mm256_add_epi64(_mm256_unpacklo_epi32(sq0, zero), _mm256_unpackhi_epi32(sq0, zero)),
+					_mm256_add_epi64(_mm256_unpacklo_epi32(sq1, zero), _mm256_unpackhi_epi32(sq1, zero))));
+				if(--untilSample == 0)
+				{
+					untilSample = stats.settings.sample;
+					histogramLine((const epicsUInt16*)s, stats);
+				}
+				d += lineBytes;
+				s += lineBytes;
+			}
+			epicsInt32 sums[8];
+			epicsUInt64 squares[4];
+			epicsUInt16 counts[16];
+			_mm256_storeu_si256((__m256i*)sums, sum32);
+			_mm256_storeu_si256((__m256i*)squares, squares64);
+			_mm256_storeu_si256((__m256i*)counts, saturated16);
+			for(int j=0; j<8; j++)
+			{
+				biasedSum += sums[j];
+			}
+			biasedSquares += squares[0] + squares[1] + squares[2] + squares[3];
+			for(int j=0; j<16; j++)
+			{
+				saturated += counts[j];
+			}
+		}
+		epicsUInt16 lows[16];
+		epicsUInt16 highs[16];
+		_mm256_storeu_si256((__m256i*)lows, lowest);
+		_mm256_storeu_si256((__m256i*)highs, highest);
+		epicsUInt16 low = 0xffff;
+		epicsUInt16 high = 0;
+		for(int j=0; j<16; j++)
+		{
+			low = lows[j] < low ? lows[j] : low;
+			high = highs[j] > high ? highs[j] : high;
+		}
+		addBiased(stats, pixels, biasedSum, biasedSquares, saturated, low, high);
+	}
+#endif
+}
+
+/**
+ * Copy a frame, or part of one, adding its statistics to those already
+ * gathered.  The destination is brought up to cache line alignment with
+ * an ordinary copy, whole lines go through the vector kernel for the
+ * processor and the tail is done a pixel at a time.  The vector kernels
+ * bias each pixel into the signed range, sum the pixels in pairs into
+ * 32 bit lanes and square them in pairs into lanes widened to 64 bits.
+ * The unbiased sums follow from
+ *     sum(p) = sum(b) + 32768 n
+ *     sum(p^2) = sum(b^2) + 65536 sum(b) + 2^30 n
+ * The narrow lanes are folded into the totals every few thousand cache
+ * lines.  A trailing odd byte is copied but not counted.
+ * \param[in] dest The destination
+ * \param[in] src The source pixels
+ * \param[in] size The number of bytes
+ * \param[in,out] stats Gets the statistics
+ */
+void FrameStats::copy(void* dest, const void* src, size_t size, FrameStats& stats)
+{
+	char* d = (char*)dest;
+	const char* s = (const char*)src;
+	size_t untilSample = 1;
+#ifdef SIMD_SSE2
+	if(((size_t)d & 1) == 0)
+	{
+		size_t head = (lineBytes - ((size_t)d & (lineBytes - 1))) & (lineBytes - 1);
+		if(head > (size & ~(size_t)1))
+		{
+			head = size & ~(size_t)1;
+		}
+		::memcpy(d, s, head);
+		stats.addPixels((const epicsUInt16*)s, head / sizeof(epicsUInt16), true);
+		d += head;
+		s += head;
+		size -= head;
+		size_t lines = size / lineBytes;
+#ifdef SIMD_AVX2
+		if(Simd::avx2())
+		{
+			copyLinesAvx2(d, s, lines, stats, untilSample);
+		}
+		else
+#endif
+		{
+			copyLinesSse2(d, s, lines, stats, untilSample);
+		}
+		_mm_sfence();
+		d += lines * lineBytes;
+		s += lines * lineBytes;
+		size -= lines * lineBytes;
+	}
+#endif
+	// The tail, or everything if there is no SSE2
+	::memcpy(d, s, size);
+	const epicsUInt16* p = (const epicsUInt16*)s;
+	size_t left = size / sizeof(epicsUInt16);
+	while(left > 0)
+	{
+		size_t n = left < linePixels ? left : linePixels;
+		bool histogram = --untilSample == 0;
+		if(histogram)
+		{
+			untilSample = stats.settings.sample;
+		}
+		stats.addPixels(p, n, histogram);
+		p += n;
+		left -= n;
+	}
+}
+
+/**
+ * Compare the throughput of a plain streaming copy with that of the
+ * copy that gathers statistics, on one thread.
+ * \param[in] size The frame size in bytes
+ * \param[in] repeats The number of copies to time
+ * \param[in] sample Histogram one cache line in this many
+ */
+void FrameStats::benchmark(size_t size, int repeats, int sample)
+{
+	epicsUInt16* src = (epicsUInt16*)malloc(size);
+	char* dest = (char*)malloc(size);
+	if(src == NULL || dest == NULL || repeats <= 0)
+	{
+		printf("pcoBenchmark stats: cannot allocate %lu bytes\n", (unsigned long)size);
+		free(src);
+		free(dest);
+		return;
+	}
+	for(size_t i=0; i<size/sizeof(epicsUInt16); i++)
+	{
+		src[i] = (epicsUInt16)((i * 2654435761u) >> 16);
+	}
+	::memset(dest, 0, size);
+	FrameStats stats;
+	stats.configure(pixelBits, 0xffff, sample);
+	epicsTimeStamp start;
+	epicsTimeStamp end;
+	epicsTimeGetCurrent(&start);
+	for(int i=0; i<repeats; i++)
+	{
+		FrameCopier::streamCopy(dest, src, size);
+	}
+	epicsTimeGetCurrent(&end);
+	double copyTime = epicsTimeDiffInSeconds(&end, &start);
+	epicsTimeGetCurrent(&start);
+	for(int i=0; i<repeats; i++)
+	{
+		stats.reset();
+		FrameStats::copy(dest, src, size, stats);
+	}
+	epicsTimeGetCurrent(&end);
+	double statsTime = epicsTimeDiffInSeconds(&end, &start);
+	double gigabytes = (double)size * repeats / 1e9;
+	printf("pcoBenchmark stats: %lu bytes x %d, histogram 1 line in %d\n",
+		(unsigned long)size, repeats, stats.settings.sample);
+	printf("    copy:       %.2f GB/s\n", copyTime > 0.0 ? gigabytes / copyTime : 0.0);
+	printf("    copy+stats: %.2f GB/s\n", statsTime > 0.0 ? gigabytes / statsTime : 0.0);
+	printf("    overhead:   %.1f%%\n", copyTime > 0.0 ? (statsTime / copyTime - 1.0) * 100.0 : 0.0);
+	printf("    min %u max %u mean %.1f sigma %.1f saturated %lu\n", stats.min, stats.max,
+		stats.mean(), stats.sigma(), (unsigned long)stats.saturated);
+	free(src);
+	free(dest);
+}
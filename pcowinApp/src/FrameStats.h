@@ -0,0 +1,54 @@
+/* FrameStats.h
+ *
+ * Revamped PCO area detector driver.
+ *
+ * Statistics of a 16 bit frame gathered while it is copied, so the
+ * pixels are only read once: minimum, maximum, sum, sum of squares,
+ * the number of saturated pixels and a coarse histogram.  The copy uses
+ * the same streaming stores as the frame copy engine and the statistics
+ * are kept in SSE2 or AVX2 registers, whichever the processor supports.
+ * The histogram is built from a sample of the frame's cache lines.
+ * Statistics of parts of a frame, or of several exposures, are merged.
+ *
+ */
+#ifndef FRAMESTATS_H_
+#define FRAMESTATS_H_
+
+#include <cstddef>
+#include "epicsTypes.h"
+
+class FrameStats
+{
+public:
+	enum {numBins=16, binBits=4, defaultSample=64, pixelBits=16};
+	/** How the statistics are gathered */
+	struct Settings
+	{
+		int saturationLevel;     // Pixels at or above this are saturated
+		int binShift;            // Pixel value to histogram bin
+		int sample;              // Histogram one cache line in this many, 1 for all
+	};
+public:
+	FrameStats();
+	void configure(int bitDepth, int saturationLevel, int sample);
+	void reset();
+	void merge(const FrameStats& other);
+	double mean() const;
+	double sigma() const;
+	static void copy(void* dest, const void* src, size_t size, FrameStats& stats);
+	static void benchmark(size_t size, int repeats, int sample);
+private:
+	void addPixels(const epicsUInt16* pixels, size_t count, bool histogram);
+public:
+	Settings settings;
+	epicsUInt64 count;           // Pixels
+	epicsUInt16 min;
+	epicsUInt16 max;
+	epicsUInt64 sum;
+	epicsUInt64 sumSquares;
+	epicsUInt64 saturated;
+	epicsUInt32 histogram[numBins];
+	epicsUInt64 sampled;         // Pixels in the histogram
+};
+
+#endif /* FRAMESTATS_H_ */
@@ -0,0 +1,555 @@
+/* FrameTransform.cpp
+ *
+ * Revamped PCO area detector driver.
+ *
+ * The software ROI.
+ *
+ * The camera's square root table sends a 16 bit value x as the 12 bit
+ * code floor(16 * sqrt(x)).  The inverse table maps each code back to
+ * the middle of the range of values that give it.
+ *
+ */
+
+#include "FrameTransform.h"
+#include "TakeLock.h"
+#include "Simd.h"
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <limits>
+#include "epicsTime.h"
+
+/** The inverse of the camera's square root table, built when the library loads */
+static struct InverseSqrt
+{
+	epicsUInt32 value[FrameTransform::lutSize];     // 32 bit for the gathers
+	InverseSqrt()
+	{
+		for(int code=0; code<FrameTransform::lutSize; code++)
+		{
+			double x = (code + 0.5) * (code + 0.5) / 256.0 + 0.5;
+			value[code] = x > 65535.0 ? 65535 : (epicsUInt32)x;
+		}
+	}
+} inverseSqrt;
+
+/** Linearise one compressed pixel */
+template<int shift> static inline epicsUInt32 decodePixel(epicsUInt16 pixel)
+{
+	return inverseSqrt.value[(pixel >> shift) & FrameTransform::lutMask];
+}
+
+/** Linearise a row of compressed pixels */
+template<int shift> static void decodeRow(epicsUInt16* dest, const epicsUInt16* src, size_t count)
+{
+	for(size_t i=0; i<count; i++)
+	{
+		dest[i] = (epicsUInt16)decodePixel<shift>(src[i]);
+	}
+}
+
+/** Linearise compressed pixels into the row buffer, the ExposureAccumulator
+ * kernel signature so it slots in for the plain widening kernels */
+template<int shift, bool first> static void decodeWiden(void* dest, const void* src, size_t count, int /*divisor*/)
+{
+	epicsUInt32* acc = (epicsUInt32*)dest;
+	const epicsUInt16* in = (const epicsUInt16*)src;
+	for(size_t i=0; i<count; i++)
+	{
+		acc[i] = (first ? 0 : acc[i]) + decodePixel<shift>(in[i]);
+	}
+}
+
+#ifdef SIMD_AVX2
+/** Look up eight compressed pixels with a gather */
+template<int shift> SIMD_TARGET_AVX2
+static inline __m256i decodeAvx2(const epicsUInt16* in)
+{
+	__m256i codes = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)in));
+	codes = _mm256_and_si256(_mm256_srli_epi32(codes, shift), _mm256_set1_epi32(FrameTransform::lutMask));
+	return _mm256_i32gather_epi32((const int*)inverseSqrt.value, codes, 4);
+}
+
+template<int shift> SIMD_TARGET_AVX2
+static void decodeRowAvx2(epicsUInt16* dest, const epicsUInt16* src, size_t count)
+{
+	size_t i = 0;
+	for(; i+16<=count; i+=16)
+	{
+		// The pack works within lanes, the permute puts the quarters back in order
+		__m256i packed = _mm256_packus_epi32(decodeAvx2<shift>(src+i), decodeAvx2<shift>(src+i+8));
+		_mm256_storeu_si256((__m256i*)(dest+i), _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0)));
+	}
+	decodeRow<shift>(dest+i, src+i, count-i);
+}
+
+template<int shift, bool first> SIMD_TARGET_AVX2
+static void decodeWidenAvx2(void* dest, const void* src, size_t count, int divisor)
+{
+	epicsUInt32* acc = (epicsUInt32*)dest;
+	const epicsUInt16* in = (const epicsUInt16*)src;
+	size_t i = 0;
+	for(; i+8<=count; i+=8)
+	{
+		__m256i values = decodeAvx2<shift>(in+i);
+		if(!first)
+		{
+			values = _mm256_add_epi32(values, _mm256_loadu_si256((const __m256i*)(acc+i)));
+		}
+		_mm256_storeu_si256((__m256i*)(acc+i), values);
+	}
+	decodeWiden<shift, first>(acc+i, in+i, count-i, divisor);
+}
+#endif
+
+/** The decoding kernels for one position of the code in the pixel */
+template<int shift> static void decodeKernels(void (*&decoder)(epicsUInt16*, const epicsUInt16*, size_t),
+	ExposureAccumulator::Kernel& widen, ExposureAccumulator::Kernel& widenAdd)
+{
+	decoder = decodeRow<shift>;
+	widen = decodeWiden<shift, true>;
+	widenAdd = decodeWiden<shift, false>;
+#ifdef SIMD_AVX2
+	if(Simd::avx2())
+	{
+		decoder = decodeRowAvx2<shift>;
+		widen = decodeWidenAvx2<shift, true>;
+		widenAdd = decodeWidenAvx2<shift, false>;
+	}
+#endif
+}
+
+/** Write a row of binned values, saturating at the limits of the output type */
+template<typename T> static void writeRow(void* dest, const epicsUInt32* row, size_t count, bool reverse)
+{
+	T* out = (T*)dest;
+	const epicsUInt32 highest = std::numeric_limits<T>::is_integer &&
+		(double)std::numeric_limits<T>::max() < (double)std::numeric_limits<epicsUInt32>::max() ?
+		(epicsUInt32)std::numeric_limits<T>::max() : std::numeric_limits<epicsUInt32>::max();
+	if(reverse)
+	{
+		out += count - 1;
+		for(size_t i=0; i<count; i++)
+		{
+			*out-- = (T)(row[i] > highest ? highest : row[i]);
+		}
+	}
+	else
+	{
+		for(size_t i=0; i<count; i++)
+		{
+			out[i] = (T)(row[i] > highest ? highest : row[i]);
+		}
+	}
+}
+
+/**
+ * Constructor
+ */
+FrameTransform::FrameTransform()
+: isRequired(false)
+, reshaping(false)
+, rowCopy(true)
+, sourceSizeX(0)
+, sourceSizeY(0)
+, offsetX(0)
+, offsetY(0)
+, sizeX(0)
+, sizeY(0)
+, binX(1)
+, binY(1)
+, reverseX(false)
+, reverseY(false)
+, dataType(NDUInt16)
+, elementBytes(sizeof(epicsUInt16))
+, writer(writeRow<epicsUInt16>)
+, decompressShift(noDecompression)
+, decoder(NULL)
+, widen(NULL)
+, widenAdd(NULL)
+{
+	this->chooseKernels();
+}
+
+/**
+ * Pick the kernels that read the source pixels, plain or through the
+ * inverse table.
+ */
+void FrameTransform::chooseKernels()
+{
+	switch(this->decompressShift)
+	{
+	case 0:
+		decodeKernels<0>(this->decoder, this->widen, this->widenAdd);
+		break;
+	case 4:
+		decodeKernels<4>(this->decoder, this->widen, this->widenAdd);
+		break;
+	default:
+		this->decoder = NULL;
+		ExposureAccumulator::kernels(NDUInt16, this->widen, this->widenAdd);
+		break;
+	}
+}
+
+/**
+ * Turn the linearising of square root compressed frames on or off.
+ * \param[in] shift The position of the 12 bit code in the pixel, 0 for
+ *        LSB aligned data, 4 for MSB aligned data or noDecompression
+ */
+void FrameTransform::setDecompression(int shift)
+{
+	TakeLock takeLock(&this->lock);
+	this->decompressShift = shift == 0 || shift == 4 ? shift : (int)noDecompression;
+	this->chooseKernels();
+	this->isRequired = this->reshaping || this->decompressing();
+}
+
+/**
+ * Find the row writer for an output type.
+ * \param[in] dataType The output type
+ * \param[out] writer The writer
+ * \param[out] elementBytes The size of an output element
+ * \return False if the type is not supported
+ */
+bool FrameTransform::findWriter(NDDataType_t dataType, RowWriter& writer, size_t& elementBytes)
+{
+	bool result = true;
+	switch(dataType)
+	{
+	case NDInt8:
+		writer = writeRow<epicsInt8>;
+		elementBytes = sizeof(epicsInt8);
+		break;
+	case NDUInt8:
+		writer = writeRow<epicsUInt8>;
+		elementBytes = sizeof(epicsUInt8);
+		break;
+	case NDInt16:
+		writer = writeRow<epicsInt16>;
+		elementBytes = sizeof(epicsInt16);
+		break;
+	case NDUInt16:
+		writer = writeRow<epicsUInt16>;
+		elementBytes = sizeof(epicsUInt16);
+		break;
+	case NDInt32:
+		writer = writeRow<epicsInt32>;
+		elementBytes = sizeof(epicsInt32);
+		break;
+	case NDUInt32:
+		writer = writeRow<epicsUInt32>;
+		elementBytes = sizeof(epicsUInt32);
+		break;
+	case NDFloat32:
+		writer = writeRow<epicsFloat32>;
+		elementBytes = sizeof(epicsFloat32);
+		break;
+	case NDFloat64:
+		writer = writeRow<epicsFloat64>;
+		elementBytes = sizeof(epicsFloat64);
+		break;
+	default:
+		result = false;
+		break;
+	}
+	return result;
+}
+
+/**
+ * Set up the transform for the frames of an acquisition.  The region is
+ * clipped to the source and an unsupported output type leaves the data
+ * as 16 bit.
+ * \param[in] sourceSizeX The width of the frames from the camera
+ * \param[in] sourceSizeY The height of the frames from the camera
+ * \param[in] dims The region, binning and reversal for X and Y
+ * \param[in] dataType The output type
+ */
+void FrameTransform::configure(int sourceSizeX, int sourceSizeY, const NDDimension_t* dims,
+	NDDataType_t dataType)
+{
+	TakeLock takeLock(&this->lock);
+	this->sourceSizeX = sourceSizeX;
+	this->sourceSizeY = sourceSizeY;
+	this->binX = dims[xDimension].binning < 1 ? 1 : dims[xDimension].binning;
+	this->binY = dims[yDimension].binning < 1 ? 1 : dims[yDimension].binning;
+	this->offsetX = dims[xDimension].offset < (size_t)sourceSizeX ? dims[xDimension].offset : 0;
+	this->offsetY = dims[yDimension].offset < (size_t)sourceSizeY ? dims[yDimension].offset : 0;
+	size_t cropX = dims[xDimension].size;
+	size_t cropY = dims[yDimension].size;
+	if(cropX == 0 || this->offsetX + cropX > (size_t)sourceSizeX)
+	{
+		cropX = sourceSizeX - this->offsetX;
+	}
+	if(cropY == 0 || this->offsetY + cropY > (size_t)sourceSizeY)
+	{
+		cropY = sourceSizeY - this->offsetY;
+	}
+	this->sizeX = cropX / this->binX;
+	this->sizeY = cropY / this->binY;
+	this->reverseX = dims[xDimension].reverse != 0;
+	this->reverseY = dims[yDimension].reverse != 0;
+	if(!FrameTransform::findWriter(dataType, this->writer, this->elementBytes))
+	{
+		dataType = NDUInt16;
+		FrameTransform::findWriter(dataType, this->writer, this->elementBytes);
+	}
+	this->dataType = dataType;
+	this->rowCopy = this->binX == 1 && this->binY == 1 && !this->reverseX && dataType == NDUInt16;
+	this->reshaping = this->offsetX != 0 || this->offsetY != 0 ||
+		(int)this->sizeX != sourceSizeX || (int)this->sizeY != sourceSizeY ||
+		!this->rowCopy || this->reverseY;
+	this->isRequired = this->reshaping || this->decompressing();
+	if(!this->rowCopy)
+	{
+		this->row.resize(this->sizeX * this->binX);
+	}
+}
+
+/**
+ * Bin the columns of a row in place.
+ * \param[in,out] row The row, the binned values end up at the start
+ * \param[in] count The number of binned values
+ * \param[in] binning The number of columns in each
+ */
+void FrameTransform::binColumns(epicsUInt32* row, size_t count, int binning)
+{
+	size_t i = 0;
+#ifdef SIMD_SSE2
+	if(binning == 2)
+	{
+		// Split even and odd columns and add them, the writes never
+		// overtake the reads
+		for(; i+4<=count; i+=4)
+		{
+			__m128 a = _mm_castsi128_ps(_mm_loadu_si128((const __m128i*)(row+2*i)));
+			__m128 b = _mm_castsi128_ps(_mm_loadu_si128((const __m128i*)(row+2*i+4)));
+			__m128i even = _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+			__m128i odd = _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+			_mm_storeu_si128((__m128i*)(row+i), _mm_add_epi32(even, odd));
+		}
+	}
+#endif
+	for(; i<count; i++)
+	{
+		const epicsUInt32* in = row + i*binning;
+		epicsUInt32 sum = in[0];
+		for(int b=1; b<binning; b++)
+		{
+			sum += in[b];
+		}
+		row[i] = sum;
+	}
+}
+
+/**
+ * Transform a frame.  The destination must have been allocated with
+ * the output size and type.
+ * \param[in] dest The output array
+ * \param[in] source The frame in the SDK buffer
+ * \return False if the destination does not match the transform
+ */
+bool FrameTransform::apply(NDArray* dest, const epicsUInt16* source)
+{
+	TakeLock takeLock(&this->lock);
+	if(dest->dataType != this->dataType || dest->dataSize < this->outputBytes())
+	{
+		return false;
+	}
+	char* out = (char*)dest->pData;
+	size_t outRowBytes = this->sizeX * this->elementBytes;
+	size_t cropX = this->sizeX * this->binX;
+	for(size_t y=0; y<this->sizeY; y++)
+	{
+		const epicsUInt16* in = source + (this->offsetY + y*this->binY) * this->sourceSizeX + this->offsetX;
+		char* outRow = out + (this->reverseY ? this->sizeY-1-y : y) * outRowBytes;
+		if(this->rowCopy && this->decoder != NULL)
+		{
+			this->decoder((epicsUInt16*)outRow, in, this->sizeX);
+		}
+		else if(this->rowCopy)
+		{
+			::memcpy(outRow, in, outRowBytes);
+		}
+		else
+		{
+			// Sum the source rows, bin the columns then write out the row
+			epicsUInt32* binned = &this->row[0];
+			this->widen(binned, in, cropX, 1);
+			for(int b=1; b<this->binY; b++)
+			{
+				this->widenAdd(binned, in + b*this->sourceSizeX, cropX, 1);
+			}
+			if(this->binX > 1)
+			{
+				FrameTransform::binColumns(binned, this->sizeX, this->binX);
+			}
+			this->writer(outRow, binned, this->sizeX, this->reverseX);
+		}
+	}
+	// Record the region the data came from as the NDArrayPool would
+	dest->dims[xDimension].offset = this->offsetX;
+	dest->dims[yDimension].offset = this->offsetY;
+	dest->dims[xDimension].binning = this->binX;
+	dest->dims[yDimension].binning = this->binY;
+	dest->dims[xDimension].reverse = this->reverseX ? 1 : 0;
+	dest->dims[yDimension].reverse = this->reverseY ? 1 : 0;
+	return true;
+}
+
+/**
+ * Time the transform against a plain copy of the frame and check it
+ * against a straightforward version for each kind of transform.
+ * \param[in] sizeX The width of the source frame
+ * \param[in] sizeY The height of the source frame
+ * \param[in] binning The binning to time in both directions
+ * \param[in] repeats The number of frames to time
+ */
+void FrameTransform::benchmark(int sizeX, int sizeY, int binning, int repeats)
+{
+	size_t pixels = (size_t)sizeX * sizeY;
+	epicsUInt16* source = (epicsUInt16*)malloc(pixels * sizeof(epicsUInt16));
+	NDArray dest;
+	dest.pData = malloc(pixels * sizeof(double));
+	dest.dataSize = pixels * sizeof(double);
+	if(source == NULL || dest.pData == NULL || sizeX < 8 || sizeY < 8 ||
+		binning < 1 || repeats <= 0)
+	{
+		printf("pcoBenchmark transform: bad size or cannot allocate %lu pixels\n", (unsigned long)pixels);
+		free(source);
+		free(dest.pData);
+		dest.pData = NULL;
+		return;
+	}
+	for(size_t i=0; i<pixels; i++)
+	{
+		source[i] = (epicsUInt16)(i * 2654435761u >> 16);
+	}
+	// Check a spread of regions, binnings, reversals, types and decompression
+	static const struct {int bin; int reverse; NDDataType_t type; int shift;} checks[] = {
+		{1, 0, NDUInt16, noDecompression}, {1, 1, NDUInt16, noDecompression},
+		{2, 0, NDUInt16, noDecompression}, {2, 1, NDUInt32, noDecompression},
+		{3, 1, NDUInt8, noDecompression}, {2, 0, NDFloat32, noDecompression},
+		{4, 1, NDInt16, noDecompression}, {3, 0, NDFloat64, noDecompression},
+		{1, 0, NDUInt16, 4}, {1, 0, NDUInt16, 0}, {2, 1, NDUInt32, 4}, {3, 0, NDUInt16, 0}};
+	int failures = 0;
+	for(size_t c=0; c<sizeof(checks)/sizeof(checks[0]); c++)
+	{
+		NDDimension_t dims[numDimensions];
+		::memset(dims, 0, sizeof(dims));
+		dims[xDimension].offset = 3;
+		dims[yDimension].offset = 5;
+		dims[xDimension].size = sizeX - 7;
+		dims[yDimension].size = sizeY - 6;
+		dims[xDimension].binning = checks[c].bin;
+		dims[yDimension].binning = checks[c].bin;
+		dims[xDimension].reverse = checks[c].reverse;
+		dims[yDimension].reverse = 1 - checks[c].reverse;
+		FrameTransform transform;
+		transform.configure(sizeX, sizeY, dims, checks[c].type);
+		transform.setDecompression(checks[c].shift);
+		dest.dataType = transform.outputType();
+		transform.apply(&dest, source);
+		size_t outX = transform.outputSizeX();
+		size_t outY = transform.outputSizeY();
+		double highest = 1e300;
+		switch(checks[c].type)
+		{
+		case NDUInt8: highest = 255.0; break;
+		case NDInt16: highest = 32767.0; break;
+		case NDUInt16: highest = 65535.0; break;
+		default: break;
+		}
+		int wrong = 0;
+		for(size_t y=0; y<outY; y++)
+		{
+			for(size_t x=0; x<outX; x++)
+			{
+				double sum = 0.0;
+				for(int by=0; by<checks[c].bin; by++)
+				{
+					for(int bx=0; bx<checks[c].bin; bx++)
+					{
+						epicsUInt16 pixel = source[(dims[yDimension].offset + y*checks[c].bin + by) * sizeX +
+							dims[xDimension].offset + x*checks[c].bin + bx];
+						sum += checks[c].shift == noDecompression ? pixel :
+							inverseSqrt.value[(pixel >> checks[c].shift) & lutMask];
+					}
+				}
+				sum = sum > highest ? highest : sum;
+				size_t ox = dims[xDimension].reverse ? outX-1-x : x;
+				size_t oy = dims[yDimension].reverse ? outY-1-y : y;
+				size_t index = oy * outX + ox;
+				double got = 0.0;
+				switch(checks[c].type)
+				{
+				case NDUInt8: got = ((epicsUInt8*)dest.pData)[index]; break;
+				case NDInt16: got = ((epicsInt16*)dest.pData)[index]; break;
+				case NDUInt16: got = ((epicsUInt16*)dest.pData)[index]; break;
+				case NDUInt32: got = ((epicsUInt32*)dest.pData)[index]; break;
+				case NDFloat32: got = ((epicsFloat32*)dest.pData)[index]; break;
+				default: got = ((epicsFloat64*)dest.pData)[index]; break;
+				}
+				if(got != sum)
+				{
+					wrong++;
+				}
+			}
+		}
+		if(wrong > 0)
+		{
+			printf("pcoBenchmark transform: binning %d reverse %d type %d shift %d, %d pixels wrong\n",
+				checks[c].bin, checks[c].reverse, (int)checks[c].type, checks[c].shift, wrong);
+			failures++;
+		}
+	}
+	// Time the requested binning to 16 bit against the plain copy
+	NDDimension_t dims[numDimensions];
+	::memset(dims, 0, sizeof(dims));
+	dims[xDimension].size = sizeX;
+	dims[yDimension].size = sizeY;
+	dims[xDimension].binning = binning;
+	dims[yDimension].binning = binning;
+	FrameTransform transform;
+	transform.configure(sizeX, sizeY, dims, binning == 1 ? NDUInt32 : NDUInt16);
+	dest.dataType = transform.outputType();
+	epicsTimeStamp start;
+	epicsTimeStamp end;
+	epicsTimeGetCurrent(&start);
+	for(int i=0; i<repeats; i++)
+	{
+		::memcpy(dest.pData, source, pixels * sizeof(epicsUInt16));
+	}
+	epicsTimeGetCurrent(&end);
+	double copyTime = epicsTimeDiffInSeconds(&end, &start);
+	epicsTimeGetCurrent(&start);
+	for(int i=0; i<repeats; i++)
+	{
+		transform.apply(&dest, source);
+	}
+	epicsTimeGetCurrent(&end);
+	double transformTime = epicsTimeDiffInSeconds(&end, &start);
+	// And the linearising of the whole frame
+	::memset(dims, 0, sizeof(dims));
+	FrameTransform decompress;
+	decompress.configure(sizeX, sizeY, dims, NDUInt16);
+	decompress.setDecompression(4);
+	dest.dataType = decompress.outputType();
+	epicsTimeGetCurrent(&start);
+	for(int i=0; i<repeats; i++)
+	{
+		decompress.apply(&dest, source);
+	}
+	epicsTimeGetCurrent(&end);
+	double decompressTime = epicsTimeDiffInSeconds(&end, &start);
+	double gigabytes = (double)pixels * sizeof(epicsUInt16) * repeats / 1e9;
+	printf("pcoBenchmark transform: %dx%d x %d, binning %d%s, %d checks failed\n",
+		sizeX, sizeY, repeats, binning, binning == 1 ? " to 32 bit" : "", failures);
+	printf("    copy:      %.2f GB/s\n", copyTime > 0.0 ? gigabytes / copyTime : 0.0);
+	printf("    transform: %.2f GB/s\n", transformTime > 0.0 ? gigabytes / transformTime : 0.0);
+	printf("    linearise: %.2f GB/s (%s)\n", decompressTime > 0.0 ? gigabytes / decompressTime : 0.0,
+		Simd::isaNames[Simd::isa()]);
+	free(source);
+	free(dest.pData);
+	dest.pData = NULL;
+}
@@ -0,0 +1,79 @@
+/* FrameTransform.h
+ *
+ * Revamped PCO area detector driver.
+ *
+ * The software ROI.  Crops, bins, reverses and converts a 16 bit frame
+ * straight out of an SDK buffer into an NDArray in one pass.  Each
+ * output row is built in a 32 bit row buffer that stays in the cache:
+ * the source rows that bin into it are widened and summed by the
+ * exposure summing kernels, the columns are binned in place and the
+ * row is then written out, reversed and converted, saturating at the
+ * limits of the output type.  A crop with no binning, reversal or
+ * conversion is a copy of each row.
+ * Frames sent with the camera's square root look up table can be
+ * linearised on the way through with the inverse table.
+ *
+ */
+#ifndef FRAMETRANSFORM_H_
+#define FRAMETRANSFORM_H_
+
+#include <vector>
+#include <cstddef>
+#include "epicsMutex.h"
+#include "epicsTypes.h"
+#include "NDArray.h"
+#include "ExposureAccumulator.h"
+
+class FrameTransform
+{
+public:
+	enum {xDimension=0, yDimension=1, numDimensions=2};
+	enum {lutBits=12, lutSize=1<<lutBits, lutMask=lutSize-1, noDecompression=-1};
+public:
+	FrameTransform();
+	virtual ~FrameTransform() {}
+	void configure(int sourceSizeX, int sourceSizeY, const NDDimension_t* dims,
+		NDDataType_t dataType);
+	void setDecompression(int shift);
+	bool decompressing() const {return this->decompressShift != noDecompression;}
+	bool required() const {return this->isRequired;}
+	size_t outputSizeX() const {return this->sizeX;}
+	size_t outputSizeY() const {return this->sizeY;}
+	NDDataType_t outputType() const {return this->dataType;}
+	size_t outputBytes() const {return this->sizeX * this->sizeY * this->elementBytes;}
+	bool apply(NDArray* dest, const epicsUInt16* source);
+	static void benchmark(int sizeX, int sizeY, int binning, int repeats);
+private:
+	/** Writes a binned row to the output, converting and maybe reversing it */
+	typedef void (*RowWriter)(void* dest, const epicsUInt32* row, size_t count, bool reverse);
+	/** Copies a row through the inverse table */
+	typedef void (*RowDecoder)(epicsUInt16* dest, const epicsUInt16* src, size_t count);
+	static bool findWriter(NDDataType_t dataType, RowWriter& writer, size_t& elementBytes);
+	void chooseKernels();
+	static void binColumns(epicsUInt32* row, size_t count, int binning);
+private:
+	epicsMutex lock;            // The row buffer is shared by the threads that read frames
+	bool isRequired;
+	bool reshaping;             // The region, binning, reversal or type change the frame
+	bool rowCopy;               // Each output row is a copy of part of a source row
+	int sourceSizeX;
+	int sourceSizeY;
+	size_t offsetX;
+	size_t offsetY;
+	size_t sizeX;               // Of the output
+	size_t sizeY;
+	int binX;
+	int binY;
+	bool reverseX;
+	bool reverseY;
+	NDDataType_t dataType;
+	size_t elementBytes;
+	RowWriter writer;
+	int decompressShift;        // Position of the compressed value in the pixel
+	RowDecoder decoder;
+	ExposureAccumulator::Kernel widen;
+	ExposureAccumulator::Kernel widenAdd;
+	std::vector<epicsUInt32> row;
+};
+
+#endif /* FRAMETRANSFORM_H_ */
@@ -0,0 +1,358 @@
+/* FrameWorkers.h
+ *
+ * Revamped PCO area detector driver.
+ *
+ * A pool of threads that work on frames independently and a reorder
+ * window that passes them on in image number order.  A frame is worked
+ * on by whichever thread is free and released by whichever thread
+ * finishes, so releases happen one at a time without a thread of their
+ * own.  The image number is only known once a frame has been worked on.
+ * A numbered frame is released when it is the next number, or when it
+ * is the lowest finished number and nothing that arrived before it is
+ * still being worked on.  Frames without a number are released in the
+ * order they were submitted.  The window bounds the frames in flight,
+ * submitting waits for room.
+ * The owner provides
+ *     void workFrame(Item& item, int worker)    any worker, in parallel
+ *     bool frameNumber(const Item& item, long& number)   after work, false if none
+ *     void releaseFrame(Item& item)             in order, one at a time
+ *     void dropFrame(Item& item)                invalidated before release
+ *
+ */
+#ifndef FRAMEWORKERS_H_
+#define FRAMEWORKERS_H_
+
+#include <vector>
+#include <deque>
+#include <string>
+#include "epicsThread.h"
+#include "epicsEvent.h"
+#include "epicsMutex.h"
+#include "epicsStdio.h"
+#include "TakeLock.h"
+#include "FreeLock.h"
+#include "ThreadPlacement.h"
+
+template<typename Owner, typename Item>
+class FrameWorkers
+{
+public:
+	/** Constructor, there are no workers until configured
+	 * \param[in] owner The object that does the work
+	 * \param[in] portName Names the threads and their placement
+	 */
+	FrameWorkers(Owner* owner, const char* portName)
+	: owner(owner)
+	, portName(portName)
+	, work(epicsEventEmpty)
+	, room(epicsEventEmpty)
+	, idle(epicsEventEmpty)
+	, exiting(false)
+	, submitted(0)
+	, released(0)
+	, releasing(false)
+	, haveNumber(false)
+	, nextNumber(0)
+	, generation(0)
+	, held(0)
+	{
+	}
+
+	virtual ~FrameWorkers()
+	{
+		this->invalidate();
+		this->flush();
+		this->stopThreads();
+	}
+
+	/** Set the number of workers and the depth of the window.  Only
+	 * call when nothing is in flight, ie after a flush.
+	 * \param[in] numWorkers The number of threads, 0 for none
+	 * \param[in] depth The most frames in flight
+	 */
+	void configure(int numWorkers, int depth)
+	{
+		numWorkers = numWorkers < 0 ? 0 : numWorkers;
+		depth = depth < 1 ? 1 : depth;
+		if(numWorkers != (int)this->threads.size() || depth != (int)this->slots.size())
+		{
+			this->stopThreads();
+			{
+				TakeLock takeLock(&this->lock);
+				this->slots.assign(depth, Slot());
+				this->submitted = 0;
+				this->released = 0;
+				this->haveNumber = false;
+				this->exiting = false;
+			}
+			for(int i=0; i<numWorkers; i++)
+			{
+				char threadName[64];
+				epicsSnprintf(threadName, sizeof(threadName), "%sWork%d", this->portName.c_str(), i);
+				this->threads.push_back(new WorkThread(this, i, threadName));
+			}
+		}
+	}
+
+	/** Are there any workers? */
+	bool active() const {return !this->threads.empty();}
+
+	/** Hand a frame to the workers, waiting while the window is full.
+	 * \param[in] item The frame
+	 * \return True if we had to wait for room
+	 */
+	bool submit(const Item& item)
+	{
+		bool stalled = false;
+		TakeLock takeLock(&this->lock);
+		while(this->submitted - this->released >= (unsigned long)this->slots.size())
+		{
+			stalled = true;
+			FreeLock freeLock(takeLock);
+			this->room.wait();
+		}
+		Slot& slot = this->slots[this->submitted % this->slots.size()];
+		slot.item = item;
+		slot.done = false;
+		slot.released = false;
+		slot.numbered = false;
+		slot.generation = this->generation;
+		this->queue.push_back(this->submitted);
+		this->submitted++;
+		this->work.signal();
+		return stalled;
+	}
+
+	/** Drop everything in flight instead of releasing it, does not wait.
+	 * The image numbers start again.
+	 */
+	void invalidate()
+	{
+		TakeLock takeLock(&this->lock);
+		this->generation++;
+		this->haveNumber = false;
+	}
+
+	/** Wait until everything submitted has been released or dropped */
+	void flush()
+	{
+		TakeLock takeLock(&this->lock);
+		while(this->released != this->submitted)
+		{
+			FreeLock freeLock(takeLock);
+			this->idle.wait();
+		}
+	}
+
+	/** The number of frames that finished before an earlier frame since the last call */
+	int takeHeld()
+	{
+		TakeLock takeLock(&this->lock);
+		int result = this->held;
+		this->held = 0;
+		return result;
+	}
+
+private:
+	/** A thread in the pool */
+	class WorkThread: public epicsThreadRunable
+	{
+	private:
+		epicsThread thread;
+		FrameWorkers* owner;
+		int index;
+	public:
+		WorkThread(FrameWorkers* owner, int index, const char* threadName)
+		: thread(*this, threadName, epicsThreadGetStackSize(epicsThreadStackMedium))
+		, owner(owner)
+		, index(index)
+		{
+			this->thread.start();
+		}
+		virtual ~WorkThread() {}
+		virtual void run() {this->owner->run(this->index);}
+		void exitWait() {this->thread.exitWait();}
+	};
+	/** A place in the window */
+	struct Slot
+	{
+		Item item;
+		bool done;         // Worked on, waiting to be released
+		bool released;     // Released ahead of an earlier slot
+		bool numbered;
+		long number;
+		int generation;
+		Slot() : done(false), released(false), numbered(false), number(0), generation(0) {}
+	};
+
+private:
+	FrameWorkers(const FrameWorkers& other);
+	FrameWorkers& operator=(const FrameWorkers& other);
+
+	/** Stop and delete the threads, nothing must be in flight */
+	void stopThreads()
+	{
+		{
+			TakeLock takeLock(&this->lock);
+			this->exiting = true;
+		}
+		for(size_t i=0; i<this->threads.size(); i++)
+		{
+			this->work.signal();
+			this->threads[i]->exitWait();
+			delete this->threads[i];
+		}
+		this->threads.clear();
+	}
+
+	/** The worker threads
+	 * \param[in] index The worker's number
+	 */
+	void run(int index)
+	{
+		int placementGeneration = ThreadPlacement::unapplied;
+		TakeLock takeLock(&this->lock);
+		while(!this->exiting)
+		{
+			if(this->queue.empty())
+			{
+				FreeLock freeLock(takeLock);
+				ThreadPlacement::apply(this->portName.c_str(), ThreadPlacement::roleProcess,
+					placementGeneration);
+				this->work.wait();
+				continue;
+			}
+			unsigned long sequence = this->queue.front();
+			this->queue.pop_front();
+			if(!this->queue.empty())
+			{
+				// Wake another worker for the rest
+				this->work.signal();
+			}
+			Slot& slot = this->slots[sequence % this->slots.size()];
+			if(slot.generation == this->generation)
+			{
+				FreeLock freeLock(takeLock);
+				this->owner->workFrame(slot.item, index);
+			}
+			slot.numbered = slot.generation == this->generation &&
+				this->owner->frameNumber(slot.item, slot.number);
+			slot.done = true;
+			if(sequence != this->released)
+			{
+				this->held++;
+			}
+			this->release(takeLock);
+		}
+		// Pass the exit on to the next worker
+		this->work.signal();
+	}
+
+	/** Choose the next finished frame to release.  Invalidated frames
+	 * go straight away, frames without a number in submission order and
+	 * numbered frames as described above.  Called with the lock taken.
+	 * \param[out] sequence The frame's place in the window
+	 * \return False if nothing can be released yet
+	 */
+	bool nextRelease(unsigned long& sequence)
+	{
+		bool first = true;          // No earlier slot is waiting
+		bool busy = false;          // An earlier slot is still being worked on
+		bool found = false;
+		bool clear = false;         // Nothing before the lowest number is being worked on
+		long lowest = 0;
+		for(unsigned long s=this->released; s!=this->submitted; s++)
+		{
+			Slot& slot = this->slots[s % this->slots.size()];
+			if(slot.released)
+			{
+				continue;
+			}
+			if(slot.done && (slot.generation != this->generation || (!slot.numbered && first)))
+			{
+				sequence = s;
+				return true;
+			}
+			if(slot.done && slot.numbered && (!found || slot.number < lowest))
+			{
+				found = true;
+				lowest = slot.number;
+				clear = !busy;
+				sequence = s;
+			}
+			busy = busy || !slot.done;
+			first = false;
+		}
+		return found && (clear || (this->haveNumber && lowest == this->nextNumber));
+	}
+
+	/** Release the finished frames that are ready unless another
+	 * worker already is.  Called with the lock taken.
+	 * \param[in] takeLock The lock
+	 */
+	void release(TakeLock& takeLock)
+	{
+		if(!this->releasing)
+		{
+			this->releasing = true;
+			unsigned long sequence;
+			while(this->nextRelease(sequence))
+			{
+				Slot& slot = this->slots[sequence % this->slots.size()];
+				slot.done = false;
+				bool keep = slot.generation == this->generation;
+				if(keep && slot.numbered)
+				{
+					this->haveNumber = true;
+					this->nextNumber = slot.number + 1;
+				}
+				{
+					// The slot is not reused until released moves past it
+					FreeLock freeLock(takeLock);
+					if(keep)
+					{
+						this->owner->releaseFrame(slot.item);
+					}
+					else
+					{
+						this->owner->dropFrame(slot.item);
+					}
+				}
+				slot.released = true;
+				while(this->released != this->submitted &&
+					this->slots[this->released % this->slots.size()].released)
+				{
+					this->slots[this->released % this->slots.size()].released = false;
+					this->released++;
+					this->room.signal();
+				}
+			}
+			this->releasing = false;
+			if(this->released == this->submitted)
+			{
+				this->idle.signal();
+			}
+		}
+	}
+
+private:
+	Owner* owner;
+	std::string portName;
+	std::vector<WorkThread*> threads;
+	std::vector<Slot> slots;
+	std::deque<unsigned long> queue;    // Submitted frames no worker has started on
+	epicsMutex lock;
+	epicsEvent work;
+	epicsEvent room;
+	epicsEvent idle;
+	bool exiting;
+	unsigned long submitted;           // Sequence numbers
+	unsigned long released;            // Everything before this has been released
+	bool releasing;                    // A worker is releasing frames
+	bool haveNumber;                   // A numbered frame has been released
+	long nextNumber;                   // The image number that follows it
+	int generation;
+	int held;
+};
+
+#endif /* FRAMEWORKERS_H_ */
@@ -23,6 +23,7 @@ GangClient::Connection::Connection(GangClient* owner)
 	: SocketProtocol("GangClient", "pco_gang", 40000000)
 	, owner(owner)
 {
+	setPlacement(owner->pco->portName);
 }
 
 // Make the asyn name from a string and an index number
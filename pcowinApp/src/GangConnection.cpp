@@ -40,6 +40,7 @@ GangConnection::GangConnection(Pco* pco, TraceStream* trace, const char* serverI
 {
 	// Start the connection
 	pco->registerGangConnection(this);
+	setPlacement(pco->portName);
 	client(serverIp, serverPort);
 	*trace << "Gang client attempting connection" << std::endl;
 }
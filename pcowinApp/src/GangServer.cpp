@@ -44,6 +44,7 @@ GangServer::GangServer(Pco* pco, TraceStream* trace, int gangPortNumber)
 {
 	// Create the client connections
 	pco->registerGangServer(this);
+	setPlacement(pco->portName);
 	for(int i=0; i<maxConnections; i++)
 	{
 		clients.push_back(new GangClient(pco, trace, this, i));
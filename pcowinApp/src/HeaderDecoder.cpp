@@ -0,0 +1,141 @@
+/* HeaderDecoder.cpp
+ *
+ * Revamped PCO area detector driver.
+ *
+ * Decodes the binary header the camera writes into a frame.
+ *
+ */
+
+#include "HeaderDecoder.h"
+#include <cstring>
+#include <ctime>
+
+/**
+ * Create the decoder for a bit alignment and dynamic resolution.
+ * \param[in] bitAlignment DllApi::bitAlignmentMsb or DllApi::bitAlignmentLsb
+ * \param[in] dynResolution The dynamic resolution of the camera in bits
+ * \return The decoder, owned by the caller
+ */
+HeaderDecoder* HeaderDecoder::create(int bitAlignment, int dynResolution)
+{
+	HeaderDecoder* result = NULL;
+	if(bitAlignment != DllApi::bitAlignmentMsb)
+	{
+		result = new HeaderDecoderT<DllApi::bitAlignmentLsb, pixelBits>();
+	}
+	else
+	{
+		switch(dynResolution)
+		{
+		case 12:
+			result = new HeaderDecoderT<DllApi::bitAlignmentMsb, 12>();
+			break;
+		case 14:
+			result = new HeaderDecoderT<DllApi::bitAlignmentMsb, 14>();
+			break;
+		case 16:
+			result = new HeaderDecoderT<DllApi::bitAlignmentMsb, 16>();
+			break;
+		default:
+			result = new HeaderDecoderAny(dynResolution > 0 && dynResolution < pixelBits ?
+				pixelBits - dynResolution : 0);
+			break;
+		}
+	}
+	return result;
+}
+
+/**
+ * Constructor
+ */
+HeaderDecoder::HeaderDecoder()
+: cachedHour(-1)
+, cachedHourSeconds(0)
+{
+}
+
+/**
+ * Make the image number from the decoded digit pairs.
+ * \param[in] pairs The decoded header
+ */
+long HeaderDecoder::numberFromPairs(const unsigned short* pairs) const
+{
+	return ((pairs[0] * (long)pairValue + pairs[1]) * pairValue + pairs[2]) * pairValue + pairs[3];
+}
+
+/**
+ * Make the time stamp from the decoded digit pairs.  The conversion
+ * of the date and hour is cached, the time zone cannot change within
+ * an hour so only the first frame of each hour pays for it.
+ * \param[in] pairs The decoded header
+ * \param[out] time The time stamp
+ */
+void HeaderDecoder::timeFromPairs(const unsigned short* pairs, epicsTimeStamp& time)
+{
+	int year = pairs[4] * pairValue + pairs[5];
+	long hour = (((long)year * pairValue + pairs[6]) * pairValue + pairs[7]) * pairValue + pairs[8];
+	if(hour != this->cachedHour)
+	{
+		struct tm ct;
+		::memset(&ct, 0, sizeof(ct));
+		ct.tm_year = year - 1900;
+		ct.tm_mon = pairs[6] - 1;
+		ct.tm_mday = pairs[7];
+		ct.tm_hour = pairs[8];
+		ct.tm_isdst = -1;
+		epicsTimeStamp start;
+		if(epicsTimeFromTM(&start, &ct, 0) == 0)
+		{
+			this->cachedHour = hour;
+			this->cachedHourSeconds = start.secPastEpoch;
+		}
+		else
+		{
+			this->cachedHour = -1;
+			this->cachedHourSeconds = 0;
+		}
+	}
+	time.secPastEpoch = this->cachedHourSeconds + pairs[9] * 60 + pairs[10];
+	time.nsec = ((pairs[11] * (epicsUInt32)pairValue + pairs[12]) * pairValue + pairs[13]) * 1000;
+}
+
+/**
+ * Decode just the image number.
+ * \param[in] frame The frame
+ * \return The image number
+ */
+long HeaderDecoderAny::imageNumber(const unsigned short* frame) const
+{
+	long result = 0;
+	for(int i=0; i<numberLength; i++)
+	{
+		result = result * pairValue + this->pair(frame[i]);
+	}
+	return result;
+}
+
+/**
+ * Decode the image number and time stamp.
+ * \param[in] frame The frame
+ * \param[out] number The image number
+ * \param[out] time The time stamp
+ */
+void HeaderDecoderAny::decode(const unsigned short* frame, long& number, epicsTimeStamp& time)
+{
+	unsigned short pairs[headerLength];
+	for(int i=0; i<headerLength; i++)
+	{
+		pairs[i] = this->pair(frame[i]);
+	}
+	number = this->numberFromPairs(pairs);
+	this->timeFromPairs(pairs, time);
+}
+
+/**
+ * Decode the two digits in a pixel.
+ */
+unsigned short HeaderDecoderAny::pair(unsigned short pixel) const
+{
+	unsigned short v = (unsigned short)(pixel >> this->pixelShift);
+	return (unsigned short)(((v >> digitBits) & digitMask) * 10 + (v & digitMask));
+}
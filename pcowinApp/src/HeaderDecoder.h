@@ -0,0 +1,125 @@
+/* HeaderDecoder.h
+ *
+ * Revamped PCO area detector driver.
+ *
+ * Decodes the binary header the camera writes into the first 14
+ * pixels of a frame when the binary timestamp is enabled.  Each
+ * pixel holds two BCD digits, shifted up by the unused bits of the
+ * pixel when the data is MSB aligned:
+ *     0-3   image number, most significant digits first
+ *     4-5   year (century, year)
+ *     6-10  month, day, hour, minute, second
+ *     11-13 microseconds, most significant digits first
+ * A decoder is built at arm time for the bit alignment and dynamic
+ * resolution in force, so the shifts are compile time constants.
+ *
+ */
+#ifndef HEADERDECODER_H_
+#define HEADERDECODER_H_
+
+#include "epicsTime.h"
+#include "epicsTypes.h"
+#include "DllApi.h"
+#include "Simd.h"
+
+class HeaderDecoder
+{
+public:
+	enum {headerLength=14, numberLength=4, digitBits=4, digitMask=0x0f, pairValue=100};
+	enum {pixelBits=16};
+public:
+	static HeaderDecoder* create(int bitAlignment, int dynResolution);
+	HeaderDecoder();
+	virtual ~HeaderDecoder() {}
+	virtual long imageNumber(const unsigned short* frame) const = 0;
+	virtual void decode(const unsigned short* frame, long& imageNumber, epicsTimeStamp& time) = 0;
+	virtual int shift() const = 0;
+protected:
+	long numberFromPairs(const unsigned short* pairs) const;
+	void timeFromPairs(const unsigned short* pairs, epicsTimeStamp& time);
+private:
+	long cachedHour;                // Date and hour the cached seconds are for
+	epicsUInt32 cachedHourSeconds;  // EPICS seconds at the start of that hour
+};
+
+/** A decoder for one bit alignment and dynamic resolution */
+template<int bitAlignment, int dynResolution>
+class HeaderDecoderT: public HeaderDecoder
+{
+public:
+	enum {pixelShift = bitAlignment == DllApi::bitAlignmentMsb ? pixelBits - dynResolution : 0};
+
+	/** Decode just the image number
+	 * \param[in] frame The frame
+	 * \return The image number
+	 */
+	virtual long imageNumber(const unsigned short* frame) const
+	{
+		long result = 0;
+		for(int i=0; i<numberLength; i++)
+		{
+			result = result * pairValue + HeaderDecoderT::pair(frame[i]);
+		}
+		return result;
+	}
+
+	/** Decode the image number and time stamp in one pass over the header
+	 * \param[in] frame The frame
+	 * \param[out] number The image number
+	 * \param[out] time The time stamp
+	 */
+	virtual void decode(const unsigned short* frame, long& number, epicsTimeStamp& time)
+	{
+		unsigned short pairs[headerLength];
+#ifdef SIMD_SSE2
+		// Two overlapping loads cover the header without reading past it
+		_mm_storeu_si128((__m128i*)pairs, HeaderDecoderT::decodePairs(
+			_mm_loadu_si128((const __m128i*)frame)));
+		_mm_storeu_si128((__m128i*)(pairs + headerLength - 8), HeaderDecoderT::decodePairs(
+			_mm_loadu_si128((const __m128i*)(frame + headerLength - 8))));
+#else
+		for(int i=0; i<headerLength; i++)
+		{
+			pairs[i] = HeaderDecoderT::pair(frame[i]);
+		}
+#endif
+		number = this->numberFromPairs(pairs);
+		this->timeFromPairs(pairs, time);
+	}
+
+	virtual int shift() const {return pixelShift;}
+
+private:
+	/** Decode the two digits in a pixel */
+	static unsigned short pair(unsigned short pixel)
+	{
+		unsigned short v = (unsigned short)(pixel >> pixelShift);
+		return (unsigned short)(((v >> digitBits) & digitMask) * 10 + (v & digitMask));
+	}
+#ifdef SIMD_SSE2
+	/** Decode the two digits in each of eight pixels */
+	static __m128i decodePairs(__m128i pixels)
+	{
+		const __m128i mask = _mm_set1_epi16(digitMask);
+		__m128i v = _mm_srli_epi16(pixels, pixelShift);
+		__m128i low = _mm_and_si128(v, mask);
+		__m128i high = _mm_and_si128(_mm_srli_epi16(v, digitBits), mask);
+		return _mm_add_epi16(_mm_mullo_epi16(high, _mm_set1_epi16(10)), low);
+	}
+#endif
+};
+
+/** A decoder for an unusual dynamic resolution, the shift is not a constant */
+class HeaderDecoderAny: public HeaderDecoder
+{
+public:
+	HeaderDecoderAny(int pixelShift) : pixelShift(pixelShift) {}
+	virtual long imageNumber(const unsigned short* frame) const;
+	virtual void decode(const unsigned short* frame, long& imageNumber, epicsTimeStamp& time);
+	virtual int shift() const {return pixelShift;}
+private:
+	unsigned short pair(unsigned short pixel) const;
+	int pixelShift;
+};
+
+#endif /* HEADERDECODER_H_ */
@@ -0,0 +1,91 @@
+/* LatencyHistogram.cpp
+ *
+ * A fixed bucket histogram of latencies.
+ *
+ */
+
+#include "LatencyHistogram.h"
+#include <cmath>
+
+// Constructor
+LatencyHistogram::LatencyHistogram()
+{
+	this->clear();
+}
+
+// Destructor
+LatencyHistogram::~LatencyHistogram()
+{
+}
+
+// The upper limit of a bucket in seconds
+double LatencyHistogram::bucketLimit(int bucket)
+{
+	return 1.0e-6 * std::pow(2.0, (double)bucket / bucketsPerOctave);
+}
+
+// Add a latency in nanoseconds
+void LatencyHistogram::add(epicsUInt64 latencyNs)
+{
+	int bucket = 0;
+	if(latencyNs > 1000)
+	{
+		bucket = (int)std::ceil(bucketsPerOctave * std::log((double)latencyNs / 1000.0) / std::log(2.0));
+		if(bucket >= numBuckets)
+		{
+			bucket = numBuckets - 1;
+		}
+	}
+	this->buckets[bucket]++;
+	this->total++;
+	if(latencyNs > this->maxNs)
+	{
+		this->maxNs = latencyNs;
+	}
+}
+
+// Empty the histogram
+void LatencyHistogram::clear()
+{
+	for(int i=0; i<numBuckets; i++)
+	{
+		this->buckets[i] = 0;
+	}
+	this->total = 0;
+	this->maxNs = 0;
+}
+
+// Return the latency in seconds that the given fraction of samples do not exceed
+double LatencyHistogram::percentile(double fraction) const
+{
+	double result = 0.0;
+	if(this->total > 0)
+	{
+		int needed = (int)std::ceil(fraction * this->total);
+		int seen = 0;
+		int bucket = 0;
+		while(bucket < numBuckets-1 && seen + this->buckets[bucket] < needed)
+		{
+			seen += this->buckets[bucket];
+			bucket++;
+		}
+		result = bucketLimit(bucket);
+		if(result > this->maximum())
+		{
+			result = this->maximum();
+		}
+	}
+	return result;
+}
+
+// Return the largest latency in seconds
+double LatencyHistogram::maximum() const
+{
+	return (double)this->maxNs * 1.0e-9;
+}
+
+// Return the number of samples
+int LatencyHistogram::count() const
+{
+	return this->total;
+}
@@ -0,0 +1,31 @@
+/* LatencyHistogram.h
+ *
+ * A fixed bucket histogram of latencies.  The buckets are a quarter
+ * of an octave wide starting at one microsecond, so the percentiles
+ * are within 19% of the true value right up to the last bucket.
+ *
+ */
+#ifndef LatencyHistogram_H_
+#define LatencyHistogram_H_
+
+#include "epicsTypes.h"
+
+class LatencyHistogram
+{
+public:
+	enum {numBuckets=100, bucketsPerOctave=4};
+	LatencyHistogram();
+	virtual ~LatencyHistogram();
+	void add(epicsUInt64 latencyNs);
+	void clear();
+	double percentile(double fraction) const;
+	double maximum() const;
+	int count() const;
+private:
+	static double bucketLimit(int bucket);
+	int buckets[numBuckets];
+	int total;
+	epicsUInt64 maxNs;
+};
+
+#endif /* LatencyHistogram_H_ */
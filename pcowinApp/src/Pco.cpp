@@ -23,6 +23,9 @@
 #include "TakeLock.h"
 #include "FreeLock.h"
 #include "initHooks.h"
+#include "epicsAtomic.h"
+#include "FrameCopier.h"
+#include "Simd.h"
 #include "PcoCameraDevice.h"
 
 // Set this symbol to 1 if you want to be able to set
@@ -31,7 +34,7 @@
 // Set this symbol to 0 if you want to only do hardware
 // ROI and binning, the achieved values being reported
 // back.
-#define DO_SOFTWARE_ROI 0
+#define DO_SOFTWARE_ROI 1
 
 /** Constants
  */
@@ -69,13 +72,12 @@ const double Pco::oneNanosecond = 1e-9;
 const double Pco::oneMillisecond = 1e-3;
 const double Pco::triggerRetryPeriod = 0.01;
 const int Pco::statusMessageSize = 256;
-
-/** Aligned allocation for DLL buffers. */
-#ifdef _WIN32
-#else
-#define _aligned_malloc(siz, align) malloc(siz)
-#define _aligned_free(buff) free(buff)
-#endif
+const double Pco::ringLatencyPeriod = 0.05;
+const double Pco::overloadRetryTime = 0.02;
+const double Pco::arrayRecheckPeriod = 0.001;
+const double Pco::frameRingWaitPeriod = 0.01;
+const int Pco::bytesPerMegabyte = 1024*1024;
+const char* Pco::dataFormatNames[] = {"Default", "5x12", "5x12sqrtLUT", "5x16"};
 
 /** The PCO object map
  */
@@ -109,8 +111,10 @@ void pcoInitHookFunction(initHookState state)
  * \param[in] maxMemory The maximum amount of memory that the NDArrayPool for this driver is
  *            allowed to allocate. Set this to -1 to allow an unlimited amount of memory.
  * \param[in] numCameraDevices The number of camera devices to create firmware parameters for.
+ * \param[in] ringDepth The initial number of buffers queued to the SDK, 0 for automatic.
  */
-Pco::Pco(const char* portName, int maxBuffers, size_t maxMemory, int numCameraDevices)
+Pco::Pco(const char* portName, int maxBuffers, size_t maxMemory, int numCameraDevices,
+        int ringDepth)
 : ADDriverEx(portName, 1, maxBuffers, maxMemory)
 , paramPixRate(this, "PCO_PIX_RATE", 0)
 , paramAdcMode(this, "PCO_ADC_MODE", DllApi::adcModeDual,
@@ -192,18 +196,172 @@ Pco::Pco(const char* portName, int maxBuffers, size_t maxMemory, int numCameraDe
 , paramRoiSymmetryY(this, "PCO_ROI_SYMMETRY_Y", 0)
 , paramInterfaceType(this, "PCO_INTERFACE", 0)
 , paramInterfaceIsCameraLink(this, "PCO_USES_CAMERALINK", 0)
+, paramZeroCopy(this, "PCO_ZERO_COPY", 0)
+, paramRingDepth(this, "PCO_RING_DEPTH", ringDepth)
+, paramRingDepthActual(this, "PCO_RING_DEPTH_ACTUAL", Pco::numQueuedBuffers)
+, paramRingMemory(this, "PCO_RING_MEMORY", 1024)
+, paramRingOccupancy(this, "PCO_RING_OCCUPANCY", 0)
+, paramRingHighWater(this, "PCO_RING_HIGH_WATER", 0)
+, paramHandoffLatency(this, "PCO_HANDOFF_LATENCY", 0.0)
+, paramHandoffLatencyMax(this, "PCO_HANDOFF_LATENCY_MAX", 0.0)
+, paramBusyPoll(this, "PCO_BUSY_POLL", 0)
+, paramBusyPollPause(this, "PCO_BUSY_POLL_PAUSE", 1)
+, paramOverloadPolicy(this, "PCO_OVERLOAD_POLICY", Pco::overloadDropNewest)
+, paramOverloadDecimation(this, "PCO_OVERLOAD_DECIMATION", 4)
+, paramOverloadReserve(this, "PCO_OVERLOAD_RESERVE", 4)
+, paramBuffersInUseHigh(this, "PCO_BUFFERS_IN_USE_HIGH", 0)
+, paramBufferAllocator(this, "PCO_BUFFER_ALLOCATOR", BufferAllocator::kindHeap)
+, paramBufferNode(this, "PCO_BUFFER_NODE", BufferAllocator::anyNode)
+, paramBufferPages(this, "PCO_BUFFER_PAGES", BufferAllocator::pagesStandard)
+, paramBufferNodeActual(this, "PCO_BUFFER_NODE_ACTUAL", BufferAllocator::anyNode)
+, paramBufferFallback(this, "PCO_BUFFER_FALLBACK", 0)
+, paramPrewarm(this, "PCO_PREWARM", 0)
+, paramPrewarmArrays(this, "PCO_PREWARM_ARRAYS", 0)
+, paramPrewarmDuration(this, "PCO_PREWARM_DURATION", 0.5)
+, paramPrewarmCount(this, "PCO_PREWARM_COUNT", 0)
+, paramPrewarmTime(this, "PCO_PREWARM_TIME", 0.0)
+, paramPoolBuffers(this, "PCO_POOL_BUFFERS", 0)
+, paramPoolFree(this, "PCO_POOL_FREE", 0)
+, paramPoolMemory(this, "PCO_POOL_MEMORY", 0)
+, paramSumOutput(this, "PCO_SUM_OUTPUT", ExposureAccumulator::outputSum)
+, paramSumKernel(this, "PCO_SUM_KERNEL", Simd::isaNames[Simd::isa()])
+, paramDecompress(this, "PCO_DECOMPRESS", 0)
+, paramDecompressActive(this, "PCO_DECOMPRESS_ACTIVE", 0)
+, paramProcessWorkers(this, "PCO_PROCESS_WORKERS", 0)
+, paramReorderDepth(this, "PCO_REORDER_DEPTH", 16)
+, paramSequenceWindow(this, "PCO_SEQUENCE_WINDOW", 4)
+, paramSequenceTimeout(this, "PCO_SEQUENCE_TIMEOUT", 0.1)
+, paramGapFill(this, "PCO_GAP_FILL", Pco::gapFillDuplicate)
+, paramMetaData(this, "PCO_METADATA", 0)
+, paramMetaDataActive(this, "PCO_METADATA_ACTIVE", 0)
+, paramAttributeCache(this, "PCO_ATTRIBUTE_CACHE", 0)
+, paramFrameStats(this, "PCO_FRAME_STATS", 0)
+, paramFrameStatsActive(this, "PCO_FRAME_STATS_ACTIVE", 0)
+, paramStatsSaturation(this, "PCO_STATS_SATURATION", 0)
+, paramStatsSample(this, "PCO_STATS_SAMPLE", FrameStats::defaultSample)
+, paramStatsPeriod(this, "PCO_STATS_PERIOD", 0.5)
+, paramStatsMin(this, "PCO_STATS_MIN", 0)
+, paramStatsMax(this, "PCO_STATS_MAX", 0)
+, paramStatsMean(this, "PCO_STATS_MEAN", 0.0)
+, paramStatsSigma(this, "PCO_STATS_SIGMA", 0.0)
+, paramStatsTotal(this, "PCO_STATS_TOTAL", 0.0)
+, paramStatsSaturated(this, "PCO_STATS_SATURATED", 0)
+, paramDrainRate(this, "PCO_DRAIN_RATE", 0.0)
+, paramDrainEta(this, "PCO_DRAIN_ETA", 0.0)
+, paramRingCapture(this, "PCO_RING_CAPTURE", 0)
+, paramRingCaptureActive(this, "PCO_RING_CAPTURE_ACTIVE", 0)
+, paramRingPreTrigger(this, "PCO_RING_PRE_TRIGGER", 100)
+, paramRingPostTrigger(this, "PCO_RING_POST_TRIGGER", 100)
+, paramRingSource(this, "PCO_RING_SOURCE", Pco::ringSourceSoft)
+, paramRingTrigger(this, "PCO_RING_TRIGGER", 0,
+		new AsynParam::Notify<Pco>(this, &Pco::onRingTrigger))
+, paramRingTriggered(this, "PCO_RING_TRIGGERED", 0)
+, paramReadoutStart(this, "PCO_READOUT_START", 1)
+, paramReadoutStop(this, "PCO_READOUT_STOP", 0)
+, paramReadoutStride(this, "PCO_READOUT_STRIDE", 1)
+, paramReadoutPreview(this, "PCO_READOUT_PREVIEW", 0)
+, paramReadoutAdd(this, "PCO_READOUT_ADD", 0,
+		new AsynParam::Notify<Pco>(this, &Pco::onReadoutAdd))
+, paramReadoutClear(this, "PCO_READOUT_CLEAR", 0,
+		new AsynParam::Notify<Pco>(this, &Pco::onReadoutClear))
+, paramReadoutQueued(this, "PCO_READOUT_QUEUED", 0)
+, paramReadout(this, "PCO_READOUT", 0,
+		new AsynParam::Notify<Pco>(this, &Pco::onReadout))
+, paramReadoutHeld(this, "PCO_READOUT_HELD", 0)
+, paramPingPong(this, "PCO_PING_PONG", 0)
+, paramPingPongActive(this, "PCO_PING_PONG_ACTIVE", 0)
+, paramPingPongSplit(this, "PCO_PING_PONG_SPLIT", 50)
+, paramPingPongBursts(this, "PCO_PING_PONG_BURSTS", 0)
+, paramPingPongCount(this, "PCO_PING_PONG_COUNT", 0)
+, paramRecordSegment(this, "PCO_RECORD_SEGMENT", 1)
 , stateMachine(NULL)
 , triggerTimer(NULL)
+, sequenceTimer(NULL)
 , api(NULL)
 , errorTrace(getAsynUser(), ASYN_TRACE_ERROR)
 , apiTrace(getAsynUser(), Pco::traceFlagsDllApi)
 , gangTrace(getAsynUser(), Pco::traceFlagsGang)
 , performanceTrace(getAsynUser(), Pco::traceFlagsPerformance)
 , stateTrace(getAsynUser(), Pco::traceFlagsPcoState)
-, receivedImageQueue(1000, sizeof(NDArray*))
+, headerDecoder(HeaderDecoder::create(DllApi::bitAlignmentLsb, HeaderDecoder::pixelBits))
+, ingestQueue(Pco::numApiBuffers)
+, ingestEvent(epicsEventEmpty)
+, ingestGeneration(0)
+, ingestExit(false)
+, ingestPlacementGeneration(ThreadPlacement::unapplied)
+, ingestThread(NULL)
+, handoffLatencySum(0.0)
+, handoffLatencyCount(0)
+, handoffLatencyMax(0.0)
+, drainGeneration(-1)
+, drainNext(0)
+, drainRange(0)
+, drainSegment(0)
+, drainLost(0)
+, frameRing(Pco::frameRingCapacity)
+, frameRingSignalled(0)
+, frameRingRoom(epicsEventEmpty)
+, receivedImageQueue(1000, sizeof(ReceivedFrame))
+, frameWorkers(this, portName)
+, processWorkers(0)
+, reorderDepth(16)
+, heldCount(0)
+, sequenceWindow(4)
+, sequenceTimeout(0.1)
+, gapFill(Pco::gapFillDuplicate)
+, overloadPolicy(Pco::overloadDropNewest)
+, overloadDecimation(4)
+, reserveSize(4)
+, dropOldestRequests(0)
+, arraysReturned(epicsEventEmpty)
+, overloadGeneration(0)
+, decimating(false)
+, decimateCount(0)
+, arraysInUse(0)
+, arraysInUseHighWater(0)
 , gangServer(NULL)
 , gangConnection(NULL)
 , performanceMonitor(NULL)
+, drainTotal(0)
+, drainImages(0)
+, drainStartTime(0)
+, ramFirst(1)
+, ramLast(0)
+, ramHeld(false)
+, readoutPreview(false)
+, pingPong(false)
+, pingPongSplit(50)
+, pingPongBursts(0)
+, pingPongCount(0)
+, pingPongRecording(false)
+, recordSegment(1)
+, ringCapture(false)
+, ringPreTrigger(0)
+, ringPostTrigger(0)
+, ringSource(Pco::ringSourceSoft)
+, ringState(Pco::ringOff)
+, ringEnableSeen(false)
+, ringLastImage(0)
+, ringTriggerImage(0)
+, ringPostFrames(0)
+, fifoQueueSize(Pco::numQueuedBuffers)
+, numAllocatedBuffers(0)
+, ringOccupancy(0)
+, ringHighWater(0)
+, zeroCopy(false)
+, metaDataSize(0)
+, attributeCache(false)
+, frameStatsActive(false)
+, statsSkip(0)
+, statsPeriod(0.5)
+, statsPublishedTime(0)
+, busyPoll(0)
+, busyPollPauseMode(0)
+, acquiring(0)
+, bufferAllocator(NULL)
+, bufferAllocatorKind(BufferAllocator::kindHeap)
+, bufferNode(BufferAllocator::anyNode)
+, sumOutput(ExposureAccumulator::outputSum)
 {
     // Put in global map
     Pco::thePcos[portName] = this;
@@ -220,6 +378,24 @@ Pco::Pco(const char* portName, int maxBuffers, size_t maxMemory, int numCameraDe
 	paramADStatusMessage = "Disconnected";
 	// The performance monitoring system
 	performanceMonitor = new PerformanceMonitor(this, &performanceTrace);
+	// The thread placement read backs
+	for(int i=0; i<ThreadPlacement::numRoles; i++)
+	{
+		std::string name = std::string("PCO_THREAD_") + ThreadPlacement::roleNames[i];
+		paramThreadCpus[i] = new StringParam(this, (name + "_CPUS").c_str(), "");
+		paramThreadPriority[i] = new IntegerParam(this, (name + "_PRIORITY").c_str(), 0);
+	}
+	// The frame statistics histogram
+	for(int i=0; i<FrameStats::numBins; i++)
+	{
+		char name[32];
+		epicsSnprintf(name, sizeof(name), "PCO_STATS_HIST%d", i);
+		paramStatsHistogram[i] = new IntegerParam(this, name, 0);
+	}
+	this->statsSettings = this->exposureStats.settings;
+	this->clearFrameTimes();
+	// Make sure the shared frame copy engine exists before acquisition starts
+	FrameCopier::instance();
     // We are not connected to a camera
     camera = NULL;
     // Initialise the buffers
@@ -227,8 +403,12 @@ Pco::Pco(const char* portName, int maxBuffers, size_t maxMemory, int numCameraDe
     {
         buffers[i].bufferNumber = DllApi::bufferUnallocated;
         buffers[i].buffer = NULL;
+        buffers[i].array = NULL;
+        buffers[i].allocatedSize = 0;
         buffers[i].eventHandle = NULL;
         buffers[i].ready = false;
+        buffers[i].inFlight = 0;
+        buffers[i].memoryImage = 0;
     }
     // Initialise the enum strings
     for(int i=0; i<DllApi::descriptionNumPixelRates; i++)
@@ -280,6 +460,9 @@ Pco::Pco(const char* portName, int maxBuffers, size_t maxMemory, int numCameraDe
 	requestReboot = stateMachine->event("Reboot");
 	requestMakeImages = stateMachine->event("MakeImages");
 	requestApplyBinningAndRoi = stateMachine->event("ApplyBinningAndRoi");
+	requestProcessFrames = stateMachine->event("ProcessFrames");
+	requestRingTrigger = stateMachine->event("RingTrigger");
+	requestReadout = stateMachine->event("Readout");
 	// Transitions
 	stateMachine->transition(stateUninitialised, requestInitialise, new StateMachine::Act<Pco>(this, &Pco::smInitialiseWait), stateUnconnected);
 	stateMachine->transition(stateUninitialised, requestStop, new StateMachine::Act<Pco>(this, &Pco::smAlreadyStopped), stateUninitialised);
@@ -302,7 +485,7 @@ Pco::Pco(const char* portName, int maxBuffers, size_t maxMemory, int numCameraDe
 	stateMachine->transition(stateAcquiring, requestTrigger, new StateMachine::Act<Pco>(this, &Pco::smTrigger), stateAcquiring);
 	stateMachine->transition(stateAcquiring, requestStop, new StateMachine::Act<Pco>(this, &Pco::smStopAcquisition), stateIdle, stateArmed);
 	stateMachine->transition(stateAcquiring, requestAcquire, new StateMachine::Act<Pco>(this, &Pco::smTrigger), stateAcquiring);
-	stateMachine->transition(stateDraining, requestImageReceived, new StateMachine::Act<Pco>(this, &Pco::smDrainImage), stateDraining, stateIdle, stateArmed);
+	stateMachine->transition(stateDraining, requestImageReceived, new StateMachine::Act<Pco>(this, &Pco::smDrainImage), stateDraining, stateIdle, stateArmed, stateAcquiring);
 	stateMachine->transition(stateDraining, requestTimerExpiry, new StateMachine::Act<Pco>(this, &Pco::smPollWhileDraining), stateDraining);
 	stateMachine->transition(stateDraining, requestStop, new StateMachine::Act<Pco>(this, &Pco::smStopAcquisition), stateIdle, stateArmed);
 	stateMachine->transition(stateExternalAcquiring, requestTimerExpiry, new StateMachine::Act<Pco>(this, &Pco::smPollWhileAcquiring), stateExternalAcquiring);
@@ -310,7 +493,7 @@ Pco::Pco(const char* portName, int maxBuffers, size_t maxMemory, int numCameraDe
 	stateMachine->transition(stateExternalAcquiring, requestMakeImages, new StateMachine::Act<Pco>(this, &Pco::smMakeGangedImage), stateExternalAcquiring, stateIdle, stateArmed);
 	stateMachine->transition(stateExternalAcquiring, requestStop, new StateMachine::Act<Pco>(this, &Pco::smStopAcquisition), stateIdle, stateArmed);
 	stateMachine->transition(stateExternalAcquiring, requestAcquire, new StateMachine::Act<Pco>(this, &Pco::smAcquire), stateExternalAcquiring);
-	stateMachine->transition(stateExternalDraining, requestImageReceived, new StateMachine::Act<Pco>(this, &Pco::smExternalDrainImage), stateExternalDraining, stateIdle, stateArmed);
+	stateMachine->transition(stateExternalDraining, requestImageReceived, new StateMachine::Act<Pco>(this, &Pco::smExternalDrainImage), stateExternalDraining, stateIdle, stateArmed, stateExternalAcquiring);
 	stateMachine->transition(stateExternalDraining, requestTimerExpiry, new StateMachine::Act<Pco>(this, &Pco::smPollWhileDraining), stateExternalDraining);
 	stateMachine->transition(stateExternalDraining, requestStop, new StateMachine::Act<Pco>(this, &Pco::smStopAcquisition), stateIdle, stateArmed);
 	stateMachine->transition(stateUnarmedAcquiring, requestTimerExpiry, new StateMachine::Act<Pco>(this, &Pco::smPollWhileAcquiring), stateUnarmedAcquiring);
@@ -318,14 +501,43 @@ Pco::Pco(const char* portName, int maxBuffers, size_t maxMemory, int numCameraDe
 	stateMachine->transition(stateUnarmedAcquiring, requestMakeImages, new StateMachine::Act<Pco>(this, &Pco::smUnarmedMakeGangedImage), stateUnarmedAcquiring, stateIdle);
 	stateMachine->transition(stateUnarmedAcquiring, requestTrigger, new StateMachine::Act<Pco>(this, &Pco::smTrigger), stateUnarmedAcquiring);
 	stateMachine->transition(stateUnarmedAcquiring, requestStop, new StateMachine::Act<Pco>(this, &Pco::smExternalStopAcquisition), stateIdle);
-	stateMachine->transition(stateUnarmedDraining, requestImageReceived, new StateMachine::Act<Pco>(this, &Pco::smUnarmedDrainImage), stateUnarmedDraining, stateIdle);
+	stateMachine->transition(stateUnarmedDraining, requestImageReceived, new StateMachine::Act<Pco>(this, &Pco::smUnarmedDrainImage), stateUnarmedDraining, stateIdle, stateArmed, stateUnarmedAcquiring);
 	stateMachine->transition(stateUnarmedDraining, requestTimerExpiry, new StateMachine::Act<Pco>(this, &Pco::smPollWhileDraining), stateUnarmedDraining);
 	stateMachine->transition(stateUnarmedDraining, requestStop, new StateMachine::Act<Pco>(this, &Pco::smExternalStopAcquisition), stateIdle);
 	stateMachine->transition(stateIdle, requestApplyBinningAndRoi, new StateMachine::Act<Pco>(this, &Pco::smApplyBinningAndRoi), stateIdle);
+	// Frame processing that finishes off the state machine's thread only matters while acquiring
+	stateMachine->transition(stateAcquiring, requestProcessFrames, new StateMachine::Act<Pco>(this, &Pco::smAcquireImage), stateAcquiring, stateIdle, stateArmed, stateDraining);
+	stateMachine->transition(stateExternalAcquiring, requestProcessFrames, new StateMachine::Act<Pco>(this, &Pco::smExternalAcquireImage), stateExternalAcquiring, stateIdle, stateArmed, stateExternalDraining);
+	stateMachine->transition(stateUnarmedAcquiring, requestProcessFrames, new StateMachine::Act<Pco>(this, &Pco::smUnarmedAcquireImage), stateUnarmedAcquiring, stateIdle, stateUnarmedDraining);
+	// A trigger freezes the ring buffer, the RAM is read once the frames after it are in
+	stateMachine->transition(stateAcquiring, requestRingTrigger, new StateMachine::Act<Pco>(this, &Pco::smRingTrigger), stateAcquiring, stateDraining);
+	stateMachine->transition(stateExternalAcquiring, requestRingTrigger, new StateMachine::Act<Pco>(this, &Pco::smRingTrigger), stateExternalAcquiring, stateExternalDraining);
+	stateMachine->transition(stateUnarmedAcquiring, requestRingTrigger, new StateMachine::Act<Pco>(this, &Pco::smRingTrigger), stateUnarmedAcquiring, stateUnarmedDraining);
+	// A recording kept in the camera RAM by a preview can be read out again
+	stateMachine->transition(stateArmed, requestReadout, new StateMachine::Act<Pco>(this, &Pco::smReadout), stateDraining, stateArmed);
 	// State machine starting state
 	stateMachine->initialState(stateUninitialised);
 	// A timer for the trigger
     triggerTimer = new StateMachine::Timer(stateMachine);
+	// A timer for giving up on a gap in the image numbers
+	sequenceTimer = new StateMachine::Timer(stateMachine);
+    // The thread that takes frames out of the SDK buffers
+    std::string ingestThreadName = std::string(portName) + "Ingest";
+    ingestThread = new IngestThread(this, ingestThreadName.c_str());
+}
+
+/**
+ * Ingest thread constructor
+ * \param[in] owner The PCO object the thread works for
+ * \param[in] threadName The name of the thread
+ */
+Pco::IngestThread::IngestThread(Pco* owner, const char* threadName)
+: thread(*this, threadName,
+        epicsThreadGetStackSize(epicsThreadStackMedium),
+        epicsThreadPriorityHigh)
+, owner(owner)
+{
+    this->thread.start();
 }
 
 /**
@@ -333,6 +545,16 @@ Pco::Pco(const char* portName, int maxBuffers, size_t maxMemory, int numCameraDe
  */
 Pco::~Pco()
 {
+    this->frameWorkers.invalidate();
+    this->frameWorkers.flush();
+    this->frameWorkers.configure(0, 1);
+    this->clearHeldFrames();
+    // Stop the ingest thread before the buffers it uses are freed
+    ingestExit = true;
+    this->invalidateIngest();
+    ingestEvent.signal();
+    frameRingRoom.signal();
+    ingestThread->exitWait();
     try
     {
         api->setRecordingState(this->camera, DllApi::recorderStateOff);
@@ -348,14 +570,28 @@ Pco::~Pco()
     }
     for(int i=0; i<Pco::numApiBuffers; i++)
     {
-        if(buffers[i].buffer != NULL)
-        {
-			_aligned_free(buffers[i].buffer);
-        }
+        releaseImageBuffer(i);
     }
+    delete ingestThread;
     delete triggerTimer;
+    delete sequenceTimer;
     delete stateMachine;
     delete performanceMonitor;
+    delete bufferAllocator;
+    delete headerDecoder;
+    for(size_t i=0; i<workerDecoders.size(); i++)
+    {
+        delete workerDecoders[i];
+    }
+    for(int i=0; i<ThreadPlacement::numRoles; i++)
+    {
+        delete paramThreadCpus[i];
+        delete paramThreadPriority[i];
+    }
+    for(int i=0; i<FrameStats::numBins; i++)
+    {
+        delete paramStatsHistogram[i];
+    }
 }
 
 /**
@@ -503,14 +739,29 @@ StateMachine::StateSelector Pco::smPollWhileAcquiring()
 			this->camType.camType != DllApi::cameraTypeEdgeGl &&
 			this->camType.camType != DllApi::cameraTypeEdgeCLHS)
 	{
-		TakeLock takeLock(&this->apiLock);
-		try
 		{
-			pollCameraAcquisition();
-			pollCamera();
+			TakeLock takeLock(&this->apiLock);
+			try
+			{
+				pollCameraAcquisition();
+				pollCamera();
+			}
+			catch(PcoException&)
+			{
+			}
 		}
-		catch(PcoException&)
+		// The acquire enable signal going inactive can freeze the ring buffer
+		if(this->ringState == Pco::ringRecording && this->ringSource == Pco::ringSourceAcqEnable)
 		{
+			TakeLock takeLock(this);
+			if(paramAcqEnable != 0)
+			{
+				this->ringEnableSeen = true;
+			}
+			else if(this->ringEnableSeen)
+			{
+				this->post(Pco::requestRingTrigger);
+			}
 		}
 	}
     stateMachine->startTimer(Pco::acquisitionStatusPollPeriod, Pco::requestTimerExpiry);
@@ -528,6 +779,63 @@ StateMachine::StateSelector Pco::smPollWhileDraining()
     return StateMachine::firstState;
 }
 
+/**
+ * Freeze the ring buffer.  The frames after the trigger are still to be
+ * recorded, the camera RAM is read once they are in.
+ * returns: firstState: waiting for the frames after the trigger
+ *          secondState: start draining memory
+ */
+StateMachine::StateSelector Pco::smRingTrigger()
+{
+	StateMachine::StateSelector result = StateMachine::firstState;
+	if(this->ringState == Pco::ringRecording)
+	{
+		this->ringTriggerImage = this->ringLastImage;
+		this->ringPostFrames = 0;
+		epicsAtomicSetIntT(&this->ringState, Pco::ringTriggered);
+		TakeLock takeLock(this);
+		paramRingTriggered = 1;
+	}
+	if(this->ringState == Pco::ringTriggered && this->ringComplete())
+	{
+		readFirstMemoryImage();
+		result = StateMachine::secondState;
+	}
+	return result;
+}
+
+/**
+ * Read out the recording a preview kept in the camera RAM again, the
+ * images given by the readout parameters.
+ * returns: firstState: reading the memory
+ *          secondState: there is no recording to read
+ */
+StateMachine::StateSelector Pco::smReadout()
+{
+	StateMachine::StateSelector result = StateMachine::secondState;
+	if(this->ramHeld)
+	{
+		this->nowAcquiring();
+		epicsAtomicSetIntT(&this->ringState, Pco::ringOff);
+		this->invalidateIngest();
+		{
+			TakeLock takeApiLock(&this->apiLock);
+			try
+			{
+				this->api->cancelImages(this->camera);
+			}
+			catch(PcoException&)
+			{
+			}
+		}
+		discardImages();
+		this->drainSegment = 0;
+		this->startReadout();
+		result = StateMachine::firstState;
+	}
+	return result;
+}
+
 /**
  * Try to arm the camera
  * returns: firstState: success
@@ -773,6 +1081,8 @@ StateMachine::StateSelector Pco::smUnarmedAcquireImage()
  * Handle an image during unarmed memory draining.
  * Returns: firstState: further images to be drained
  *          secondState: acquisition complete and disarmed
+ *          thirdState: preview complete and still armed
+ *          fourthState: waiting for the next ping-pong burst
  */
 StateMachine::StateSelector Pco::smUnarmedDrainImage()
 {
@@ -783,6 +1093,19 @@ StateMachine::StateSelector Pco::smUnarmedDrainImage()
 		// More to handle
 		result = StateMachine::firstState;
 	}
+	else if(this->pingPongRecording)
+	{
+		// The next ping-pong burst is being recorded
+		result = this->nextPingPongBurst() ? StateMachine::firstState : StateMachine::fourthState;
+	}
+	else if(this->readoutPreview)
+	{
+		// Draining complete, keep the recording for another readout
+		this->holdRecording();
+		acquisitionComplete();
+		discardImages();
+		result = StateMachine::thirdState;
+	}
 	else
 	{
 		// Draining complete
@@ -839,6 +1162,7 @@ StateMachine::StateSelector Pco::smExternalAcquireImage()
  * Returns: firstState: further images to be drained
  *          secondState: acquisition complete and disarmed
  *          thirdState: acquisition complete and still armed
+ *          fourthState: waiting for the next ping-pong burst
  */
 StateMachine::StateSelector Pco::smDrainImage()
 {
@@ -849,6 +1173,19 @@ StateMachine::StateSelector Pco::smDrainImage()
 		// More draining to perform
 		result = StateMachine::firstState;
 	}
+	else if(this->pingPongRecording)
+	{
+		// The next ping-pong burst is being recorded
+		result = this->nextPingPongBurst() ? StateMachine::firstState : StateMachine::fourthState;
+	}
+	else if(this->readoutPreview)
+	{
+		// Complete, the recording is kept for another readout
+		this->holdRecording();
+		acquisitionComplete();
+		discardImages();
+		result = StateMachine::thirdState;
+	}
 	else if((triggerMode == DllApi::triggerAuto) || (triggerMode == DllApi::triggerExternalOnly))
 	{
 		// Complete and disarmed
@@ -870,10 +1207,11 @@ StateMachine::StateSelector Pco::smDrainImage()
 }
 
 /**
- * Handle an image during unarmed memory draining.
+ * Handle an image during externally triggered memory draining.
  * Returns: firstState: further images to be drained
  *          secondState: acquisition complete and disarmed
  *          thirdState: acquisition complete and still armed
+ *          fourthState: waiting for the next ping-pong burst
  */
 StateMachine::StateSelector Pco::smExternalDrainImage()
 {
@@ -884,6 +1222,19 @@ StateMachine::StateSelector Pco::smExternalDrainImage()
 		// More to handle
 		result = StateMachine::firstState;
 	}
+	else if(this->pingPongRecording)
+	{
+		// The next ping-pong burst is being recorded
+		result = this->nextPingPongBurst() ? StateMachine::firstState : StateMachine::fourthState;
+	}
+	else if(this->readoutPreview)
+	{
+		// Complete, the recording is kept for another readout
+		this->holdRecording();
+		acquisitionComplete();
+		discardImages();
+		result = StateMachine::thirdState;
+	}
 	else if(triggerMode == DllApi::triggerAuto)
 	{
 		// Normal mode, automatic triggering
@@ -955,204 +1306,580 @@ StateMachine::StateSelector Pco::smApplyBinningAndRoi()
 }
 
 /**
- * Start reading the camera's internal memory
+ * Start reading the camera's internal memory once a burst has been
+ * recorded.  The recording is every image of the burst, or for a ring
+ * buffer the window around the trigger.  Ping-pong bursts carry on
+ * recording into the other segment while this one is read.
  */
 void Pco::readFirstMemoryImage()
 {
-	// Read the first image
+	// Stop the live images, the buffers the ingest thread has not
+	// finished with are not given back
+	this->invalidateIngest();
 	this->api->cancelImages(this->camera);
-	try
+	if(this->pingPong)
 	{
-		this->api->setRecordingState(this->camera, DllApi::recorderStateOff);
+		this->pingPongCount++;
+		this->drainSegment = this->recordSegment;
+		this->swapRamSegment(this->pingPongBursts == 0 || this->pingPongCount < this->pingPongBursts);
 	}
-	catch(PcoException&)
+	else
 	{
+		this->drainSegment = 0;
+		try
+		{
+			this->api->setRecordingState(this->camera, DllApi::recorderStateOff);
+		}
+		catch(PcoException&)
+		{
+		}
 	}
-	memoryImageCounter = 1;
-	this->api->getImageEx(this->camera, /*segment=*/1, memoryImageCounter,
-		memoryImageCounter, /*bufferNumber=*/0, 
-		this->xCamSize, this->yCamSize, this->camDescription.dynResolution);
 	discardImages();
-	// Get an ND array
-	NDArray* image = allocArray(this->xCamSize, this->yCamSize, NDUInt16);
-	if(image != NULL)
+	// The recording, a ring buffer only has its window around the trigger
+	unsigned long first = 1;
+	unsigned long last = (unsigned long)(this->numImages*this->numExposures);
+	if(this->ringState != Pco::ringOff)
 	{
-		// Copy the image into an NDArray
-		::memcpy(image->pData, this->buffers[0].buffer,
-				this->xCamSize*this->yCamSize*sizeof(unsigned short));
-		// And pass it to the state machine
-		this->receivedImageQueue.send(&image, sizeof(NDArray*));
+		this->ringWindow(first, last);
 	}
-	this->post(Pco::requestImageReceived);
+	this->ramFirst = first;
+	this->ramLast = last;
+	this->startReadout();
 }
 
 /**
- * Process the previous image and read the next image from the camera's internal memory.
- * Returns true if another image is read.
+ * Start reading the images of the recording that the readout parameters
+ * ask for: the queued ranges, or if there are none the start, stop and
+ * stride.  The images are numbered from 1 within the recording.  Every
+ * buffer in the ring is given to the SDK for the next image in turn, so
+ * the transfers run back to back.  The ingest thread copies each image
+ * out and gives its buffer straight back for the next image still to be
+ * read, while the state machine processes the images already copied.
+ * Live images must already have been stopped.
  */
-bool Pco::readNextMemoryImage()
+void Pco::startReadout()
 {
-	bool result = false;
-	// Get the image from the queue
-	NDArray* image;
-    this->receivedImageQueue.tryReceive(&image, sizeof(NDArray*));
-	// Continue processing the image
-	if(image != NULL)
+	std::vector<ReadoutRange> requested;
 	{
-		validateAndProcessFrame(image);
+		TakeLock takeLock(this);
+		if(this->readoutQueue.empty())
+		{
+			requested.push_back(this->requestedRange());
+		}
+		else
+		{
+			requested.swap(this->readoutQueue);
+		}
+		// Ping-pong bursts do not stop for a preview
+		this->readoutPreview = paramReadoutPreview != 0 && !this->pingPong;
+		paramReadoutQueued = 0;
+		paramReadoutHeld = 0;
 	}
-	// Update statistics
-	TakeLock takeLock(this);
-	paramADNumExposuresCounter = this->numExposuresCounter;
-	paramImageNumber = this->lastImageNumber;
-	paramCamRamUseFrames = paramCamRamUseFrames - 1;
-	memoryImageCounter++;
-	// Are we finished?
-	if(this->numImagesCounter < this->numImages)
-	{
-		// More images to read
-		this->api->getImageEx(this->camera, /*segment=*/1, memoryImageCounter,
-			memoryImageCounter, /*bufferNumber=*/0, 
-			this->xCamSize, this->yCamSize, this->camDescription.dynResolution);
-		// Get an ND array
-		NDArray* image = allocArray(this->xCamSize, this->yCamSize, NDUInt16);
-		if(image != NULL)
+	this->ramHeld = false;
+	// Into RAM image numbers, a last of 0 is the end of the recording
+	unsigned long length = this->ramLast >= this->ramFirst ? this->ramLast - this->ramFirst + 1 : 0;
+	std::vector<ReadoutRange> ranges;
+	this->drainTotal = 0;
+	for(size_t i=0; i<requested.size(); i++)
+	{
+		unsigned long last = requested[i].last == 0 || requested[i].last > length ?
+				length : requested[i].last;
+		if(requested[i].first <= last)
 		{
-			// Copy the image into an NDArray
-			::memcpy(image->pData, this->buffers[0].buffer,
-					this->xCamSize*this->yCamSize*sizeof(unsigned short));
-			// And pass it to the state machine
-			this->receivedImageQueue.send(&image, sizeof(NDArray*));
+			ReadoutRange range;
+			range.first = this->ramFirst + requested[i].first - 1;
+			range.last = this->ramFirst + last - 1;
+			range.stride = requested[i].stride;
+			ranges.push_back(range);
+			this->drainTotal += (last - requested[i].first) / range.stride + 1;
 		}
-		this->post(Pco::requestImageReceived);
-		result = true;
 	}
-	return result;
+	this->drainImages = this->drainTotal / (this->numExposures > 0 ? this->numExposures : 1);
+	this->numImagesCounter = 0;
+	this->numExposuresCounter = 0;
+	this->exposureAccumulator.reset();
+	this->memoryImageCounter = 0;
+	this->drainStartTime = epicsMonotonicGet();
+	epicsAtomicSetIntT(&this->drainLost, 0);
+	{
+		// A new generation tells the images apart from live ones still on their way
+		TakeLock ingest(&this->ingestLock);
+		this->ingestGeneration++;
+		epicsAtomicSetIntT(&this->drainGeneration, this->ingestGeneration);
+		this->arraysReturned.signal();
+		TakeLock takeApiLock(&this->apiLock);
+		this->queueHead = 0;
+		for(int i=0; i<this->fifoQueueSize; i++)
+		{
+			epicsAtomicSetIntT(&this->buffers[i].inFlight, 0);
+		}
+		this->drainRanges.swap(ranges);
+		this->drainRange = 0;
+		this->drainNext = this->drainRanges.empty() ? 1 : this->drainRanges[0].first;
+		unsigned long memoryImage;
+		for(int i=0; i<this->fifoQueueSize &&
+				this->ingestQueue.pending() < this->ingestQueue.capacity() &&
+				(memoryImage = this->nextDrainImage()) != 0; i++)
+		{
+			this->buffers[i].memoryImage = memoryImage;
+			if(this->drainSegment != 0)
+			{
+				// The ingest thread reads from a segment the camera may be recording beside
+				IngestItem item;
+				item.bufferNumber = i;
+				item.statusDrv = 0;
+				item.generation = this->ingestGeneration;
+				item.segment = this->drainSegment;
+				epicsTimeGetCurrent(&item.handoffTime);
+				item.wakeupTime = epicsMonotonicGet();
+				epicsAtomicSetIntT(&this->buffers[i].inFlight, 1);
+				this->ingestQueue.tryPush(item);
+			}
+			else
+			{
+				this->api->addBufferEx(this->camera, /*firstImage=*/memoryImage,
+					/*lastImage=*/memoryImage, this->buffers[i].bufferNumber,
+					this->xCamSize, this->yCamSize, this->camDescription.dynResolution);
+			}
+		}
+	}
+	if(this->drainSegment != 0)
+	{
+		this->ingestEvent.signal();
+	}
+	// The drain state finishes even if there is nothing to read
+	this->post(Pco::requestImageReceived);
+	TakeLock takeLock(this);
+	paramDrainRate = 0.0;
+	paramDrainEta = 0.0;
 }
 
 /**
- * Try and make stitched images in the full control ganged mode.
- * Returns: firstState: further images to be acquired
- *          secondState: acquisition complete and disarmed
- *          thirdState: acquisition complete and still armed
+ * The next RAM image for the drain to give the SDK, stepping through the
+ * ranges.  Call with the ingest lock taken.
+ * \return The image or 0 if there are no more
  */
-StateMachine::StateSelector Pco::smMakeGangedImage()
+unsigned long Pco::nextDrainImage() throw()
 {
-	StateMachine::StateSelector result;
-	if(!makeImages())
+	unsigned long result = 0;
+	while(result == 0 && this->drainRange < this->drainRanges.size())
 	{
-        result = StateMachine::firstState;
+		const ReadoutRange& range = this->drainRanges[this->drainRange];
+		if(this->drainNext <= range.last)
+		{
+			result = this->drainNext;
+			this->drainNext += range.stride;
+		}
+		else if(++this->drainRange < this->drainRanges.size())
+		{
+			this->drainNext = this->drainRanges[this->drainRange].first;
+		}
 	}
-    else if(triggerMode != DllApi::triggerSoftware)
-    {
-        acquisitionComplete();
-        doDisarm();
-        result = StateMachine::secondState;
-    }
-    else
-    {
-        acquisitionComplete();
-        result = StateMachine::thirdState;
-    }
-    return result;
+	return result;
 }
 
 /**
- * Try and make stiched images in the full control ganged mode during unarmed acquisition.
- * Returns: firstState: further images to be acquired
- *          secondState: acquisition complete and disarmed
+ * Stop recording into the segment that has just filled and, if there are
+ * more bursts to come, carry on in the other one.  The other segment has
+ * been read by now, so it is cleared first.
+ * \param[in] record Carry on recording
  */
-StateMachine::StateSelector Pco::smUnarmedMakeGangedImage()
+void Pco::swapRamSegment(bool record) throw()
 {
-	StateMachine::StateSelector result;
-	if(!makeImages())
 	{
-        result = StateMachine::firstState;
+		TakeLock takeApiLock(&this->apiLock);
+		try
+		{
+			this->api->setRecordingState(this->camera, DllApi::recorderStateOff);
+		}
+		catch(PcoException&)
+		{
+		}
+		this->pingPongRecording = false;
+		if(record)
+		{
+			try
+			{
+				unsigned short segment = this->recordSegment == 1 ? 2 : 1;
+				this->api->setActiveRamSegment(this->camera, segment);
+				this->api->clearRamSegment(this->camera);
+				this->api->setRecordingState(this->camera, DllApi::recorderStateOn);
+				this->recordSegment = segment;
+				this->pingPongRecording = true;
+			}
+			catch(PcoException& e)
+			{
+				errorTrace << "Failed to swap RAM segment, " << e.what() << std::endl;
+			}
+		}
 	}
-    else
-    {
-        acquisitionComplete();
-        doDisarm();
-        discardImages();
-        result = StateMachine::secondState;
-    }
-    return result;
+	TakeLock takeLock(this);
+	paramPingPongCount = this->pingPongCount;
+	paramRecordSegment = this->recordSegment;
 }
 
 /**
- * Disarm the camera and discard any images in the queues.
- * Returns: firstState: always
+ * A ping-pong drain has finished while the camera records the next
+ * burst.  Start reading the next burst if it is already in, otherwise
+ * give the buffers back for live images to watch it being recorded.
+ * \return True if the next burst is being read
  */
-StateMachine::StateSelector Pco::smDisarmAndDiscard()
+bool Pco::nextPingPongBurst()
 {
-	acquisitionComplete();
-    doDisarm();
-    discardImages();
-    // Release the stop busy record
+	bool result = false;
+	int ramUsePercent;
+	int ramUseFrames;
+	{
+		TakeLock takeApiLock(&this->apiLock);
+		this->checkMemoryBuffer(ramUsePercent, ramUseFrames);
+	}
+	if(ramUseFrames >= this->numImages*this->numExposures)
+	{
+		this->readFirstMemoryImage();
+		result = true;
+	}
+	else
+	{
+		this->resumeLiveImages();
+	}
 	TakeLock takeLock(this);
-	paramConfirmedStop = 0;
-	return StateMachine::firstState;
+	paramCamRamUse = ramUsePercent;
+	paramCamRamUseFrames = ramUseFrames;
+	return result;
 }
 
 /**
- * Software trigger the camera
- * Returns: firstState: always
+ * Give every buffer back to the SDK for live images after a drain.
  */
-StateMachine::StateSelector Pco::smTrigger()
+void Pco::resumeLiveImages() throw()
 {
-    startCamera();
-    return StateMachine::firstState;
+	this->numImagesCounter = 0;
+	this->numExposuresCounter = 0;
+	TakeLock ingest(&this->ingestLock);
+	this->ingestGeneration++;
+	this->drainNext = 0;
+	this->arraysReturned.signal();
+	TakeLock takeApiLock(&this->apiLock);
+	this->queueHead = 0;
+	for(int i=0; i<this->fifoQueueSize; i++)
+	{
+		epicsAtomicSetIntT(&this->buffers[i].inFlight, 0);
+		this->buffers[i].memoryImage = 0;
+		try
+		{
+			this->api->addBufferEx(this->camera, /*firstImage=*/0, /*lastImage=*/0,
+				this->buffers[i].bufferNumber, this->xCamSize, this->yCamSize,
+				this->camDescription.dynResolution);
+		}
+		catch(PcoException&)
+		{
+		}
+	}
 }
 
 /**
- * Stop the camera acquiring
- * Returns: firstState: camera is stopped and disarmed
- *          secondState: camera is stopped but still armed
+ * The pages of the camera RAM in each of the ping-pong segments
+ * \param[out] seg1 The pages in segment 1
+ * \param[out] seg2 The pages in segment 2
  */
-StateMachine::StateSelector Pco::smStopAcquisition()
+void Pco::pingPongPages(unsigned long& seg1, unsigned long& seg2) const throw()
 {
-	StateMachine::StateSelector result;
-    if(triggerMode != DllApi::triggerSoftware)
-    {
-        acquisitionComplete();
-        doDisarm();
-		discardImages();
-        result = StateMachine::firstState;
-    }
-    else
-    {
-        acquisitionComplete();
-		discardImages();
-        result = StateMachine::secondState;
-    }
-    // Release the stop busy record
-	TakeLock takeLock(this);
-	paramConfirmedStop = 0;
-    return result;
+	seg1 = (unsigned long)((double)this->camStorage.ramSizePages * this->pingPongSplit / 100.0);
+	seg2 = this->camStorage.ramSizePages - seg1;
 }
 
 /**
- * Stop the camera acquiring when triggered by an external trigger
- * Returns: firstState: always
+ * Keep the recording in the camera RAM for another readout, the camera
+ * stays armed until then.
  */
-StateMachine::StateSelector Pco::smExternalStopAcquisition()
+void Pco::holdRecording() throw()
 {
-	acquisitionComplete();
-	doDisarm();
-	discardImages();
-    // Release the stop busy record
+	this->ramHeld = true;
 	TakeLock takeLock(this);
-	paramConfirmedStop = 0;
-	return StateMachine::firstState;
+	paramReadoutHeld = 1;
 }
 
-
-/** Initialise the camera
+/**
+ * Process the images read from the camera's internal memory so far.
+ * Returns true if there are more to come.
  */
-void Pco::initialiseCamera(TakeLock& takeLock)
+bool Pco::readNextMemoryImage()
 {
-	// Get various camera data
-	api->getGeneral(camera);
+	// Images copied from now on need a new image received event
+	epicsAtomicSetIntT(&this->frameRingSignalled, 0);
+	ReceivedFrame frames[Pco::frameBatchSize];
+	int n;
+	while(this->numImagesCounter < (int)this->drainImages &&
+			(n = this->takeFrames(frames, Pco::frameBatchSize)) > 0)
+	{
+		for(int i=0; i<n; i++)
+		{
+			if(frames[i].generation != epicsAtomicGetIntT(&this->drainGeneration) ||
+				this->numImagesCounter >= (int)this->drainImages)
+			{
+				// A live image from before the drain, or more than we need
+				frames[i].image->release();
+			}
+			else
+			{
+				frames[i].dequeuedTime = epicsMonotonicGet();
+				this->decodeFrame(frames[i], this->headerDecoder);
+				// The readout skips images on purpose, each follows on from
+				// the last, unnumbered ones by their place in the recording
+				this->lastImageNumber = frames[i].numbered ? frames[i].imageNumber - 1 :
+						(long)(frames[i].memoryImage - this->ramFirst);
+				validateAndProcessFrame(frames[i]);
+				// The memory is read in order, there is nothing to wait for
+				this->releaseHeldFrames(true);
+				this->memoryImageCounter++;
+			}
+		}
+	}
+	// Are we finished?  Images the ingest thread lost will never arrive.
+	unsigned long handled = this->memoryImageCounter +
+		(unsigned long)epicsAtomicGetIntT(&this->drainLost);
+	bool result = this->numImagesCounter < (int)this->drainImages && handled < this->drainTotal;
+	if(!result)
+	{
+		this->endMemoryDrain();
+	}
+	// The throughput so far and the time left at that rate
+	double elapsed = (double)(epicsMonotonicGet() - this->drainStartTime) * Pco::oneNanosecond;
+	double imageBytes = (double)this->xCamSize * this->yCamSize * sizeof(unsigned short);
+	unsigned long remaining = result ? this->drainTotal - handled : 0;
+	// Update statistics
+	TakeLock takeLock(this);
+	paramADNumExposuresCounter = this->numExposuresCounter;
+	paramImageNumber = this->lastImageNumber;
+	paramCamRamUseFrames = (int)remaining;
+	if(elapsed > 0.0 && this->memoryImageCounter > 0)
+	{
+		paramDrainRate = this->memoryImageCounter * imageBytes / elapsed / Pco::bytesPerMegabyte;
+		paramDrainEta = remaining * elapsed / this->memoryImageCounter;
+	}
+	return result;
+}
+
+/**
+ * Stop reading the camera's internal memory, taking back the buffers
+ * still queued for images that are not wanted.  Does nothing if the
+ * memory is not being read.
+ */
+void Pco::endMemoryDrain() throw()
+{
+	bool draining;
+	{
+		TakeLock ingest(&this->ingestLock);
+		draining = this->drainNext != 0;
+	}
+	if(draining)
+	{
+		this->invalidateIngest();
+		TakeLock takeApiLock(&this->apiLock);
+		try
+		{
+			this->api->cancelImages(this->camera);
+		}
+		catch(PcoException&)
+		{
+		}
+	}
+}
+
+/**
+ * Work out the images of a frozen ring buffer to read: the frames before
+ * and after the trigger, oldest first, the way the camera numbers the
+ * images in a ring buffer segment.  The recording may have run on past
+ * the frames wanted after the trigger.  If the frames carry their image
+ * number, the newest is read to find out by how much.
+ * \param[out] first The first image to read
+ * \param[out] last The last image to read, first-1 if there are none
+ */
+void Pco::ringWindow(unsigned long& first, unsigned long& last) throw()
+{
+	unsigned long validImages = 0;
+	unsigned long maxImages = 0;
+	try
+	{
+		this->api->getNumberOfImagesInSegment(this->camera, /*segment=*/1, &validImages, &maxImages);
+	}
+	catch(PcoException&)
+	{
+	}
+	last = validImages;
+	if(validImages > 0 && this->ringTriggerImage > 0)
+	{
+		try
+		{
+			this->api->getImageEx(this->camera, /*segment=*/1, validImages, validImages,
+				this->buffers[0].bufferNumber, this->xCamSize, this->yCamSize,
+				this->camDescription.dynResolution);
+			const unsigned short* newest = this->buffers[0].buffer;
+			if(this->isImageValid(newest))
+			{
+				long overrun = this->headerDecoder->imageNumber(newest) -
+					(this->ringTriggerImage + this->ringPostTrigger);
+				if(overrun > 0)
+				{
+					last = (unsigned long)overrun < validImages ? validImages - overrun : 0;
+				}
+			}
+		}
+		catch(PcoException&)
+		{
+		}
+	}
+	unsigned long span = (unsigned long)(this->ringPreTrigger + this->ringPostTrigger);
+	first = last > span ? last - span + 1 : 1;
+	if(last == 0)
+	{
+		first = 1;
+	}
+}
+
+/**
+ * Have the frames wanted after the ring buffer trigger been recorded?
+ * Counted by image number if the frames carry it, otherwise by the
+ * live frames seen since the trigger.
+ */
+bool Pco::ringComplete() const throw()
+{
+	bool result;
+	if(this->ringTriggerImage > 0)
+	{
+		result = this->ringLastImage - this->ringTriggerImage >= this->ringPostTrigger;
+	}
+	else
+	{
+		result = this->ringPostFrames >= this->ringPostTrigger;
+	}
+	return result;
+}
+
+/**
+ * Try and make stitched images in the full control ganged mode.
+ * Returns: firstState: further images to be acquired
+ *          secondState: acquisition complete and disarmed
+ *          thirdState: acquisition complete and still armed
+ */
+StateMachine::StateSelector Pco::smMakeGangedImage()
+{
+	StateMachine::StateSelector result;
+	if(!makeImages())
+	{
+        result = StateMachine::firstState;
+	}
+    else if(triggerMode != DllApi::triggerSoftware)
+    {
+        acquisitionComplete();
+        doDisarm();
+        result = StateMachine::secondState;
+    }
+    else
+    {
+        acquisitionComplete();
+        result = StateMachine::thirdState;
+    }
+    return result;
+}
+
+/**
+ * Try and make stiched images in the full control ganged mode during unarmed acquisition.
+ * Returns: firstState: further images to be acquired
+ *          secondState: acquisition complete and disarmed
+ */
+StateMachine::StateSelector Pco::smUnarmedMakeGangedImage()
+{
+	StateMachine::StateSelector result;
+	if(!makeImages())
+	{
+        result = StateMachine::firstState;
+	}
+    else
+    {
+        acquisitionComplete();
+        doDisarm();
+        discardImages();
+        result = StateMachine::secondState;
+    }
+    return result;
+}
+
+/**
+ * Disarm the camera and discard any images in the queues.
+ * Returns: firstState: always
+ */
+StateMachine::StateSelector Pco::smDisarmAndDiscard()
+{
+	acquisitionComplete();
+    doDisarm();
+    discardImages();
+    // Release the stop busy record
+	TakeLock takeLock(this);
+	paramConfirmedStop = 0;
+	return StateMachine::firstState;
+}
+
+/**
+ * Software trigger the camera
+ * Returns: firstState: always
+ */
+StateMachine::StateSelector Pco::smTrigger()
+{
+    startCamera();
+    return StateMachine::firstState;
+}
+
+/**
+ * Stop the camera acquiring
+ * Returns: firstState: camera is stopped and disarmed
+ *          secondState: camera is stopped but still armed
+ */
+StateMachine::StateSelector Pco::smStopAcquisition()
+{
+	StateMachine::StateSelector result;
+	endMemoryDrain();
+    if(triggerMode != DllApi::triggerSoftware)
+    {
+        acquisitionComplete();
+        doDisarm();
+		discardImages();
+        result = StateMachine::firstState;
+    }
+    else
+    {
+        acquisitionComplete();
+		discardImages();
+        result = StateMachine::secondState;
+    }
+    // Release the stop busy record
+	TakeLock takeLock(this);
+	paramConfirmedStop = 0;
+    return result;
+}
+
+/**
+ * Stop the camera acquiring when triggered by an external trigger
+ * Returns: firstState: always
+ */
+StateMachine::StateSelector Pco::smExternalStopAcquisition()
+{
+	acquisitionComplete();
+	doDisarm();
+	discardImages();
+    // Release the stop busy record
+	TakeLock takeLock(this);
+	paramConfirmedStop = 0;
+	return StateMachine::firstState;
+}
+
+
+/** Initialise the camera
+ */
+void Pco::initialiseCamera(TakeLock& takeLock)
+{
+	// Get various camera data
+	api->getGeneral(camera);
 	api->getCameraType(camera, &camType);
 	api->getSensorStruct(camera);
 	api->getCameraDescription(camera, &camDescription);
@@ -1288,8 +2015,7 @@ void Pco::initialiseCamera(TakeLock& takeLock)
     getDeviceFirmwareInfo();
 
 	// Work out how to decode the BCD frame number in the image
-	this->shiftLowBcd = Pco::bitsPerShortWord - this->camDescription.dynResolution;
-	this->shiftHighBcd = this->shiftLowBcd + Pco::bitsPerNybble;
+	this->createHeaderDecoder(paramBitAlignment);
 
 	// Set the camera clock
 	this->setCameraClock();
@@ -1470,7 +2196,7 @@ bool Pco::pollCameraAcquisition()
 		int mask = 1;
 		unsigned long statusDll;
 		unsigned long statusDrv;
-		for(int i=0; i<Pco::numApiBuffers; i++)
+		for(int i=0; i<this->numAllocatedBuffers; i++)
 		{
 			this->api->getBufferStatus(this->camera, this->buffers[i].bufferNumber, &statusDll, &statusDrv);
 			if((statusDll & DllApi::statusDllEventSet) != 0)
@@ -1478,9 +2204,33 @@ bool Pco::pollCameraAcquisition()
 				flags |= mask << this->buffers[i].bufferNumber;
 			}
 		}
+		// Ingest statistics, the mean is over the poll period
+		int occupancy;
+		int highWater;
+		double latencyMean = 0.0;
+		double latencyMax;
+		{
+			TakeLock takeLock(&this->apiLock);
+			occupancy = this->ringOccupancy;
+			highWater = this->ringHighWater;
+			if(this->handoffLatencyCount > 0)
+			{
+				latencyMean = this->handoffLatencySum / this->handoffLatencyCount;
+			}
+			latencyMax = this->handoffLatencyMax;
+			this->handoffLatencySum = 0.0;
+			this->handoffLatencyCount = 0;
+		}
         // Update EPICS
 		TakeLock takeLock(this);
 		paramBuffersReady = (int)flags;
+		paramRingOccupancy = occupancy;
+		paramRingHighWater = highWater;
+		paramHandoffLatency = latencyMean / Pco::oneMillisecond;
+		paramHandoffLatencyMax = latencyMax / Pco::oneMillisecond;
+		paramBuffersInUse = epicsAtomicGetIntT(&this->arraysInUse);
+		paramBuffersInUseHigh = epicsAtomicGetIntT(&this->arraysInUseHighWater);
+		performanceMonitor->publishLatency(takeLock);
     }
     catch(PcoException& e)
     {
@@ -1523,6 +2273,15 @@ bool Pco::pollCamera()
 	    paramCamRamUse = ramUsePercent;
 		paramCamRamUseFrames = ramUseFrames;
 		paramBuffersInUse = this->pNDArrayPool->getNumBuffers() - this->pNDArrayPool->getNumFree();
+		paramBuffersInUseHigh = epicsAtomicGetIntT(&this->arraysInUseHighWater);
+		for(int i=0; i<ThreadPlacement::numRoles; i++)
+		{
+			std::string cpus;
+			int priority;
+			ThreadPlacement::effective(this->portName, (ThreadPlacement::Role)i, cpus, priority);
+			*paramThreadCpus[i] = cpus;
+			*paramThreadPriority[i] = priority;
+		}
     }
     catch(PcoException& e)
     {
@@ -1582,6 +2341,11 @@ void Pco::onAcquire(TakeLock& takeLock)
     		gangServer->start();
     	}
     }
+    else if(epicsAtomicGetIntT(&this->ringState) == Pco::ringRecording)
+    {
+        // A stop freezes a recording ring buffer, which is then read out
+        this->post(Pco::requestRingTrigger);
+    }
     else
     {
         // Stop the acquisition
@@ -1624,6 +2388,7 @@ void Pco::onClearStateRecord(TakeLock& takeLock)
 {
     if(paramClearStateRecord)
     {
+        stateMachine->clearRecord();
         paramStateRecord = "";
         paramClearStateRecord = 0;
     }
@@ -1656,17 +2421,11 @@ void Pco::onGetImage(TakeLock& takeLock)
 	{
 		TakeLock(&this->apiLock);
 		this->api->getImageEx(this->camera, /*segment=*/1, 0,
-			0, /*bufferNumber=*/Pco::getImageBuffer, 
+			0, /*bufferNumber=*/this->getImageBuffer(), 
 			this->xCamSize, this->yCamSize, this->camDescription.dynResolution);
-		// Get an ND array
-		NDArray* image = allocArray(this->xCamSize, this->yCamSize, NDUInt16);
-		if(image != NULL)
+		// Copy the image into an NDArray and pass it to the state machine
+		if(this->sendFrame(this->buffers[0].buffer))
 		{
-			// Copy the image into an NDArray
-			::memcpy(image->pData, this->buffers[0].buffer,
-					this->xCamSize*this->yCamSize*sizeof(unsigned short));
-			// And pass it to the state machine
-			this->receivedImageQueue.send(&image, sizeof(NDArray*));
 			this->post(Pco::requestImageReceived);
 		}
 	}
@@ -1696,12 +2455,12 @@ void Pco::post(const StateMachine::Event* req)
 /**
  * Allocate an ND array
  */
-NDArray* Pco::allocArray(int sizeX, int sizeY, NDDataType_t dataType)
+NDArray* Pco::allocArray(int sizeX, int sizeY, NDDataType_t dataType, bool countFailure)
 {
     size_t maxDims[] = {sizeX, sizeY};
     NDArray* image = this->pNDArrayPool->alloc(sizeof(maxDims)/sizeof(size_t),
             maxDims, dataType, 0, NULL);
-    if(image == NULL)
+    if(image == NULL && countFailure)
     {
         // Out of area detector NDArrays
     	TakeLock takeLock(this);
@@ -1710,84 +2469,700 @@ NDArray* Pco::allocArray(int sizeX, int sizeY, NDDataType_t dataType)
     return image;
 }
 
+/**
+ * Allocate an ND array for a frame, the size and type the software ROI produces
+ */
+NDArray* Pco::allocFrameArray(bool countFailure)
+{
+    return allocArray((int)this->frameTransform.outputSizeX(), (int)this->frameTransform.outputSizeY(),
+            this->frameTransform.outputType(), countFailure);
+}
+
+/**
+ * Copy a frame out of an SDK buffer into an ND array, doing the software
+ * ROI on the way, and keep its binary header.  The frame statistics are
+ * gathered during a plain copy, the binary header is left out of them.
+ * \param[in] image The array from allocFrameArray
+ * \param[in] buffer The SDK buffer
+ * \param[out] frame Gets the header and statistics
+ * \return False if the array no longer fits the frame, there has been an arm
+ */
+bool Pco::extractFrame(NDArray* image, const unsigned short* buffer, ReceivedFrame& frame) throw()
+{
+    bool result = true;
+    ::memcpy(frame.header, buffer, sizeof(frame.header));
+    frame.hasStats = false;
+    if(this->frameTransform.required())
+    {
+        result = this->frameTransform.apply(image, buffer);
+    }
+    else if(this->frameStatsActive)
+    {
+        int pixels = this->xCamSize*this->yCamSize;
+        int skip = this->statsSkip < pixels ? this->statsSkip : pixels;
+        unsigned short* pixel = (unsigned short*)image->pData;
+        ::memcpy(pixel, buffer, skip*sizeof(unsigned short));
+        frame.stats.settings = this->statsSettings;
+        frame.stats.reset();
+        FrameCopier::instance().copy(pixel + skip, buffer + skip,
+                (pixels - skip)*sizeof(unsigned short), &frame.stats);
+        frame.hasStats = true;
+    }
+    else
+    {
+        FrameCopier::instance().copy(image->pData, buffer,
+                this->xCamSize*this->yCamSize*sizeof(unsigned short));
+    }
+    return result;
+}
+
+/**
+ * Read the meta data of the frame in an SDK buffer if the camera is
+ * sending them.  Must be done before the buffer goes back to the SDK.
+ * \param[in] bufferNumber The SDK's number for the buffer
+ * \param[out] frame Gets the meta data
+ */
+void Pco::readMetaData(short bufferNumber, ReceivedFrame& frame) throw()
+{
+    frame.hasMetaData = false;
+    if(epicsAtomicGetIntT(&this->metaDataSize) > 0)
+    {
+        try
+        {
+            this->api->getMetaData(this->camera, bufferNumber, &frame.metaData);
+            frame.hasMetaData = true;
+        }
+        catch(PcoException&)
+        {
+        }
+    }
+}
+
+/**
+ * Copy a frame read on demand out of an SDK buffer and pass it to the
+ * state machine through the message queue.
+ * \param[in] buffer The SDK buffer
+ * \return False if there was no array for it
+ */
+bool Pco::sendFrame(const unsigned short* buffer)
+{
+    bool result = false;
+    NDArray* image = allocFrameArray();
+    if(image != NULL)
+    {
+        ReceivedFrame frame;
+        frame.image = image;
+        frame.wakeupTime = 0;
+        frame.copiedTime = 0;
+        frame.dequeuedTime = 0;
+        frame.heldTime = 0;
+        frame.generation = this->ingestGeneration;
+        frame.memoryImage = 0;
+        frame.hasMetaData = false;
+        frame.attributesAdded = false;
+        for(int i=0; i<Pco::numApiBuffers; i++)
+        {
+            if(this->buffers[i].buffer == buffer)
+            {
+                this->readMetaData(this->buffers[i].bufferNumber, frame);
+            }
+        }
+        if(this->extractFrame(image, buffer, frame))
+        {
+            this->receivedImageQueue.send(&frame, sizeof(ReceivedFrame));
+            result = true;
+        }
+        else
+        {
+            image->release();
+        }
+    }
+    return result;
+}
+
 /**
  * A frame has been received.  This is an indication that
  * a frame is ready in the specified buffer.  We must also
  * check all buffers from the last frame to this one for
  * valid frames otherwise things may go out of order.
+ * This runs on the capture thread so it only identifies the
+ * filled buffers and hands them to the ingest thread, which
+ * does the copying and gives the buffers back to the SDK.
  */
 void Pco::frameReceived(int bufferNumber)
 {
-// JAT: This version needs a lock to avoid reentrant calls to the dll
-//      We need to get the image out of the DLL buffer as soon as possible
-//      and return the buffer to the DLL.  Otherwise, the edge at high
-//      rates loses frames.
 	// To avoid deadlocks, we mustn't take the parameter lock at the same time
 	// as the api lock.  So we count the errors locally and then pass them
 	// to the performance monitor at the end.
-	int frameStatusError = 0;
 	int captureError = 0;
+	int handedOff = 0;
+	// The capture loop calls us as soon as it wakes for the buffer
+	epicsUInt64 wakeupTime = epicsMonotonicGet();
 	{
 		// We need to grab the API for the whole of this part
 		TakeLock takeLock(&this->apiLock);
-		// Try receiving from the current head to the given buffer number
-		int tryBuffer;
-		bool going = true;
-		do
+		// Ignore wake ups for buffers we already have
+		unsigned long statusDll;
+		unsigned long statusDrv;
+		bool going = epicsAtomicGetIntT(&this->buffers[bufferNumber].inFlight) == 0;
+		if(going)
+		{
+			this->api->getBufferStatus(this->camera, bufferNumber, &statusDll, &statusDrv);
+			going = (statusDll & DllApi::statusDllEventSet) != 0;
+		}
+		// Count the filled buffers we find, that's how far behind the SDK we are
+		int occupancy = 0;
+		// Try receiving from the current head to the given buffer number
+		int tryBuffer = bufferNumber;
+		while(going)
 		{
 			tryBuffer = this->queueHead;
-			// Get the buffer status
-			unsigned long statusDll;
-			unsigned long statusDrv;
-			this->api->getBufferStatus(this->camera, tryBuffer, &statusDll, &statusDrv);
-			if((statusDll & DllApi::statusDllEventSet) != 0)
+			if(epicsAtomicGetIntT(&this->buffers[tryBuffer].inFlight) != 0)
 			{
-				// Buffer is good for further processing
-				// No error or buffer cancelled.
-				if(statusDrv == 0)
+				// The ingest thread hasn't given this one back yet
+				going = false;
+			}
+			else
+			{
+				this->api->getBufferStatus(this->camera, tryBuffer, &statusDll, &statusDrv);
+				IngestItem item;
+				item.bufferNumber = tryBuffer;
+				item.statusDrv = statusDrv;
+				item.generation = this->ingestGeneration;
+				item.segment = 0;
+				epicsTimeGetCurrent(&item.handoffTime);
+				item.wakeupTime = wakeupTime;
+				if((statusDll & DllApi::statusDllEventSet) == 0)
 				{
-					// Copy the image from the buffer into a frame
-					NDArray* image = allocArray(this->xCamSize, this->yCamSize, NDUInt16);
-					if(image != NULL)
-					{
-						// Copy the image into an NDArray
-						::memcpy(image->pData, this->buffers[tryBuffer].buffer,
-								this->xCamSize*this->yCamSize*sizeof(unsigned short));
-						// And pass it to the state machine
-						this->receivedImageQueue.send(&image, sizeof(NDArray*));
-						this->post(Pco::requestImageReceived);
-					}
+					// Buffer has not been given to us
+					captureError++;
+					going = false;
+				}
+				else if(!this->ingestQueue.tryPush(item))
+				{
+					// Cannot happen, the queue holds every buffer
+					captureError++;
+					going = false;
 				}
 				else
 				{
-					// There was an error associated with the frame
-					frameStatusError++;
+					epicsAtomicSetIntT(&this->buffers[tryBuffer].inFlight, 1);
+					occupancy++;
+					handedOff++;
+					this->queueHead = (tryBuffer + 1) % this->fifoQueueSize;
+					going = tryBuffer != bufferNumber;
 				}
-				// Give the buffer back to the driver
-				this->api->addBufferEx(this->camera, /*firstImage=*/0,
-					/*lastImage=*/0, tryBuffer,
+			}
+		}
+		if(handedOff > 0)
+		{
+			this->ringOccupancy = occupancy;
+			if(occupancy > this->ringHighWater)
+			{
+				this->ringHighWater = occupancy;
+			}
+		}
+	}
+	if(handedOff > 0)
+	{
+		this->ingestEvent.signal();
+	}
+	// Now update the performance monitor
+	if(captureError > 0)
+	{
+		TakeLock takeLock(this);
+		performanceMonitor->count(takeLock, PerformanceMonitor::PERF_CAPTUREERROR, true, captureError);
+	}
+}
+
+/**
+ * The ingest thread.  Takes the filled buffers handed over by
+ * frameReceived, passes their frames to the state machine
+ * and returns the buffers to the SDK.
+ */
+void Pco::ingestRun()
+{
+	while(!this->ingestExit)
+	{
+		ThreadPlacement::apply(this->portName, ThreadPlacement::roleIngest,
+			this->ingestPlacementGeneration);
+		this->ingestEvent.wait();
+		int frameStatusError = 0;
+		IngestItem item;
+		while(this->ingestQueue.tryPop(item))
+		{
+			this->ingestFrame(item, frameStatusError);
+		}
+		if(frameStatusError > 0)
+		{
+			TakeLock takeLock(this);
+			performanceMonitor->count(takeLock, PerformanceMonitor::PERF_FRAMESTATUSERROR, true, frameStatusError);
+		}
+	}
+}
+
+/**
+ * Ingest one filled buffer.  Items queued before the last arm or
+ * disarm are dropped, their buffers no longer belong to us.
+ * \param[in] item The buffer handed over by the capture thread
+ * \param[in,out] frameStatusError Incremented if the SDK flagged the frame
+ */
+void Pco::ingestFrame(const IngestItem& item, int& frameStatusError) throw()
+{
+	// Allocate before taking any locks, allocArray may need the port lock
+	bool driverError = false;
+	NDArray* image = NULL;
+	NDArray* fresh = NULL;
+	ReceivedFrame frame;
+	frame.hasMetaData = false;
+	frame.hasStats = false;
+	frame.attributesAdded = false;
+	frame.generation = item.generation;
+	frame.heldTime = 0;
+	frame.memoryImage = 0;
+	OverloadCounts overload = {0, 0, 0};
+	bool draining = item.generation == epicsAtomicGetIntT(&this->drainGeneration);
+	if(item.statusDrv != 0)
+	{
+		// There was an error associated with the frame
+		frameStatusError++;
+	}
+	else if(draining)
+	{
+		// The camera RAM keeps the frames, so wait for an array
+		fresh = this->allocDrainArray(item.generation);
+	}
+	else
+	{
+		fresh = this->allocIngestArray(item.generation, overload);
+	}
+	{
+		TakeLock ingest(&this->ingestLock);
+		if(item.generation != this->ingestGeneration)
+		{
+			if(fresh != NULL)
+			{
+				fresh->release();
+			}
+			return;
+		}
+		epicsTimeStamp now;
+		epicsTimeGetCurrent(&now);
+		double latency = epicsTimeDiffInSeconds(&now, &item.handoffTime);
+		int index = item.bufferNumber;
+		if(fresh != NULL && item.segment != 0)
+		{
+			// Read the image out of a segment the camera is not recording into
+			TakeLock takeApiLock(&this->apiLock);
+			try
+			{
+				this->api->getImageEx(this->camera, item.segment, this->buffers[index].memoryImage,
+					this->buffers[index].memoryImage, this->buffers[index].bufferNumber,
 					this->xCamSize, this->yCamSize, this->camDescription.dynResolution);
 			}
-			else
+			catch(PcoException&)
 			{
-				// Buffer has not been given to us
-				captureError++;
-				going = false;
+				driverError = true;
+				fresh->release();
+				fresh = NULL;
+			}
+		}
+		if(fresh != NULL && this->buffers[index].array != NULL && !this->frameTransform.required())
+		{
+			// Zero copy, the buffer already is an NDArray
+			TakeLock takeApiLock(&this->apiLock);
+			try
+			{
+				image = this->swapZeroCopyBuffer(index, fresh);
+				::memcpy(frame.header, image->pData, sizeof(frame.header));
+			}
+			catch(PcoException&)
+			{
+				// Frame is lost but the buffer must still go back
+				driverError = true;
+			}
+		}
+		else if(fresh != NULL)
+		{
+			// Copy the image into an NDArray, doing any software ROI
+			image = fresh;
+			if(!this->extractFrame(image, this->buffers[index].buffer, frame))
+			{
+				image->release();
+				image = NULL;
+			}
+		}
+		// Give the buffer back to the driver
+		TakeLock takeApiLock(&this->apiLock);
+		this->handoffLatencySum += latency;
+		this->handoffLatencyCount++;
+		if(latency > this->handoffLatencyMax)
+		{
+			this->handoffLatencyMax = latency;
+		}
+		epicsAtomicSetIntT(&this->buffers[index].inFlight, 0);
+		frame.memoryImage = this->buffers[index].memoryImage;
+		if(image != NULL)
+		{
+			this->readMetaData(this->buffers[index].bufferNumber, frame);
+		}
+		// While draining the camera RAM the buffer goes back for the next
+		// image still to be read, if there is one
+		unsigned long memoryImage = 0;
+		bool addBack = true;
+		if(this->drainNext != 0)
+		{
+			memoryImage = this->nextDrainImage();
+			addBack = memoryImage != 0;
+		}
+		this->buffers[index].memoryImage = memoryImage;
+		if(addBack && item.segment != 0)
+		{
+			// The next image of the segment is read on this thread too
+			IngestItem next = item;
+			epicsTimeGetCurrent(&next.handoffTime);
+			next.wakeupTime = epicsMonotonicGet();
+			epicsAtomicSetIntT(&this->buffers[index].inFlight, 1);
+			if(!this->ingestQueue.tryPush(next))
+			{
+				epicsAtomicSetIntT(&this->buffers[index].inFlight, 0);
+				epicsAtomicIncrIntT(&this->drainLost);
+				driverError = true;
 			}
-			if(going)
+			addBack = false;
+		}
+		try
+		{
+			if(addBack)
 			{
-				this->queueHead = (tryBuffer + 1) % this->fifoQueueSize;
+				this->api->addBufferEx(this->camera, /*firstImage=*/memoryImage,
+					/*lastImage=*/memoryImage, index,
+					this->xCamSize, this->yCamSize, this->camDescription.dynResolution);
 			}
 		}
-		while(tryBuffer != bufferNumber && going);
+		catch(PcoException&)
+		{
+			driverError = true;
+		}
 	}
-	// Now update the performance monitor
-	if(frameStatusError > 0 || captureError > 0)
+	if(driverError || overload.dropNewest > 0 || overload.decimated > 0 ||
+		overload.reserveUsed > 0)
 	{
 		TakeLock takeLock(this);
-		performanceMonitor->count(takeLock, PerformanceMonitor::PERF_FRAMESTATUSERROR, true, frameStatusError);
-		performanceMonitor->count(takeLock, PerformanceMonitor::PERF_CAPTUREERROR, true, captureError);
+		if(driverError)
+		{
+			performanceMonitor->count(takeLock, PerformanceMonitor::PERF_DRIVERERROR);
+		}
+		if(overload.dropNewest > 0)
+		{
+			// Only the frames that were lost for want of an array
+			performanceMonitor->count(takeLock, PerformanceMonitor::PERF_OUTOFARRAYS, true, overload.dropNewest);
+			performanceMonitor->count(takeLock, PerformanceMonitor::PERF_DROPNEWEST, true, overload.dropNewest);
+		}
+		if(overload.decimated > 0)
+		{
+			performanceMonitor->count(takeLock, PerformanceMonitor::PERF_DECIMATED, true, overload.decimated);
+		}
+		if(overload.reserveUsed > 0)
+		{
+			performanceMonitor->count(takeLock, PerformanceMonitor::PERF_RESERVEUSED, false, overload.reserveUsed);
+		}
+	}
+	if(image != NULL)
+	{
+		// And pass it to the state machine
+		frame.image = image;
+		frame.wakeupTime = item.wakeupTime;
+		frame.copiedTime = epicsMonotonicGet();
+		this->queueFrame(frame);
+	}
+	else if(draining)
+	{
+		// The drain counts the images it will never see
+		epicsAtomicIncrIntT(&this->drainLost);
+		this->post(Pco::requestImageReceived);
+	}
+}
+
+/**
+ * Allocate the NDArray for an image read from the camera RAM.  Nothing
+ * is lost by waiting for an array, so the drain goes at the pace of the
+ * plugins instead of dropping frames.  The wait ends when frame processing
+ * returns arrays or the drain is invalidated.  Arrays the plugins return
+ * are not signalled, so they are looked for every arrayRecheckPeriod.
+ * Only the ingest thread may call this.
+ * \param[in] generation The drain the image belongs to
+ * \return The array or NULL if the drain has ended
+ */
+NDArray* Pco::allocDrainArray(int generation) throw()
+{
+	NDArray* image = allocFrameArray(false);
+	while(image == NULL && generation == epicsAtomicGetIntT(&this->ingestGeneration))
+	{
+		this->arraysReturned.wait(Pco::arrayRecheckPeriod);
+		image = allocFrameArray(false);
 	}
+	this->noteArraysInUse();
+	return image;
+}
+
+/**
+ * Allocate the NDArray for an ingested frame, applying the overload
+ * policy if the pool has run dry.  Only the ingest thread may call this.
+ * \param[in] generation The arm the frame belongs to
+ * \param[in,out] counts Incremented with what the policy did
+ * \return The array or NULL if the frame is to be dropped
+ */
+NDArray* Pco::allocIngestArray(int generation, OverloadCounts& counts) throw()
+{
+	int policy = epicsAtomicGetIntT(&this->overloadPolicy);
+	// Start afresh after each arm
+	if(generation != this->overloadGeneration)
+	{
+		this->overloadGeneration = generation;
+		this->decimating = false;
+		this->decimateCount = 0;
+	}
+	// While decimating only every Nth frame is kept
+	if(this->decimating)
+	{
+		this->decimateCount++;
+		if(this->decimateCount < epicsAtomicGetIntT(&this->overloadDecimation))
+		{
+			counts.decimated++;
+			return NULL;
+		}
+		this->decimateCount = 0;
+	}
+	// Running out is only counted if the policy cannot find an array either
+	NDArray* image = allocFrameArray(false);
+	switch(policy)
+	{
+	case Pco::overloadDropOldest:
+		if(image == NULL && this->frameRing.pending() > 0)
+		{
+			// Ask the state machine to drop its oldest frame and
+			// wait for the array to come back to the pool
+			epicsAtomicIncrIntT(&this->dropOldestRequests);
+			epicsUInt64 deadline = epicsMonotonicGet() +
+				(epicsUInt64)(Pco::overloadRetryTime / Pco::oneNanosecond);
+			while(image == NULL && epicsMonotonicGet() < deadline)
+			{
+				this->arraysReturned.wait(Pco::arrayRecheckPeriod);
+				image = allocFrameArray(false);
+			}
+			if(image == NULL)
+			{
+				// Withdraw the request if it has not been acted on
+				this->takeDropRequest();
+			}
+		}
+		break;
+	case Pco::overloadDecimate:
+		if(image == NULL)
+		{
+			this->decimating = true;
+			this->decimateCount = 0;
+		}
+		else if(this->decimating && this->pNDArrayPool->getNumFree() > 0)
+		{
+			// The pool has spare arrays again
+			this->decimating = false;
+		}
+		break;
+	case Pco::overloadReserve:
+		if(image == NULL)
+		{
+			TakeLock ingest(&this->ingestLock);
+			if(generation == this->ingestGeneration && !this->reserveArrays.empty())
+			{
+				image = this->reserveArrays.back();
+				this->reserveArrays.pop_back();
+				counts.reserveUsed++;
+			}
+		}
+		else
+		{
+			this->fillReserve(generation);
+		}
+		break;
+	default:
+		break;
+	}
+	if(image == NULL)
+	{
+		counts.dropNewest++;
+	}
+	this->noteArraysInUse();
+	return image;
+}
+
+/**
+ * Take one request to drop the oldest queued frame.  The state
+ * machine takes them to act on them, the ingest thread to withdraw
+ * ones that were not acted on in time.
+ * \return True if there was a request
+ */
+bool Pco::takeDropRequest() throw()
+{
+	int pending = epicsAtomicGetIntT(&this->dropOldestRequests);
+	while(pending > 0)
+	{
+		int was = epicsAtomicCmpAndSwapIntT(&this->dropOldestRequests, pending, pending-1);
+		if(was == pending)
+		{
+			return true;
+		}
+		pending = was;
+	}
+	return false;
+}
+
+/**
+ * Top up the arrays held back for the ingest path.  Arrays are
+ * only kept if no arm has happened since, so they are the right size.
+ * \param[in] generation The arm the arrays are for
+ */
+void Pco::fillReserve(int generation) throw()
+{
+	bool more = true;
+	while(more)
+	{
+		{
+			TakeLock ingest(&this->ingestLock);
+			more = generation == this->ingestGeneration &&
+				(int)this->reserveArrays.size() < epicsAtomicGetIntT(&this->reserveSize);
+		}
+		if(more)
+		{
+			NDArray* spare = allocFrameArray(false);
+			more = spare != NULL;
+			if(more)
+			{
+				TakeLock ingest(&this->ingestLock);
+				if(generation == this->ingestGeneration)
+				{
+					this->reserveArrays.push_back(spare);
+				}
+				else
+				{
+					spare->release();
+					more = false;
+				}
+			}
+		}
+	}
+}
+
+/**
+ * Give the held back arrays back to the pool.  The caller holds ingestLock.
+ */
+void Pco::releaseReserve() throw()
+{
+	for(size_t i=0; i<this->reserveArrays.size(); i++)
+	{
+		this->reserveArrays[i]->release();
+	}
+	this->reserveArrays.clear();
+}
+
+/**
+ * Sample the number of NDArrays in use and track the high water mark.
+ * Called whenever arrays are taken or given back in the frame path.
+ */
+void Pco::noteArraysInUse() throw()
+{
+	int inUse = this->pNDArrayPool->getNumBuffers() - this->pNDArrayPool->getNumFree();
+	epicsAtomicSetIntT(&this->arraysInUse, inUse);
+	int high = epicsAtomicGetIntT(&this->arraysInUseHighWater);
+	while(inUse > high)
+	{
+		int was = epicsAtomicCmpAndSwapIntT(&this->arraysInUseHighWater, high, inUse);
+		if(was == high)
+		{
+			break;
+		}
+		high = was;
+	}
+}
+
+/**
+ * Pass a streamed frame to the state machine.  Only the ingest thread
+ * may call this.  An image received event is only posted when the
+ * state machine has caught up with the previous one, so a stream of
+ * frames does not fill the state machine's request queue.  If the ring
+ * is full we wait for the state machine to take frames, as the message
+ * queue it replaces did.  The wait is given up, and the image released,
+ * if the driver is exiting or the arm the frame belongs to has ended.
+ * \param[in] frame The frame and its time stamps
+ */
+void Pco::queueFrame(const ReceivedFrame& frame) throw()
+{
+	while(!this->frameRing.tryPush(frame))
+	{
+		if(this->ingestExit ||
+			frame.generation != epicsAtomicGetIntT(&this->ingestGeneration))
+		{
+			frame.image->release();
+			return;
+		}
+		this->frameRingRoom.wait(Pco::frameRingWaitPeriod);
+	}
+	if(epicsAtomicCmpAndSwapIntT(&this->frameRingSignalled, 0, 1) == 0)
+	{
+		this->post(Pco::requestImageReceived);
+	}
+}
+
+/**
+ * Take a batch of received frames, streamed ones first.  Only the
+ * state machine thread may call this.  Frames from the message queue
+ * carry no time stamps.
+ * \param[out] frames Where to put the frames
+ * \param[in] maxFrames The most frames to take
+ * \return The number of frames taken
+ */
+int Pco::takeFrames(ReceivedFrame* frames, int maxFrames) throw()
+{
+	int n = 0;
+	while(n < maxFrames && this->frameRing.tryPop(frames[n]))
+	{
+		n++;
+	}
+	if(n > 0)
+	{
+		this->frameRingRoom.signal();
+	}
+	while(n < maxFrames && this->receivedImageQueue.tryReceive(&frames[n], sizeof(ReceivedFrame)) > 0)
+	{
+		n++;
+	}
+	return n;
+}
+
+/**
+ * Forget the time stamps of the frame being processed.
+ */
+void Pco::clearFrameTimes() throw()
+{
+	for(int i=0; i<PerformanceMonitor::numTimestamps; i++)
+	{
+		this->frameTimes[i] = 0;
+	}
+}
+
+/**
+ * Invalidate everything queued for the ingest thread and wait for
+ * it to finish with the buffer it is working on.  Call before the
+ * image buffers are freed or reallocated.
+ */
+void Pco::invalidateIngest() throw()
+{
+	TakeLock ingest(&this->ingestLock);
+	this->ingestGeneration++;
+	this->drainNext = 0;
+	this->releaseReserve();
+	this->arraysReturned.signal();
 }
 
 /**
@@ -1799,6 +3174,24 @@ void Pco::frameWaitFault()
 	performanceMonitor->count(takeLock, PerformanceMonitor::PERF_WAITFAULT);
 }
 
+/**
+ * Should the capture loop busy poll?  Only while acquiring and
+ * only if it was requested at the last arm.
+ */
+bool Pco::busyPollActive() const
+{
+	return epicsAtomicGetIntT(&this->busyPoll) != 0 &&
+		epicsAtomicGetIntT(&this->acquiring) != 0;
+}
+
+/**
+ * Should the capture loop pause the processor between polls?
+ */
+bool Pco::busyPollPause() const
+{
+	return epicsAtomicGetIntT(&this->busyPollPauseMode) != 0;
+}
+
 /**
  * Get frames from the PCO4000.  This version
  * uses the getImageEx function to receive
@@ -1819,18 +3212,10 @@ void Pco::getFrames()
 		{
 			// Try to receive an image
 			this->api->getImageEx(this->camera, /*segment=*/1, 0,
-				0, /*bufferNumber=*/Pco::getImageBuffer, 
+				0, /*bufferNumber=*/this->getImageBuffer(), 
 				this->xCamSize, this->yCamSize, this->camDescription.dynResolution);
-			// Get an ND array
-			NDArray* image = allocArray(this->xCamSize, this->yCamSize, NDUInt16);
-			if(image != NULL)
-			{
-				// Copy the image into an NDArray
-				::memcpy(image->pData, this->buffers[Pco::getImageBuffer].buffer,
-						this->xCamSize*this->yCamSize*sizeof(unsigned short));
-				// And pass it to the state machine
-				this->receivedImageQueue.send(&image, sizeof(NDArray*));
-			}
+			// Copy the image into an NDArray and pass it to the state machine
+			this->sendFrame(this->buffers[this->getImageBuffer()].buffer);
 			this->post(Pco::requestImageReceived);
 			// More frames?
 			this->api->getNumberOfImagesInSegment(this->camera, /*segment=*/1, &validImages, &maxImages);
@@ -1879,7 +3264,7 @@ void Pco::pollForFrames()
 				{
 					printf("#### Getting an image\n");
 					this->api->getImageEx(this->camera, /*segment=*/1, 0,
-						0, /*bufferNumber=*/Pco::getImageBuffer, 
+						0, /*bufferNumber=*/this->getImageBuffer(), 
 						this->xCamSize, this->yCamSize, this->camDescription.dynResolution);
 				}
 				catch(PcoException&)
@@ -1887,15 +3272,9 @@ void Pco::pollForFrames()
 					TakeLock takeLock(this);
 					performanceMonitor->count(takeLock, PerformanceMonitor::PERF_DRIVERERROR);
 				}
-				// Get an ND array
-				NDArray* image = allocArray(this->xCamSize, this->yCamSize, NDUInt16);
-				if(image != NULL)
+				// Copy the image into an NDArray and pass it to the state machine
+				if(this->sendFrame(this->buffers[0].buffer))
 				{
-					// Copy the image into an NDArray
-					::memcpy(image->pData, this->buffers[0].buffer,
-							this->xCamSize*this->yCamSize*sizeof(unsigned short));
-					// And pass it to the state machine
-					this->receivedImageQueue.send(&image, sizeof(NDArray*));
 					this->post(Pco::requestImageReceived);
 				}
 				// Count frames read by the poll
@@ -1916,31 +3295,77 @@ asynUser* Pco::getAsynUser()
 }
 
 /**
- * Allocate image buffers and give them to the SDK.  We allocate actual memory here,
- * rather than using the NDArray memory because the SDK hangs onto the buffers, it only
+ * Allocate image buffers and give them to the SDK.  Normally we allocate actual memory
+ * here, rather than using the NDArray memory because the SDK hangs onto the buffers, it only
  * shows them to us when there is a frame ready.  We must copy the frame out of the buffer
  * into an NDArray for use by the rest of the system.
+ * In zero copy mode the buffers are NDArrays taken from the pool instead.  A filled
+ * buffer is passed on as it is and a fresh NDArray takes its place in the SDK.  Note
+ * that this holds the ring's arrays out of the pool for the whole acquisition.
+ * Only the ring, fifoQueueSize buffers, and the getImage buffer after it are
+ * allocated.  The SDK numbers buffers in the order they are allocated.
  */
 void Pco::allocateImageBuffers() throw(std::bad_alloc, PcoException)
 {
-    // Now allocate the memory and tell the SDK
-	int bufferSize = this->xCamSize * this->yCamSize;
+    // Now allocate the memory and tell the SDK, with room for any meta data
+	int bufferSize = this->xCamSize * this->yCamSize + this->metaDataSize;
     try
     {
+        // Change allocator if a different one has been chosen
         for(int i=0; i<Pco::numApiBuffers; i++)
         {
-            if(this->buffers[i].buffer != NULL)
+            this->releaseImageBuffer(i);
+        }
+        if(this->bufferAllocator == NULL || this->bufferAllocator->kind() != this->bufferAllocatorKind)
+        {
+            delete this->bufferAllocator;
+            this->bufferAllocator = BufferAllocator::create(this->bufferAllocatorKind);
+        }
+        int node = this->bufferPreferredNode();
+        int pages = this->zeroCopy ? BufferAllocator::pagesStandard : BufferAllocator::pagesHuge;
+        int actualNode = BufferAllocator::anyNode;
+        this->numAllocatedBuffers = this->fifoQueueSize + 1;
+        for(int i=0; i<this->numAllocatedBuffers; i++)
+        {
+            if(this->zeroCopy)
             {
-				_aligned_free(this->buffers[i].buffer);
+                this->buffers[i].array = allocArray(this->xCamSize, this->yCamSize, NDUInt16);
+                if(this->buffers[i].array == NULL)
+                {
+                    throw std::bad_alloc();
+                }
+                this->buffers[i].buffer = (unsigned short*)this->buffers[i].array->pData;
+            }
+            else
+            {
+                BufferAllocator::Placement placement;
+                this->buffers[i].buffer = (unsigned short*)this->bufferAllocator->allocate(
+                        bufferSize*sizeof(unsigned short), node, placement);
+                if(this->buffers[i].buffer == NULL)
+                {
+                    throw std::bad_alloc();
+                }
+                this->buffers[i].allocatedSize = bufferSize*sizeof(unsigned short);
+                pages = std::min(pages, placement.pages);
+                actualNode = i == 0 || placement.node == actualNode ? placement.node : BufferAllocator::anyNode;
             }
-			this->buffers[i].buffer = (unsigned short*)_aligned_malloc(bufferSize*sizeof(unsigned short), 0x10000);
             this->buffers[i].bufferNumber = DllApi::bufferUnallocated;
             this->buffers[i].eventHandle = NULL;
             this->api->allocateBuffer(this->camera, &this->buffers[i].bufferNumber,
                     bufferSize * sizeof(short), &this->buffers[i].buffer,
                     &this->buffers[i].eventHandle);
             this->buffers[i].ready = true;
+            this->buffers[i].inFlight = 0;
+            this->buffers[i].memoryImage = 0;
         }
+        this->handoffLatencySum = 0.0;
+        this->handoffLatencyCount = 0;
+        this->handoffLatencyMax = 0.0;
+        // Report where the buffers ended up
+        paramBufferPages = pages;
+        paramBufferNodeActual = actualNode;
+        paramBufferFallback = !this->zeroCopy && this->bufferAllocatorKind == BufferAllocator::kindHugePages &&
+                (pages != BufferAllocator::pagesHuge || (node != BufferAllocator::anyNode && actualNode != node));
     }
     catch(std::bad_alloc& e)
     {
@@ -1964,6 +3389,81 @@ void Pco::allocateImageBuffers() throw(std::bad_alloc, PcoException)
     }
 }
 
+/**
+ * Release the memory behind an image buffer, either back to the
+ * heap or, in zero copy mode, back to the NDArray pool.
+ * \param[in] index The buffer to release
+ */
+void Pco::releaseImageBuffer(int index) throw()
+{
+    if(this->buffers[index].array != NULL)
+    {
+        this->buffers[index].array->release();
+    }
+    else if(this->buffers[index].buffer != NULL)
+    {
+        this->bufferAllocator->release(this->buffers[index].buffer, this->buffers[index].allocatedSize);
+    }
+    this->buffers[index].array = NULL;
+    this->buffers[index].buffer = NULL;
+    this->buffers[index].allocatedSize = 0;
+}
+
+/**
+ * The NUMA node the SDK buffers should be placed on.  A node chosen
+ * by the user, normally the frame grabber's, wins.  Otherwise the node
+ * of the first CPU the capture thread is pinned to.
+ * \return The node, anyNode to leave it to the system
+ */
+int Pco::bufferPreferredNode() const throw()
+{
+    int result = this->bufferNode;
+    if(result < 0)
+    {
+        result = BufferAllocator::anyNode;
+        unsigned long long mask = ThreadPlacement::effectiveMask(this->portName, ThreadPlacement::roleCapture);
+        for(int cpu=0; mask != 0 && result == BufferAllocator::anyNode; cpu++, mask >>= 1)
+        {
+            if(mask & 1)
+            {
+                result = BufferAllocator::nodeOfCpu(cpu);
+            }
+        }
+    }
+    return result;
+}
+
+/**
+ * Zero copy mode: take the filled NDArray out of a buffer and give
+ * the SDK a fresh one from the pool in its place.  If the SDK refuses
+ * the fresh array it is released and the buffer keeps its old one.
+ * Must be called with the API lock held and before the buffer is
+ * returned to the SDK.
+ * \param[in] index The buffer that holds a frame
+ * \param[in] fresh The replacement array
+ * \return The filled array
+ */
+NDArray* Pco::swapZeroCopyBuffer(int index, NDArray* fresh) throw(PcoException)
+{
+    // Re-allocating an existing buffer number just moves it to new memory
+    unsigned short* freshBuffer = (unsigned short*)fresh->pData;
+    try
+    {
+        this->api->allocateBuffer(this->camera, &this->buffers[index].bufferNumber,
+                this->xCamSize * this->yCamSize * sizeof(short), &freshBuffer,
+                &this->buffers[index].eventHandle);
+    }
+    catch(PcoException&)
+    {
+        fresh->release();
+        throw;
+    }
+    NDArray* image = this->buffers[index].array;
+    this->buffers[index].array = fresh;
+    this->buffers[index].buffer = freshBuffer;
+    return image;
+}
+
 /**
  * Free the image buffers
  */
@@ -2142,11 +3642,96 @@ void Pco::addAvailableBuffer(int index) throw(PcoException)
 void Pco::addAvailableBufferAll() throw(PcoException)
 {
 	this->queueHead = 0;
-    for(int i=0; i<Pco::numQueuedBuffers; i++)
+    for(int i=0; i<this->fifoQueueSize; i++)
     {
         addAvailableBuffer(i);
     }
-	this->fifoQueueSize = Pco::numQueuedBuffers;
+}
+
+/**
+ * Work out how many buffers to queue to the SDK.  An explicit request is
+ * just limited to what the SDK can hold.  The automatic policy queues enough
+ * buffers to ride out ringLatencyPeriod of capture thread stall at the
+ * expected frame rate, limited by the memory budget.  Call after the
+ * acquisition times and image size have been configured.
+ * \return The ring depth
+ */
+int Pco::calcRingDepth() throw()
+{
+	int depth = paramRingDepth;
+	if(depth == Pco::ringDepthAuto)
+	{
+		double framePeriod = this->expectedFramePeriod();
+		depth = Pco::numQueuedBuffers;
+		if(framePeriod > 0.0)
+		{
+			depth = std::max(depth, (int)(Pco::ringLatencyPeriod / framePeriod) + 1);
+		}
+		double frameBytes = (double)this->xCamSize * this->yCamSize * sizeof(unsigned short);
+		double budget = (double)paramRingMemory * Pco::bytesPerMegabyte;
+		if(frameBytes > 0.0 && budget > 0.0)
+		{
+			depth = std::min(depth, (int)(budget / frameBytes));
+		}
+	}
+	return std::max(1, std::min(depth, (int)Pco::maxQueuedBuffers));
+}
+
+/**
+ * The expected time between frames.  Call after the acquisition
+ * times have been configured.
+ * \return The period in seconds
+ */
+double Pco::expectedFramePeriod() const throw()
+{
+	return std::max(this->acquisitionPeriod, this->exposureTime + this->delayTime);
+}
+
+/**
+ * Grow the NDArray pool before recording starts so the first frames
+ * do not wait for it to allocate.  Takes enough arrays of the ingest
+ * size for PCO_PREWARM_ARRAYS frames, or PCO_PREWARM_DURATION seconds
+ * of frames if that is 0, touches them so the memory is really there
+ * and puts them back on the pool's free list.  The pool limits still apply.
+ * \param[in] takeLock The port lock, released while the arrays are touched
+ */
+void Pco::prewarmArrayPool(TakeLock& takeLock) throw()
+{
+	int count = 0;
+	epicsUInt64 start = epicsMonotonicGet();
+	if(paramPrewarm != 0)
+	{
+		int wanted = paramPrewarmArrays;
+		double framePeriod = this->expectedFramePeriod();
+		if(wanted <= 0 && framePeriod > 0.0)
+		{
+			wanted = (int)(paramPrewarmDuration / framePeriod) + 1;
+		}
+		std::vector<NDArray*> arrays;
+		{
+			FreeLock freeLock(takeLock);
+			for(int i=0; i<wanted; i++)
+			{
+				NDArray* array = allocFrameArray(false);
+				if(array == NULL)
+				{
+					break;
+				}
+				::memset(array->pData, 0, array->dataSize);
+				arrays.push_back(array);
+			}
+			for(size_t i=0; i<arrays.size(); i++)
+			{
+				arrays[i]->release();
+			}
+		}
+		count = (int)arrays.size();
+	}
+	paramPrewarmCount = count;
+	paramPrewarmTime = (double)(epicsMonotonicGet() - start) * Pco::oneNanosecond / Pco::oneMillisecond;
+	paramPoolBuffers = this->pNDArrayPool->getNumBuffers();
+	paramPoolFree = this->pNDArrayPool->getNumFree();
+	paramPoolMemory = (int)(this->pNDArrayPool->getMemorySize() / Pco::bytesPerMegabyte);
 }
 
 /**
@@ -2155,6 +3740,9 @@ void Pco::addAvailableBufferAll() throw(PcoException)
  */
 void Pco::doArm() throw(std::bad_alloc, PcoException)
 {
+	// Nothing from the last acquisition may still be with the workers
+	this->frameWorkers.invalidate();
+	this->frameWorkers.flush();
 	TakeLock takeLock(this);
 	performanceMonitor->count(takeLock, PerformanceMonitor::PERF_ARM, /*fault=*/false);
 	// Camera now busy
@@ -2187,6 +3775,8 @@ void Pco::doArm() throw(std::bad_alloc, PcoException)
 	this->reqRoiSizeY = paramADSizeY;
 	this->reqBinX = paramADBinX;
 	this->reqBinY = paramADBinY;
+	this->reverseX = paramADReverseX;
+	this->reverseY = paramADReverseY;
     this->reqRoiPercentX = paramRoiPercentX;
     this->reqRoiPercentY = paramRoiPercentY;
 	this->adcMode = paramAdcMode;
@@ -2206,6 +3796,34 @@ void Pco::doArm() throw(std::bad_alloc, PcoException)
 	this->camlinkLongGap = paramCamlinkLongGap;
 	this->recoderSubmode = paramRecorderSubmode;
 	this->storageMode = paramStorageMode;
+	this->zeroCopy = paramZeroCopy != 0;
+	this->attributeCache = paramAttributeCache != 0;
+	this->bufferAllocatorKind = paramBufferAllocator;
+	this->bufferNode = paramBufferNode;
+	epicsAtomicSetIntT(&this->busyPoll, paramBusyPoll != 0);
+	epicsAtomicSetIntT(&this->busyPollPauseMode, paramBusyPollPause != 0);
+	epicsAtomicSetIntT(&this->overloadPolicy, (int)paramOverloadPolicy);
+	epicsAtomicSetIntT(&this->overloadDecimation, paramOverloadDecimation < 1 ? 1 : (int)paramOverloadDecimation);
+	epicsAtomicSetIntT(&this->reserveSize, paramOverloadReserve < 0 ? 0 : (int)paramOverloadReserve);
+	this->processWorkers = paramProcessWorkers < 0 ? 0 : (int)paramProcessWorkers;
+	this->reorderDepth = paramReorderDepth < 1 ? 1 : (int)paramReorderDepth;
+	this->sequenceWindow = paramSequenceWindow < 0 ? 0 : (int)paramSequenceWindow;
+	this->sequenceTimeout = paramSequenceTimeout < 0.0 ? 0.0 : (double)paramSequenceTimeout;
+	this->gapFill = paramGapFill;
+	this->ringCapture = paramRingCapture != 0 && this->storageMode == DllApi::storageModeRecorder &&
+			this->recoderSubmode == DllApi::recorderSubmodeRingBuffer;
+	this->ringPreTrigger = paramRingPreTrigger < 0 ? 0 : (int)paramRingPreTrigger;
+	this->ringPostTrigger = paramRingPostTrigger < 0 ? 0 : (int)paramRingPostTrigger;
+	this->ringSource = paramRingSource;
+	this->pingPong = paramPingPong != 0 && this->storageMode == DllApi::storageModeRecorder &&
+			this->recoderSubmode == DllApi::recorderSubmodeSequence && !this->ringCapture &&
+			this->camStorage.ramSizePages > 0;
+	this->pingPongSplit = std::max((int)Pco::pingPongSplitMin,
+			std::min((int)Pco::pingPongSplitMax, (int)paramPingPongSplit));
+	this->pingPongBursts = paramPingPongBursts < 0 ? 0 : (int)paramPingPongBursts;
+	epicsAtomicSetIntT(&this->dropOldestRequests, 0);
+	epicsAtomicSetIntT(&this->arraysInUseHighWater, 0);
+	paramBuffersInUseHigh = 0;
 
 	// Clear error counters
 	performanceMonitor->clear(takeLock);
@@ -2221,13 +3839,34 @@ void Pco::doArm() throw(std::bad_alloc, PcoException)
 	this->cfgBinningAndRoi();    // Also sets camera image size
 	this->cfgTriggerMode();
 	this->cfgTimestampMode();
+	this->cfgMetaDataMode();
 	this->cfgAcquireMode();
 	this->cfgAdcMode();
 	this->cfgBitAlignmentMode();
 	this->cfgPixelRate();
 	this->cfgAcquisitionTimes();
 
+	// Size the SDK buffer ring
+	this->fifoQueueSize = this->calcRingDepth();
+	this->ringOccupancy = 0;
+	this->ringHighWater = 0;
+	paramRingDepthActual = this->fifoQueueSize;
+	paramRingOccupancy = 0;
+	paramRingHighWater = 0;
+	paramHandoffLatency = 0.0;
+	paramHandoffLatencyMax = 0.0;
+
+	// Make sure the ingest thread has let go of the old buffers
+	{
+		FreeLock freeLock(takeLock);
+		this->invalidateIngest();
+	}
 	this->allocateImageBuffers();
+	if(this->overloadPolicy == Pco::overloadReserve)
+	{
+		this->fillReserve(this->ingestGeneration);
+	}
+	this->prewarmArrayPool(takeLock);
 
 	// Set the image parameters for the image buffer transfer inside the CamLink and GigE interface.
 	// While using CamLink or GigE this function must be called, before the user tries to get images
@@ -2236,6 +3875,38 @@ void Pco::doArm() throw(std::bad_alloc, PcoException)
 
 	this->adjustTransferParamsAndLut();
 
+	// Linearise square root LUT data on the way out of the SDK buffers
+	// if asked.  The 12 bit code is at the top of an MSB aligned pixel.
+	bool decompress = paramDecompress != 0 && this->dataFormat == dataFormat5x12sqrtLut;
+	this->frameTransform.setDecompression(!decompress ? (int)FrameTransform::noDecompression :
+			this->bitAlignmentMode == DllApi::bitAlignmentMsb ? Pco::bitsPerShortWord - FrameTransform::lutBits : 0);
+	paramDecompressActive = decompress ? 1 : 0;
+
+	// Gather frame statistics in the plain copy out of the SDK buffers,
+	// the software ROI and zero copy do not make one
+	this->frameStatsActive = paramFrameStats != 0 && !this->frameTransform.required() &&
+			this->buffers[0].array == NULL;
+	int alignShift = this->bitAlignmentMode == DllApi::bitAlignmentMsb ?
+			Pco::bitsPerShortWord - this->camDescription.dynResolution : 0;
+	int saturationLevel = paramStatsSaturation > 0 ? (int)paramStatsSaturation :
+			((1 << this->camDescription.dynResolution) - 1) << alignShift;
+	this->exposureStats.configure(this->camDescription.dynResolution + alignShift,
+			saturationLevel, paramStatsSample);
+	this->exposureStats.reset();
+	this->statsSettings = this->exposureStats.settings;
+	this->statsSkip = this->timestampMode == DllApi::timestampModeBinary ||
+			this->timestampMode == DllApi::timestampModeBinaryAndAscii ? HeaderDecoder::headerLength : 0;
+	this->statsPeriod = paramStatsPeriod;
+	this->statsPublishedTime = 0;
+	paramFrameStatsActive = this->frameStatsActive ? 1 : 0;
+
+	// The camera may not have taken the ring buffer submode
+	this->ringCapture = this->ringCapture && this->recoderSubmode == DllApi::recorderSubmodeRingBuffer;
+	paramRingCaptureActive = this->ringCapture ? 1 : 0;
+	this->pingPong = this->pingPong && this->recoderSubmode == DllApi::recorderSubmodeSequence;
+	paramPingPongActive = this->pingPong ? 1 : 0;
+	paramRecordSegment = this->recordSegment;
+
 	// Update what we have really set
 	paramADMinX = this->reqRoiStartX;
 	paramADMinY = this->reqRoiStartY;
@@ -2245,10 +3916,12 @@ void Pco::doArm() throw(std::bad_alloc, PcoException)
 	paramADBinY = this->reqBinY;
 	paramADTriggerMode = this->triggerMode;
 	paramTimestampMode = this->timestampMode;
+	paramMetaDataActive = this->metaDataSize > 0 ? 1 : 0;
 	paramAcquireMode = this->acquireMode;
 	paramAdcMode = this->adcMode;
 	paramBitAlignment = this->bitAlignmentMode;
 	paramPixRate = this->pixRateValue;
+	this->createHeaderDecoder(this->bitAlignmentMode);
 	paramADAcquireTime = this->exposureTime;
 	paramADAcquirePeriod = this->acquisitionPeriod;
 	paramDelayTime = this->delayTime;
@@ -2359,11 +4032,18 @@ void Pco::cfgStorage() throw(PcoException)
 	// Does this camera have memory?
 	if(this->camStorage.ramSizePages > 0)
 	{
-		// Yes, we want the memory all in the first segment
+		// Yes, we want the memory all in the first segment, or split
+		// between two for ping-pong bursts
+		unsigned long seg1 = this->camStorage.ramSizePages;
+		unsigned long seg2 = 0;
+		if(this->pingPong)
+		{
+			this->pingPongPages(seg1, seg2);
+		}
 	    this->api->clearRamSegment(this->camera);
-		this->api->setCameraRamSegmentSize(this->camera, 
-			this->camStorage.ramSizePages, 0, 0, 0);
+		this->api->setCameraRamSegmentSize(this->camera, seg1, seg2, 0, 0);
 		this->api->setActiveRamSegment(this->camera, 1);
+		this->recordSegment = 1;
 	}
 }
 
@@ -2420,6 +4100,31 @@ void Pco::cfgTimestampMode() throw(PcoException)
     }
 }
 
+/**
+ * Configure the meta data block the camera appends to each image.  Only
+ * some cameras have one.  There is no room for it in zero copy mode, the
+ * buffers are NDArrays the size of the image.
+ */
+void Pco::cfgMetaDataMode() throw(PcoException)
+{
+    int size = 0;
+    if(this->camDescription.generalCaps & DllApi::generalCapsMetaData)
+    {
+        unsigned short mode = paramMetaData != 0 && !this->zeroCopy ?
+                DllApi::metaDataModeOn : DllApi::metaDataModeOff;
+        unsigned short blockSize = 0;
+        unsigned short version = 0;
+        this->api->setMetaDataMode(this->camera, mode, &blockSize, &version);
+        this->api->getMetaDataMode(this->camera, &mode, &blockSize, &version);
+        if(mode == DllApi::metaDataModeOn)
+        {
+            size = blockSize;
+        }
+    }
+    // The ingest thread reads this
+    epicsAtomicSetIntT(&this->metaDataSize, size);
+}
+
 /**
  * Configure the trigger mode.
  * Handle the external only trigger mode by translating to the
@@ -2463,6 +4168,8 @@ void Pco::cfgBinningAndRoi(bool updateParams) throw(PcoException)
         this->reqRoiSizeY = paramADSizeY;
         this->reqBinX = paramADBinX;
         this->reqBinY = paramADBinY;
+        this->reverseX = paramADReverseX;
+        this->reverseY = paramADReverseY;
         this->reqRoiPercentX = paramRoiPercentX;
         this->reqRoiPercentY = paramRoiPercentY;
     }
@@ -2649,25 +4356,30 @@ void Pco::cfgBinningAndRoi(bool updateParams) throw(PcoException)
     this->arrayDims[Pco::yDimension].binning = this->swBinY;
     this->arrayDims[Pco::xDimension].reverse = this->reverseX;
     this->arrayDims[Pco::yDimension].reverse = this->reverseY;
-    this->roiRequired =
-            this->arrayDims[Pco::xDimension].offset != 0 ||
-            this->arrayDims[Pco::yDimension].offset != 0 ||
-            (int)this->arrayDims[Pco::xDimension].size != this->xCamSize ||
-            (int)this->arrayDims[Pco::yDimension].size != this->yCamSize ||
-            this->arrayDims[Pco::xDimension].binning != 1 ||
-            this->arrayDims[Pco::yDimension].binning != 1 ||
-            this->arrayDims[Pco::xDimension].reverse != 0 ||
-            this->arrayDims[Pco::yDimension].reverse != 0 ||
-            (NDDataType_t)this->dataType != NDUInt16;
+    // Frames are cut down as they are copied out of the SDK buffers
+    this->frameTransform.configure(this->xCamSize, this->yCamSize,
+            this->arrayDims, (NDDataType_t)this->dataType);
 
 	// Validate the burst mode
 	if(paramStorageMode == DllApi::storageModeRecorder)
 	{
-		// Number of frames that can fit in the RAM
+		// Number of frames that can fit in the RAM, a ping-pong burst
+		// must fit in either segment
+		unsigned long pages = this->camStorage.ramSizePages;
+		if(this->pingPong)
+		{
+			unsigned long seg1;
+			unsigned long seg2;
+			this->pingPongPages(seg1, seg2);
+			pages = std::min(seg1, seg2);
+		}
 		int pixelsPerFrame = this->xCamSize * this->yCamSize; 
-		int maxFrames = (int)((double)this->camStorage.ramSizePages * 
+		int maxFrames = (int)((double)pages * 
 			(double)this->camStorage.pageSizePixels / (double)pixelsPerFrame);
-		if(this->numImages*this->numExposures > maxFrames)
+		// A ring buffer only needs to hold the frames around the trigger
+		int burstFrames = this->ringCapture ? this->ringPreTrigger + this->ringPostTrigger :
+			this->numImages*this->numExposures;
+		if(burstFrames > maxFrames)
 		{
 			throw PcoException("Too many images for burst buffer", -1);
 		}
@@ -2788,12 +4500,14 @@ void Pco::cfgAcquisitionTimes() throw(PcoException)
  */
 void Pco::nowAcquiring() throw()
 {
+	this->startWorkers();
 	TakeLock takeLock(this);
 	performanceMonitor->count(takeLock, PerformanceMonitor::PERF_START, /*fault=*/false);
     // Get info
     this->arrayCounter = paramNDArrayCounter;
     this->numImages = paramADNumImages;
     this->numExposures = paramADNumExposures;
+    this->sumOutput = paramSumOutput;
     if(this->imageMode == ADImageSingle)
     {
         this->numImages = 1;
@@ -2801,14 +4515,34 @@ void Pco::nowAcquiring() throw()
     // Clear counters
     this->numImagesCounter = 0;
     this->numExposuresCounter = 0;
+    this->exposureAccumulator.reset();
+    // A ring buffer records until it is triggered
+    this->ringEnableSeen = false;
+    this->ringLastImage = 0;
+    this->ringTriggerImage = 0;
+    this->ringPostFrames = 0;
+    epicsAtomicSetIntT(&this->ringState, this->ringCapture ? (int)Pco::ringRecording : (int)Pco::ringOff);
+    paramRingTriggered = 0;
+    // Ping-pong bursts start in whichever segment the camera records into
+    this->pingPongCount = 0;
+    this->pingPongRecording = this->pingPong;
+    paramPingPongCount = 0;
+    // Attributes that cannot change during the acquisition are only read now
+    this->acquisitionAttributes.clear();
+    if(this->attributeCache)
+    {
+        this->getAttributes(&this->acquisitionAttributes);
+        this->addAcquisitionAttributes(&this->acquisitionAttributes);
+    }
     // Set info
     paramADStatus = ADStatusReadout;
     paramADAcquire = 1;
-    paramNDArraySize = this->xCamSize*this->yCamSize*sizeof(unsigned short);
-    paramNDArraySizeX = this->xCamSize;
-    paramNDArraySizeY = this->yCamSize;
+    paramNDArraySize = (int)this->frameTransform.outputBytes();
+    paramNDArraySizeX = (int)this->frameTransform.outputSizeX();
+    paramNDArraySizeY = (int)this->frameTransform.outputSizeY();
     paramADNumImagesCounter = this->numImagesCounter;
     paramADNumExposuresCounter = this->numExposuresCounter;
+    epicsAtomicSetIntT(&this->acquiring, 1);
 }
 
 /**
@@ -2820,6 +4554,8 @@ void Pco::acquisitionComplete() throw()
     paramADStatus = ADStatusIdle;
     paramADAcquire = 0;
     this->triggerTimer->stop();
+    epicsAtomicSetIntT(&this->acquiring, 0);
+    epicsAtomicSetIntT(&this->ringState, Pco::ringOff);
 }
 
 /**
@@ -2827,15 +4563,25 @@ void Pco::acquisitionComplete() throw()
  */
 void Pco::doDisarm() throw()
 {
+	epicsAtomicSetIntT(&this->acquiring, 0);
+	epicsAtomicSetIntT(&this->ringState, Pco::ringOff);
 	{
+		TakeLock ingest(&this->ingestLock);
+		this->ingestGeneration++;
+		this->drainNext = 0;
+		this->releaseReserve();
+		this->arraysReturned.signal();
 		TakeLock lock(&this->apiLock);
 		this->api->stopFrameCapture();
 		this->freeImageBuffers();
 	}
+	// The next arm clears the camera RAM
+	this->ramHeld = false;
 	{
 		TakeLock lock(this);
 		paramArmMode = 0;
 		paramArmComplete = 0;
+		paramReadoutHeld = 0;
 	}
 }
 
@@ -2870,194 +4616,561 @@ void Pco::startCamera() throw()
 }
 
 /**
- * Discard all images waiting in the queue.
+ * Discard all images waiting in the queue.
+ */
+void Pco::discardImages() throw()
+{
+	this->frameWorkers.invalidate();
+	if(!this->frameWorkers.active())
+	{
+		// Otherwise the workers' release stage owns the held frames,
+		// it drops them with the invalidated frames
+		this->clearHeldFrames();
+	}
+	epicsAtomicSetIntT(&this->frameRingSignalled, 0);
+	ReceivedFrame frames[Pco::frameBatchSize];
+	int n;
+	while((n = this->takeFrames(frames, Pco::frameBatchSize)) > 0)
+	{
+		for(int i=0; i<n; i++)
+		{
+			frames[i].image->release();
+		}
+	}
+	this->arraysReturned.signal();
+}
+
+/**
+ * Receive all available images from the camera.  This function is called in
+ * response to an image ready event, but we read all images and cope if there are
+ * none so that missing image ready events don't stall the system.  Receiving
+ * stops when the queue is empty or the acquisition is complete.  Frames are
+ * taken in batches and the parameters updated once per batch.  Returns
+ * true if the acquisition is complete or there are enough frames in memory in burst mode.
+ */
+bool Pco::receiveImages() throw()
+{
+	bool result = false;
+	// Frames streamed from now on need a new image received event
+	epicsAtomicSetIntT(&this->frameRingSignalled, 0);
+	ReceivedFrame frames[Pco::frameBatchSize];
+	int n = 0;
+	// Frames held for a gap in the image numbers may have waited long enough
+	if(epicsAtomicGetIntT(&this->heldCount) > 0 && paramStorageMode != DllApi::storageModeRecorder)
+	{
+		if(this->frameWorkers.active())
+		{
+			// The held frames belong to the release stage, send it an empty frame
+			ReceivedFrame frame;
+			frame.image = NULL;
+			this->frameWorkers.submit(frame);
+		}
+		else
+		{
+			this->releaseHeldFrames(false);
+			result = this->acquisitionDone();
+			TakeLock takeLock(this);
+			paramADNumExposuresCounter = this->numExposuresCounter;
+			paramImageNumber = this->lastImageNumber;
+		}
+	}
+	while(!result && (this->imageMode == ADImageContinuous ||
+            this->numImagesCounter < this->numImages) &&
+			(n = this->takeFrames(frames, Pco::frameBatchSize)) > 0)
+	{
+		if(paramStorageMode == DllApi::storageModeRecorder)
+		{
+			// Burst mode...
+			for(int i=0; i<n; i++)
+			{
+				if(this->ringState != Pco::ringOff)
+				{
+					// Where the ring buffer has got to
+					this->decodeFrame(frames[i], this->headerDecoder);
+					if(frames[i].valid && frames[i].numbered)
+					{
+						this->ringLastImage = frames[i].imageNumber;
+					}
+					if(this->ringState == Pco::ringTriggered)
+					{
+						this->ringPostFrames++;
+					}
+				}
+				frames[i].image->release();
+			}
+			// Read the memory state
+			int ramUsePercent;
+			int ramUseFrames;
+			this->checkMemoryBuffer(ramUsePercent, ramUseFrames);
+			// Update EPICS
+			TakeLock takeLock(this);
+			paramCamRamUse = ramUsePercent;
+			paramCamRamUseFrames = ramUseFrames;
+			// Done?  A ring buffer records until the frames after its trigger are in.
+			if(this->ringState != Pco::ringOff)
+			{
+				result = this->ringState == Pco::ringTriggered && this->ringComplete();
+			}
+			else
+			{
+				result = ramUseFrames >= this->numImages*this->numExposures;
+			}
+		}
+		else if(this->frameWorkers.active())
+		{
+			// Not burst mode, the workers process the frames and release
+			// them in order
+			int droppedOldest = 0;
+			int stalls = 0;
+			for(int i=0; i<n; i++)
+			{
+				if(this->takeDropRequest())
+				{
+					frames[i].image->release();
+					droppedOldest++;
+					this->arraysReturned.signal();
+				}
+				else
+				{
+					frames[i].dequeuedTime = epicsMonotonicGet();
+					stalls += this->frameWorkers.submit(frames[i]) ? 1 : 0;
+				}
+			}
+			result = this->acquisitionDone();
+			int held = this->frameWorkers.takeHeld();
+			TakeLock takeLock(this);
+			if(droppedOldest > 0)
+			{
+				performanceMonitor->count(takeLock, PerformanceMonitor::PERF_DROPOLDEST, true, droppedOldest);
+			}
+			if(stalls > 0)
+			{
+				performanceMonitor->count(takeLock, PerformanceMonitor::PERF_WORKERSTALL, false, stalls);
+			}
+			if(held > 0)
+			{
+				performanceMonitor->count(takeLock, PerformanceMonitor::PERF_REORDERHOLD, false, held);
+			}
+		}
+		else
+		{
+			// Not burst mode...
+			int droppedOldest = 0;
+			for(int i=0; i<n; i++)
+			{
+				if(result)
+				{
+					// Acquisition complete, the rest would be discarded anyway
+					frames[i].image->release();
+				}
+				else if(this->takeDropRequest())
+				{
+					// The ingest thread needs an array, this is the oldest frame
+					frames[i].image->release();
+					droppedOldest++;
+					this->arraysReturned.signal();
+				}
+				else
+				{
+					// The frame leaves the queue when we start on it
+					frames[i].dequeuedTime = epicsMonotonicGet();
+					this->decodeFrame(frames[i], this->headerDecoder);
+					validateAndProcessFrame(frames[i]);
+					result = this->acquisitionDone();
+				}
+			}
+			// Update statistics
+			TakeLock takeLock(this);
+			paramADNumExposuresCounter = this->numExposuresCounter;
+			paramImageNumber = this->lastImageNumber;
+			if(droppedOldest > 0)
+			{
+				performanceMonitor->count(takeLock, PerformanceMonitor::PERF_DROPOLDEST, true, droppedOldest);
+			}
+		}
+	}
+	if(this->frameWorkers.active() && paramStorageMode != DllApi::storageModeRecorder)
+	{
+		// The workers may have completed the acquisition since, make sure
+		// the last images are out before we say so
+		result = result || this->acquisitionDone();
+		if(result)
+		{
+			this->frameWorkers.flush();
+		}
+	}
+	this->arraysReturned.signal();
+    return result;
+}
+
+/**
+ * Has the acquisition got all its images?
+ */
+bool Pco::acquisitionDone() const throw()
+{
+	return this->imageMode != ADImageContinuous &&
+			epicsAtomicGetIntT(&this->numImagesCounter) >= this->numImages;
+}
+
+/**
+ * Get the processing workers ready for an acquisition.  Nothing from
+ * the last acquisition is left with them afterwards.  Each worker has
+ * its own header decoder, built for the settings of the arm.  The gang
+ * modes complete images on the state machine thread too, so they
+ * process frames there.
+ */
+void Pco::startWorkers() throw()
+{
+	this->frameWorkers.invalidate();
+	this->frameWorkers.flush();
+	int numWorkers = this->gangServer != NULL || this->gangConnection != NULL ?
+			0 : this->processWorkers;
+	this->frameWorkers.configure(numWorkers, this->reorderDepth);
+	this->clearHeldFrames();
+	for(size_t i=0; i<this->workerDecoders.size(); i++)
+	{
+		delete this->workerDecoders[i];
+	}
+	this->workerDecoders.clear();
+	for(int i=0; i<numWorkers; i++)
+	{
+		this->workerDecoders.push_back(HeaderDecoder::create(this->bitAlignmentMode,
+				this->camDescription.dynResolution));
+	}
+}
+
+/**
+ * Check a frame and decode its binary header, if it has one.
+ * \param[in,out] frame The frame
+ * \param[in] decoder The header decoder to use
+ */
+void Pco::decodeFrame(ReceivedFrame& frame, HeaderDecoder* decoder) throw()
+{
+	frame.valid = this->isImageValid(frame.header);
+	frame.numbered = this->timestampMode == DllApi::timestampModeBinary ||
+			this->timestampMode == DllApi::timestampModeBinaryAndAscii;
+	frame.imageNumber = 0;
+	if(frame.valid && frame.numbered)
+	{
+		decoder->decode(frame.header, frame.imageNumber, frame.imageTime);
+	}
+	else
+	{
+		epicsTimeGetCurrent(&frame.imageTime);
+	}
+}
+
+/**
+ * The work on a frame that can go on in parallel, on a worker thread.
+ * The header is decoded and, unless exposures are being summed into a
+ * new array, the array's attribute list is filled in.  Only the work
+ * that depends on the order of the frames is left for the release.
+ * \param[in,out] frame The frame
+ * \param[in] worker The worker's number
+ */
+void Pco::workFrame(ReceivedFrame& frame, int worker) throw()
+{
+	if(frame.image != NULL)
+	{
+		this->decodeFrame(frame, this->workerDecoders[worker]);
+		if(frame.valid && this->numExposures <= 1)
+		{
+			NDAttributeList* list = frame.image->pAttributeList;
+			if(this->attributeCache)
+			{
+				this->addAttributes(list, frame);
+			}
+			else
+			{
+				// Reading the attributes reads parameters
+				TakeLock takeLock(this);
+				this->addAttributes(list, frame);
+			}
+			if(frame.hasStats)
+			{
+				this->addStatsAttributes(list, frame.stats);
+			}
+			frame.attributesAdded = true;
+		}
+	}
+}
+
+/**
+ * The image number the workers order a frame by.  Frames without one
+ * keep the order they arrived in.
+ * \param[in] frame The frame, its header decoded
+ * \param[out] number The image number
+ * \return True if the frame has an image number
+ */
+bool Pco::frameNumber(const ReceivedFrame& frame, long& number) throw()
+{
+	bool result = frame.image != NULL && frame.valid && frame.numbered;
+	if(result)
+	{
+		number = frame.imageNumber;
+	}
+	return result;
+}
+
+/**
+ * Process a frame the workers have finished with.  Frames are released
+ * in image number order, one at a time, on whichever worker finished
+ * them.  Frames past the end of the acquisition are dropped.
+ * \param[in] frame The frame
+ */
+void Pco::releaseFrame(ReceivedFrame& frame) throw()
+{
+	if(this->acquisitionDone())
+	{
+		if(frame.image != NULL)
+		{
+			frame.image->release();
+		}
+	}
+	else
+	{
+		if(frame.image != NULL)
+		{
+			validateAndProcessFrame(frame);
+		}
+		else
+		{
+			// Sent to check on the held frames
+			this->releaseHeldFrames(false);
+		}
+		TakeLock takeLock(this);
+		paramADNumExposuresCounter = this->numExposuresCounter;
+		paramImageNumber = this->lastImageNumber;
+		if(this->acquisitionDone())
+		{
+			// The state machine may have nothing left to wake it, an
+			// image received event could start a new acquisition if
+			// it has already moved on to armed
+			this->post(Pco::requestProcessFrames);
+		}
+	}
+	this->arraysReturned.signal();
+}
+
+/**
+ * Drop a frame that was with the workers when they were invalidated.
+ * \param[in] frame The frame
  */
-void Pco::discardImages() throw()
+void Pco::dropFrame(ReceivedFrame& frame) throw()
 {
-    while(this->receivedImageQueue.pending() > 0)
-    {
-        NDArray* image;
-        this->receivedImageQueue.tryReceive(&image, sizeof(NDArray*));
-		image->release();
-    }
+	// Frames are dropped before any of a later acquisition are released,
+	// so the held frames are from the same acquisition
+	this->clearHeldFrames();
+	if(frame.image != NULL)
+	{
+		frame.image->release();
+	}
+	this->arraysReturned.signal();
 }
 
 /**
- * Receive all available images from the camera.  This function is called in
- * response to an image ready event, but we read all images and cope if there are
- * none so that missing image ready events don't stall the system.  Receiving
- * stops when the queue is empty or the acquisition is complete.  Returns
- * true if the acquisition is complete or there are enough frames in memory in burst mode.
+ * Validate a frame that has been received into an ND array and pass it on
+ * for processing in image number order.  A frame that arrives ahead of a
+ * lower number is held in the sequence window until the gap fills, the
+ * window is full or the frame has waited the sequence timeout.
+ * \param[in] frame The frame, its header already decoded
  */
-bool Pco::receiveImages() throw()
+void Pco::validateAndProcessFrame(ReceivedFrame& frame)
 {
-	bool result = false;
-    // Poll the buffer queue
-    // Note that the API has aready reset the event so the event status bit
-    // returned by getBufferStatus will already be clear.  However, for
-    // buffers that do have data ready return a statusDrv of zero.
-    while(this->receivedImageQueue.pending() > 0 &&
-    		(this->imageMode == ADImageContinuous ||
-            this->numImagesCounter < this->numImages))
-    {
-		// Get the image
-		NDArray* image;
-        this->receivedImageQueue.tryReceive(&image, sizeof(NDArray*));
-		if(paramStorageMode == DllApi::storageModeRecorder)
+	// If there is a binary timestamp in the frame, we can sort
+	// out the invalid frames that some cameras output when 
+	// arming.
+	if(!frame.valid)
+	{
+		TakeLock takeLock(this);
+		performanceMonitor->count(takeLock, PerformanceMonitor::PERF_INVALIDFRAME);
+		frame.image->release();
+	}
+	else if(!frame.numbered)
+	{
+		// The image does not contain the BCD image number,
+		// use the dead reckoning number instead.
+		this->lastImageNumber++;
+		this->finishFrame(frame);
+	}
+	else
+	{
+		if(this->lastImageNumber - frame.imageNumber > Pco::sequenceRestart)
 		{
-			// Burst mode...
-			image->release();
-			// Read the memory state
-			int ramUsePercent;
-			int ramUseFrames;
-			this->checkMemoryBuffer(ramUsePercent, ramUseFrames);
-			// Update EPICS
+			// The camera's counter has wrapped or restarted, finish
+			// with the old numbers
+			this->releaseHeldFrames(true);
+			this->lastImageNumber = frame.imageNumber - 1;
+		}
+		if(frame.imageNumber <= this->lastImageNumber ||
+				this->heldFrames.count(frame.imageNumber) > 0)
+		{
+			// Already given up on or a repeat
+			asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s: late frame %ld, last %ld\n",
+					this->portName, frame.imageNumber, this->lastImageNumber);
 			TakeLock takeLock(this);
-			paramCamRamUse = ramUsePercent;
-			paramCamRamUseFrames = ramUseFrames;
-			// Done?
-			result = ramUseFrames >= this->numImages*this->numExposures;
-			image->release();
+			performanceMonitor->count(takeLock, PerformanceMonitor::PERF_LATEFRAME);
+			frame.image->release();
 		}
 		else
 		{
-			// Not burst mode...
-			validateAndProcessFrame(image);
-			// Update statistics
-			TakeLock takeLock(this);
-			paramADNumExposuresCounter = this->numExposuresCounter;
-			paramImageNumber = this->lastImageNumber;
-			// Done?
-			result = this->imageMode != ADImageContinuous &&
-    				this->numImagesCounter >= this->numImages;
+			if(!this->heldFrames.empty() && frame.imageNumber < this->heldFrames.rbegin()->first)
+			{
+				TakeLock takeLock(this);
+				performanceMonitor->count(takeLock, PerformanceMonitor::PERF_OUTOFORDER, /*fault=*/false);
+			}
+			frame.heldTime = epicsMonotonicGet();
+			this->heldFrames[frame.imageNumber] = frame;
+			this->releaseHeldFrames(false);
 		}
 	}
-    return result;
 }
 
 /**
- * Validate and process a frame that has been received into an ND array
+ * Process the held frames that are next in sequence.  A gap in the image
+ * numbers is given up on when the window is full, a frame after it has
+ * waited too long or we are told to, the frames in it count as missing.
+ * \param[in] giveUp Process all the held frames, whatever the gaps
  */
-void Pco::validateAndProcessFrame(NDArray* image)
+void Pco::releaseHeldFrames(bool giveUp)
 {
-	// If there is a binary timestamp in the frame, we can sort
-	// out the invalid frames that some cameras output when 
-	// arming.
-	if(this->isImageValid((unsigned short*)image->pData))
+	epicsUInt64 now = epicsMonotonicGet();
+	while(!this->heldFrames.empty() && !this->acquisitionDone())
 	{
-		// What is the number of the image?  If the image does not
-		// contain the BCD image number
-		// use the dead reckoning number instead.
-		long imageNumber = this->lastImageNumber + 1;
-		if(this->timestampMode == DllApi::timestampModeBinary ||
-			this->timestampMode == DllApi::timestampModeBinaryAndAscii)
-		{
-			imageNumber = this->extractImageNumber(
-					(unsigned short*)image->pData);
-		}
-		// If this is the image we are expecting?
-		if(imageNumber != this->lastImageNumber+1)
+		std::map<long, ReceivedFrame>::iterator next = this->heldFrames.begin();
+		long expected = this->lastImageNumber + 1;
+		if(next->first != expected)
 		{
-			printf("Missing frame, got=%ld, exp=%ld\n", imageNumber, this->lastImageNumber+1);
+			epicsUInt64 oldest = now;
+			std::map<long, ReceivedFrame>::iterator pos;
+			for(pos=this->heldFrames.begin(); pos!=this->heldFrames.end(); ++pos)
+			{
+				oldest = pos->second.heldTime < oldest ? pos->second.heldTime : oldest;
+			}
+			if(!giveUp && (int)this->heldFrames.size() <= this->sequenceWindow &&
+					(double)(now - oldest) / 1.0e9 < this->sequenceTimeout)
+			{
+				// Wait for the gap to fill
+				break;
+			}
+			long missing = next->first - expected;
+			printf("Missing frame, got=%ld, exp=%ld\n", next->first, expected);
 			// If we are missing just one frame, duplicate this one
-			if(imageNumber == this->lastImageNumber+2)
+			if(missing == 1 && this->gapFill == Pco::gapFillDuplicate)
 			{
 				printf("One frame missing, duplicating\n");
-				image->reserve();
-				processFrame(image);
+				next->second.image->reserve();
+				processFrame(next->second.image, next->second);
 			}
 			TakeLock takeLock(this);
-			performanceMonitor->count(takeLock, PerformanceMonitor::PERF_MISSINGFRAME);
+			performanceMonitor->count(takeLock, PerformanceMonitor::PERF_MISSINGFRAME, true, (int)missing);
 		}
-		this->lastImageNumber = imageNumber;
-		// Further processing of the frame
-		processFrame(image);
+		ReceivedFrame frame = next->second;
+		this->heldFrames.erase(next);
+		this->lastImageNumber = frame.imageNumber;
+		this->finishFrame(frame);
 	}
-	else
+	epicsAtomicSetIntT(&this->heldCount, (int)this->heldFrames.size());
+	if(!this->heldFrames.empty() && !this->acquisitionDone())
 	{
-		TakeLock takeLock(this);
-		performanceMonitor->count(takeLock, PerformanceMonitor::PERF_INVALIDFRAME);
-		image->release();
+		// Come back to give up on the gap if nothing else arrives
+		this->sequenceTimer->start(this->sequenceTimeout, Pco::requestProcessFrames);
 	}
 }
 
 /**
- * Process a frame that has been received into an ND array
+ * Forget the held frames.  Only call from whatever is processing frames,
+ * or when nothing is.
  */
-void Pco::processFrame(NDArray* image)
+void Pco::clearHeldFrames() throw()
 {
-	// Do software ROI, binning and reversal if required
-	if(this->roiRequired)
+	std::map<long, ReceivedFrame>::iterator pos;
+	for(pos=this->heldFrames.begin(); pos!=this->heldFrames.end(); ++pos)
 	{
-		NDArray* scratch;
-		this->pNDArrayPool->convert(image, &scratch,
-				(NDDataType_t)this->dataType, this->arrayDims);
-		image->release();
-		image = scratch;
+		pos->second.image->release();
 	}
-	// Handle summing of multiple exposures
-	bool nextImageReady = false;
-	if(this->numExposures > 1)
+	this->heldFrames.clear();
+	epicsAtomicSetIntT(&this->heldCount, 0);
+}
+
+/**
+ * Process a frame that is next in sequence, recording its time stamps.
+ * \param[in] frame The frame
+ */
+void Pco::finishFrame(ReceivedFrame& frame)
+{
+	this->frameTimes[PerformanceMonitor::TS_WAKEUP] = frame.wakeupTime;
+	this->frameTimes[PerformanceMonitor::TS_COPIED] = frame.copiedTime;
+	this->frameTimes[PerformanceMonitor::TS_DEQUEUED] = frame.dequeuedTime;
+	processFrame(frame.image, frame);
+	this->clearFrameTimes();
+}
+
+/**
+ * Process a frame that has been received into an ND array
+ * \param[in] image The frame, any software ROI already done
+ * \param[in] frame The frame's decoded header and meta data
+ */
+void Pco::processFrame(NDArray* image, const ReceivedFrame& frame)
+{
+	// Handle summing of multiple exposures, the exposure is kept
+	// as it is if its type cannot be summed
+	bool nextImageReady = true;
+	bool summed = false;
+	if(frame.hasStats)
 	{
-		this->numExposuresCounter++;
-		if(this->numExposuresCounter > 1)
-		{
-			switch(image->dataType)
-			{
-			case NDUInt8:
-			case NDInt8:
-				sumArray<epicsUInt8>(image, this->imageSum);
-				break;
-			case NDUInt16:
-			case NDInt16:
-				sumArray<epicsUInt16>(image, this->imageSum);
-				break;
-			case NDUInt32:
-			case NDInt32:
-				sumArray<epicsUInt32>(image, this->imageSum);
-				break;
-			default:
-				break;
-			}
-			// throw away the previous accumulator
-			this->imageSum->release();
-		}
-		// keep the sum of previous images for the next iteration
-		this->imageSum = image;
-		if(this->numExposuresCounter >= this->numExposures)
-		{
-			// we have finished accumulating
-			nextImageReady = true;
-			this->numExposuresCounter = 0;
-		}
+		this->exposureStats.merge(frame.stats);
 	}
-	else
+	if(this->numExposures > 1 && this->exposureAccumulator.add(image))
 	{
-		nextImageReady = true;
+		summed = true;
+		this->numExposuresCounter = this->exposureAccumulator.count();
+		nextImageReady = this->numExposuresCounter >= this->numExposures;
 	}
 	if(nextImageReady)
 	{
-		// Attach the image information
-		image->uniqueId = this->arrayCounter;
-		epicsTimeStamp imageTime;
-		if(this->timestampMode == DllApi::timestampModeBinary ||
-				this->timestampMode == DllApi::timestampModeBinaryAndAscii)
+		// The time stamp is that of the last exposure
+		if(summed)
 		{
-			this->extractImageTimeStamp(&imageTime,
-					(unsigned short*)image->pData);
+			// We have finished accumulating
+			this->numExposuresCounter = 0;
+			image->release();
+			image = this->exposureAccumulator.finish(this->pNDArrayPool, this->sumOutput);
+			if(image == NULL)
+			{
+				this->exposureStats.reset();
+				TakeLock takeLock(this);
+				performanceMonitor->count(takeLock, PerformanceMonitor::PERF_OUTOFARRAYS);
+				return;
+			}
 		}
-		else
+		// Attach the image information, unless a worker has already.  The
+		// attributes read parameters and this may be on a worker thread.
 		{
-			epicsTimeGetCurrent(&imageTime);
+			TakeLock takeLock(this);
+			image->uniqueId = this->arrayCounter;
+			image->timeStamp = frame.imageTime.secPastEpoch +
+					frame.imageTime.nsec * Pco::oneNanosecond;
+			if(!frame.attributesAdded)
+			{
+				this->addAttributes(image->pAttributeList, frame);
+			}
+			if(this->exposureStats.count > 0)
+			{
+				if(!frame.attributesAdded)
+				{
+					this->addStatsAttributes(image->pAttributeList, this->exposureStats);
+				}
+				this->publishStats(this->exposureStats);
+				this->exposureStats.reset();
+			}
 		}
-		image->timeStamp = imageTime.secPastEpoch +
-				imageTime.nsec / Pco::oneNanosecond;
-		this->getAttributes(image->pAttributeList);
 		// Show the image to the gang system
 		if(this->gangConnection)
 		{
             this->gangConnection->sendImage(image, this->numImagesCounter);
 		}
+		this->frameTimes[PerformanceMonitor::TS_PROCESSED] = epicsMonotonicGet();
 		if(this->gangServer == NULL ||
                 !gangServer->imageReceived(this->numImagesCounter, image))
 		{
@@ -3065,24 +5178,187 @@ void Pco::processFrame(NDArray* image)
             imageComplete(image);
 		}
 	}
+	else
+	{
+		// The exposure is in the sum now
+		image->release();
+	}
 	TakeLock takeLock(this);
 	performanceMonitor->count(takeLock, PerformanceMonitor::PERF_GOODFRAME, /*fault=*/false);
 }
 
+/**
+ * Fill in the attributes of a frame's array, from the cached list or
+ * read now, and those that come with the frame.  If they are read now
+ * the port lock must be taken.
+ * \param[in] list The attribute list
+ * \param[in] frame The frame
+ */
+void Pco::addAttributes(NDAttributeList* list, const ReceivedFrame& frame)
+{
+	if(this->attributeCache)
+	{
+		this->acquisitionAttributes.copy(list);
+	}
+	else
+	{
+		this->getAttributes(list);
+		this->addAcquisitionAttributes(list);
+	}
+	this->addFrameAttributes(list, frame);
+}
+
+/**
+ * Add the attributes the driver sets that only change at arm.
+ * \param[in] list The attribute list
+ */
+void Pco::addAcquisitionAttributes(NDAttributeList* list)
+{
+	// Record how the data crossed the camera link
+	int decompressed = this->frameTransform.decompressing() ? 1 : 0;
+	list->add("PcoTransferFormat", "Camera link data format",
+			NDAttrString, (void*)Pco::dataFormatNames[this->dataFormat]);
+	list->add("PcoDecompressed", "Square root LUT data linearised by the driver",
+			NDAttrInt32, &decompressed);
+}
+
+/**
+ * Add the attributes that come with each frame, from its binary
+ * header and the camera's meta data.
+ * \param[in] list The attribute list
+ * \param[in] frame The frame
+ */
+void Pco::addFrameAttributes(NDAttributeList* list, const ReceivedFrame& frame)
+{
+	if(frame.numbered)
+	{
+		epicsInt32 imageNumber = (epicsInt32)frame.imageNumber;
+		double hardwareTime = frame.imageTime.secPastEpoch +
+				frame.imageTime.nsec * Pco::oneNanosecond;
+		list->add("PcoImageNumber", "Image number from the frame header",
+				NDAttrInt32, &imageNumber);
+		list->add("PcoHardwareTime", "Camera time stamp from the frame header, EPICS epoch",
+				NDAttrFloat64, &hardwareTime);
+	}
+	if(frame.hasMetaData)
+	{
+		const DllApi::MetaData& meta = frame.metaData;
+		epicsInt32 counter = (epicsInt32)meta.imageCounter;
+		double exposure = 0.0;
+		if(meta.exposureTimebase < DllApi::numTimebases)
+		{
+			exposure = (double)meta.exposureTime / DllApi::timebaseScaleFactor[meta.exposureTimebase];
+		}
+		double frameRate = meta.frameRateMilliHz / 1000.0;
+		epicsInt32 binX = meta.binningX;
+		epicsInt32 binY = meta.binningY;
+		epicsInt32 triggerMode = meta.triggerMode;
+		epicsInt32 syncStatus = meta.syncStatus;
+		list->add("PcoMetaImageCounter", "Image counter from the camera meta data",
+				NDAttrInt32, &counter);
+		list->add("PcoMetaExposureTime", "Exposure time from the camera meta data (s)",
+				NDAttrFloat64, &exposure);
+		list->add("PcoMetaFrameRate", "Frame rate from the camera meta data (Hz)",
+				NDAttrFloat64, &frameRate);
+		list->add("PcoMetaBinX", "Horizontal binning from the camera meta data",
+				NDAttrInt32, &binX);
+		list->add("PcoMetaBinY", "Vertical binning from the camera meta data",
+				NDAttrInt32, &binY);
+		list->add("PcoMetaTriggerMode", "Trigger mode from the camera meta data",
+				NDAttrInt32, &triggerMode);
+		list->add("PcoMetaSyncStatus", "External sync locked, from the camera meta data",
+				NDAttrInt32, &syncStatus);
+		if(meta.sensorTemperature != DllApi::metaDataNoTemperature)
+		{
+			epicsInt32 temperature = meta.sensorTemperature;
+			list->add("PcoMetaSensorTemperature", "Sensor temperature from the camera meta data (C)",
+					NDAttrInt32, &temperature);
+		}
+	}
+}
+
+/**
+ * Add the statistics gathered while the frame, or the exposures summed
+ * into it, were copied.
+ * \param[in] list The attribute list
+ * \param[in] stats The statistics
+ */
+void Pco::addStatsAttributes(NDAttributeList* list, const FrameStats& stats)
+{
+	epicsInt32 lowest = stats.min;
+	epicsInt32 highest = stats.max;
+	double mean = stats.mean();
+	double sigma = stats.sigma();
+	double total = (double)stats.sum;
+	epicsInt32 saturated = (epicsInt32)stats.saturated;
+	epicsInt32 binWidth = 1 << stats.settings.binShift;
+	list->add("PcoStatsMin", "Minimum pixel value", NDAttrInt32, &lowest);
+	list->add("PcoStatsMax", "Maximum pixel value", NDAttrInt32, &highest);
+	list->add("PcoStatsMean", "Mean pixel value", NDAttrFloat64, &mean);
+	list->add("PcoStatsSigma", "Standard deviation of the pixel values", NDAttrFloat64, &sigma);
+	list->add("PcoStatsTotal", "Sum of the pixel values", NDAttrFloat64, &total);
+	list->add("PcoStatsSaturated", "Pixels at or above the saturation level",
+			NDAttrInt32, &saturated);
+	list->add("PcoStatsHistBinWidth", "Pixel values in each histogram bin",
+			NDAttrInt32, &binWidth);
+	for(int i=0; i<FrameStats::numBins; i++)
+	{
+		char name[32];
+		epicsInt32 count = (epicsInt32)stats.histogram[i];
+		epicsSnprintf(name, sizeof(name), "PcoStatsHist%d", i);
+		list->add(name, "Sampled pixels in the histogram bin", NDAttrInt32, &count);
+	}
+}
+
+/**
+ * Copy the statistics to their parameters, at most once a period.
+ * \param[in] stats The statistics
+ */
+void Pco::publishStats(const FrameStats& stats)
+{
+	epicsUInt64 now = epicsMonotonicGet();
+	if(this->statsPublishedTime == 0 ||
+		(double)(now - this->statsPublishedTime) * Pco::oneNanosecond >= this->statsPeriod)
+	{
+		this->statsPublishedTime = now;
+		TakeLock takeLock(this);
+		paramStatsMin = stats.min;
+		paramStatsMax = stats.max;
+		paramStatsMean = stats.mean();
+		paramStatsSigma = stats.sigma();
+		paramStatsTotal = (double)stats.sum;
+		paramStatsSaturated = (int)stats.saturated;
+		for(int i=0; i<FrameStats::numBins; i++)
+		{
+			*paramStatsHistogram[i] = (int)stats.histogram[i];
+		}
+	}
+}
+
 /**
  * An image has been completed, pass it on.
  */
 void Pco::imageComplete(NDArray* image)
 {
+    // The plugins are called with the port locked, this may be on a
+    // worker thread
+    TakeLock takeLock(this);
     // Update statistics
     this->arrayCounter++;
     this->numImagesCounter++;
     // Pass the array on
     this->doCallbacksGenericPointer(image, NDArrayData, 0);
+    this->frameTimes[PerformanceMonitor::TS_CALLBACKS] = epicsMonotonicGet();
     image->release();
-    TakeLock takeLock(this);
+    this->noteArraysInUse();
     paramNDArrayCounter = arrayCounter;
     paramADNumImagesCounter = this->numImagesCounter;
+    // Only frames that came through the receive path have time stamps
+    if(this->frameTimes[PerformanceMonitor::TS_DEQUEUED] != 0)
+    {
+        performanceMonitor->recordLatency(takeLock, this->frameTimes);
+        this->clearFrameTimes();
+    }
 }
 
 /**
@@ -3103,35 +5379,14 @@ bool Pco::makeImages()
 }
 
 /**
- * Convert BCD coded number in image to int 
- */
-long Pco::bcdToInt(unsigned short pixel) throw()
-{
-    int shiftLowBcd = 0;
-    if(paramBitAlignment == DllApi::bitAlignmentMsb)
-    {
-        // In MSB mode, need to shift down
-        shiftLowBcd = Pco::bitsPerShortWord - this->camDescription.dynResolution;
-    }
-    int shiftHighBcd = shiftLowBcd + Pco::bitsPerNybble;
-    long p1 = (pixel>>shiftLowBcd)&(Pco::nybbleMask);
-    long p2 = (pixel>>shiftHighBcd)&(Pco::nybbleMask);
-    return p2*bcdDigitValue + p1;    
-}
-
-/**
- * Convert bcd number in first 4 pixels of image to extract image counter value
+ * Build the decoder for the binary header in the frames.  Called
+ * when the bit alignment or dynamic resolution may have changed.
+ * \param[in] bitAlignment The bit alignment in force
  */
-long Pco::extractImageNumber(unsigned short* imagebuffer) throw()
+void Pco::createHeaderDecoder(int bitAlignment) throw()
 {
-
-    long imageNumber = 0;
-    for(int i=0; i<Pco::bcdPixelLength; i++) 
-    {
-        imageNumber *= Pco::bcdDigitValue * Pco::bcdDigitValue;
-        imageNumber += bcdToInt(imagebuffer[i]);
-    };
-    return imageNumber;
+    delete this->headerDecoder;
+    this->headerDecoder = HeaderDecoder::create(bitAlignment, this->camDescription.dynResolution);
 }
 
 /**
@@ -3139,7 +5394,7 @@ long Pco::extractImageNumber(unsigned short* imagebuffer) throw()
  * frames on arming.  If there is an embedded timestamp we can detect
  * this as the timestamp is also completely zero.  
  */
-bool Pco::isImageValid(unsigned short* imagebuffer) throw()
+bool Pco::isImageValid(const unsigned short* imagebuffer) throw()
 {
 	bool result = true;
     if(this->timestampMode == DllApi::timestampModeBinary ||
@@ -3154,37 +5409,6 @@ bool Pco::isImageValid(unsigned short* imagebuffer) throw()
 	return result;
 }
 
-/**
- * Convert bcd numbers in pixels 5 to 14 of image to extract time stamp 
- */
-void Pco::extractImageTimeStamp(epicsTimeStamp* imageTime,
-        unsigned short* imageBuffer) throw()
-{
-    unsigned long nanoSec = 0;
-    struct tm ct;
-    ct.tm_year = bcdToInt(imageBuffer[4])*100 + bcdToInt(imageBuffer[5] - 1900);
-    ct.tm_mon = bcdToInt(imageBuffer[6])-1;
-    ct.tm_mday = bcdToInt(imageBuffer[7]);
-    ct.tm_hour = bcdToInt(imageBuffer[8]);
-    ct.tm_min = bcdToInt(imageBuffer[9]);
-    ct.tm_sec = bcdToInt(imageBuffer[10]);
-    nanoSec = (bcdToInt(imageBuffer[11])*10000 + bcdToInt(imageBuffer[12])*100 +
-            bcdToInt(imageBuffer[13]))*1000;
-   
-#if 0
-    // JAT: We'll comment this out for now and see what the PCO
-    //      does return.
-    // fix year if necessary
-    // (pco4000 seems to always return 2036 for year)
-    if(ct.tm_year >= 2036)
-    {
-        ct.tm_year = this->cameraYear;
-    }
-#endif
-        
-    epicsTimeFromTM (imageTime, &ct, nanoSec );
-}
-
 /**
  * This stop command is designed for use with a busy record
  */
@@ -3195,6 +5419,76 @@ void Pco::onConfirmedStop(TakeLock& takeLock)
 	this->onAcquire(takeLock);
 }
 
+/**
+ * Freeze a recording ring buffer
+ */
+void Pco::onRingTrigger(TakeLock& takeLock)
+{
+	if(paramRingTrigger)
+	{
+		this->post(Pco::requestRingTrigger);
+	}
+	paramRingTrigger = 0;
+}
+
+/**
+ * Queue a range of images to read out of the camera RAM
+ */
+void Pco::onReadoutAdd(TakeLock& takeLock)
+{
+	if(paramReadoutAdd)
+	{
+		if(this->readoutQueue.size() < (size_t)Pco::readoutQueueCapacity)
+		{
+			this->readoutQueue.push_back(this->requestedRange());
+		}
+		else
+		{
+			errorTrace << "Readout queue full" << std::endl;
+		}
+		paramReadoutQueued = (int)this->readoutQueue.size();
+	}
+	paramReadoutAdd = 0;
+}
+
+/**
+ * Empty the queue of readout ranges
+ */
+void Pco::onReadoutClear(TakeLock& takeLock)
+{
+	if(paramReadoutClear)
+	{
+		this->readoutQueue.clear();
+		paramReadoutQueued = 0;
+	}
+	paramReadoutClear = 0;
+}
+
+/**
+ * The range of images the start, stop and stride parameters ask for.
+ * Call with the port lock taken.
+ */
+Pco::ReadoutRange Pco::requestedRange() throw()
+{
+	ReadoutRange range;
+	range.first = paramReadoutStart < 1 ? 1 : (unsigned long)paramReadoutStart;
+	range.last = paramReadoutStop < 1 ? 0 : (unsigned long)paramReadoutStop;
+	range.stride = paramReadoutStride < 1 ? 1 : (unsigned long)paramReadoutStride;
+	return range;
+}
+
+/**
+ * Read out the recording kept in the camera RAM
+ */
+void Pco::onReadout(TakeLock& takeLock)
+{
+	if(paramReadout)
+	{
+		this->post(Pco::requestReadout);
+	}
+	paramReadout = 0;
+}
+
 /**
  * Queue a request to apply the requested binning and ROI settings
  */
@@ -3247,25 +5541,6 @@ void Pco::registerGangConnection(GangConnection* gangConnection)
 	unlock();
 }
 
-/**
- * Helper function to sum 2 NDArrays
- */
-template<typename T> void Pco::sumArray(NDArray* startingArray,
-        NDArray* addArray) throw()
-{
-    T* inOutData = reinterpret_cast<T*>(startingArray->pData);
-    T* addData = reinterpret_cast<T*>(addArray->pData);
-    NDArrayInfo_t inInfo;
-
-    startingArray->getInfo(&inInfo);
-    for(int i=0; i<this->xCamSize*this->yCamSize; i++)
-    {
-        *inOutData += *addData;
-        inOutData++;
-        addData++;
-    }
-}
-
 /**
  * Get firmware information of each device on the camera
  */
@@ -3290,12 +5565,17 @@ void Pco::getDeviceFirmwareInfo()
 }
 
 // IOC shell configuration command
-extern "C" int pcoConfig(const char* portName, int maxBuffers, size_t maxMemory, int numCameraDevices)
+extern "C" int pcoConfig(const char* portName, int maxBuffers, size_t maxMemory, int numCameraDevices,
+        int ringDepth, const char* threads)
 {
     Pco* existing = Pco::getPco(portName);
     if(existing == NULL)
     {
-        new Pco(portName, maxBuffers, maxMemory, numCameraDevices);
+        if(threads != NULL && threads[0] != '\0')
+        {
+            ThreadPlacement::configure(portName, threads);
+        }
+        new Pco(portName, maxBuffers, maxMemory, numCameraDevices, ringDepth);
     }
     else
     {
@@ -3307,18 +5587,116 @@ static const iocshArg pcoConfigArg0 = {"Port name", iocshArgString};
 static const iocshArg pcoConfigArg1 = {"maxBuffers", iocshArgInt};
 static const iocshArg pcoConfigArg2 = {"maxMemory", iocshArgInt};
 static const iocshArg pcoConfigArg3 = {"numCameraDevices", iocshArgInt};
+static const iocshArg pcoConfigArg4 = {"ringDepth", iocshArgInt};
+static const iocshArg pcoConfigArg5 = {"threads", iocshArgString};
 static const iocshArg * const pcoConfigArgs[] = {&pcoConfigArg0, &pcoConfigArg1,
-        &pcoConfigArg2, &pcoConfigArg3};
-static const iocshFuncDef configPco = {"pcoConfig", 4, pcoConfigArgs};
+        &pcoConfigArg2, &pcoConfigArg3, &pcoConfigArg4, &pcoConfigArg5};
+static const iocshFuncDef configPco = {"pcoConfig", 6, pcoConfigArgs};
 static void configPcoCallFunc(const iocshArgBuf *args)
 {
-    pcoConfig(args[0].sval, args[1].ival, args[2].ival, args[3].ival);
+    pcoConfig(args[0].sval, args[1].ival, args[2].ival, args[3].ival, args[4].ival,
+            args[5].sval);
+}
+
+// Pin the capture thread to a core with a raised priority
+extern "C" int pcoCapturePin(const char* portName, int cpu, int priority)
+{
+    Pco* pco = Pco::getPco(portName);
+    if(pco != NULL)
+    {
+        unsigned long long cpuMask = cpu >= 0 && cpu < 64 ? 1ULL << cpu : 0;
+        if(!ThreadPlacement::configure(portName, ThreadPlacement::roleCapture, cpuMask, priority))
+        {
+            printf("pcoCapturePin: priority must be 0 to %d\n", (int)epicsThreadPriorityMax);
+        }
+    }
+    else
+    {
+        printf("pcoCapturePin: Pco \"%s\" not found\n", portName);
+    }
+    return asynSuccess;
+}
+static const iocshArg pcoCapturePinArg0 = {"Port name", iocshArgString};
+static const iocshArg pcoCapturePinArg1 = {"cpu", iocshArgInt};
+static const iocshArg pcoCapturePinArg2 = {"priority", iocshArgInt};
+static const iocshArg * const pcoCapturePinArgs[] = {&pcoCapturePinArg0,
+        &pcoCapturePinArg1, &pcoCapturePinArg2};
+static const iocshFuncDef capturePinPco = {"pcoCapturePin", 3, pcoCapturePinArgs};
+static void capturePinPcoCallFunc(const iocshArgBuf *args)
+{
+    pcoCapturePin(args[0].sval, args[1].ival, args[2].ival);
+}
+
+// Benchmark the frame handling engines
+static void benchmarkCopy(int sizeKb, int repeats, int, int)
+{
+    FrameCopier::instance().benchmark((size_t)(sizeKb > 0 ? sizeKb : 0) * 1024, repeats);
+}
+static void benchmarkStats(int sizeKb, int repeats, int sample, int)
+{
+    FrameStats::benchmark((size_t)(sizeKb > 0 ? sizeKb : 0) * 1024, repeats, sample);
+}
+static void benchmarkAccumulate(int pixels, int exposures, int, int)
+{
+    ExposureAccumulator::benchmark(pixels > 0 ? (size_t)pixels : 0, exposures);
+}
+static void benchmarkTransform(int sizeX, int sizeY, int binning, int repeats)
+{
+    FrameTransform::benchmark(sizeX, sizeY, binning, repeats);
+}
+static void benchmarkStateMachine(int numEvents, int, int, int)
+{
+    StateMachine::benchmark(numEvents);
+}
+static const struct
+{
+    const char* name;
+    const char* args;
+    void (*run)(int arg1, int arg2, int arg3, int arg4);
+} pcoBenchmarks[] =
+{
+    {"copy", "sizeKb repeats", benchmarkCopy},
+    {"stats", "sizeKb repeats sample", benchmarkStats},
+    {"accumulate", "pixels exposures", benchmarkAccumulate},
+    {"transform", "sizeX sizeY binning repeats", benchmarkTransform},
+    {"stateMachine", "events", benchmarkStateMachine}
+};
+extern "C" int pcoBenchmark(const char* name, int arg1, int arg2, int arg3, int arg4)
+{
+    for(size_t b=0; b<sizeof(pcoBenchmarks)/sizeof(pcoBenchmarks[0]); b++)
+    {
+        if(name != NULL && strcmp(name, pcoBenchmarks[b].name) == 0)
+        {
+            pcoBenchmarks[b].run(arg1, arg2, arg3, arg4);
+            return asynSuccess;
+        }
+    }
+    printf("pcoBenchmark: benchmark \"%s\" not found, choose from\n", name != NULL ? name : "");
+    for(size_t b=0; b<sizeof(pcoBenchmarks)/sizeof(pcoBenchmarks[0]); b++)
+    {
+        printf("    pcoBenchmark %s %s\n", pcoBenchmarks[b].name, pcoBenchmarks[b].args);
+    }
+    return asynSuccess;
+}
+static const iocshArg pcoBenchmarkArg0 = {"name", iocshArgString};
+static const iocshArg pcoBenchmarkArg1 = {"arg1", iocshArgInt};
+static const iocshArg pcoBenchmarkArg2 = {"arg2", iocshArgInt};
+static const iocshArg pcoBenchmarkArg3 = {"arg3", iocshArgInt};
+static const iocshArg pcoBenchmarkArg4 = {"arg4", iocshArgInt};
+static const iocshArg * const pcoBenchmarkArgs[] = {&pcoBenchmarkArg0,
+        &pcoBenchmarkArg1, &pcoBenchmarkArg2, &pcoBenchmarkArg3, &pcoBenchmarkArg4};
+static const iocshFuncDef benchmarkPco = {"pcoBenchmark", 5, pcoBenchmarkArgs};
+static void benchmarkPcoCallFunc(const iocshArgBuf *args)
+{
+    pcoBenchmark(args[0].sval, args[1].ival, args[2].ival, args[3].ival, args[4].ival);
 }
 
 /** Register the commands */
 static void pcoRegister(void)
 {
     iocshRegister(&configPco, configPcoCallFunc);
+    iocshRegister(&capturePinPco, capturePinPcoCallFunc);
+    iocshRegister(&benchmarkPco, benchmarkPcoCallFunc);
 }
 extern "C" { epicsExportRegistrar(pcoRegister); }
 
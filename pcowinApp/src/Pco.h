@@ -13,6 +13,7 @@
 #include <string>
 #include <map>
 #include <set>
+#include <vector>
 #include "StateMachine.h"
 #include "DllApi.h"
 #include "TraceStream.h"
@@ -21,16 +22,28 @@
 #include "DoubleParam.h"
 #include "StringParam.h"
 #include "epicsMutex.h"
+#include "epicsEvent.h"
+#include "epicsThread.h"
+#include "epicsTime.h"
+#include "SpscQueue.h"
+#include "PerformanceMonitor.h"
+#include "ThreadPlacement.h"
+#include "BufferAllocator.h"
+#include "HeaderDecoder.h"
+#include "ExposureAccumulator.h"
+#include "FrameTransform.h"
+#include "FrameStats.h"
+#include "FrameWorkers.h"
 class GangServer;
 class GangConnection;
-class PerformanceMonitor;
 class TakeLock;
 
 class Pco: public ADDriverEx
 {
 // Construction
 public:
-    Pco(const char* portName, int maxBuffers, size_t maxMemory, int numCameraDevices);
+    Pco(const char* portName, int maxBuffers, size_t maxMemory, int numCameraDevices,
+            int ringDepth=0);
     virtual ~Pco();
 
 // Parameters
@@ -105,6 +118,83 @@ public:
 	IntegerParam paramRoiSymmetryY;
 	IntegerParam paramInterfaceType;
 	IntegerParam paramInterfaceIsCameraLink;
+	IntegerParam paramZeroCopy;
+	IntegerParam paramRingDepth;
+	IntegerParam paramRingDepthActual;
+	IntegerParam paramRingMemory;
+	IntegerParam paramRingOccupancy;
+	IntegerParam paramRingHighWater;
+	DoubleParam paramHandoffLatency;
+	DoubleParam paramHandoffLatencyMax;
+	IntegerParam paramBusyPoll;
+	IntegerParam paramBusyPollPause;
+	IntegerParam paramOverloadPolicy;
+	IntegerParam paramOverloadDecimation;
+	IntegerParam paramOverloadReserve;
+	IntegerParam paramBuffersInUseHigh;
+	IntegerParam paramBufferAllocator;
+	IntegerParam paramBufferNode;
+	IntegerParam paramBufferPages;
+	IntegerParam paramBufferNodeActual;
+	IntegerParam paramBufferFallback;
+	IntegerParam paramPrewarm;
+	IntegerParam paramPrewarmArrays;
+	DoubleParam paramPrewarmDuration;
+	IntegerParam paramPrewarmCount;
+	DoubleParam paramPrewarmTime;
+	IntegerParam paramPoolBuffers;
+	IntegerParam paramPoolFree;
+	IntegerParam paramPoolMemory;
+	IntegerParam paramSumOutput;
+	StringParam paramSumKernel;
+	IntegerParam paramDecompress;
+	IntegerParam paramDecompressActive;
+	IntegerParam paramProcessWorkers;
+	IntegerParam paramReorderDepth;
+	IntegerParam paramSequenceWindow;
+	DoubleParam paramSequenceTimeout;
+	IntegerParam paramGapFill;
+	IntegerParam paramMetaData;
+	IntegerParam paramMetaDataActive;
+	IntegerParam paramAttributeCache;
+	IntegerParam paramFrameStats;
+	IntegerParam paramFrameStatsActive;
+	IntegerParam paramStatsSaturation;
+	IntegerParam paramStatsSample;
+	DoubleParam paramStatsPeriod;
+	IntegerParam paramStatsMin;
+	IntegerParam paramStatsMax;
+	DoubleParam paramStatsMean;
+	DoubleParam paramStatsSigma;
+	DoubleParam paramStatsTotal;
+	IntegerParam paramStatsSaturated;
+	IntegerParam* paramStatsHistogram[FrameStats::numBins];
+	DoubleParam paramDrainRate;
+	DoubleParam paramDrainEta;
+	IntegerParam paramRingCapture;
+	IntegerParam paramRingCaptureActive;
+	IntegerParam paramRingPreTrigger;
+	IntegerParam paramRingPostTrigger;
+	IntegerParam paramRingSource;
+	IntegerParam paramRingTrigger;
+	IntegerParam paramRingTriggered;
+	IntegerParam paramReadoutStart;
+	IntegerParam paramReadoutStop;
+	IntegerParam paramReadoutStride;
+	IntegerParam paramReadoutPreview;
+	IntegerParam paramReadoutAdd;
+	IntegerParam paramReadoutClear;
+	IntegerParam paramReadoutQueued;
+	IntegerParam paramReadout;
+	IntegerParam paramReadoutHeld;
+	IntegerParam paramPingPong;
+	IntegerParam paramPingPongActive;
+	IntegerParam paramPingPongSplit;
+	IntegerParam paramPingPongBursts;
+	IntegerParam paramPingPongCount;
+	IntegerParam paramRecordSegment;
+	StringParam* paramThreadCpus[ThreadPlacement::numRoles];
+	IntegerParam* paramThreadPriority[ThreadPlacement::numRoles];
 
     // Camera devices
     std::vector<int> pcoCameraDeviceName;
@@ -128,6 +218,7 @@ public:
     static const double initialisationPeriod;
     static const char* stateNames[];
     static const char* eventNames[];
+    static const char* dataFormatNames[];
     static const int bitsPerShortWord;
     static const int bitsPerNybble;
     static const long nybbleMask;
@@ -140,7 +231,21 @@ public:
     static const int defaultRoiMinY;
     static const int defaultExposureTime;
     static const int defaultDelayTime;
-    enum {numQueuedBuffers=2, numApiBuffers=8, getImageBuffer=7};
+    enum {numQueuedBuffers=2, numApiBuffers=DllApi::maxNumBuffers};
+    enum {ringDepthAuto=0, maxQueuedBuffers=numApiBuffers-1};   // One is kept for getImage
+    enum {frameRingCapacity=1000, frameBatchSize=16};
+    static const double ringLatencyPeriod;
+    enum {overloadDropNewest=0, overloadDropOldest=1, overloadDecimate=2, overloadReserve=3};
+    static const double overloadRetryTime;
+    static const double arrayRecheckPeriod;
+    static const double frameRingWaitPeriod;
+    enum {gapFillNone=0, gapFillDuplicate=1};
+    enum {sequenceRestart=1000};
+    enum {ringOff=0, ringRecording=1, ringTriggered=2};
+    enum {ringSourceSoft=0, ringSourceAcqEnable=1};
+    enum {readoutQueueCapacity=64};
+    enum {pingPongSplitMin=1, pingPongSplitMax=99};
+    static const int bytesPerMegabyte;
     static const int edgeXSizeNeedsReducedCamlink;
     static const int edgePixRateNeedsReducedCamlink;
     static const int edgeBaudRate;
@@ -163,19 +268,25 @@ public:
 	void getFrames();
 	void pollForFrames();
 	void frameWaitFault();
+	bool busyPollActive() const;
+	bool busyPollPause() const;
     void trace(int flags, const char* format, ...);
     asynUser* getAsynUser();
     void registerDllApi(DllApi* api);
     void registerGangServer(GangServer* gangServer);
     void registerGangConnection(GangConnection* gangConnection);
-    NDArray* allocArray(int sizeX, int sizeY, NDDataType_t dataType);
+    NDArray* allocArray(int sizeX, int sizeY, NDDataType_t dataType, bool countFailure=true);
+    NDArray* allocFrameArray(bool countFailure=true);
+    bool sendFrame(const unsigned short* buffer);
     void imageComplete(NDArray* image);
     void initialiseOnceRunning();
+    void ingestRun();
 
 // Member variables
 private:
     StateMachine* stateMachine;
     StateMachine::Timer* triggerTimer;
+    StateMachine::Timer* sequenceTimer;
     DllApi* api;
     DllApi::Handle camera;
 	DllApi::CameraType camType;
@@ -183,8 +294,7 @@ private:
 	DllApi::Storage camStorage;
     DllApi::Transfer camTransfer;
     DllApi::Sizes camSizes;
-    int shiftLowBcd;         // Shift for decoding the BCD frame number in image
-    int shiftHighBcd;        // Shift for decoding the BCD frame number in image
+    HeaderDecoder* headerDecoder;  // For the bit alignment and resolution in force
     TraceStream errorTrace;
 public:
     TraceStream apiTrace;
@@ -196,13 +306,122 @@ private:
     {
         short bufferNumber;
         unsigned short* buffer;
+        NDArray* array;          // Owning NDArray in zero copy mode, otherwise NULL
+        size_t allocatedSize;    // Size the buffer allocator gave us
         DllApi::Handle eventHandle;
         bool ready;
+        int inFlight;            // Handed to the ingest thread, not yet back with the SDK
+        unsigned long memoryImage;   // The RAM image given to the SDK, 0 for a live frame
     } buffers[Pco::numApiBuffers];
+    /** A filled buffer passed from the capture thread to the ingest thread */
+    struct IngestItem
+    {
+        int bufferNumber;
+        unsigned long statusDrv;
+        int generation;
+        unsigned short segment;  // Read the buffer's RAM image from this segment first, 0 if filled
+        epicsTimeStamp handoffTime;
+        epicsUInt64 wakeupTime;  // Monotonic time stamps in nanoseconds
+    };
+    /** Images of the camera RAM to read out, every stride'th from first to last */
+    struct ReadoutRange
+    {
+        unsigned long first;
+        unsigned long last;
+        unsigned long stride;
+    };
+    /** What the overload policy did while ingesting */
+    struct OverloadCounts
+    {
+        int dropNewest;
+        int decimated;
+        int reserveUsed;
+    };
+    /** A frame passed from the ingest thread to the state machine */
+    struct ReceivedFrame
+    {
+        NDArray* image;
+        epicsUInt64 wakeupTime;
+        epicsUInt64 copiedTime;
+        epicsUInt64 dequeuedTime;
+        epicsUInt64 heldTime;    // When it joined the sequence window
+        int generation;          // The ingest generation it was copied in
+        unsigned long memoryImage;   // The camera RAM image it was read from, 0 if live
+        unsigned short header[HeaderDecoder::headerLength];   // The frame's binary header
+        // Decoded from the header
+        bool valid;
+        bool numbered;           // The image number is from the header
+        long imageNumber;
+        epicsTimeStamp imageTime;
+        bool hasMetaData;        // Read from the SDK before the buffer went back
+        DllApi::MetaData metaData;
+        bool hasStats;           // Gathered while the frame was copied
+        FrameStats stats;
+        bool attributesAdded;    // A worker has filled in the array's attributes
+    };
+    /** The thread that copies frames out of the SDK buffers */
+    class IngestThread: public epicsThreadRunable
+    {
+    private:
+        epicsThread thread;
+        Pco* owner;
+    public:
+        IngestThread(Pco* owner, const char* threadName);
+        virtual ~IngestThread() {}
+        virtual void run() {this->owner->ingestRun();}
+        void exitWait() {this->thread.exitWait();}
+    };
+public:
+    // Functions called by the frame workers
+    void workFrame(ReceivedFrame& frame, int worker) throw();
+    bool frameNumber(const ReceivedFrame& frame, long& number) throw();
+    void releaseFrame(ReceivedFrame& frame) throw();
+    void dropFrame(ReceivedFrame& frame) throw();
+private:
+    SpscQueue<IngestItem> ingestQueue;   // Pushed with the api lock taken
+    epicsEvent ingestEvent;
+    epicsMutex ingestLock;       // Held while the ingest thread touches buffer memory
+    int ingestGeneration;        // Incremented at arm and disarm to invalidate queued items
+    bool ingestExit;
+    int ingestPlacementGeneration;
+    IngestThread* ingestThread;
+    double handoffLatencySum;
+    int handoffLatencyCount;
+    double handoffLatencyMax;
+    int drainGeneration;         // The ingest generation of the camera RAM drain
+    unsigned long drainNext;     // The next RAM image to give the SDK, 0 when not draining
+    std::vector<ReadoutRange> drainRanges;   // What the drain reads, in order
+    size_t drainRange;           // The range drainNext is in
+    unsigned short drainSegment;     // Read by the ingest thread, 0 to have the SDK fill the buffers
+    int drainLost;               // RAM images the ingest thread could not pass on
     int queueHead;
     long lastImageNumber;
     bool lastImageNumberValid;
-    epicsMessageQueue receivedImageQueue;
+    SpscQueue<ReceivedFrame> frameRing;   // Streamed frames, from the ingest thread
+    int frameRingSignalled;          // An image received event is outstanding for the ring
+    epicsEvent frameRingRoom;        // Frames have been taken from the ring
+    epicsMessageQueue receivedImageQueue;  // Frames read on demand from other threads
+    FrameWorkers<Pco, ReceivedFrame> frameWorkers;
+    std::vector<HeaderDecoder*> workerDecoders;   // One each, the decoders keep state
+    int processWorkers;          // Taking effect at the next acquisition
+    int reorderDepth;
+    std::map<long, ReceivedFrame> heldFrames;   // Waiting for a lower image number, by number
+    int heldCount;               // Of the held frames, for the state machine thread
+    int sequenceWindow;          // The most frames held for a gap
+    double sequenceTimeout;      // The longest a frame is held for a gap
+    int gapFill;
+    epicsUInt64 frameTimes[PerformanceMonitor::numTimestamps];  // Of the frame being processed
+    int overloadPolicy;          // What to do when the NDArray pool runs dry
+    int overloadDecimation;      // Keep one frame in this many while decimating
+    int reserveSize;             // Arrays held back for the ingest path
+    std::vector<NDArray*> reserveArrays;   // Guarded by ingestLock
+    int dropOldestRequests;      // Queued frames the ingest thread wants dropped
+    epicsEvent arraysReturned;   // Frame processing may have given arrays back to the pool
+    int overloadGeneration;      // Ingest thread only, the arm the state below belongs to
+    bool decimating;
+    int decimateCount;
+    int arraysInUse;
+    int arraysInUseHighWater;
     int numImagesCounter;
     int numExposuresCounter;
     int numImages;
@@ -268,16 +487,59 @@ private:
     int reqRoiPercentX;
     int reqRoiPercentY;
     //int friendlyRoiSetting;
-    NDArray* imageSum;
+    ExposureAccumulator exposureAccumulator;
+    int sumOutput;
     NDDimension_t arrayDims[numDimensions];
-    bool roiRequired;
+    FrameTransform frameTransform;
     GangServer* gangServer;
     GangConnection* gangConnection;
     PerformanceMonitor* performanceMonitor;
 	epicsMutex apiLock;
-	unsigned long memoryImageCounter;
+	unsigned long memoryImageCounter;   // RAM images processed by the drain
+	unsigned long drainTotal;
+	unsigned long drainImages;   // The arrays the drain makes
+	epicsUInt64 drainStartTime;
+	unsigned long ramFirst;  // The recording held in the camera RAM
+	unsigned long ramLast;
+	bool ramHeld;            // The recording is kept for another readout
+	bool readoutPreview;     // This readout keeps the recording
+	std::vector<ReadoutRange> readoutQueue;   // Queued by the readout parameters
+	bool pingPong;           // Record into one RAM segment while the other is read
+	int pingPongSplit;       // Percentage of the RAM in segment 1
+	int pingPongBursts;      // Bursts to record, 0 until stopped
+	int pingPongCount;       // Bursts recorded so far
+	bool pingPongRecording;  // The camera records into recordSegment during the drain
+	unsigned short recordSegment;
+	bool ringCapture;        // Record into a ring buffer until a trigger freezes it
+	int ringPreTrigger;      // Frames read out from before the trigger
+	int ringPostTrigger;     // and after it
+	int ringSource;
+	int ringState;           // Read by onAcquire
+	bool ringEnableSeen;     // The acquire enable signal has been active
+	long ringLastImage;      // The newest live frame
+	long ringTriggerImage;   // The newest live frame at the trigger, 0 if not numbered
+	int ringPostFrames;      // Live frames since the trigger
 	int fifoQueueSize;
+	int numAllocatedBuffers;  // The ring and, after it, the getImage buffer
+	int ringOccupancy;
+	int ringHighWater;
 	bool useGetFrames;
+	bool zeroCopy;
+	int metaDataSize;        // Pixels the camera appends to each image, 0 when off
+	bool attributeCache;     // The attribute list is read once per acquisition
+	NDAttributeList acquisitionAttributes;
+	bool frameStatsActive;   // Statistics are gathered in the frame copy
+	FrameStats::Settings statsSettings;
+	int statsSkip;           // Leading pixels left out, the binary header
+	double statsPeriod;      // Between updates of the statistics parameters
+	epicsUInt64 statsPublishedTime;
+	FrameStats exposureStats;  // Of the exposures summed so far
+	int busyPoll;            // Busy poll the buffer events while acquiring
+	int busyPollPauseMode;   // Pause the processor between polls
+	int acquiring;
+	BufferAllocator* bufferAllocator;
+	int bufferAllocatorKind;
+	int bufferNode;          // Preferred NUMA node for the SDK buffers, -1 for automatic
 
 public:
     static std::map<std::string, Pco*> thePcos;
@@ -295,16 +557,45 @@ private:
     void startCamera() throw();
     void allocateImageBuffers() throw(std::bad_alloc, PcoException);
     void freeImageBuffers() throw();
+    void releaseImageBuffer(int index) throw();
+    int bufferPreferredNode() const throw();
+    void prewarmArrayPool(TakeLock& takeLock) throw();
+    double expectedFramePeriod() const throw();
+    NDArray* swapZeroCopyBuffer(int index, NDArray* fresh) throw(PcoException);
     void adjustTransferParamsAndLut() throw(PcoException);
     void setCameraClock() throw(PcoException);
     void addAvailableBuffer(int index) throw(PcoException);
     void addAvailableBufferAll() throw(PcoException);
+    int calcRingDepth() throw();
+    int getImageBuffer() const throw() {return this->numAllocatedBuffers - 1;}
+    void ingestFrame(const IngestItem& item, int& frameStatusError) throw();
+    void invalidateIngest() throw();
     bool receiveImages() throw();
     void discardImages() throw();
-    long extractImageNumber(unsigned short* imagebuffer) throw();
-    bool isImageValid(unsigned short* imagebuffer) throw();
-    long bcdToInt(unsigned short pixel) throw();
-    void extractImageTimeStamp(epicsTimeStamp* imageTime, unsigned short* imageBuffer) throw();
+    bool extractFrame(NDArray* image, const unsigned short* buffer, ReceivedFrame& frame) throw();
+    void queueFrame(const ReceivedFrame& frame) throw();
+    int takeFrames(ReceivedFrame* frames, int maxFrames) throw();
+    void clearFrameTimes() throw();
+    NDArray* allocIngestArray(int generation, OverloadCounts& counts) throw();
+    NDArray* allocDrainArray(int generation) throw();
+    bool takeDropRequest() throw();
+    void fillReserve(int generation) throw();
+    void releaseReserve() throw();
+    void noteArraysInUse() throw();
+    bool isImageValid(const unsigned short* imagebuffer) throw();
+    void decodeFrame(ReceivedFrame& frame, HeaderDecoder* decoder) throw();
+    bool acquisitionDone() const throw();
+    void startWorkers() throw();
+    void releaseHeldFrames(bool giveUp);
+    void clearHeldFrames() throw();
+    void finishFrame(ReceivedFrame& frame);
+    void readMetaData(short bufferNumber, ReceivedFrame& frame) throw();
+    void addAttributes(NDAttributeList* list, const ReceivedFrame& frame);
+    void addAcquisitionAttributes(NDAttributeList* list);
+    void addFrameAttributes(NDAttributeList* list, const ReceivedFrame& frame);
+    void addStatsAttributes(NDAttributeList* list, const FrameStats& stats);
+    void publishStats(const FrameStats& stats);
+    void createHeaderDecoder(int bitAlignment) throw();
     void acquisitionComplete() throw();
     void checkMemoryBuffer(int& percentUsed, int& numFrames) throw(PcoException);
     void setValidBinning(std::set<int>& valid, int max, int step) throw();
@@ -318,8 +609,7 @@ private:
     void cfgPixelRate() throw(PcoException);
     void cfgAcquisitionTimes() throw(PcoException);
 	void cfgStorage() throw(PcoException);
-    template<typename T> void sumArray(NDArray* startingArray,
-            NDArray* addArray) throw();
+	void cfgMetaDataMode() throw(PcoException);
     void initialisePixelRate();
     void outputStatusMessage(const char* text);
     void doReboot();
@@ -335,10 +625,25 @@ private:
 	void onApplyBinningAndRoi(TakeLock& takeLock);
 	void onRequestPercentageRoi(TakeLock& takeLock);
 	void onAdcMode(TakeLock& takeLock);
-	void validateAndProcessFrame(NDArray* image);
-	void processFrame(NDArray* image);
+	void onRingTrigger(TakeLock& takeLock);
+	void onReadoutAdd(TakeLock& takeLock);
+	void onReadoutClear(TakeLock& takeLock);
+	void onReadout(TakeLock& takeLock);
+	void validateAndProcessFrame(ReceivedFrame& frame);
+	void processFrame(NDArray* image, const ReceivedFrame& frame);
 	void readFirstMemoryImage();
+	void startReadout();
+	unsigned long nextDrainImage() throw();
+	ReadoutRange requestedRange() throw();
+	void holdRecording() throw();
+	void swapRamSegment(bool record) throw();
+	bool nextPingPongBurst();
+	void resumeLiveImages() throw();
+	void pingPongPages(unsigned long& seg1, unsigned long& seg2) const throw();
 	bool readNextMemoryImage();
+	void endMemoryDrain() throw();
+	void ringWindow(unsigned long& first, unsigned long& last) throw();
+	bool ringComplete() const throw();
 	bool roiSymmetryRequiredX();
 	bool roiSymmetryRequiredY();
     void getDeviceFirmwareInfo();
@@ -368,6 +673,9 @@ public:
 	const StateMachine::Event* requestReboot;
 	const StateMachine::Event* requestMakeImages;
 	const StateMachine::Event* requestApplyBinningAndRoi;
+	const StateMachine::Event* requestProcessFrames;
+	const StateMachine::Event* requestRingTrigger;
+	const StateMachine::Event* requestReadout;
 
 public:
     StateMachine::StateSelector smInitialiseWait();
@@ -395,6 +703,8 @@ public:
     StateMachine::StateSelector smDrainImage();
     StateMachine::StateSelector smAlreadyStopped();
     StateMachine::StateSelector smApplyBinningAndRoi();
+    StateMachine::StateSelector smRingTrigger();
+    StateMachine::StateSelector smReadout();
 };
 
 #endif
@@ -18,6 +18,7 @@
 #include "iocsh.h"
 #include "sc2_SDKStructures.h"
 #include "SC2_SDKAddendum.h"
+#include "sc2_common.h"
 #include "sc2_defs.h"
 #include "PCO_err.h"
 #define PCO_ERRT_H_CREATE_OBJECT
@@ -30,21 +31,11 @@
  */
 PcoApi::PcoApi(Pco* pco, TraceStream* trace)
 : DllApi(pco, trace)
-, thread(*this, "PcoApi", epicsThreadGetStackSize(epicsThreadStackMedium))
+, capture(pco, trace)
 , buffersValid(false)
-, useGetImage(false)
 {
-    // Initialise the buffer information
-    for(int i=0; i<DllApi::maxNumBuffers; i++)
-    {
-        this->buffers[i].addedToDll = false;
-        this->buffers[i].eventHandle = NULL;
-    }
-    // Create the start/stop events
-    this->startEvent = ::CreateEvent(NULL, TRUE, FALSE, "StartEvent");
-    this->stopEvent = ::CreateEvent(NULL, TRUE, FALSE, "StopEvent");
     // Start the thread
-    this->thread.start();
+    this->capture.startThread();
 }
 
 /**
@@ -52,92 +43,94 @@ PcoApi::PcoApi(Pco* pco, TraceStream* trace)
  */
 PcoApi::~PcoApi()
 {
-    ::CloseHandle(this->startEvent);
-    ::CloseHandle(this->stopEvent);
 }
 
 /**
- * The thread that handles buffer events
+ * Capture loop constructor
  */
-void PcoApi::run()
+PcoApi::SdkCapture::SdkCapture(Pco* pco, TraceStream* trace)
+: FrameCapture(pco, trace, "PcoApi")
 {
-    while(true)
+    for(int i=0; i<DllApi::maxNumBuffers; i++)
     {
-		::ResetEvent(this->startEvent);
-        // Wait for the start event
-        HANDLE waitEvents[PcoApi::numberOfWaitingEvents] = {this->startEvent};
-        DWORD result = ::WaitForMultipleObjects(PcoApi::numberOfWaitingEvents,
-            waitEvents, FALSE, INFINITE);
-		::ResetEvent(this->startEvent);
-        if(result == WAIT_OBJECT_0)
-        {
-			*trace << "#### Entering run event loop" << std::endl;
-			::ResetEvent(this->stopEvent);
-            bool running = true;
-            while(running)
-            {
-				if(this->useGetImage)
-				{
-					// Check for stopped
-					if(::WaitForSingleObject(this->stopEvent, 100) == WAIT_OBJECT_0)
-					{
-						// Stop event received
-						::ResetEvent(this->stopEvent);
-						running = false;
-						*trace << "#### Exiting run event loop" << std::endl;
-					}
-					else
-					{
-						// Try to get a frame
-						this->pco->getFrames();
-					}
-				}
-				else
-				{
-					// Wait for an image or the stop event
-					HANDLE runEvents[PcoApi::numberOfRunningEvents];
-					runEvents[PcoApi::stopEventIndex] = this->stopEvent;
-					for(int i=0; i<DllApi::maxNumBuffers; i++)
-					{
-						if(this->buffers[i].eventHandle != NULL)
-						{
-							runEvents[PcoApi::firstBufferEventIndex+i] = this->buffers[i].eventHandle;
-						}
-					}
-					result = ::WaitForMultipleObjects(PcoApi::numberOfRunningEvents,
-						runEvents, FALSE, PcoApi::waitTimeoutMs);
-					{
-						// What should we do?
-						if(result == WAIT_TIMEOUT)
-						{
-							// Do a poll
-							this->pco->pollForFrames();
-						}
-						else if(::WaitForSingleObject(this->stopEvent, 0) == WAIT_OBJECT_0)
-						{
-							// Stop event received
-							::ResetEvent(this->stopEvent);
-							running = false;
-							*trace << "#### Exiting run event loop" << std::endl;
-						}
-						else if(result >= WAIT_OBJECT_0+PcoApi::firstBufferEventIndex &&
-							result < WAIT_OBJECT_0+PcoApi::firstBufferEventIndex+DllApi::maxNumBuffers)
-						{
-							// Handle a buffer ready
-							int eventBufferNumber = result - WAIT_OBJECT_0 - PcoApi::firstBufferEventIndex;
-							this->pco->frameReceived(eventBufferNumber);
-						}
-						else
-						{
-							// Faulty exit reason
-							*trace << "#### Unhandled wait result " << result << std::endl;
-							this->pco->frameWaitFault();
-						}
-					}
-				}
-            }
-        }
+        this->eventHandles[i] = NULL;
     }
+    this->sdkWakeEvent = ::CreateEvent(NULL, FALSE, FALSE, NULL);
+}
+
+/**
+ * Capture loop destructor
+ */
+PcoApi::SdkCapture::~SdkCapture()
+{
+    // The thread waits on our events, stop it before they go
+    this->stopThread();
+    ::CloseHandle(this->sdkWakeEvent);
+}
+
+/**
+ * Record the event the SDK created for a buffer
+ */
+void PcoApi::SdkCapture::setEventHandle(int bufferNumber, Handle eventHandle)
+{
+    this->eventHandles[bufferNumber] = eventHandle;
+    this->bufferAllocated(bufferNumber);
+}
+
+/**
+ * Set the SDK event of a buffer
+ */
+void PcoApi::SdkCapture::signalBuffer(int bufferNumber)
+{
+    ::SetEvent(this->eventHandles[bufferNumber]);
+}
+
+/**
+ * Clear the SDK event of a buffer
+ */
+void PcoApi::SdkCapture::resetBuffer(int bufferNumber)
+{
+    if(this->eventHandles[bufferNumber] != NULL)
+    {
+        ::ResetEvent(this->eventHandles[bufferNumber]);
+    }
+}
+
+/**
+ * Wake the capture loop
+ */
+void PcoApi::SdkCapture::wake()
+{
+    ::SetEvent(this->sdkWakeEvent);
+}
+
+/**
+ * Wait for one of a set of buffers using the SDK events
+ */
+int PcoApi::SdkCapture::waitForBuffers(const int* bufferNumbers, int numBuffers, double timeout)
+{
+    HANDLE runEvents[SdkCapture::numberOfRunningEvents];
+    runEvents[SdkCapture::wakeEventIndex] = this->sdkWakeEvent;
+    for(int i=0; i<numBuffers; i++)
+    {
+        runEvents[SdkCapture::firstBufferEventIndex+i] = this->eventHandles[bufferNumbers[i]];
+    }
+    DWORD result = ::WaitForMultipleObjects(SdkCapture::firstBufferEventIndex+numBuffers,
+        runEvents, FALSE, (DWORD)(timeout*1000.0));
+    if(result == WAIT_TIMEOUT)
+    {
+        return FrameCapture::waitTimeout;
+    }
+    else if(result == WAIT_OBJECT_0+SdkCapture::wakeEventIndex)
+    {
+        return FrameCapture::waitWoken;
+    }
+    else if(result >= WAIT_OBJECT_0+SdkCapture::firstBufferEventIndex &&
+        result < WAIT_OBJECT_0+SdkCapture::firstBufferEventIndex+(DWORD)numBuffers)
+    {
+        return (int)(result - WAIT_OBJECT_0 - SdkCapture::firstBufferEventIndex);
+    }
+    return FrameCapture::waitFault;
 }
 
 /**
@@ -662,7 +655,7 @@ int PcoApi::doAllocateBuffer(Handle handle, short* bufferNumber, unsigned long s
 {
     this->buffersValid = true;
     int result = PCO_AllocateBuffer(handle, bufferNumber, size, buffer, eventHandle);
-    this->buffers[*bufferNumber].eventHandle = *eventHandle;
+    this->capture.setEventHandle(*bufferNumber, *eventHandle);
     return result;
 }
 
@@ -673,11 +666,7 @@ int PcoApi::doCancelImages(Handle handle)
 {
     this->buffersValid = false;
     int result = PCO_CancelImages(handle);
-    for(int i=0; i<DllApi::maxNumBuffers; i++)
-    {
-        ::ResetEvent(this->buffers[i].eventHandle);
-        this->buffers[i].addedToDll = false;
-    }
+    this->capture.cancelBuffers();
     return result;
 }
 
@@ -709,9 +698,12 @@ int PcoApi::doAddBufferEx(Handle handle, unsigned long firstImage, unsigned long
 {
     if(this->buffersValid)
     {
-		::ResetEvent(this->buffers[bufferNumber].eventHandle);
-        return PCO_AddBufferEx(handle, firstImage, lastImage, bufferNumber,
+		this->capture.resetBuffer(bufferNumber);
+        int result = PCO_AddBufferEx(handle, firstImage, lastImage, bufferNumber,
                 xRes, yRes, bitRes);
+        // Tell the capture loop to wait for this buffer again
+        this->capture.bufferAdded(bufferNumber);
+        return result;
     }
     else
     {
@@ -895,13 +887,62 @@ int PcoApi::doSetCameraRamSegmentSize(Handle handle, unsigned long seg1,
 	return PCO_SetCameraRamSegmentSize(handle, segs);
 }
 
+/**
+ * Get the meta data mode
+ */
+int PcoApi::doGetMetaDataMode(Handle handle, unsigned short* mode, unsigned short* size,
+	unsigned short* version)
+{
+	return PCO_GetMetaDataMode(handle, mode, size, version);
+}
+
+/**
+ * Set the meta data mode
+ */
+int PcoApi::doSetMetaDataMode(Handle handle, unsigned short mode, unsigned short* size,
+	unsigned short* version)
+{
+	return PCO_SetMetaDataMode(handle, mode, size, version);
+}
+
+/**
+ * Get the meta data of the image in a buffer, decoding the BCD image counter
+ */
+int PcoApi::doGetMetaData(Handle handle, short bufferNumber, MetaData* metaData)
+{
+	PCO_METADATA_STRUCT meta;
+	::memset(&meta, 0, sizeof(meta));
+	meta.wSize = sizeof(meta);
+	int result = PCO_GetMetaData(handle, bufferNumber, &meta, 0, 0);
+	if(result == DllApi::errorNone)
+	{
+		// The counter's least significant byte comes first
+		metaData->imageCounter = 0;
+		for(int i=sizeof(meta.bIMAGE_COUNTER_BCD)-1; i>=0; i--)
+		{
+			metaData->imageCounter = metaData->imageCounter * Pco::bcdDigitValue * Pco::bcdDigitValue +
+				(meta.bIMAGE_COUNTER_BCD[i] >> Pco::bitsPerNybble) * Pco::bcdDigitValue +
+				(meta.bIMAGE_COUNTER_BCD[i] & Pco::nybbleMask);
+		}
+		metaData->exposureTimebase = meta.wEXPOSURE_TIME_BASE;
+		metaData->exposureTime = meta.dwEXPOSURE_TIME;
+		metaData->frameRateMilliHz = meta.dwFRAMERATE_MILLIHZ;
+		metaData->sensorTemperature = meta.sSENSOR_TEMPERATURE;
+		metaData->binningX = meta.bBINNING_X;
+		metaData->binningY = meta.bBINNING_Y;
+		metaData->triggerMode = meta.bTRIGGER_MODE;
+		metaData->syncStatus = meta.bSYNC_STATUS;
+		metaData->timeStatus = meta.bIMAGE_TIME_STATUS;
+	}
+	return result;
+}
+
 /*
  * Start the frame acquisition thread
  */
 void PcoApi::doStartFrameCapture(bool useGetImage)
 {
-	this->useGetImage = useGetImage;
-    ::SetEvent(this->startEvent);
+    this->capture.start(useGetImage);
 }
 
 /*
@@ -909,7 +950,7 @@ void PcoApi::doStartFrameCapture(bool useGetImage)
  */
 void PcoApi::doStopFrameCapture()
 {
-    ::SetEvent(this->stopEvent);
+    this->capture.stop();
 }
 
 // C entry point for iocinit
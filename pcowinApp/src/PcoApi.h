@@ -22,10 +22,11 @@
 #include "winsock2.h"
 #include "epicsThread.h"
 #include "epicsMutex.h"
+#include "FrameCapture.h"
 class Pco;
 class TraceStream;
 
-class PcoApi: public DllApi, public epicsThreadRunable
+class PcoApi: public DllApi
 {
 // Construction
 public:
@@ -122,34 +123,39 @@ protected:
 	virtual int doSetNoiseFilterMode(Handle handle, unsigned short mode);
 	virtual int doSetCameraRamSegmentSize(Handle handle, unsigned long seg1,
 		unsigned long seg2, unsigned long seg3, unsigned long seg4);
+	virtual int doGetMetaDataMode(Handle handle, unsigned short* mode, unsigned short* size,
+		unsigned short* version);
+	virtual int doSetMetaDataMode(Handle handle, unsigned short mode, unsigned short* size,
+		unsigned short* version);
+	virtual int doGetMetaData(Handle handle, short bufferNumber, MetaData* metaData);
 	virtual void doStartFrameCapture(bool useGetImage);
 	virtual void doStopFrameCapture();
 
-// Overrides of epicsThreadRunable
-public:
-    virtual void run();
-
-// Constants
+// The capture loop waiting on the events created by the SDK
 protected:
-    enum {numberOfRunningEvents = DllApi::maxNumBuffers+1};
-    enum {numberOfWaitingEvents = 1};
-    enum {waitTimeoutMs = 5000};
-    enum {stopEventIndex=0, firstBufferEventIndex=1};
-
+    class SdkCapture: public FrameCapture
+    {
+    public:
+        SdkCapture(Pco* pco, TraceStream* trace);
+        virtual ~SdkCapture();
+        void setEventHandle(int bufferNumber, Handle eventHandle);
+        virtual void signalBuffer(int bufferNumber);
+        virtual void resetBuffer(int bufferNumber);
+    protected:
+        virtual int waitForBuffers(const int* bufferNumbers, int numBuffers, double timeout);
+        virtual void wake();
+    protected:
+        enum {wakeEventIndex=0, firstBufferEventIndex=1};
+        enum {numberOfRunningEvents = DllApi::maxNumBuffers+1};
+        Handle sdkWakeEvent;          // Replaces FrameCapture::wakeEvent in the SDK's wait
+        Handle eventHandles[DllApi::maxNumBuffers];
+    };
 
 // Members
 protected:
-    epicsThread thread;
-    struct
-    {
-        bool addedToDll;
-        Handle eventHandle;
-    } buffers[DllApi::maxNumBuffers];
-    Handle stopEvent;
-    Handle startEvent;
+    SdkCapture capture;
     bool buffersValid;
 	Handle handle;
-	bool useGetImage;
 
 // Functions
 protected:
@@ -15,6 +15,14 @@
 #include "FreeLock.h"
 #include <sstream>
 
+// The latency stages, each measured between two of the frame time stamps
+const char* PerformanceMonitor::stageNames[PerformanceMonitor::numStages] =
+	{"CAPTURE", "QUEUE", "PROCESS", "CALLBACK", "TOTAL"};
+const PerformanceMonitor::Timestamp PerformanceMonitor::stageStart[PerformanceMonitor::numStages] =
+	{TS_WAKEUP, TS_COPIED, TS_DEQUEUED, TS_PROCESSED, TS_WAKEUP};
+const PerformanceMonitor::Timestamp PerformanceMonitor::stageEnd[PerformanceMonitor::numStages] =
+	{TS_COPIED, TS_DEQUEUED, TS_PROCESSED, TS_CALLBACKS, TS_CALLBACKS};
+
 // Constructor
 // When used at the client end, the server is NULL
 PerformanceMonitor::PerformanceMonitor(Pco* pco, TraceStream* trace)
@@ -29,6 +37,14 @@ PerformanceMonitor::PerformanceMonitor(Pco* pco, TraceStream* trace)
 	, paramCntDriverError(pco, "PCO_PERFCNT_DRIVERERROR", 0)
 	, paramCntCaptureError(pco, "PCO_PERFCNT_CAPTUREERROR", 0)
 	, paramCntPollGetFrame(pco, "PCO_PERFCNT_POLLGETFRAME", 0)
+	, paramCntDropNewest(pco, "PCO_PERFCNT_DROPNEWEST", 0)
+	, paramCntDropOldest(pco, "PCO_PERFCNT_DROPOLDEST", 0)
+	, paramCntDecimated(pco, "PCO_PERFCNT_DECIMATED", 0)
+	, paramCntReserveUsed(pco, "PCO_PERFCNT_RESERVEUSED", 0)
+	, paramCntWorkerStall(pco, "PCO_PERFCNT_WORKERSTALL", 0)
+	, paramCntReorderHold(pco, "PCO_PERFCNT_REORDERHOLD", 0)
+	, paramCntOutOfOrder(pco, "PCO_PERFCNT_OUTOFORDER", 0)
+	, paramCntLateFrame(pco, "PCO_PERFCNT_LATEFRAME", 0)
 	, paramCntFault(pco, "PCO_PERFCNT_FAULT", 0)
 	, paramAccReboot(pco, "PCO_PERFACC_REBOOT", 0)
 	, paramAccConnect(pco, "PCO_PERFACC_CONNECT", 0)
@@ -43,12 +59,30 @@ PerformanceMonitor::PerformanceMonitor(Pco* pco, TraceStream* trace)
 	, paramAccDriverError(pco, "PCO_PERFACC_DRIVERERROR", 0)
 	, paramAccCaptureError(pco, "PCO_PERFACC_CAPTUREERROR", 0)
 	, paramAccPollGetFrame(pco, "PCO_PERFACC_POLLGETFRAME", 0)
+	, paramAccDropNewest(pco, "PCO_PERFACC_DROPNEWEST", 0)
+	, paramAccDropOldest(pco, "PCO_PERFACC_DROPOLDEST", 0)
+	, paramAccDecimated(pco, "PCO_PERFACC_DECIMATED", 0)
+	, paramAccReserveUsed(pco, "PCO_PERFACC_RESERVEUSED", 0)
+	, paramAccWorkerStall(pco, "PCO_PERFACC_WORKERSTALL", 0)
+	, paramAccReorderHold(pco, "PCO_PERFACC_REORDERHOLD", 0)
+	, paramAccOutOfOrder(pco, "PCO_PERFACC_OUTOFORDER", 0)
+	, paramAccLateFrame(pco, "PCO_PERFACC_LATEFRAME", 0)
 	, paramAccFault(pco, "PCO_PERFACC_FAULT", 0)
 	, paramTestCount(pco, "PCO_PERF_TESTCOUNT", 0,
 			new AsynParam::Notify<PerformanceMonitor>(this, &PerformanceMonitor::onTestCount))
 	, paramReset(pco, "PCO_PERF_RESET", 0,
 			new AsynParam::Notify<PerformanceMonitor>(this, &PerformanceMonitor::onReset))
+	, paramLatencyReset(pco, "PCO_LATENCY_RESET", 0,
+			new AsynParam::Notify<PerformanceMonitor>(this, &PerformanceMonitor::onLatencyReset))
 {
+	// The latency parameters, PCO_LATENCY_<stage>_P50 etc
+	for(int i=0; i<numStages; i++)
+	{
+		std::string name = std::string("PCO_LATENCY_") + stageNames[i];
+		this->paramLatencyP50[i] = new DoubleParam(pco, (name + "_P50").c_str(), 0.0);
+		this->paramLatencyP99[i] = new DoubleParam(pco, (name + "_P99").c_str(), 0.0);
+		this->paramLatencyMax[i] = new DoubleParam(pco, (name + "_MAX").c_str(), 0.0);
+	}
 	// Set up the counter maps
 	this->session[PERF_GOODFRAME] = &this->paramCntGoodFrame;
 	this->session[PERF_MISSINGFRAME] = &this->paramCntMissingFrame;
@@ -59,6 +93,14 @@ PerformanceMonitor::PerformanceMonitor(Pco* pco, TraceStream* trace)
 	this->session[PERF_DRIVERERROR] = &this->paramCntDriverError;
 	this->session[PERF_CAPTUREERROR] = &this->paramCntCaptureError;
 	this->session[PERF_POLLGETFRAME] = &this->paramCntPollGetFrame;
+	this->session[PERF_DROPNEWEST] = &this->paramCntDropNewest;
+	this->session[PERF_DROPOLDEST] = &this->paramCntDropOldest;
+	this->session[PERF_DECIMATED] = &this->paramCntDecimated;
+	this->session[PERF_RESERVEUSED] = &this->paramCntReserveUsed;
+	this->session[PERF_WORKERSTALL] = &this->paramCntWorkerStall;
+	this->session[PERF_REORDERHOLD] = &this->paramCntReorderHold;
+	this->session[PERF_OUTOFORDER] = &this->paramCntOutOfOrder;
+	this->session[PERF_LATEFRAME] = &this->paramCntLateFrame;
 	this->accumulating[PERF_REBOOT] = &this->paramAccReboot;
 	this->accumulating[PERF_CONNECT] = &this->paramAccConnect;
 	this->accumulating[PERF_ARM] = &this->paramAccArm;
@@ -72,11 +114,25 @@ PerformanceMonitor::PerformanceMonitor(Pco* pco, TraceStream* trace)
 	this->accumulating[PERF_DRIVERERROR] = &this->paramAccDriverError;
 	this->accumulating[PERF_CAPTUREERROR] = &this->paramAccCaptureError;
 	this->accumulating[PERF_POLLGETFRAME] = &this->paramAccPollGetFrame;
+	this->accumulating[PERF_DROPNEWEST] = &this->paramAccDropNewest;
+	this->accumulating[PERF_DROPOLDEST] = &this->paramAccDropOldest;
+	this->accumulating[PERF_DECIMATED] = &this->paramAccDecimated;
+	this->accumulating[PERF_RESERVEUSED] = &this->paramAccReserveUsed;
+	this->accumulating[PERF_WORKERSTALL] = &this->paramAccWorkerStall;
+	this->accumulating[PERF_REORDERHOLD] = &this->paramAccReorderHold;
+	this->accumulating[PERF_OUTOFORDER] = &this->paramAccOutOfOrder;
+	this->accumulating[PERF_LATEFRAME] = &this->paramAccLateFrame;
 }
 
 // Destructor
 PerformanceMonitor::~PerformanceMonitor()
 {
+	for(int i=0; i<numStages; i++)
+	{
+		delete this->paramLatencyP50[i];
+		delete this->paramLatencyP99[i];
+		delete this->paramLatencyMax[i];
+	}
 }
 
 // Increment a counter
@@ -136,3 +192,41 @@ void PerformanceMonitor::onTestCount(TakeLock& takeLock)
 	count(takeLock, (PerformanceMonitor::Param)(int)paramTestCount);
 }
 
+
+// Add the latencies of a frame to the histograms.  A stage is skipped
+// if either of its time stamps is missing (zero), which is the case for
+// frames that did not arrive through the streaming path.
+void PerformanceMonitor::recordLatency(TakeLock& takeLock, const epicsUInt64* timestamps)
+{
+	for(int i=0; i<numStages; i++)
+	{
+		epicsUInt64 start = timestamps[stageStart[i]];
+		epicsUInt64 end = timestamps[stageEnd[i]];
+		if(start != 0 && end >= start)
+		{
+			this->latency[i].add(end - start);
+		}
+	}
+}
+
+// Publish the latency percentiles in milliseconds
+void PerformanceMonitor::publishLatency(TakeLock& takeLock)
+{
+	for(int i=0; i<numStages; i++)
+	{
+		*this->paramLatencyP50[i] = this->latency[i].percentile(0.50) * 1000.0;
+		*this->paramLatencyP99[i] = this->latency[i].percentile(0.99) * 1000.0;
+		*this->paramLatencyMax[i] = this->latency[i].maximum() * 1000.0;
+	}
+}
+
+// Empty the latency histograms
+void PerformanceMonitor::onLatencyReset(TakeLock& takeLock)
+{
+	(*trace) << "Clear latency histograms" << std::endl;
+	for(int i=0; i<numStages; i++)
+	{
+		this->latency[i].clear();
+	}
+	this->publishLatency(takeLock);
+}
@@ -10,6 +10,8 @@
 #define PerformanceMonitor_H_
 
 #include "IntegerParam.h"
+#include "DoubleParam.h"
+#include "LatencyHistogram.h"
 #include "NDArray.h"
 #include <map>
 class TraceStream;
@@ -21,12 +23,23 @@ class PerformanceMonitor
 public:
 	enum Param {PERF_REBOOT=0, PERF_CONNECT, PERF_ARM, PERF_START, PERF_GOODFRAME, PERF_MISSINGFRAME,
 		PERF_OUTOFARRAYS, PERF_INVALIDFRAME, PERF_FRAMESTATUSERROR, PERF_WAITFAULT, PERF_DRIVERERROR,
-		PERF_CAPTUREERROR, PERF_POLLGETFRAME};
+		PERF_CAPTUREERROR, PERF_POLLGETFRAME, PERF_DROPNEWEST, PERF_DROPOLDEST, PERF_DECIMATED,
+		PERF_RESERVEUSED, PERF_WORKERSTALL, PERF_REORDERHOLD,
+		PERF_OUTOFORDER, PERF_LATEFRAME};
+	// The points in the pipeline at which a frame is time stamped
+	enum Timestamp {TS_WAKEUP=0, TS_COPIED, TS_DEQUEUED, TS_PROCESSED, TS_CALLBACKS, numTimestamps};
+	// The latencies measured between them
+	enum Stage {STAGE_CAPTURE=0, STAGE_QUEUE, STAGE_PROCESS, STAGE_CALLBACK, STAGE_TOTAL, numStages};
 	PerformanceMonitor(Pco* pco, TraceStream* trace);
 	virtual ~PerformanceMonitor();
 	void count(TakeLock& takeLock, PerformanceMonitor::Param param, bool fault=true, int by=1);
 	void clear(TakeLock& takeLock);
+	void recordLatency(TakeLock& takeLock, const epicsUInt64* timestamps);
+	void publishLatency(TakeLock& takeLock);
 private:
+	static const char* stageNames[numStages];
+	static const Timestamp stageStart[numStages];
+	static const Timestamp stageEnd[numStages];
 	Pco* pco;
 	TraceStream* trace;
 	// Session counters
@@ -39,6 +52,14 @@ private:
 	IntegerParam paramCntDriverError;       // The PCO driver library returned an error during acquisition
 	IntegerParam paramCntCaptureError;      // Frame event received but buffer not released to us
 	IntegerParam paramCntPollGetFrame;      // A frame was received by polling after the camera jammed up
+	IntegerParam paramCntDropNewest;        // Out of arrays, the new frame was dropped
+	IntegerParam paramCntDropOldest;        // Out of arrays, the oldest queued frame was dropped
+	IntegerParam paramCntDecimated;         // Out of arrays, the frame was skipped while decimating
+	IntegerParam paramCntReserveUsed;       // Out of arrays, the frame used a reserved array
+	IntegerParam paramCntWorkerStall;       // The processing workers' reorder window was full
+	IntegerParam paramCntReorderHold;       // A processed frame waited for an earlier one
+	IntegerParam paramCntOutOfOrder;        // A frame arrived ahead of a lower image number
+	IntegerParam paramCntLateFrame;         // A frame arrived after its number was given up on
 	IntegerParam paramCntFault;             // Count of all faults
 	// Accumulating counters (autosave restores them after a reboot)
 	IntegerParam paramAccReboot;
@@ -54,16 +75,31 @@ private:
 	IntegerParam paramAccDriverError;
 	IntegerParam paramAccCaptureError;
 	IntegerParam paramAccPollGetFrame;
+	IntegerParam paramAccDropNewest;
+	IntegerParam paramAccDropOldest;
+	IntegerParam paramAccDecimated;
+	IntegerParam paramAccReserveUsed;
+	IntegerParam paramAccWorkerStall;
+	IntegerParam paramAccReorderHold;
+	IntegerParam paramAccOutOfOrder;
+	IntegerParam paramAccLateFrame;
 	IntegerParam paramAccFault;
+	// Frame pipeline latencies
+	DoubleParam* paramLatencyP50[numStages];
+	DoubleParam* paramLatencyP99[numStages];
+	DoubleParam* paramLatencyMax[numStages];
+	LatencyHistogram latency[numStages];
 	// Commands
 	IntegerParam paramTestCount;
 	IntegerParam paramReset;
+	IntegerParam paramLatencyReset;
 	// The counter maps
 	std::map<PerformanceMonitor::Param, IntegerParam*> session;
 	std::map<PerformanceMonitor::Param, IntegerParam*> accumulating;
 	// Handlers
     void onReset(TakeLock& takeLock);
     void onTestCount(TakeLock& takeLock);
+    void onLatencyReset(TakeLock& takeLock);
 };
 
 #endif /* PerformanceMonitor_H_ */
@@ -0,0 +1,64 @@
+/* Simd.cpp
+ *
+ * Revamped PCO area detector driver.
+ *
+ * The vector instruction sets the frame kernels are built for.
+ *
+ */
+
+#include "Simd.h"
+#if defined(SIMD_AVX2) && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+/** Constants */
+const char* Simd::isaNames[Simd::numIsas] = {"Scalar", "SSE2", "AVX2"};
+
+/**
+ * Return the instruction set the kernels use, chosen on first call.
+ */
+int Simd::isa()
+{
+	static int result = -1;
+	if(result < 0)
+	{
+		int found = isaScalar;
+#ifdef SIMD_SSE2
+		found = isaSse2;
+#endif
+		if(found == isaSse2 && Simd::cpuHasAvx2())
+		{
+			found = isaAvx2;
+		}
+		result = found;
+	}
+	return result;
+}
+
+/**
+ * Does the processor and operating system support AVX2?
+ */
+bool Simd::cpuHasAvx2()
+{
+#if !defined(SIMD_AVX2)
+	return false;
+#elif defined(_MSC_VER)
+	int regs[4];
+	__cpuid(regs, 0);
+	if(regs[0] < 7)
+	{
+		return false;
+	}
+	__cpuid(regs, 1);
+	// OSXSAVE and AVX, then the OS must be saving the YMM state
+	if((regs[2] & (1<<27)) == 0 || (regs[2] & (1<<28)) == 0 || (_xgetbv(0) & 6) != 6)
+	{
+		return false;
+	}
+	__cpuidex(regs, 7, 0);
+	return (regs[1] & (1<<5)) != 0;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") != 0;
+#endif
+}
@@ -0,0 +1,45 @@
+/* Simd.h
+ *
+ * Revamped PCO area detector driver.
+ *
+ * The vector instruction sets the frame kernels are built for.  SSE2
+ * kernels are compiled in whenever the compiler targets SSE2, which
+ * every x86-64 build does.  AVX2 kernels are compiled for that target
+ * alone, marked SIMD_TARGET_AVX2, and only used if the processor has it.
+ * Kernels are chosen once, with
+ *     #ifdef SIMD_AVX2
+ *         if(Simd::avx2()) ...
+ *     #endif
+ *
+ */
+#ifndef SIMD_H_
+#define SIMD_H_
+
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SIMD_SSE2
+#endif
+
+#if defined(SIMD_SSE2) && defined(_MSC_VER)
+#include <immintrin.h>
+#define SIMD_AVX2
+#define SIMD_TARGET_AVX2
+#elif defined(SIMD_SSE2) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define SIMD_AVX2
+#define SIMD_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+class Simd
+{
+public:
+	enum Isa {isaScalar=0, isaSse2=1, isaAvx2=2, numIsas};
+	static const char* isaNames[numIsas];
+	static int isa();
+	/** Use the AVX2 kernels? */
+	static bool avx2() {return Simd::isa() == isaAvx2;}
+private:
+	static bool cpuHasAvx2();
+};
+
+#endif /* SIMD_H_ */
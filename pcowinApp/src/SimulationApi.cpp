@@ -13,14 +13,17 @@
 #include "SimulationApi.h"
 #include "TraceStream.h"
 #include "Pco.h"
+#include "HeaderDecoder.h"
 #include "epicsExport.h"
 #include "iocsh.h"
+#include <ctime>
 
 /**
  * Constants
  */
 const int SimulationApi::edgeSetupDataLength = 1;
 const int SimulationApi::edgeSetupDataType = 1;
+const int SimulationApi::metaDataSize = 32;
 
 /**
  * Constructor
@@ -85,20 +88,31 @@ SimulationApi::SimulationApi(Pco* pco, TraceStream* trace)
 , paramArmed(pco, "SimArmed", false)
 , paramClearStateRecord(pco, "SimClearStateRecord", 0)
 , paramExternalTrigger(pco, "SimExternalTrigger", 0, new AsynParam::Notify<SimulationApi>(this, &SimulationApi::onExternalTrigger))
+, paramMetaDataMode(pco, "SimMetaDataMode", DllApi::metaDataModeOff)
 , paramStateRecord(pco, "SimStateRecord", "")
 , bufferQueue(DllApi::maxNumBuffers, sizeof(int))
+, capture(pco, trace, "SimulationApi")
 , stateMachine(NULL)
 , frameNumber(0)
+, activeSegment(1)
 {
     // Initialise the buffers
     for(int i=0; i<DllApi::maxNumBuffers; i++)
     {
         this->buffers[i].status = 0;
         this->buffers[i].buffer = NULL;
+        this->buffers[i].frameNumber = 0;
+    }
+    // The camera RAM starts out empty
+    for(int i=0; i<DllApi::storageNumSegments; i++)
+    {
+        this->segments[i].sizePages = 0;
+        this->segments[i].validImages = 0;
+        this->segments[i].firstFrame = 0;
     }
     // Create the state machine
     this->stateMachine = new StateMachine("SimulationApi", this->pco,
-            &paramStateRecord, trace);
+            &paramStateRecord, trace, 10, ThreadPlacement::roleSimulation);
 	// Events
     requestConnectionUp = stateMachine->event("ConnectionUp");
     requestConnectionDown = stateMachine->event("ConnectionDown");
@@ -132,6 +146,8 @@ SimulationApi::SimulationApi(Pco* pco, TraceStream* trace)
 	stateMachine->transition(stateRecording, requestTrigger, new StateMachine::Act<SimulationApi>(this, &SimulationApi::smCreateFrame), stateRecording);
 	// Starting state
 	stateMachine->initialState(stateConnected);
+    // Start the capture thread
+    this->capture.startThread();
 }
 
 /**
@@ -191,60 +207,237 @@ void SimulationApi::generateFrame()
     {
         this->frameNumber = 0;
     }
+    // In burst mode the camera records it
+    if(paramStorageMode == DllApi::storageModeRecorder)
+    {
+        this->recordFrame();
+    }
     // Is there a buffer available in the queue
     if(this->bufferQueue.pending() > 0)
     {
         int bufferNumber;
         this->bufferQueue.tryReceive(&bufferNumber, sizeof(int));
-        // Fill the frame with a pattern
-        for(int x=0; x<paramActualHorzRes; x++)
+        this->fillFrame(bufferNumber, this->frameNumber);
+        // Give the buffer back to the driver by setting its event
+        this->buffers[bufferNumber].status |= DllApi::statusDllEventSet;
+        this->capture.signalBuffer(bufferNumber);
+    }
+}
+
+/**
+ * Fill a buffer with the simulated frame, time stamped now
+ * \param[in] bufferNumber The buffer
+ * \param[in] frameNumber The image number in the header
+ */
+void SimulationApi::fillFrame(int bufferNumber, unsigned long frameNumber)
+{
+    FrameFormat format;
+    format.width = paramActualHorzRes;
+    format.height = paramActualVertRes;
+    format.timestampMode = paramTimestampMode;
+    format.bitAlignment = paramBitAlignment;
+    format.dynResolution = paramDynResolution;
+    epicsTimeStamp now;
+    epicsTimeGetCurrent(&now);
+    SimulationApi::fillFrame(this->buffers[bufferNumber].buffer, format, frameNumber, now);
+    this->buffers[bufferNumber].frameNumber = frameNumber;
+}
+
+/**
+ * Draw a simulated frame: a pattern with the binary header a camera
+ * puts in the first pixels when the time stamp mode asks for it.
+ * \param[in] frame The frame
+ * \param[in] format The size and header settings
+ * \param[in] frameNumber The image number
+ * \param[in] time The time stamp, written as local time to the microsecond
+ */
+void SimulationApi::fillFrame(unsigned short* frame, const FrameFormat& format,
+        unsigned long frameNumber, const epicsTimeStamp& time)
+{
+    // Fill the frame with a pattern
+    for(int x=0; x<format.width; x++)
+    {
+        for(int y=0; y<format.height; y++)
         {
-            for(int y=0; y<paramActualVertRes; y++)
+            bool dark = true;
+            if(((x / 16) & 1) != 0)
             {
-                bool dark = true;
-                if(((x / 16) & 1) != 0)
-                {
-                    dark = !dark;
-                }
-                if(((y / 16) & 1) != 0)
-                {
-                    dark = !dark;
-                }
-                this->buffers[bufferNumber].buffer[y*paramActualHorzRes+x] = (dark ? 15 : 255);
+                dark = !dark;
+            }
+            if(((y / 16) & 1) != 0)
+            {
+                dark = !dark;
             }
+            frame[y*format.width+x] = (dark ? 15 : 255);
+        }
+    }
+    // Plant the BCD time stamp if enabled
+    if(format.timestampMode == DllApi::timestampModeBinary ||
+            format.timestampMode == DllApi::timestampModeBinaryAndAscii)
+    {
+        int shiftLowBcd = 0;
+        if(format.bitAlignment == DllApi::bitAlignmentMsb)
+        {
+            shiftLowBcd = Pco::bitsPerShortWord - format.dynResolution;
         }
-        // Plant the BCD time stamp if enabled
-        if(paramTimestampMode == DllApi::timestampModeBinary ||
-                paramTimestampMode == DllApi::timestampModeBinaryAndAscii)
+        int shiftHighBcd = shiftLowBcd + Pco::bitsPerNybble;
+        struct tm ct;
+        unsigned long nanoSec;
+        epicsTimeToTM(&ct, &nanoSec, &time);
+        unsigned long microSec = nanoSec / 1000;
+        unsigned long pairs[HeaderDecoder::headerLength] = {
+            (frameNumber / 1000000) % 100, (frameNumber / 10000) % 100,
+            (frameNumber / 100) % 100, frameNumber % 100,
+            (unsigned long)(ct.tm_year + 1900) / 100, (unsigned long)(ct.tm_year + 1900) % 100,
+            (unsigned long)ct.tm_mon + 1, (unsigned long)ct.tm_mday, (unsigned long)ct.tm_hour,
+            (unsigned long)ct.tm_min, (unsigned long)ct.tm_sec,
+            microSec / 10000, (microSec / 100) % 100, microSec % 100};
+        for(int i=0; i<HeaderDecoder::headerLength; i++)
         {
-            // The frame number
-            int shiftLowBcd = 0;
-            if(paramBitAlignment == DllApi::bitAlignmentMsb)
+            frame[i] = (unsigned short)(((pairs[i] % Pco::bcdDigitValue) << shiftLowBcd) |
+                    ((pairs[i] / Pco::bcdDigitValue) << shiftHighBcd));
+        }
+    }
+}
+
+/**
+ * The number of frames a segment of the camera RAM holds
+ * \param[in] segment The segment, numbered from 1
+ */
+unsigned long SimulationApi::segmentCapacity(int segment)
+{
+    unsigned long pixelsPerFrame = (unsigned long)paramActualHorzRes * paramActualVertRes;
+    unsigned long result = 0;
+    if(pixelsPerFrame > 0 && segment >= 1 && segment <= DllApi::storageNumSegments)
+    {
+        result = this->segments[segment-1].sizePages * (unsigned long)paramPageSize / pixelsPerFrame;
+    }
+    return result;
+}
+
+/**
+ * Record the current frame in the active segment of the camera RAM.
+ * When the segment is full a sequence stops recording and a ring buffer
+ * overwrites its oldest frame, the images stay numbered oldest first.
+ */
+void SimulationApi::recordFrame()
+{
+    TakeLock takeLock(&this->ramLock);
+    int segment = this->activeSegment;
+    if(this->segments[segment-1].validImages < this->segmentCapacity(segment))
+    {
+        if(this->segments[segment-1].validImages == 0)
+        {
+            this->segments[segment-1].firstFrame = this->frameNumber;
+        }
+        this->segments[segment-1].validImages++;
+    }
+    else if(paramRecorderSubmode == DllApi::recorderSubmodeRingBuffer &&
+            this->segments[segment-1].validImages > 0)
+    {
+        this->segments[segment-1].firstFrame++;
+    }
+}
+
+/**
+ * Read an image from the camera RAM into a buffer
+ * \param[in] segment The segment, numbered from 1
+ * \param[in] image The image in the segment, numbered from 1
+ * \param[in] bufferNumber The buffer
+ * \return False if there is no such image
+ */
+bool SimulationApi::readMemoryImage(unsigned short segment, unsigned long image, int bufferNumber)
+{
+    bool found = false;
+    unsigned long frameNumber = 0;
+    {
+        TakeLock takeLock(&this->ramLock);
+        found = segment >= 1 && segment <= DllApi::storageNumSegments &&
+                image >= 1 && image <= this->segments[segment-1].validImages;
+        if(found)
+        {
+            frameNumber = this->segments[segment-1].firstFrame + image - 1;
+        }
+    }
+    if(found)
+    {
+        this->fillFrame(bufferNumber, frameNumber);
+    }
+    return found;
+}
+
+/**
+ * Check the header decoders against frames drawn by the simulation,
+ * for each bit alignment and a range of dynamic resolutions.  The frames are spaced so the sequence crosses
+ * hour and day boundaries and the image number wraps.
+ * \param[in] numFrames The number of frames to check for each decoder
+ * \return False if any frame did not decode to what was written
+ */
+bool SimulationApi::checkHeaderDecoder(int numFrames)
+{
+    static const struct {int bitAlignment; int dynResolution;} configs[] = {
+        {DllApi::bitAlignmentLsb, 16}, {DllApi::bitAlignmentLsb, 12},
+        {DllApi::bitAlignmentMsb, 16}, {DllApi::bitAlignmentMsb, 14},
+        {DllApi::bitAlignmentMsb, 12}, {DllApi::bitAlignmentMsb, 10}};
+    static const double framePeriod = 97.123457;
+    enum {width=32, height=2};
+    int failures = 0;
+    epicsTimeStamp start;
+    epicsTimeGetCurrent(&start);
+    for(size_t c=0; c<sizeof(configs)/sizeof(configs[0]); c++)
+    {
+        HeaderDecoder* decoder = HeaderDecoder::create(configs[c].bitAlignment,
+                configs[c].dynResolution);
+        FrameFormat format;
+        format.width = width;
+        format.height = height;
+        format.timestampMode = DllApi::timestampModeBinary;
+        format.bitAlignment = configs[c].bitAlignment;
+        format.dynResolution = configs[c].dynResolution;
+        epicsTimeStamp time = start;
+        unsigned long frameNumber = 99999999 - numFrames / 2;
+        for(int i=0; i<numFrames; i++)
+        {
+            unsigned short frame[width*height];
+            // The header only holds microseconds
+            time.nsec -= time.nsec % 1000;
+            SimulationApi::fillFrame(frame, format, frameNumber, time);
+            long number;
+            epicsTimeStamp decoded;
+            decoder->decode(frame, number, decoded);
+            bool timeOk = decoded.secPastEpoch == time.secPastEpoch && decoded.nsec == time.nsec;
+            if(!timeOk && decoded.nsec == time.nsec)
             {
-                shiftLowBcd = Pco::bitsPerShortWord - paramDynResolution;
+                // The repeated hour when summer time ends is ambiguous in
+                // the header, accept either reading of the wall clock time
+                struct tm decodedTm;
+                struct tm expectedTm;
+                unsigned long nsec;
+                epicsTimeToTM(&decodedTm, &nsec, &decoded);
+                epicsTimeToTM(&expectedTm, &nsec, &time);
+                timeOk = decodedTm.tm_year == expectedTm.tm_year && decodedTm.tm_yday == expectedTm.tm_yday &&
+                        decodedTm.tm_hour == expectedTm.tm_hour && decodedTm.tm_min == expectedTm.tm_min &&
+                        decodedTm.tm_sec == expectedTm.tm_sec;
             }
-            int shiftHighBcd = shiftLowBcd + Pco::bitsPerNybble;
-            unsigned long n = this->frameNumber;
-            unsigned long divisor = Pco::bcdDigitValue * Pco::bcdDigitValue *
-                    Pco::bcdDigitValue * Pco::bcdDigitValue * Pco::bcdDigitValue *
-                    Pco::bcdDigitValue * Pco::bcdDigitValue;
-            for(int i=0; i<Pco::bcdPixelLength; i++)
+            if(number != (long)frameNumber || decoder->imageNumber(frame) != (long)frameNumber || !timeOk)
             {
-                unsigned long n0 = n / divisor;
-                n -= n0 * divisor;
-                divisor /= Pco::bcdDigitValue;
-                unsigned long n1 = n / divisor;
-                n -= n1 * divisor;
-                divisor /= Pco::bcdDigitValue;
-                unsigned short pixel = (unsigned short)((n1 << shiftLowBcd) | (n0 << shiftHighBcd));
-                this->buffers[bufferNumber].buffer[i] = pixel;
+                if(failures < 10)
+                {
+                    printf("headerDecoderCheck: alignment %d resolution %d frame %lu decoded as %ld %u.%09u, "
+                            "expected %u.%09u\n", configs[c].bitAlignment, configs[c].dynResolution,
+                            frameNumber, number, decoded.secPastEpoch, decoded.nsec,
+                            time.secPastEpoch, time.nsec);
+                }
+                failures++;
             }
-            // TODO: The time
+            frameNumber = (frameNumber + 1) % 100000000;
+            epicsTimeAddSeconds(&time, framePeriod);
         }
-        // Give the buffer back to the driver
-        this->buffers[bufferNumber].status |= DllApi::statusDllEventSet;
-        this->pco->frameReceived(bufferNumber);
+        delete decoder;
     }
+    printf("headerDecoderCheck: %d frames, %d failures\n",
+            numFrames * (int)(sizeof(configs)/sizeof(configs[0])), failures);
+    return failures == 0;
 }
 
 /**
@@ -441,11 +634,12 @@ int SimulationApi::doGetStorageStruct(Handle handle, Storage* storage)
     {
 		storage->ramSizePages = (unsigned long)paramRamSize;
 		storage->pageSizePixels= (unsigned short)paramPageSize;
+		TakeLock takeLock(&this->ramLock);
 		for(int i=0; i<DllApi::storageNumSegments; i++)
 		{
-			storage->segmentSizePages[storageNumSegments] = 0;
+			storage->segmentSizePages[i] = this->segments[i].sizePages;
 		}
-		storage->activeSegment = 0;
+		storage->activeSegment = this->activeSegment;
         result = DllApi::errorNone;
     }
     return result;
@@ -1017,11 +1211,12 @@ int SimulationApi::doAllocateBuffer(Handle handle, short* bufferNumber, unsigned
                 this->buffers[*bufferNumber].buffer = *buffer;
                 this->buffers[*bufferNumber].status |= DllApi::statusDllExternalBuffer;
             }
-            // Create the event (the simulation doesn't use this, so just indicate created)
+            // Create the event, the capture loop provides it
             if(*eventHandle == NULL)
             {
                 this->buffers[*bufferNumber].status |= DllApi::statusDllEventCreated;
             }
+            this->capture.bufferAllocated(*bufferNumber);
             // Return result
             result = DllApi::errorNone;
         }
@@ -1043,6 +1238,7 @@ int SimulationApi::doCancelImages(Handle handle)
             int bufferNumber;
             this->bufferQueue.tryReceive(&bufferNumber, sizeof(int));
         }
+        this->capture.cancelBuffers();
         this->post(SimulationApi::requestCancelImages);
         result = DllApi::errorNone;
     }
@@ -1086,15 +1282,37 @@ int SimulationApi::doAddBufferEx(Handle handle, unsigned long firstImage, unsign
     int result = DllApi::errorAny;
     if(paramConnected && paramOpen)
     {
+        result = DllApi::errorNone;
         // Are the parameters correct?
         if((int)xRes == paramActualHorzRes && (int)yRes == paramActualVertRes &&
         		firstImage==0 && lastImage==0)
         {
             // Put the buffer on the queue
+            this->buffers[bufferNumber].status &= ~DllApi::statusDllEventSet;
+            this->capture.resetBuffer(bufferNumber);
             int v = bufferNumber;
-            this->bufferQueue.trySend(&v, sizeof(int));
+            if(this->bufferQueue.trySend(&v, sizeof(int)) == 0)
+            {
+                this->capture.bufferAdded(bufferNumber);
+            }
+        }
+        else if((int)xRes == paramActualHorzRes && (int)yRes == paramActualVertRes &&
+        		firstImage!=0 && lastImage==firstImage)
+        {
+            // An image from the active segment, the transfer is immediate
+            this->buffers[bufferNumber].status &= ~DllApi::statusDllEventSet;
+            this->capture.resetBuffer(bufferNumber);
+            this->capture.bufferAdded(bufferNumber);
+            if(this->readMemoryImage(this->activeSegment, firstImage, bufferNumber))
+            {
+                this->buffers[bufferNumber].status |= DllApi::statusDllEventSet;
+                this->capture.signalBuffer(bufferNumber);
+            }
+            else
+            {
+                result = DllApi::errorAny;
+            }
         }
-        result = DllApi::errorNone;
     }
     return result;
 }
@@ -1106,7 +1324,13 @@ int SimulationApi::doGetImageEx(Handle handle, unsigned short segment, unsigned
 		unsigned long lastImage, short bufferNumber, unsigned short xRes, 
 		unsigned short yRes, unsigned short bitRes)
 {
-    return DllApi::errorAny;
+    int result = DllApi::errorAny;
+    if(paramConnected && paramOpen && firstImage == lastImage &&
+            this->readMemoryImage(segment, firstImage, bufferNumber))
+    {
+        result = DllApi::errorNone;
+    }
+    return result;
 }
 
 /**
@@ -1164,7 +1388,8 @@ int SimulationApi::doFreeBuffer(Handle handle, short bufferNumber)
  */
 int SimulationApi::doGetActiveRamSegment(Handle handle, unsigned short* segment)
 {
-    *segment = 1;
+    TakeLock takeLock(&this->ramLock);
+    *segment = this->activeSegment;
     return DllApi::errorNone;
 }
 
@@ -1173,7 +1398,14 @@ int SimulationApi::doGetActiveRamSegment(Handle handle, unsigned short* segment)
  */
 int SimulationApi::doSetActiveRamSegment(Handle handle, unsigned short segment)
 {
-    return DllApi::errorNone;
+    int result = DllApi::errorAny;
+    if(segment >= 1 && segment <= DllApi::storageNumSegments)
+    {
+        TakeLock takeLock(&this->ramLock);
+        this->activeSegment = segment;
+        result = DllApi::errorNone;
+    }
+    return result;
 }
 
 /**
@@ -1184,6 +1416,12 @@ int SimulationApi::doGetNumberOfImagesInSegment(Handle handle, unsigned short se
 {
     *validImageCount = 0;
     *maxImageCount = 0;
+    if(segment >= 1 && segment <= DllApi::storageNumSegments)
+    {
+        TakeLock takeLock(&this->ramLock);
+        *validImageCount = this->segments[segment-1].validImages;
+        *maxImageCount = this->segmentCapacity(segment);
+    }
     return DllApi::errorNone;
 }
 
@@ -1209,8 +1447,8 @@ int SimulationApi::doSetTimeouts(Handle handle, unsigned int commandTimeout,
  */
 int SimulationApi::doGetCameraRamSize(Handle handle, unsigned long* numPages, unsigned short* pageSize)
 {
-	*numPages = 0;
-	*pageSize = 0;
+	*numPages = (unsigned long)paramRamSize;
+	*pageSize = (unsigned short)paramPageSize;
 	return DllApi::errorNone;
 }
 
@@ -1219,6 +1457,8 @@ int SimulationApi::doGetCameraRamSize(Handle handle, unsigned long* numPages, un
  */
 int SimulationApi::doClearRamSegment(Handle handle)
 {
+    TakeLock takeLock(&this->ramLock);
+    this->segments[this->activeSegment-1].validImages = 0;
     return DllApi::errorNone;
 }
 
@@ -1299,7 +1539,80 @@ int SimulationApi::doSetNoiseFilterMode(Handle handle, unsigned short mode)
 int SimulationApi::doSetCameraRamSegmentSize(Handle handle, unsigned long seg1,
 	unsigned long seg2, unsigned long seg3, unsigned long seg4)
 {
-    return DllApi::errorNone;
+    int result = DllApi::errorAny;
+    if(seg1 + seg2 + seg3 + seg4 <= (unsigned long)paramRamSize)
+    {
+        // Resizing loses the recorded images
+        unsigned long sizes[DllApi::storageNumSegments] = {seg1, seg2, seg3, seg4};
+        TakeLock takeLock(&this->ramLock);
+        for(int i=0; i<DllApi::storageNumSegments; i++)
+        {
+            this->segments[i].sizePages = sizes[i];
+            this->segments[i].validImages = 0;
+        }
+        result = DllApi::errorNone;
+    }
+    return result;
+}
+
+/**
+ * Get the meta data mode
+ */
+int SimulationApi::doGetMetaDataMode(Handle handle, unsigned short* mode, unsigned short* size,
+	unsigned short* version)
+{
+    int result = DllApi::errorAny;
+    if(paramConnected && paramOpen)
+    {
+        *mode = (unsigned short)paramMetaDataMode;
+        *size = (unsigned short)SimulationApi::metaDataSize;
+        *version = 1;
+        result = DllApi::errorNone;
+    }
+    return result;
+}
+
+/**
+ * Set the meta data mode
+ */
+int SimulationApi::doSetMetaDataMode(Handle handle, unsigned short mode, unsigned short* size,
+	unsigned short* version)
+{
+    int result = DllApi::errorAny;
+    if(paramConnected && paramOpen && (paramGeneralCaps & DllApi::generalCapsMetaData) != 0)
+    {
+        paramMetaDataMode = mode;
+        *size = (unsigned short)SimulationApi::metaDataSize;
+        *version = 1;
+        result = DllApi::errorNone;
+    }
+    return result;
+}
+
+/**
+ * Get the meta data of the frame in a buffer, made up from the settings
+ */
+int SimulationApi::doGetMetaData(Handle handle, short bufferNumber, MetaData* metaData)
+{
+    int result = DllApi::errorAny;
+    if(paramConnected && paramOpen && paramMetaDataMode == DllApi::metaDataModeOn &&
+            bufferNumber >= 0 && bufferNumber < DllApi::maxNumBuffers)
+    {
+        double period = (double)paramDelayTime / DllApi::timebaseScaleFactor[paramDelayTimebase] +
+                (double)paramExposureTime / DllApi::timebaseScaleFactor[paramExposureTimebase];
+        metaData->imageCounter = this->buffers[bufferNumber].frameNumber;
+        metaData->exposureTimebase = (unsigned short)paramExposureTimebase;
+        metaData->exposureTime = (unsigned long)paramExposureTime;
+        metaData->frameRateMilliHz = period > 0.0 ? (unsigned long)(1000.0 / period) : 0;
+        metaData->sensorTemperature = (short)paramTempCcd;
+        metaData->binningX = (unsigned char)paramActualHorzBin;
+        metaData->binningY = (unsigned char)paramActualVertBin;
+        metaData->triggerMode = (unsigned char)paramTriggerMode;
+        metaData->syncStatus = 0;
+        metaData->timeStatus = 0;
+        result = DllApi::errorNone;
+    }
+    return result;
 }
 
 /*
@@ -1307,6 +1620,7 @@ int SimulationApi::doSetCameraRamSegmentSize(Handle handle, unsigned long seg1,
  */
 void SimulationApi::doStartFrameCapture(bool useGetImage)
 {
+    this->capture.start(useGetImage);
 }
 
 /*
@@ -1314,6 +1628,7 @@ void SimulationApi::doStartFrameCapture(bool useGetImage)
  */
 void SimulationApi::doStopFrameCapture()
 {
+    this->capture.stop();
 }
 
 // C entry point for iocinit
@@ -1340,10 +1655,27 @@ static void configSimulationApiCallFunc(const iocshArgBuf *args)
     simulationApiConfig(args[0].sval);
 }
 
+// Check the frame header decoders against simulated headers
+extern "C" int headerDecoderCheck(int numFrames)
+{
+    SimulationApi::checkHeaderDecoder(numFrames > 0 ? numFrames : 1000);
+    return asynSuccess;
+}
+static const iocshArg headerDecoderCheckArg0 = {"numFrames", iocshArgInt};
+static const iocshArg* const headerDecoderCheckArgs[] =
+    {&headerDecoderCheckArg0};
+static const iocshFuncDef checkHeaderDecoder =
+    {"headerDecoderCheck", 1, headerDecoderCheckArgs};
+static void checkHeaderDecoderCallFunc(const iocshArgBuf *args)
+{
+    headerDecoderCheck(args[0].ival);
+}
+
 /** Register the functions */
 static void simulationApiRegister(void)
 {
     iocshRegister(&configSimulationApi, configSimulationApiCallFunc);
+    iocshRegister(&checkHeaderDecoder, checkHeaderDecoderCallFunc);
 }
 
 extern "C" { epicsExportRegistrar(simulationApiRegister); }
@@ -15,10 +15,12 @@
 
 #include <string>
 #include "epicsMessageQueue.h"
+#include "epicsMutex.h"
 #include "StateMachine.h"
 #include "DllApi.h"
 #include "IntegerParam.h"
 #include "StringParam.h"
+#include "FrameCapture.h"
 class Pco;
 class TraceStream;
 class TakeLock;
@@ -120,6 +122,11 @@ protected:
 	virtual int doSetNoiseFilterMode(Handle handle, unsigned short mode);
 	virtual int doSetCameraRamSegmentSize(Handle handle, unsigned long seg1,
 		unsigned long seg2, unsigned long seg3, unsigned long seg4);
+	virtual int doGetMetaDataMode(Handle handle, unsigned short* mode, unsigned short* size,
+		unsigned short* version);
+	virtual int doSetMetaDataMode(Handle handle, unsigned short mode, unsigned short* size,
+		unsigned short* version);
+	virtual int doGetMetaData(Handle handle, short bufferNumber, MetaData* metaData);
 	virtual void doStartFrameCapture(bool useGetImage);
 	virtual void doStopFrameCapture();
 
@@ -183,6 +190,7 @@ private:
 	IntegerParam paramArmed;
 	IntegerParam paramClearStateRecord;
 	IntegerParam paramExternalTrigger;
+	IntegerParam paramMetaDataMode;
 	StringParam paramStateRecord;
 
 public:
@@ -207,6 +215,7 @@ public:
 protected:
     static const int edgeSetupDataLength;
     static const int edgeSetupDataType;
+    static const int metaDataSize;
     static const char* stateNames[];
     static const char* eventNames[];
 
@@ -216,15 +225,44 @@ protected:
     {
         unsigned short* buffer;
         unsigned long status;
+        unsigned long frameNumber;      // Of the frame last put in it
     } buffers[DllApi::maxNumBuffers];
     epicsMessageQueue bufferQueue;
+    FrameCapture capture;
     StateMachine* stateMachine;
     int frameNumber;
+    /** The camera RAM, only the numbers of the frames recorded are kept */
+    struct
+    {
+        unsigned long sizePages;
+        unsigned long validImages;
+        unsigned long firstFrame;       // The frame number of image 1
+    } segments[DllApi::storageNumSegments];
+    unsigned short activeSegment;       // Numbered from 1
+    epicsMutex ramLock;                 // The segments are read on the driver's threads
+    /** How a frame is drawn */
+    struct FrameFormat
+    {
+        int width;
+        int height;
+        int timestampMode;
+        int bitAlignment;
+        int dynResolution;
+    };
 
 // Functions
 protected:
     void post(const StateMachine::Event* req);
     void generateFrame();
+    void fillFrame(int bufferNumber, unsigned long frameNumber);
+    static void fillFrame(unsigned short* frame, const FrameFormat& format,
+            unsigned long frameNumber, const epicsTimeStamp& time);
+    unsigned long segmentCapacity(int segment);
+    void recordFrame();
+    bool readMemoryImage(unsigned short segment, unsigned long image, int bufferNumber);
+public:
+    static bool checkHeaderDecoder(int numFrames);
+protected:
     void startTriggerTimer();
     void onConnected(TakeLock& takeLock);
     void onExternalTrigger(TakeLock& takeLock);
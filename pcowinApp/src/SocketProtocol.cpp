@@ -6,6 +6,7 @@
  */
 
 #include "SocketProtocol.h"
+#include "ThreadPlacement.h"
 #ifdef _WIN32
 #include <winsock2.h>
 #define socklen_t int
@@ -51,6 +52,7 @@ SocketProtocol::SocketProtocol(const char* name, const char* preamble, size_t ma
 , tcpPort(0)
 , buffer(NULL)
 , bufferSize(0)
+, placementGeneration(ThreadPlacement::unapplied)
 , rxState(RXSTATE_PREAMBLE)
 , requiredSize(0)
 {
@@ -79,6 +81,14 @@ SocketProtocol::~SocketProtocol()
     delete this->txbuffer;
 }
 
+/** Place the receive thread as a gang thread of a port.
+ * \param[in] portName The port the connection belongs to
+ */
+void SocketProtocol::setPlacement(const char* portName)
+{
+    this->placementPort = portName;
+}
+
 /** Initialise the protocol variables to their initial state
  */
 void SocketProtocol::resetProtocol()
@@ -107,6 +117,11 @@ void SocketProtocol::run()
     this->resetProtocol();
     while(true)
     {
+        if(!this->placementPort.empty())
+        {
+            ThreadPlacement::apply(this->placementPort.c_str(), ThreadPlacement::roleGang,
+                    this->placementGeneration);
+        }
         switch(this->state)
         {
         case STATE_IDLE:
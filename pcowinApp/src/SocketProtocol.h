@@ -64,6 +64,8 @@ private:
     std::string hostName;
     int tcpPort;
     char* txbuffer;
+    std::string placementPort;
+    int placementGeneration;
 private:
     // Protocol variables
     char* buffer;
@@ -78,6 +80,7 @@ public:
     void server(long long fd);
     void client(const char* hostName, int tcpPort);
     void listen(int tcpPort);
+    void setPlacement(const char* portName);
     void transmit(char tag, int parameter, void* data, size_t dataSize);
     virtual void connected() {}
     virtual void disconnected() {}
@@ -0,0 +1,89 @@
+/* SpscQueue.h
+ *
+ * A fixed capacity queue that is safe without locks provided that
+ * exactly one thread pushes and exactly one thread pops.  The
+ * indices are published with memory barriers so that an item is
+ * completely written before the consumer can see it and completely
+ * read before the producer can overwrite it.
+ *
+ */
+#ifndef SPSCQUEUE_H_
+#define SPSCQUEUE_H_
+
+#include <vector>
+#include "epicsAtomic.h"
+
+template<typename T>
+class SpscQueue
+{
+public:
+	SpscQueue(int capacity)
+	: slots(capacity+1)
+	, numSlots(capacity+1)
+	, head(0)
+	, tail(0)
+	{
+	}
+
+	/** Add an item, producer thread only.
+	 * \param[in] item The item to add
+	 * \return False if the queue is full
+	 */
+	bool tryPush(const T& item)
+	{
+		int next = (this->tail + 1) % this->numSlots;
+		if(next == epicsAtomicGetIntT(&this->head))
+		{
+			return false;
+		}
+		this->slots[this->tail] = item;
+		epicsAtomicWriteMemoryBarrier();
+		epicsAtomicSetIntT(&this->tail, next);
+		return true;
+	}
+
+	/** Remove an item, consumer thread only.
+	 * \param[out] item The item removed
+	 * \return False if the queue is empty
+	 */
+	bool tryPop(T& item)
+	{
+		if(this->head == epicsAtomicGetIntT(&this->tail))
+		{
+			return false;
+		}
+		epicsAtomicReadMemoryBarrier();
+		item = this->slots[this->head];
+		// A write barrier does not order the read of the slot before the
+		// store of the index, the compare and swap is a full barrier.  It
+		// always succeeds, only the consumer writes the head.
+		epicsAtomicCmpAndSwapIntT(&this->head, this->head, (this->head + 1) % this->numSlots);
+		return true;
+	}
+
+	/** The number of items in the queue.  Only exact when called
+	 * from the producer or consumer thread.
+	 */
+	int pending() const
+	{
+		int n = epicsAtomicGetIntT(&this->tail) - epicsAtomicGetIntT(&this->head);
+		return n < 0 ? n + this->numSlots : n;
+	}
+
+	/** The maximum number of items the queue can hold */
+	int capacity() const
+	{
+		return this->numSlots - 1;
+	}
+
+private:
+	SpscQueue();
+	SpscQueue(const SpscQueue& other);
+	SpscQueue& operator=(const SpscQueue& other);
+	std::vector<T> slots;
+	int numSlots;
+	int head;    // Written only by the consumer
+	int tail;    // Written only by the producer
+};
+
+#endif /* SPSCQUEUE_H_ */
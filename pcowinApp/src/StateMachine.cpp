@@ -7,7 +7,15 @@
 #include "StringParam.h"
 #include "TakeLock.h"
 #include <string>
+#include <map>
 #include <algorithm>
+#include "epicsTime.h"
+#include "epicsMutex.h"
+#include "epicsAtomic.h"
+#include "epicsStdio.h"
+
+/** The state record is published at most this often, in seconds */
+const double StateMachine::recordPublishPeriod = 0.1;
 
 /**
  * Timer class constructor.
@@ -59,6 +67,8 @@ void StateMachine::Timer::stop()
  */
 StateMachine::Timer::expireStatus StateMachine::Timer::expire(const epicsTime& currentTime)
 {
+    ThreadPlacement::apply(this->machine->placementName(), ThreadPlacement::roleTimer,
+            this->machine->timerPlacementGeneration);
     this->machine->post(this->expiryEvent);
     return noRestart;
 }
@@ -104,44 +114,6 @@ const StateMachine::State* StateMachine::TransitionAct::execute() const
 	return result;
 }
 
-/* Transition key constructor. */
-StateMachine::TransitionKey::TransitionKey(const State* st, const Event* ev)
-	: st(st), ev(ev)
-{
-}
-
-/* Transition key default constructor. */
-StateMachine::TransitionKey::TransitionKey()
-	: st(NULL), ev(NULL)
-{
-}
-
-/* Transition key copy constructor. */
-StateMachine::TransitionKey::TransitionKey(const TransitionKey& other)
-	: st(NULL), ev(NULL)
-{
-	*this = other;
-}
-
-/* Transition key destructor */
-StateMachine::TransitionKey::~TransitionKey()
-{
-}
-
-/* Transition key assignment operator */
-StateMachine::TransitionKey& StateMachine::TransitionKey::operator=(const TransitionKey& other)
-{
-	st=other.st; 
-	ev=other.ev; 
-	return *this;
-}
-
-/* Transition key less than operator so this object can be used as a map key */
-bool StateMachine::TransitionKey::operator<(const TransitionKey& other) const
-{
-	return *st == *other.st ? *ev < *other.ev : *st < *other.st;
-}
-
 /**
  * Constructor.
  * \param[in] name The name of the machine, used in trace messages.
@@ -154,20 +126,32 @@ bool StateMachine::TransitionKey::operator<(const TransitionKey& other) const
  * \param[in] stateNames An array of state name strings.
  * \param[in] eventNames An array of event name strings.
  * \param[in] requestQueueCapacity The size of the event queue.
+ * \param[in] role The placement role of the machine's thread.
  */
 StateMachine::StateMachine(const char* name,
         asynPortDriver* portDriver,
         StringParam* paramRecord,
-        TraceStream* tracer, int requestQueueCapacity)
-    : currentState(NULL)
+        TraceStream* tracer, int requestQueueCapacity,
+        ThreadPlacement::Role role)
+    : tableStates(0)
+    , tableEvents(0)
+    , currentState(NULL)
     , name(name)
     , tracer(tracer)
     , portDriver(portDriver)
     , paramRecord(paramRecord)
+    , recordHead(0)
+    , recordLength(0)
+    , recordChanged(false)
+    , recordPublishedTime(0)
+    , recordClearRequested(0)
     , requestQueue(requestQueueCapacity, sizeof(const Event*))
     , thread(*this, name, epicsThreadGetStackSize(epicsThreadStackMedium))
-    , timerQueue(epicsTimerQueueActive::allocate(true))
-    , timer(this)
+    , timerQueue(epicsTimerQueueActive::allocate(false))
+    , timer(new Timer(this))
+    , role(role)
+    , placementGeneration(ThreadPlacement::unapplied)
+    , timerPlacementGeneration(ThreadPlacement::unapplied)
 {
     // Start the thread
     this->thread.start();
@@ -178,28 +162,63 @@ StateMachine::StateMachine(const char* name,
  */
 StateMachine::~StateMachine()
 {
+    // A null event stops the thread
+    const Event* stop = NULL;
+    this->requestQueue.send(&stop, sizeof(const Event*));
+    this->thread.exitWait();
+    // The timer goes back to its queue, so it must go first
+    delete this->timer;
+    this->timer = NULL;
     this->timerQueue.release();
-    std::map<TransitionKey, TransitionAct*>::iterator pos;
-    for(std::map<TransitionKey, TransitionAct*>::iterator pos=transitions.begin();
-    		pos!=transitions.end(); ++pos)
+    for(size_t i=0; i<table.size(); i++)
     {
-    	delete pos->second;
+    	delete table[i];
     }
-	transitions.clear();
-    for(std::list<const State*>::iterator pos=states.begin();
-    		pos!=states.end(); ++pos)
+	table.clear();
+    for(size_t i=0; i<states.size(); i++)
     {
-    	delete *pos;
+    	delete states[i];
     }
     states.clear();
-    for(std::list<const Event*>::iterator pos=events.begin();
-    		pos!=events.end(); ++pos)
+    for(size_t i=0; i<events.size(); i++)
     {
-    	delete *pos;
+    	delete events[i];
     }
     events.clear();
 }
 
+/**
+ * The name to place the machine's threads by, the port's if there is one
+ */
+const char* StateMachine::placementName() const
+{
+	return this->portDriver != NULL ? this->portDriver->portName : this->name.c_str();
+}
+
+/**
+ * Size the transition table for the states and events defined so far,
+ * keeping the transitions already in it.
+ */
+void StateMachine::layoutTable()
+{
+	int numStates = (int)states.size();
+	int numEvents = (int)events.size();
+	if(numStates != tableStates || numEvents != tableEvents)
+	{
+		std::vector<TransitionAct*> newTable(numStates*numEvents, (TransitionAct*)NULL);
+		for(int st=0; st<tableStates; st++)
+		{
+			for(int ev=0; ev<tableEvents; ev++)
+			{
+				newTable[st*numEvents + ev] = table[st*tableEvents + ev];
+			}
+		}
+		table.swap(newTable);
+		tableStates = numStates;
+		tableEvents = numEvents;
+	}
+}
+
 /**
  * Define a state transition.
  */
@@ -208,17 +227,11 @@ void StateMachine::transition(const State* st, const Event* ev, AbstractAct* act
 {
 	// The transition
 	TransitionAct* action = new TransitionAct(act, s1, s2, s3, s4);
-	TransitionKey key(st, ev);
-	// Is one already in the map with this st/ev pair?
-	std::map<TransitionKey, TransitionAct*>::iterator pos = transitions.find(key);
-	if(pos != transitions.end())
-	{
-		// Yes, remove it.
-		delete pos->second;
-		transitions.erase(pos);
-	}
-	// Add in this transition
-	transitions[key] = action;
+	layoutTable();
+	// Replace any already defined for this st/ev pair
+	TransitionAct*& entry = table[(int)*st*tableEvents + (int)*ev];
+	delete entry;
+	entry = action;
 }
 
 /**
@@ -254,7 +267,7 @@ void StateMachine::initialState(const State* state)
  */
 void StateMachine::post(const Event* req)
 {
-    if(tracer != NULL)
+    if(tracer != NULL && tracer->enabled())
     {
     	*(tracer) << name << ": post request = " << *req << std::endl;
     }
@@ -268,8 +281,8 @@ void StateMachine::post(const Event* req)
  */
 void StateMachine::startTimer(double delay, const Event* expiryEvent)
 {
-    this->timer.stop();
-    this->timer.start(delay, expiryEvent);
+    this->timer->stop();
+    this->timer->start(delay, expiryEvent);
 }
 
 /**
@@ -277,49 +290,133 @@ void StateMachine::startTimer(double delay, const Event* expiryEvent)
  */
 void StateMachine::stopTimer()
 {
-    this->timer.stop();
+    this->timer->stop();
 }
 
 /**
- * The function that is run by the thread.  Runs forever processing
- * events from the message queue when available.
+ * The function that is run by the thread.  Processes events from the
+ * message queue until a null event arrives.  A changed state record is
+ * published straight away after a quiet spell and otherwise at most every
+ * recordPublishPeriod, so a burst of events does not take the port lock
+ * for each one.
  */
 void StateMachine::run()
 {
-    while(true)
+    bool running = true;
+    while(running)
     {
+        ThreadPlacement::apply(this->placementName(), this->role, this->placementGeneration);
+        double timeout = -1.0;
+        if(this->recordChanged)
+        {
+            double elapsed = (double)(epicsMonotonicGet() - this->recordPublishedTime) * 1.0e-9;
+            if(elapsed >= StateMachine::recordPublishPeriod)
+            {
+                this->publishRecord();
+            }
+            else
+            {
+                timeout = StateMachine::recordPublishPeriod - elapsed;
+            }
+        }
         const Event* event;
-        if(requestQueue.receive(&event, sizeof(const Event*)) == sizeof(const Event*))
+        int received = timeout < 0.0 ?
+                requestQueue.receive(&event, sizeof(const Event*)) :
+                requestQueue.receive(&event, sizeof(const Event*), timeout);
+        if(received == sizeof(const Event*))
         {
-            // Get the event processed
-			TransitionKey key(currentState, event);
-			std::map<TransitionKey, TransitionAct*>::iterator pos = transitions.find(key);
-			const State* nextState = this->currentState;
-			if(pos != transitions.end())
-			{
-				nextState = pos->second->execute();
-			}
-            // Do the trace
-            if(tracer != NULL)
+            if(event == NULL)
             {
-            	(*tracer) << name << ": " << *currentState << "--" << *event << "--> " <<
-            			*nextState << std::endl;
+                running = false;
             }
-            // Update the state record
+            else
             {
-            	TakeLock takeLock(portDriver);
-            	std::string record = *paramRecord;
-            	record += (char)(int)*nextState;
-            	size_t startPos = record.size() - maxStateRecordLength;
-            	startPos = std::max<size_t>(startPos, 0);
-            	*paramRecord = record.substr(startPos, maxStateRecordLength);
+                this->dispatch(event);
             }
-            // Change the state
-            currentState = nextState;
         }
     }
 }
 
+/**
+ * Process one event: look up the transition, run its action, record the
+ * next state and move to it.  Nothing is allocated and no lock taken.
+ * \param[in] event The event
+ * \return The next state
+ */
+const StateMachine::State* StateMachine::dispatch(const Event* event)
+{
+    // Get the event processed
+    int st = (int)*currentState;
+    int ev = (int)*event;
+    const State* nextState = this->currentState;
+    if(st < tableStates && ev < tableEvents)
+    {
+        TransitionAct* action = table[st*tableEvents + ev];
+        if(action != NULL)
+        {
+            nextState = action->execute();
+        }
+    }
+    // Do the trace
+    if(tracer != NULL && tracer->enabled())
+    {
+    	(*tracer) << name << ": " << *currentState << "--" << *event << "--> " <<
+    			*nextState << std::endl;
+    }
+    // Update the state record
+    this->takeRecordClear();
+    this->record[this->recordHead] = (char)(int)*nextState;
+    this->recordHead = (this->recordHead + 1) % maxStateRecordLength;
+    this->recordLength = std::min<int>(this->recordLength + 1, maxStateRecordLength);
+    this->recordChanged = true;
+    // Change the state
+    currentState = nextState;
+    return nextState;
+}
+
+/**
+ * Write the state record to its parameter, oldest state first.
+ */
+void StateMachine::publishRecord()
+{
+    this->takeRecordClear();
+    char text[maxStateRecordLength];
+    int oldest = (this->recordHead - this->recordLength + maxStateRecordLength) % maxStateRecordLength;
+    for(int i=0; i<this->recordLength; i++)
+    {
+        text[i] = this->record[(oldest + i) % maxStateRecordLength];
+    }
+    if(this->paramRecord != NULL && this->portDriver != NULL)
+    {
+        TakeLock takeLock(portDriver);
+        *paramRecord = std::string(text, this->recordLength);
+    }
+    this->recordChanged = false;
+    this->recordPublishedTime = epicsMonotonicGet();
+}
+
+/**
+ * Empty the state record if a clear has been requested.
+ */
+void StateMachine::takeRecordClear()
+{
+    if(epicsAtomicGetIntT(&this->recordClearRequested))
+    {
+        epicsAtomicSetIntT(&this->recordClearRequested, 0);
+        this->recordHead = 0;
+        this->recordLength = 0;
+    }
+}
+
+/**
+ * Forget the states recorded so far, the record parameter is cleared
+ * by the caller.
+ */
+void StateMachine::clearRecord()
+{
+    epicsAtomicSetIntT(&this->recordClearRequested, 1);
+}
+
 /**
  * Return the number of events on the queue.
  */
@@ -348,3 +445,117 @@ bool StateMachine::isState(const State* s)
     return this->currentState == s;
 }
 
+/** The actions of the benchmark machine */
+class StateMachineBenchmark
+{
+public:
+	StateMachine::StateSelector step() {return StateMachine::firstState;}
+};
+
+/** The map key transitions were looked up by before the table, as it was */
+class StateMachineBenchmarkKey
+{
+private:
+	const StateMachine::State* st;
+	const StateMachine::Event* ev;
+public:
+	StateMachineBenchmarkKey(const StateMachine::State* st, const StateMachine::Event* ev)
+		: st(st), ev(ev) {}
+	StateMachineBenchmarkKey(const StateMachineBenchmarkKey& other)
+		: st(NULL), ev(NULL) {*this = other;}
+	StateMachineBenchmarkKey& operator=(const StateMachineBenchmarkKey& other)
+		{st=other.st; ev=other.ev; return *this;}
+	bool operator<(const StateMachineBenchmarkKey& other) const
+		{return *st == *other.st ? *ev < *other.ev : *st < *other.st;}
+};
+
+/**
+ * Measure the event dispatch rate.  The way events were dispatched before
+ * the transition table is timed alongside the table for comparison.  Its
+ * map lookup and state record update are the old code, but the port lock
+ * and the record parameter need a port, so an epicsMutex and a string
+ * stand in for them.  The parameter callbacks the old update made when it
+ * released the port lock are not included, so the old way was slower
+ * than this shows.
+ * \param[in] numEvents The number of events to dispatch
+ */
+void StateMachine::benchmark(int numEvents)
+{
+	enum {numStates=10, numBenchmarkEvents=16};
+	if(numEvents <= 0)
+	{
+		numEvents = 1000000;
+	}
+	StateMachineBenchmark target;
+	StateMachine machine("Benchmark", NULL, NULL);
+	const State* benchStates[numStates];
+	const Event* benchEvents[numBenchmarkEvents];
+	char name[32];
+	for(int i=0; i<numStates; i++)
+	{
+		epicsSnprintf(name, sizeof(name), "State%d", i);
+		benchStates[i] = machine.state(name);
+	}
+	for(int i=0; i<numBenchmarkEvents; i++)
+	{
+		epicsSnprintf(name, sizeof(name), "Event%d", i);
+		benchEvents[i] = machine.event(name);
+	}
+	std::map<StateMachineBenchmarkKey, TransitionAct*> transitions;
+	for(int st=0; st<numStates; st++)
+	{
+		for(int ev=0; ev<numBenchmarkEvents; ev++)
+		{
+			const State* next = benchStates[(st + 1) % numStates];
+			machine.transition(benchStates[st], benchEvents[ev],
+				new Act<StateMachineBenchmark>(&target, &StateMachineBenchmark::step), next);
+			transitions[StateMachineBenchmarkKey(benchStates[st], benchEvents[ev])] =
+				machine.table[st*machine.tableEvents + ev];
+		}
+	}
+	machine.initialState(benchStates[0]);
+	// The old way, the record starts full as the old update underflowed
+	// while it was shorter
+	epicsMutex lock;
+	std::string paramRecord(maxStateRecordLength, (char)0);
+	const State* currentState = benchStates[0];
+	epicsTimeStamp start;
+	epicsTimeStamp end;
+	epicsTimeGetCurrent(&start);
+	for(int i=0; i<numEvents; i++)
+	{
+		const Event* event = benchEvents[i % numBenchmarkEvents];
+		StateMachineBenchmarkKey key(currentState, event);
+		std::map<StateMachineBenchmarkKey, TransitionAct*>::iterator pos = transitions.find(key);
+		const State* nextState = currentState;
+		if(pos != transitions.end())
+		{
+			nextState = pos->second->execute();
+		}
+		{
+			TakeLock takeLock(&lock);
+			std::string record = paramRecord;
+			record += (char)(int)*nextState;
+			size_t startPos = record.size() - maxStateRecordLength;
+			startPos = std::max<size_t>(startPos, 0);
+			paramRecord = record.substr(startPos, maxStateRecordLength);
+		}
+		currentState = nextState;
+	}
+	epicsTimeGetCurrent(&end);
+	double mapTime = epicsTimeDiffInSeconds(&end, &start);
+	// The table way
+	epicsTimeGetCurrent(&start);
+	for(int i=0; i<numEvents; i++)
+	{
+		machine.dispatch(benchEvents[i % numBenchmarkEvents]);
+	}
+	epicsTimeGetCurrent(&end);
+	double tableTime = epicsTimeDiffInSeconds(&end, &start);
+	machine.recordChanged = false;
+	printf("pcoBenchmark stateMachine: %d events, %d states x %d events\n",
+		numEvents, numStates, numBenchmarkEvents);
+	printf("    map:   %.2f Mevents/s, old lookup with the port lock and record parameter emulated\n",
+		mapTime > 0.0 ? numEvents / mapTime / 1e6 : 0.0);
+	printf("    table: %.2f Mevents/s\n", tableTime > 0.0 ? numEvents / tableTime / 1e6 : 0.0);
+}
@@ -6,13 +6,14 @@
 #define __STATE_MACHINE_H
 
 #include <string>
-#include <map>
-#include <list>
+#include <vector>
 #include <iostream>
 #include "epicsMessageQueue.h"
 #include "epicsThread.h"
 #include "epicsTimer.h"
+#include "epicsTypes.h"
 #include "asynPortDriver.h"
+#include "ThreadPlacement.h"
 class TraceStream;
 class StringParam;
 
@@ -24,6 +25,7 @@ public:
 	{
 	public:
 		AbstractAct() {}
+		virtual ~AbstractAct() {}
 		virtual StateSelector operator()() = 0;
 	};
 	template<class Target>
@@ -96,36 +98,44 @@ private:
 		~TransitionAct();
 		const State* execute() const;
 	};
-	class TransitionKey
-	{
-	private:
-		const State* st;
-		const Event* ev;
-	public:
-		TransitionKey(const State* st, const Event* ev);
-		TransitionKey();
-		TransitionKey(const TransitionKey& other);
-		~TransitionKey();
-		TransitionKey& operator=(const TransitionKey& other);
-		bool operator<(const TransitionKey& other) const;
-	};
-	std::map<TransitionKey, TransitionAct*> transitions;
-	std::list<const State*> states;
-	std::list<const Event*> events;
+	// The transitions in a flat table indexed by state then event, NULL where there is none
+	std::vector<TransitionAct*> table;
+	int tableStates;
+	int tableEvents;
+	std::vector<const State*> states;
+	std::vector<const Event*> events;
     const State* currentState;
     std::string name;
     TraceStream* tracer;
     asynPortDriver* portDriver;
     StringParam* paramRecord;
     enum {maxStateRecordLength=40};
+    static const double recordPublishPeriod;
+    // The state record, a ring of the latest states published at a throttled rate
+    char record[maxStateRecordLength];
+    int recordHead;
+    int recordLength;
+    bool recordChanged;
+    epicsUInt64 recordPublishedTime;
+    int recordClearRequested;
     epicsMessageQueue requestQueue;
     epicsThread thread;
     epicsTimerQueueActive& timerQueue;
-    Timer timer;
+    Timer* timer;                // Deleted before its queue is released
+    ThreadPlacement::Role role;
+    int placementGeneration;
+    int timerPlacementGeneration;
+private:
+    const char* placementName() const;
+    void layoutTable();
+    const State* dispatch(const Event* event);
+    void publishRecord();
+    void takeRecordClear();
 public:
     StateMachine(const char* name, asynPortDriver* portDriver,
             StringParam* paramRecord,
-            TraceStream* tracer=NULL, int requestQueueCapacity=10);
+            TraceStream* tracer=NULL, int requestQueueCapacity=10,
+            ThreadPlacement::Role role=ThreadPlacement::roleState);
     virtual ~StateMachine();
     void post(const Event* req);
     void startTimer(double delay, const Event* expiryEvent);
@@ -140,6 +150,8 @@ public:
 	const State* state(const char* name);
 	const Event* event(const char* name);
 	void initialState(const State* state);
+	void clearRecord();
+	static void benchmark(int numEvents);
 };
 
 #endif
@@ -0,0 +1,289 @@
+/* ThreadPlacement.cpp
+ *
+ * Revamped PCO area detector driver.
+ *
+ * CPU affinity and priority for the driver's threads.
+ *
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+#include "ThreadPlacement.h"
+#include "TakeLock.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include "epicsThread.h"
+#include "epicsAtomic.h"
+#include "epicsString.h"
+#include "epicsExport.h"
+#include "iocsh.h"
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+/** The role names used by the IOC shell commands and the parameter names */
+const char* ThreadPlacement::roleNames[ThreadPlacement::numRoles] =
+	{"STATE", "INGEST", "CAPTURE", "SIMULATION", "GANG", "TIMER", "COPY", "PROCESS"};
+
+/** The settings */
+std::map<ThreadPlacement::Key, ThreadPlacement::Setting> ThreadPlacement::settings;
+epicsMutex ThreadPlacement::lock;
+int ThreadPlacement::generation = 0;
+
+/**
+ * Set the affinity and priority of a role.  Threads pick the change
+ * up the next time they apply their placement.
+ * \param[in] portName The port, NULL or empty for all ports
+ * \param[in] role The thread role
+ * \param[in] cpuMask The CPUs the threads may run on, 0 to leave alone
+ * \param[in] priority The EPICS thread priority, 0 to leave alone
+ * \return False if the priority is out of range
+ */
+bool ThreadPlacement::configure(const char* portName, Role role, unsigned long long cpuMask, int priority)
+{
+	bool result = priority >= 0 && priority <= (int)epicsThreadPriorityMax;
+	if(result)
+	{
+		TakeLock takeLock(&ThreadPlacement::lock);
+		Setting& setting = ThreadPlacement::settings[Key(portName == NULL ? "" : portName, role)];
+		setting.cpuMask = cpuMask;
+		setting.priority = priority;
+		epicsAtomicIncrIntT(&ThreadPlacement::generation);
+	}
+	return result;
+}
+
+/**
+ * Set the placement of several roles from a string of the form
+ * "role=cpuMask[:priority],...", eg "capture=0x4:90,state=0x8".
+ * \param[in] portName The port, NULL or empty for all ports
+ * \param[in] spec The settings
+ * \return False if any of the settings could not be understood
+ */
+bool ThreadPlacement::configure(const char* portName, const char* spec)
+{
+	bool result = true;
+	std::stringstream items(spec == NULL ? "" : spec);
+	std::string item;
+	while(std::getline(items, item, ','))
+	{
+		std::string::size_type equals = item.find('=');
+		Role role;
+		if(equals == std::string::npos || !ThreadPlacement::findRole(item.substr(0, equals).c_str(), role))
+		{
+			printf("ThreadPlacement: bad setting \"%s\"\n", item.c_str());
+			result = false;
+			continue;
+		}
+		const char* value = item.c_str() + equals + 1;
+		char* end = NULL;
+		unsigned long long cpuMask = strtoull(value, &end, 0);
+		int priority = 0;
+		if(*end == ':')
+		{
+			priority = (int)strtol(end + 1, &end, 0);
+		}
+		if(*end != '\0' || !ThreadPlacement::configure(portName, role, cpuMask, priority))
+		{
+			printf("ThreadPlacement: bad setting \"%s\"\n", item.c_str());
+			result = false;
+		}
+	}
+	return result;
+}
+
+/**
+ * Look up a role by name, ignoring case.
+ * \param[in] name The name
+ * \param[out] role The role
+ * \return False if there is no such role
+ */
+bool ThreadPlacement::findRole(const char* name, Role& role)
+{
+	for(int i=0; name != NULL && i<numRoles; i++)
+	{
+		if(epicsStrCaseCmp(name, roleNames[i]) == 0)
+		{
+			role = (Role)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Apply the placement of a role to the calling thread if the
+ * settings have changed since it last did so.  Cheap when nothing
+ * has changed.
+ * \param[in] portName The port the thread belongs to, empty for shared threads
+ * \param[in] role The thread's role
+ * \param[in,out] threadGeneration The settings the thread last applied,
+ *                initialise to unapplied.
+ */
+void ThreadPlacement::apply(const char* portName, Role role, int& threadGeneration)
+{
+	int current = epicsAtomicGetIntT(&ThreadPlacement::generation);
+	if(current != threadGeneration)
+	{
+		threadGeneration = current;
+		Setting wanted;
+		{
+			TakeLock takeLock(&ThreadPlacement::lock);
+			std::map<Key, Setting>::iterator pos = ThreadPlacement::settings.find(Key(portName, role));
+			if(pos == ThreadPlacement::settings.end() || (pos->second.cpuMask == 0 && pos->second.priority == 0))
+			{
+				pos = ThreadPlacement::settings.find(Key("", role));
+			}
+			if(pos != ThreadPlacement::settings.end())
+			{
+				wanted = pos->second;
+			}
+		}
+		bool pinned = wanted.cpuMask != 0 && ThreadPlacement::pinCurrentThread(wanted.cpuMask);
+		if(wanted.priority > 0)
+		{
+			epicsThreadSetPriority(epicsThreadGetIdSelf(), (unsigned int)wanted.priority);
+		}
+		// Record what the thread ended up with, a mask of 0 left its affinity as it was
+		TakeLock takeLock(&ThreadPlacement::lock);
+		Setting& setting = ThreadPlacement::settings[Key(portName, role)];
+		if(pinned || !setting.applied)
+		{
+			setting.appliedMask = pinned ? wanted.cpuMask : 0;
+		}
+		setting.appliedPriority = (int)epicsThreadGetPrioritySelf();
+		setting.applied = true;
+	}
+}
+
+/**
+ * Get the placement the threads of a role last applied.  Shared
+ * threads are reported against every port.
+ * \param[in] portName The port
+ * \param[in] role The role
+ * \param[out] cpus The CPU mask in hex, "all" for no affinity or empty if no thread has applied it
+ * \param[out] priority The EPICS thread priority, 0 if no thread has applied it
+ */
+void ThreadPlacement::effective(const char* portName, Role role, std::string& cpus, int& priority)
+{
+	cpus.clear();
+	priority = 0;
+	TakeLock takeLock(&ThreadPlacement::lock);
+	const Setting* setting = ThreadPlacement::findApplied(portName, role);
+	if(setting != NULL)
+	{
+		std::stringstream str;
+		if(setting->appliedMask == 0)
+		{
+			str << "all";
+		}
+		else
+		{
+			str << "0x" << std::hex << setting->appliedMask;
+		}
+		cpus = str.str();
+		priority = setting->appliedPriority;
+	}
+}
+
+/**
+ * Get the CPU mask the threads of a role last applied.
+ * \param[in] portName The port
+ * \param[in] role The role
+ * \return The mask, 0 for no affinity
+ */
+unsigned long long ThreadPlacement::effectiveMask(const char* portName, Role role)
+{
+	TakeLock takeLock(&ThreadPlacement::lock);
+	const Setting* setting = ThreadPlacement::findApplied(portName, role);
+	return setting == NULL ? 0 : setting->appliedMask;
+}
+
+/**
+ * Find what the threads of a role last applied, for the port or
+ * failing that shared threads.  The caller holds the lock.
+ * \param[in] portName The port
+ * \param[in] role The role
+ * \return The setting, NULL if no thread has applied one
+ */
+const ThreadPlacement::Setting* ThreadPlacement::findApplied(const char* portName, Role role)
+{
+	std::map<Key, Setting>::iterator pos = ThreadPlacement::settings.find(Key(portName, role));
+	if(pos == ThreadPlacement::settings.end() || !pos->second.applied)
+	{
+		pos = ThreadPlacement::settings.find(Key("", role));
+	}
+	return pos != ThreadPlacement::settings.end() && pos->second.applied ? &pos->second : NULL;
+}
+
+/**
+ * Restrict the calling thread to a set of CPUs.
+ * \param[in] cpuMask The CPUs, bit n for CPU n
+ * \return False if the platform does not support it or it failed
+ */
+bool ThreadPlacement::pinCurrentThread(unsigned long long cpuMask)
+{
+#if defined(_WIN32)
+	DWORD_PTR mask = (DWORD_PTR)cpuMask;
+	return mask != 0 && ::SetThreadAffinityMask(::GetCurrentThread(), mask) != 0;
+#elif defined(__linux__)
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	for(int cpu=0; cpu<(int)(sizeof(cpuMask)*8) && cpu<CPU_SETSIZE; cpu++)
+	{
+		if(cpuMask & (1ULL << cpu))
+		{
+			CPU_SET(cpu, &cpus);
+		}
+	}
+	return pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0;
+#else
+	return false;
+#endif
+}
+
+// IOC shell thread placement command
+extern "C" int pcoThreadConfig(const char* portName, const char* role, const char* cpuMask, int priority)
+{
+	ThreadPlacement::Role r;
+	char* end = NULL;
+	unsigned long long mask = cpuMask == NULL ? 0 : strtoull(cpuMask, &end, 0);
+	if(!ThreadPlacement::findRole(role, r))
+	{
+		printf("pcoThreadConfig: role must be one of state, ingest, capture, simulation, gang, timer, copy or process\n");
+	}
+	else if(end != NULL && *end != '\0')
+	{
+		printf("pcoThreadConfig: bad CPU mask \"%s\"\n", cpuMask);
+	}
+	else if(!ThreadPlacement::configure(portName, r, mask, priority))
+	{
+		printf("pcoThreadConfig: priority must be 0 to %d\n", (int)epicsThreadPriorityMax);
+	}
+	return 0;
+}
+static const iocshArg pcoThreadConfigArg0 = {"Port name", iocshArgString};
+static const iocshArg pcoThreadConfigArg1 = {"role", iocshArgString};
+static const iocshArg pcoThreadConfigArg2 = {"cpuMask", iocshArgString};
+static const iocshArg pcoThreadConfigArg3 = {"priority", iocshArgInt};
+static const iocshArg* const pcoThreadConfigArgs[] = {&pcoThreadConfigArg0,
+	&pcoThreadConfigArg1, &pcoThreadConfigArg2, &pcoThreadConfigArg3};
+static const iocshFuncDef configThreadPlacement = {"pcoThreadConfig", 4, pcoThreadConfigArgs};
+static void configThreadPlacementCallFunc(const iocshArgBuf *args)
+{
+	pcoThreadConfig(args[0].sval, args[1].sval, args[2].sval, args[3].ival);
+}
+
+/** Register the functions */
+static void threadPlacementRegister(void)
+{
+	iocshRegister(&configThreadPlacement, configThreadPlacementCallFunc);
+}
+
+extern "C" { epicsExportRegistrar(threadPlacementRegister); }
@@ -0,0 +1,54 @@
+/* ThreadPlacement.h
+ *
+ * Revamped PCO area detector driver.
+ *
+ * CPU affinity and priority for the driver's threads.  Settings are
+ * held per port and thread role, with settings made for no port
+ * applying to every port that has none of its own.  Each thread
+ * applies its settings to itself, at start up and again whenever
+ * they change, and records what it ended up with so the driver can
+ * publish it.
+ *
+ */
+#ifndef THREADPLACEMENT_H_
+#define THREADPLACEMENT_H_
+
+#include <map>
+#include <string>
+#include <utility>
+#include "epicsMutex.h"
+
+class ThreadPlacement
+{
+public:
+	enum Role {roleState=0, roleIngest, roleCapture, roleSimulation, roleGang,
+		roleTimer, roleCopy, roleProcess, numRoles};
+	static const char* roleNames[numRoles];
+	enum {unapplied=-1};
+public:
+	static bool configure(const char* portName, Role role, unsigned long long cpuMask, int priority);
+	static bool configure(const char* portName, const char* spec);
+	static bool findRole(const char* name, Role& role);
+	static void apply(const char* portName, Role role, int& generation);
+	static void effective(const char* portName, Role role, std::string& cpus, int& priority);
+	static unsigned long long effectiveMask(const char* portName, Role role);
+	static bool pinCurrentThread(unsigned long long cpuMask);
+private:
+	/** The settings for one port and role */
+	struct Setting
+	{
+		unsigned long long cpuMask;        // 0 leaves the affinity alone
+		int priority;                      // 0 leaves the priority alone
+		bool applied;
+		unsigned long long appliedMask;    // 0 for no affinity
+		int appliedPriority;
+		Setting() : cpuMask(0), priority(0), applied(false), appliedMask(0), appliedPriority(0) {}
+	};
+	typedef std::pair<std::string, int> Key;
+	static const Setting* findApplied(const char* portName, Role role);
+	static std::map<Key, Setting> settings;
+	static epicsMutex lock;
+	static int generation;
+};
+
+#endif /* THREADPLACEMENT_H_ */
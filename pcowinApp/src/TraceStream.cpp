@@ -44,6 +44,15 @@ void TraceBuf::vprintf(const char *pformat, va_list argptr)
     }
 }
 
+/**
+ * Is this trace being output?  Lets callers skip formatting it.
+ * \return True if the flag is set in the trace mask
+ */
+bool TraceBuf::enabled() const
+{
+    return (pasynTrace->getTraceMask(user) & flag) != 0;
+}
+
 /**
  * Called when the output buffer overflows.  The character is placed at the
  * end of the buffer and it is then written out.  Placing the character at
@@ -127,6 +136,15 @@ void TraceStream::printf(const char *pformat, ...)
     va_end(argptr);
 }
 
+/**
+ * Is this trace being output?
+ * \return True if the flag is set in the trace mask
+ */
+bool TraceStream::enabled() const
+{
+    return buffer.enabled();
+}
+
 /**
  * Destructor.
  */
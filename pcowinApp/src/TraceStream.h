@@ -15,6 +15,7 @@ class TraceBuf: public std::streambuf
 public:
     TraceBuf(asynUser* user, int flag, size_t bufferSize);
     void vprintf(const char *pformat, va_list argptr);
+    bool enabled() const;
 
 protected:
     virtual std::streambuf::int_type overflow(std::streambuf::int_type ch);
@@ -39,6 +40,7 @@ public:
     TraceStream(asynUser* user, int flag, size_t bufferSize=256);
     virtual ~TraceStream();
     void printf(const char *pformat, ...);
+    bool enabled() const;
 
 private:
     TraceBuf buffer;